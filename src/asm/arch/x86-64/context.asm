@@ -0,0 +1,87 @@
+%if 0
+/**
+ * @file context.asm
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Switches between kernel threads. Only the registers a C call
+ * preserves are saved, the caller has already spilled the others.
+ * Extended state is switched lazily in C, #NM gets its own stub so
+ * that nothing touches the FPU before CR0.TS is cleared.
+*/
+%endif
+bits 64
+section .text
+
+; void _x86_switch_context(uint64_t *save_rsp, uint64_t load_rsp)
+global _x86_switch_context
+_x86_switch_context:
+                    push rbp
+                    push rbx
+                    push r12
+                    push r13
+                    push r14
+                    push r15
+                    mov [rdi], rsp
+                    mov rsp, rsi
+                    pop r15
+                    pop r14
+                    pop r13
+                    pop r12
+                    pop rbx
+                    pop rbp
+                    ret
+
+; First return of a new thread, r12 holds the thread
+extern thread_start
+global _x86_thread_start
+_x86_thread_start:
+                    mov rdi, r12
+                    call thread_start
+                    ud2
+
+; Device not available (#NM)
+extern thread_fpu_trap
+global _x86_fpu_trap_stub
+_x86_fpu_trap_stub:
+                    clts
+                    push rax
+                    push rcx
+                    push rdx
+                    push rsi
+                    push rdi
+                    push r8
+                    push r9
+                    push r10
+                    push r11
+                    call thread_fpu_trap
+                    pop r11
+                    pop r10
+                    pop r9
+                    pop r8
+                    pop rdi
+                    pop rsi
+                    pop rdx
+                    pop rcx
+                    pop rax
+                    iretq
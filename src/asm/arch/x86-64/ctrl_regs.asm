@@ -98,6 +98,12 @@ _x86_WRMSR:     mov ecx, edi
                 wrmsr
                 ret
 
+global _x86_RDTSC
+_x86_RDTSC:     rdtsc
+                shl rdx, 32
+                or rax, rdx
+                ret
+
     
 section .bss
 global _x86_CR0
@@ -28,13 +28,12 @@
 %endif
 bits 64
 
-extern gdtr
+; void _install_gdt(struct gdt_header *gdtr)
 global _install_gdt
 _install_gdt:
                      cli
                      push rax
-                     lea rax, [rel gdtr]
-                     lgdt [rax]                 ; Load GDTR
+                     lgdt [rdi]                 ; Load GDTR
                      push 0x08
                      lea rax, [rel _gdt_set_cs]
                      push rax
@@ -45,3 +45,37 @@ inb:            push rdx
                 in al, dx
                 pop rdx
                 ret
+
+global outw
+outw:           push rdx
+                push rax
+                mov dx, di
+                mov ax, si
+                out dx, ax
+                pop rax
+                pop rdx
+                ret
+
+global inw
+inw:            push rdx
+                mov dx, di
+                in ax, dx
+                pop rdx
+                ret
+
+global outd
+outd:           push rdx
+                push rax
+                mov dx, di
+                mov eax, esi
+                out dx, eax
+                pop rax
+                pop rdx
+                ret
+
+global ind
+ind:            push rdx
+                mov dx, di
+                in eax, dx
+                pop rdx
+                ret
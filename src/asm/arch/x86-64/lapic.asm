@@ -0,0 +1,66 @@
+%if 0
+/**
+ * @file lapic.asm
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Interrupt stubs for the LAPIC. The handlers are C code, so every
+ * register a C call may clobber is saved around them.
+*/
+%endif
+bits 64
+section .text
+
+%macro lapic_stub 2
+extern %2
+global %1
+%1:
+                    push rax
+                    push rcx
+                    push rdx
+                    push rsi
+                    push rdi
+                    push r8
+                    push r9
+                    push r10
+                    push r11
+                    call %2
+                    pop r11
+                    pop r10
+                    pop r9
+                    pop r8
+                    pop rdi
+                    pop rsi
+                    pop rdx
+                    pop rcx
+                    pop rax
+                    iretq
+%endmacro
+
+lapic_stub _x86_lapic_timer_stub, lapic_timer_interrupt
+lapic_stub _x86_lapic_wake_stub, lapic_wake_interrupt
+
+; Spurious interrupts are not acknowledged
+global _x86_lapic_spurious_stub
+_x86_lapic_spurious_stub:
+                    iretq
@@ -4,6 +4,7 @@ section .text
 global _syscall
 extern Arc_SyscallTable
 _syscall:
+            swapgs                      ; GS base to this CPU's struct ARC_PerCPU
             push rcx
             push r11
             shl rdi, 3
@@ -13,4 +14,5 @@ _syscall:
             call [rax]
             pop r11
             pop rcx
+            swapgs                      ; And back to the caller's
             o64 sysret
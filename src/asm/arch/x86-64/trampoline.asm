@@ -0,0 +1,110 @@
+%if 0
+/**
+ * @file trampoline.asm
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Real mode entry of the application processors. Copied to
+ * ARC_SMP_TRAMPOLINE (0x8000) and started there by a SIPI, it goes
+ * through protected mode into long mode on the page tables of the
+ * bootstrap processor, then calls the entry in _x86_trampoline_data.
+ * Every address is taken relative to where the code is copied to.
+*/
+%endif
+%define T(x) ((x) - _x86_trampoline_start + 0x8000)
+
+section .text
+
+bits 16
+global _x86_trampoline_start
+_x86_trampoline_start:
+                    cli
+                    cld
+                    xor ax, ax
+                    mov ds, ax
+                    lgdt [T(trampoline_gdtr)]
+                    mov eax, cr0
+                    and eax, ~0x60000000        ; Clear CD and NW
+                    or eax, 1                   ; Protected mode
+                    mov cr0, eax
+                    jmp 0x08:T(trampoline_32)
+
+bits 32
+trampoline_32:
+                    mov ax, 0x10
+                    mov ds, ax
+                    mov es, ax
+                    mov fs, ax
+                    mov gs, ax
+                    mov ss, ax
+                    mov eax, cr4
+                    or eax, 1 << 5              ; PAE
+                    mov cr4, eax
+                    mov eax, [T(trampoline_cr3)]
+                    mov cr3, eax
+                    mov ecx, 0xC0000080         ; EFER, LME is set in the BSP's value
+                    mov eax, [T(trampoline_efer)]
+                    mov edx, [T(trampoline_efer) + 4]
+                    wrmsr
+                    mov eax, cr0
+                    or eax, (1 << 31) | (1 << 16) ; Paging and write protect
+                    mov cr0, eax
+                    jmp 0x18:T(trampoline_64)
+
+bits 64
+trampoline_64:
+                    mov ax, 0x10
+                    mov ds, ax
+                    mov es, ax
+                    mov ss, ax
+                    xor ax, ax
+                    mov fs, ax
+                    mov gs, ax
+                    mov rsp, [T(trampoline_stack)]
+                    mov rdi, [T(trampoline_cpu)]
+                    mov rax, [T(trampoline_entry)]
+                    call rax                    ; Does not return
+.hang:              cli
+                    hlt
+                    jmp .hang
+
+; Filled in by Arc_StartAPs for each processor
+align 8
+global _x86_trampoline_data
+_x86_trampoline_data:
+trampoline_cr3:     dq 0
+trampoline_efer:    dq 0
+trampoline_stack:   dq 0
+trampoline_entry:   dq 0
+trampoline_cpu:     dq 0
+
+align 8
+trampoline_gdt:     dq 0
+                    dq 0x00CF9A000000FFFF       ; 32-bit code
+                    dq 0x00CF92000000FFFF       ; Data
+                    dq 0x00AF9A000000FFFF       ; 64-bit code
+trampoline_gdtr:    dw 4 * 8 - 1
+                    dd T(trampoline_gdt)
+
+global _x86_trampoline_end
+_x86_trampoline_end:
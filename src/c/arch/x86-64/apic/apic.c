@@ -26,6 +26,7 @@
 */
 #include <arch/x86-64/apic/apic.h>
 #include <arch/x86-64/apic/lapic.h>
+#include <arch/x86-64/smp.h>
 #include <mm/slab.h>
 #include <fs/vfs.h>
 #include <global.h>
@@ -56,13 +57,28 @@ int Arc_InitAPIC() {
 		return -1;
 	}
 
+	// Up first, the BSP is told apart by its LAPIC ID
+	Arc_InitLAPIC();
+
 	uint8_t data[2] = { 0 };
 
 	while (Arc_ReadVFS(data, 1, 2, apic) > 0) {
 		switch (data[0]) {
 		case ENTRY_TYPE_LAPIC: {
-			ARC_DEBUG(INFO, "LAPIC found\n");
-			break;
+			// ACPI processor ID, APIC ID, flags
+			uint8_t entry[6] = { 0 };
+
+			if (data[1] < 8 || Arc_ReadVFS(entry, 1, 6, apic) != 6) {
+				break;
+			}
+
+			uint32_t flags = entry[2] | (entry[3] << 8) | (entry[4] << 16) | ((uint32_t)entry[5] << 24);
+
+			ARC_DEBUG(INFO, "LAPIC %d found (CPU %d)\n", entry[1], Arc_SMPRegisterCPU(entry[1], flags));
+
+			Arc_SeekVFS(apic, data[1] - 8, ARC_VFS_SEEK_CUR);
+
+			continue;
 		}
 
 		case ENTRY_TYPE_IOAPIC: {
@@ -91,6 +107,5 @@ int Arc_InitAPIC() {
 
 	Arc_CloseVFS(apic);
 
-	Arc_InitLAPIC();
 	return 0;
 }
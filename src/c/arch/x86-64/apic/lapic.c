@@ -23,14 +23,33 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  *
  * @DESCRIPTION
+ * The LAPIC is left in xAPIC mode at its default address, mapped
+ * identity. Its timer only ever runs one-shot, it is programmed for
+ * the next deadline of the calling CPU and otherwise left stopped.
 */
 #include <arch/x86-64/apic/lapic.h>
+#include <arch/x86-64/acpi/hpet.h>
 #include <arch/x86-64/ctrl_regs.h>
+#include <arch/x86-64/io/port.h>
+#include <arch/x86-64/idt.h>
+#include <arch/x86-64/percpu.h>
+#include <lib/atomics.h>
+#include <lib/timer.h>
 #include <global.h>
 #include <cpuid.h>
 #include <mm/vmm.h>
 #include <mm/slab.h>
 
+#define LAPIC_LVT_MASKED       (1 << 16)
+#define LAPIC_LVT_TSC_DEADLINE (0b10 << 17)
+#define LAPIC_TIMER_DIVIDE_16  0b0011
+#define LAPIC_MSR_TSC_DEADLINE 0x6E0
+
+/// How long the timers are measured for, in microseconds.
+#define LAPIC_CALIBRATE_US 10000
+
+#define PIT_HZ 1193182
+
 struct lapic_reg {
         uint32_t resv0 __attribute__((aligned(16)));
         uint32_t resv1 __attribute__((aligned(16)));
@@ -69,6 +88,16 @@ struct lapic_reg {
         uint32_t resv8 __attribute__((aligned(16)));
 }__attribute__((packed));
 
+extern void _x86_lapic_timer_stub();
+extern void _x86_lapic_wake_stub();
+extern void _x86_lapic_spurious_stub();
+
+static volatile struct lapic_reg *lapic = NULL;
+static uint64_t lapic_tsc_hz = 0;
+/// Rate of the LAPIC timer after the divider.
+static uint64_t lapic_timer_hz = 0;
+static int lapic_tsc_deadline = 0;
+
 int Arc_InitLAPIC() {
         register uint32_t eax;
         register uint32_t ebx;
@@ -99,16 +128,193 @@ int Arc_InitLAPIC() {
         ARC_DEBUG(INFO, "LAPIC register at %p\n", ARC_PHYS_TO_HHDM(reg));
         // NOTE: Ignore bits 31:27 of reg->lapic_id on P6 and Pentium processors
         uint8_t ver = reg->lapic_ver & 0xFF;
-        ARC_DEBUG(INFO, "LAPIC ID: 0x%X (%s)\n", reg->lapic_id >> 28, ((reg->spurious_int_vector >> 8) & 1) ? "disabled, enabling" : "enabled");
-        if ((reg->spurious_int_vector >> 8) & 1) {
-                // Enable LAPIC
-                reg->spurious_int_vector |= 1 << 8;
-        }
+        ARC_DEBUG(INFO, "LAPIC ID: 0x%X (%s)\n", reg->lapic_id >> 28, ((reg->spurious_int_vector >> 8) & 1) ? "enabled" : "disabled, enabling");
+        // Enable LAPIC
+        reg->spurious_int_vector = (1 << 8) | ARC_LAPIC_SPURIOUS_VECTOR;
         ARC_DEBUG(INFO, "\tVersion: %d (%s)\n", ver, ver < 0xA ? "82489DX discrete APIC" : "Integrated APIC");
         ARC_DEBUG(INFO, "\tMax LVT: %d+1\n", ((reg->lapic_ver >> 16) & 0xFF));
         ARC_DEBUG(INFO, "\tEOI-broadcast supression: %s\n", (reg->lapic_ver >> 24) & 1 ? "yes" : "no");
 
+        lapic = reg;
+
+        // The same for every CPU
+        Arc_InstallIDTGate(ARC_LAPIC_WAKE_VECTOR, _x86_lapic_wake_stub);
+        Arc_InstallIDTGate(ARC_LAPIC_SPURIOUS_VECTOR, _x86_lapic_spurious_stub);
+
         ARC_DEBUG(INFO, "Successfully initialized LAPIC\n");
 
         return 0;
 }
+
+ARC_NO_FPU void Arc_LAPICEOI() {
+        lapic->eoi_reg = 0;
+}
+
+ARC_NO_FPU uint32_t Arc_LAPICID() {
+        if (lapic == NULL) {
+                return 0;
+        }
+
+        return lapic->lapic_id >> 24;
+}
+
+void Arc_LAPICSendIPI(uint32_t lapic_id, uint32_t command) {
+        uint64_t flags = Arc_IRQSave();
+
+        lapic->icr1 = lapic_id << 24;
+        // Writing the low half sends it
+        lapic->icr0 = command;
+
+        // Delivery status
+        while (lapic->icr0 & (1 << 12)) {
+                __builtin_ia32_pause();
+        }
+
+        Arc_IRQRestore(flags);
+}
+
+/**
+ * Busy wait on the HPET, or PIT channel 2 if there is none.
+ *
+ * @param uint64_t us - Microseconds to wait, at most 54925 for the PIT.
+ * */
+static void lapic_reference_wait(uint64_t us) {
+        uint64_t period = Arc_HPETPeriod();
+
+        if (period != 0) {
+                uint64_t ticks = (us * 1000000000) / period;
+                uint64_t start = Arc_HPETCounter();
+
+                // The counter may only be 32 bits wide, the wait fits either way
+                while ((uint32_t)(Arc_HPETCounter() - start) < ticks) {
+                        __builtin_ia32_pause();
+                }
+
+                return;
+        }
+
+        uint16_t count = (PIT_HZ * us) / 1000000;
+
+        // Speaker off, gate low while channel 2 is set up for mode 0
+        uint8_t gate = inb(0x61) & ~0b11;
+        outb(0x61, gate);
+        outb(0x43, 0b10110000);
+        outb(0x42, count & 0xFF);
+        outb(0x42, count >> 8);
+        outb(0x61, gate | 1);
+
+        // OUT2 goes high once the count reaches zero
+        while ((inb(0x61) & (1 << 5)) == 0) {
+                __builtin_ia32_pause();
+        }
+}
+
+static int lapic_calibrate() {
+        lapic->div_conf_reg = LAPIC_TIMER_DIVIDE_16;
+        lapic->lvt_timer_reg = LAPIC_LVT_MASKED | ARC_LAPIC_TIMER_VECTOR;
+
+        uint64_t flags = Arc_IRQSave();
+
+        lapic->init_count_reg = 0xFFFFFFFF;
+        uint64_t tsc = _x86_RDTSC();
+
+        lapic_reference_wait(LAPIC_CALIBRATE_US);
+
+        uint32_t remaining = lapic->cur_count_reg;
+        tsc = _x86_RDTSC() - tsc;
+        lapic->init_count_reg = 0;
+
+        Arc_IRQRestore(flags);
+
+        lapic_tsc_hz = tsc * (1000000 / LAPIC_CALIBRATE_US);
+        lapic_timer_hz = (uint64_t)(0xFFFFFFFF - remaining) * (1000000 / LAPIC_CALIBRATE_US);
+
+        register uint32_t eax;
+        register uint32_t ebx;
+        register uint32_t ecx;
+        register uint32_t edx;
+
+        __cpuid(0x01, eax, ebx, ecx, edx);
+        lapic_tsc_deadline = (ecx >> 24) & 1;
+
+        ARC_DEBUG(INFO, "TSC %"PRIu64"Hz, LAPIC timer %"PRIu64"Hz (%s, %s deadline)\n", lapic_tsc_hz, lapic_timer_hz, Arc_HPETPeriod() != 0 ? "HPET" : "PIT", lapic_tsc_deadline ? "TSC" : "one-shot");
+
+        if (lapic_tsc_hz == 0 || lapic_timer_hz == 0) {
+                ARC_DEBUG(ERR, "Failed to calibrate LAPIC timer\n");
+                return 1;
+        }
+
+        return 0;
+}
+
+int Arc_InitLAPICTimer(int cpu) {
+        if (lapic == NULL) {
+                return 1;
+        }
+
+        if (cpu == 0) {
+                if (lapic_calibrate() != 0) {
+                        return 1;
+                }
+
+                Arc_InstallIDTGate(ARC_LAPIC_TIMER_VECTOR, _x86_lapic_timer_stub);
+        } else if (lapic_tsc_hz == 0) {
+                return 1;
+        }
+
+        if (lapic_tsc_deadline) {
+                lapic->lvt_timer_reg = LAPIC_LVT_TSC_DEADLINE | ARC_LAPIC_TIMER_VECTOR;
+                // Order the LVT write before any write to the deadline MSR
+                __asm__ volatile("mfence" : : : "memory");
+                _x86_WRMSR(LAPIC_MSR_TSC_DEADLINE, 0);
+        } else {
+                lapic->div_conf_reg = LAPIC_TIMER_DIVIDE_16;
+                lapic->lvt_timer_reg = ARC_LAPIC_TIMER_VECTOR;
+                lapic->init_count_reg = 0;
+        }
+
+        return 0;
+}
+
+ARC_NO_FPU void Arc_LAPICTimerDeadline(uint64_t deadline) {
+        if (lapic_tsc_deadline) {
+                _x86_WRMSR(LAPIC_MSR_TSC_DEADLINE, deadline);
+                return;
+        }
+
+        if (deadline == 0) {
+                lapic->init_count_reg = 0;
+                return;
+        }
+
+        uint64_t now = _x86_RDTSC();
+        uint64_t delta = deadline > now ? deadline - now : 0;
+
+        // Cut far deadlines short so the product below cannot overflow
+        delta = min(delta, lapic_tsc_hz / 16);
+
+        uint64_t count = (delta * lapic_timer_hz) / lapic_tsc_hz;
+
+        // A count of zero stops the timer
+        lapic->init_count_reg = max(count, (uint64_t)1);
+}
+
+uint64_t Arc_GetTSCFrequency() {
+        return lapic_tsc_hz;
+}
+
+/**
+ * Called by _x86_lapic_timer_stub.
+ * */
+ARC_NO_FPU void lapic_timer_interrupt() {
+        ARC_THIS_CPU_ADD(timer_interrupts, 1);
+        Arc_LAPICEOI();
+        Arc_TimerInterrupt();
+}
+
+/**
+ * Called by _x86_lapic_wake_stub, waking up was all it was for.
+ * */
+ARC_NO_FPU void lapic_wake_interrupt() {
+        Arc_LAPICEOI();
+}
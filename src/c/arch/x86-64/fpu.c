@@ -0,0 +1,144 @@
+/**
+ * @file fpu.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Detects XSAVE support, turns on the state components the kernel
+ * switches (x87, SSE and AVX) and wraps the save and restore
+ * instructions.
+*/
+#include <arch/x86-64/fpu.h>
+#include <global.h>
+#include <util.h>
+#include <cpuid.h>
+
+#define FPU_CR4_OSFXSR     (1 << 9)
+#define FPU_CR4_OSXMMEXCPT (1 << 10)
+#define FPU_CR4_OSXSAVE    (1 << 18)
+
+// x87, SSE and AVX
+#define FPU_XCR0_WANTED 0b111
+
+#define FPU_FXSAVE_SIZE 512
+#define FPU_DEFAULT_FCW 0x037F
+#define FPU_DEFAULT_MXCSR 0x1F80
+
+static int fpu_has_xsave = 0;
+static int fpu_has_xsaveopt = 0;
+static uint64_t fpu_xcr0 = 0;
+static size_t fpu_state_size = FPU_FXSAVE_SIZE;
+
+int Arc_InitializeFPU() {
+	register uint32_t eax;
+	register uint32_t ebx;
+	register uint32_t ecx;
+	register uint32_t edx;
+
+	__cpuid(0x01, eax, ebx, ecx, edx);
+
+	fpu_has_xsave = (ecx >> 26) & 1;
+
+	uint64_t cr0 = 0;
+	__asm__ volatile("mov %0, cr0" : "=r"(cr0));
+	cr0 = (cr0 & ~ARC_FPU_CR0_EM) | ARC_FPU_CR0_MP;
+	__asm__ volatile("mov cr0, %0" : : "r"(cr0));
+
+	uint64_t cr4 = 0;
+	__asm__ volatile("mov %0, cr4" : "=r"(cr4));
+	cr4 |= FPU_CR4_OSFXSR | FPU_CR4_OSXMMEXCPT;
+
+	if (fpu_has_xsave) {
+		cr4 |= FPU_CR4_OSXSAVE;
+	}
+
+	__asm__ volatile("mov cr4, %0" : : "r"(cr4));
+
+	if (fpu_has_xsave) {
+		__cpuid_count(0x0D, 0, eax, ebx, ecx, edx);
+		fpu_xcr0 = eax & FPU_XCR0_WANTED;
+
+		__asm__ volatile("xsetbv" : : "c"(0), "a"((uint32_t)fpu_xcr0), "d"((uint32_t)(fpu_xcr0 >> 32)));
+
+		// EBX is the size needed for the components now enabled
+		__cpuid_count(0x0D, 0, eax, ebx, ecx, edx);
+		fpu_state_size = ebx;
+
+		__cpuid_count(0x0D, 1, eax, ebx, ecx, edx);
+		fpu_has_xsaveopt = eax & 1;
+	}
+
+	__asm__ volatile("fninit");
+
+	ARC_DEBUG(INFO, "FPU: %s, XCR0 0x%lX, %lu byte save area\n", fpu_has_xsaveopt ? "XSAVEOPT" : (fpu_has_xsave ? "XSAVE" : "FXSAVE"), fpu_xcr0, fpu_state_size);
+
+	return 0;
+}
+
+size_t Arc_FPUStateSize() {
+	return fpu_state_size;
+}
+
+void Arc_FPUInitState(void *area) {
+	// XRSTOR puts every component whose XSTATE_BV bit is clear (all
+	// of them, the header is zeroed) in its initial state, except for
+	// MXCSR which is always loaded
+	memset(area, 0, fpu_state_size);
+
+	*(uint16_t *)area = FPU_DEFAULT_FCW;
+	*(uint32_t *)((uint8_t *)area + 24) = FPU_DEFAULT_MXCSR;
+}
+
+void Arc_FPUSave(void *area) {
+	uint32_t low = fpu_xcr0 & 0xFFFFFFFF;
+	uint32_t high = fpu_xcr0 >> 32;
+
+	if (fpu_has_xsaveopt) {
+		__asm__ volatile("xsaveopt64 [%0]" : : "r"(area), "a"(low), "d"(high) : "memory");
+	} else if (fpu_has_xsave) {
+		__asm__ volatile("xsave64 [%0]" : : "r"(area), "a"(low), "d"(high) : "memory");
+	} else {
+		__asm__ volatile("fxsave64 [%0]" : : "r"(area) : "memory");
+	}
+}
+
+void Arc_FPURestore(void *area) {
+	uint32_t low = fpu_xcr0 & 0xFFFFFFFF;
+	uint32_t high = fpu_xcr0 >> 32;
+
+	if (fpu_has_xsave) {
+		__asm__ volatile("xrstor64 [%0]" : : "r"(area), "a"(low), "d"(high) : "memory");
+	} else {
+		__asm__ volatile("fxrstor64 [%0]" : : "r"(area) : "memory");
+	}
+}
+
+void Arc_FPUTrapNext() {
+	uint64_t cr0 = 0;
+
+	__asm__ volatile("mov %0, cr0" : "=r"(cr0));
+	__asm__ volatile("mov cr0, %0" : : "r"(cr0 | ARC_FPU_CR0_TS) : "memory");
+}
+
+void Arc_FPUAllow() {
+	__asm__ volatile("clts" : : : "memory");
+}
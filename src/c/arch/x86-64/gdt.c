@@ -24,15 +24,15 @@
  *
  * @DESCRIPTION
  * Change out the GDT to better suit 64-bit mode, remove no longer needed 32-bit
- * segments.
+ * segments. Each CPU has a GDT of its own, as each needs its own TSS.
 */
+#include <arch/x86-64/gdt.h>
 #include <global.h>
 
 struct gdt_header {
 	uint16_t size;
 	uint64_t base;
 }__attribute__((packed));
-struct gdt_header gdtr;
 
 struct gdt_entry {
 	uint16_t limit;
@@ -42,32 +42,76 @@ struct gdt_entry {
 	uint8_t flags_limit;
 	uint8_t base3;
 }__attribute__((packed));
-static struct gdt_entry gdt_entries[16];
 
-void set_gdt_gate(int i, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
-	gdt_entries[i].base1 = (base      ) & 0xFFFF;
-	gdt_entries[i].base2 = (base >> 16) & 0xFF;
-	gdt_entries[i].base3 = (base >> 24) & 0xFF;
+struct gdt_tss {
+	uint32_t resv0;
+	/// Stacks loaded on a switch to ring 0 to 2.
+	uint64_t rsp[3];
+	uint64_t resv1;
+	uint64_t ist[7];
+	uint64_t resv2;
+	uint16_t resv3;
+	uint16_t iopb;
+}__attribute__((packed));
+
+struct gdt_cpu {
+	// The TSS descriptor takes up two entries
+	struct gdt_entry entries[7];
+	struct gdt_tss tss;
+	struct gdt_header gdtr;
+};
+static struct gdt_cpu gdt_cpus[ARC_GDT_MAX_CPUS];
+
+static void set_gdt_gate(struct gdt_entry *entries, int i, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+	entries[i].base1 = (base      ) & 0xFFFF;
+	entries[i].base2 = (base >> 16) & 0xFF;
+	entries[i].base3 = (base >> 24) & 0xFF;
 
-	gdt_entries[i].access = access;
+	entries[i].access = access;
 
-	gdt_entries[i].limit = (limit) & 0xFFFF;
-	gdt_entries[i].flags_limit = (flags & 0x0F) << 4 | ((limit >> 16) & 0x0F);
+	entries[i].limit = (limit) & 0xFFFF;
+	entries[i].flags_limit = (flags & 0x0F) << 4 | ((limit >> 16) & 0x0F);
 }
 
-extern void _install_gdt();
-void Arc_InstallGDT() {
-	set_gdt_gate(0, 0, 0, 0, 0);
-	set_gdt_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xA); // Kernel Code 64
-	set_gdt_gate(2, 0, 0xFFFFFFFF, 0x92, 0xC); // Kernel Data 32 / 64
-	set_gdt_gate(3, 0, 0xFFFFFFFF, 0xF2, 0xC); // User Data 32 / 64
-	set_gdt_gate(4, 0, 0xFFFFFFFF, 0xFA, 0xA); // User Code 64
+static void set_tss_gate(struct gdt_entry *entries, int i, struct gdt_tss *tss) {
+	uint64_t base = (uintptr_t)tss;
+
+	set_gdt_gate(entries, i, base & 0xFFFFFFFF, sizeof(struct gdt_tss) - 1, 0x89, 0x0); // Available 64-bit TSS
+
+	// Upper half of the base, the rest is reserved
+	uint32_t *upper = (uint32_t *)&entries[i + 1];
+	upper[0] = base >> 32;
+	upper[1] = 0;
+}
+
+extern void _install_gdt(struct gdt_header *gdtr);
+int Arc_InstallGDT(int cpu, void *stack) {
+	if (cpu < 0 || cpu >= ARC_GDT_MAX_CPUS) {
+		return 1;
+	}
+
+	struct gdt_cpu *state = &gdt_cpus[cpu];
+	struct gdt_entry *entries = state->entries;
+
+	set_gdt_gate(entries, 0, 0, 0, 0, 0);
+	set_gdt_gate(entries, 1, 0, 0xFFFFFFFF, 0x9A, 0xA); // Kernel Code 64
+	set_gdt_gate(entries, 2, 0, 0xFFFFFFFF, 0x92, 0xC); // Kernel Data 32 / 64
+	set_gdt_gate(entries, 3, 0, 0xFFFFFFFF, 0xF2, 0xC); // User Data 32 / 64
+	set_gdt_gate(entries, 4, 0, 0xFFFFFFFF, 0xFA, 0xA); // User Code 64
+
+	state->tss.rsp[0] = (uintptr_t)stack;
+	// No I/O permission bitmap
+	state->tss.iopb = sizeof(struct gdt_tss);
+	set_tss_gate(entries, 5, &state->tss);
+
+	state->gdtr.size = sizeof(state->entries) - 1;
+	state->gdtr.base = (uintptr_t)entries;
 
+	_install_gdt(&state->gdtr);
 
-	gdtr.size = sizeof(gdt_entries) * 8 - 1;
-	gdtr.base = (uintptr_t)&gdt_entries;
+	__asm__ volatile("ltr %0" : : "r"((uint16_t)ARC_GDT_TSS_SEL) : "memory");
 
-	_install_gdt();
+	ARC_DEBUG(INFO, "Installed GDT of CPU %d\n", cpu);
 
-	ARC_DEBUG(INFO, "Installed GDT\n");
+	return 0;
 }
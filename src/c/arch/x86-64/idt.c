@@ -103,6 +103,14 @@ void install_idt_gate(int i, uint64_t offset, uint16_t segment, uint8_t attrs) {
 	idt_entries[i].reserved = 0;
 }
 
+void Arc_InstallIDTGate(int vector, void (*stub)()) {
+	install_idt_gate(vector, (uintptr_t)stub, 0x08, 0x8E);
+}
+
+void Arc_LoadIDT() {
+	__asm__ volatile("lidt [%0]" : : "r"(&idtr) : "memory");
+}
+
 void handle_gp(int error_code) {
 	if (error_code == 0) {
 		printf("#GP may have been caused by one of the following:\n");
@@ -0,0 +1,232 @@
+/**
+ * @file pci.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Configuration space access and a brute force scan of every bus.
+ * Block devices with a driver get a resource in ARC_DRI_GROUP_BLOCK
+ * and a /dev/vdX node.
+*/
+#include <arch/x86-64/pci/pci.h>
+#include <arch/x86-64/io/port.h>
+#include <arctan.h>
+#include <fs/block.h>
+#include <fs/vfs.h>
+#include <mm/vmm.h>
+#include <global.h>
+#include <util.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+/**
+ * A device for which there is a block device driver.
+ * */
+struct pci_block_driver {
+	uint16_t vendor;
+	uint16_t device;
+	uint64_t dri_index;
+};
+
+static struct pci_block_driver pci_block_drivers[] = {
+	// virtio-blk, modern and transitional
+	{ 0x1AF4, 0x1042, ARC_DRI_VIRTIO_BLK },
+	{ 0x1AF4, 0x1001, ARC_DRI_VIRTIO_BLK },
+};
+
+/// Number of /dev/vdX nodes created.
+static int pci_block_count = 0;
+
+static void pci_select(struct ARC_PCIDevice *dev, uint8_t offset) {
+	uint32_t address = (1 << 31) | ((uint32_t)dev->bus << 16) | ((uint32_t)dev->slot << 11) | ((uint32_t)dev->function << 8) | (offset & 0xFC);
+
+	outd(PCI_CONFIG_ADDRESS, address);
+}
+
+uint32_t Arc_PCIRead32(struct ARC_PCIDevice *dev, uint8_t offset) {
+	pci_select(dev, offset);
+
+	return ind(PCI_CONFIG_DATA);
+}
+
+uint16_t Arc_PCIRead16(struct ARC_PCIDevice *dev, uint8_t offset) {
+	return (Arc_PCIRead32(dev, offset) >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+uint8_t Arc_PCIRead8(struct ARC_PCIDevice *dev, uint8_t offset) {
+	return (Arc_PCIRead32(dev, offset) >> ((offset & 3) * 8)) & 0xFF;
+}
+
+void Arc_PCIWrite32(struct ARC_PCIDevice *dev, uint8_t offset, uint32_t value) {
+	pci_select(dev, offset);
+	outd(PCI_CONFIG_DATA, value);
+}
+
+void Arc_PCIWrite16(struct ARC_PCIDevice *dev, uint8_t offset, uint16_t value) {
+	int shift = (offset & 2) * 8;
+	uint32_t dword = Arc_PCIRead32(dev, offset);
+
+	dword &= ~(0xFFFF << shift);
+	dword |= (uint32_t)value << shift;
+
+	Arc_PCIWrite32(dev, offset, dword);
+}
+
+uint64_t Arc_PCIGetBAR(struct ARC_PCIDevice *dev, int bar) {
+	if (bar < 0 || bar > 5) {
+		return 0;
+	}
+
+	uint32_t low = Arc_PCIRead32(dev, ARC_PCI_CFG_BAR0 + bar * 4);
+
+	if ((low & 1) != 0) {
+		// I/O space
+		return 0;
+	}
+
+	uint64_t address = low & 0xFFFFFFF0;
+
+	if (((low >> 1) & 0b11) == 0b10 && bar < 5) {
+		address |= (uint64_t)Arc_PCIRead32(dev, ARC_PCI_CFG_BAR0 + (bar + 1) * 4) << 32;
+	}
+
+	return address;
+}
+
+uint8_t Arc_PCIFindCapability(struct ARC_PCIDevice *dev, uint8_t id, uint8_t after) {
+	if ((Arc_PCIRead16(dev, ARC_PCI_CFG_STATUS) & ARC_PCI_STATUS_CAPABILITIES) == 0) {
+		return 0;
+	}
+
+	uint8_t offset = after == 0 ? Arc_PCIRead8(dev, ARC_PCI_CFG_CAPABILITY) : Arc_PCIRead8(dev, after + 1);
+
+	// Bound the walk in case the list loops
+	for (int i = 0; i < 48 && offset != 0; i++) {
+		offset &= 0xFC;
+
+		if (Arc_PCIRead8(dev, offset) == id) {
+			return offset;
+		}
+
+		offset = Arc_PCIRead8(dev, offset + 1);
+	}
+
+	return 0;
+}
+
+void Arc_PCIEnableDevice(struct ARC_PCIDevice *dev) {
+	uint16_t command = Arc_PCIRead16(dev, ARC_PCI_CFG_COMMAND);
+
+	command |= ARC_PCI_COMMAND_MEMORY | ARC_PCI_COMMAND_BUS_MASTER | ARC_PCI_COMMAND_INTX_OFF;
+
+	Arc_PCIWrite16(dev, ARC_PCI_CFG_COMMAND, command);
+}
+
+void *Arc_PCIMapBAR(struct ARC_PCIDevice *dev, int bar, uint64_t offset, size_t length) {
+	uint64_t base = Arc_PCIGetBAR(dev, bar);
+
+	if (base == 0 || length == 0) {
+		return NULL;
+	}
+
+	uint64_t start = (base + offset) & ~0xFFFULL;
+	uint64_t end = ALIGN(base + offset + length, 0x1000);
+
+	for (uint64_t page = start; page < end; page += 0x1000) {
+		if (Arc_MapPageVMM(page, ARC_PHYS_TO_HHDM(page), ARC_VMM_OVERW_FLAG | 3 | ARC_VMM_PAT_UC(0)) != 0) {
+			ARC_DEBUG(ERR, "Failed to map BAR%d page 0x%"PRIX64"\n", bar, page);
+			return NULL;
+		}
+	}
+
+	return (void *)ARC_PHYS_TO_HHDM(base + offset);
+}
+
+static void pci_probe(struct ARC_PCIDevice *dev) {
+	for (size_t i = 0; i < sizeof(pci_block_drivers) / sizeof(*pci_block_drivers); i++) {
+		if (pci_block_drivers[i].vendor != dev->vendor || pci_block_drivers[i].device != dev->device) {
+			continue;
+		}
+
+		if (pci_block_count >= 26) {
+			ARC_DEBUG(WARN, "Too many block devices, skipping\n");
+			return;
+		}
+
+		char path[] = "/dev/vda";
+		path[7] += pci_block_count;
+
+		struct ARC_Resource *res = Arc_InitializeResource(path + 5, ARC_DRI_GROUP_BLOCK, pci_block_drivers[i].dri_index, dev);
+
+		if (res == NULL || res->driver_state == NULL) {
+			ARC_DEBUG(ERR, "Failed to initialize %s\n", path);
+			return;
+		}
+
+		Arc_CreateVFS(path, 0, ARC_VFS_N_BLOCK, res->driver_state);
+		pci_block_count++;
+
+		return;
+	}
+}
+
+static void pci_scan_function(uint8_t bus, uint8_t slot, uint8_t function) {
+	struct ARC_PCIDevice dev = { .bus = bus, .slot = slot, .function = function };
+
+	dev.vendor = Arc_PCIRead16(&dev, ARC_PCI_CFG_VENDOR);
+
+	if (dev.vendor == 0xFFFF) {
+		return;
+	}
+
+	dev.device = Arc_PCIRead16(&dev, ARC_PCI_CFG_DEVICE);
+	dev.class = Arc_PCIRead8(&dev, ARC_PCI_CFG_CLASS);
+	dev.subclass = Arc_PCIRead8(&dev, ARC_PCI_CFG_SUBCLASS);
+	dev.prog_if = Arc_PCIRead8(&dev, ARC_PCI_CFG_PROG_IF);
+
+	ARC_DEBUG(INFO, "%02X:%02X.%d %04X:%04X class %02X.%02X.%02X\n", bus, slot, function, dev.vendor, dev.device, dev.class, dev.subclass, dev.prog_if);
+
+	pci_probe(&dev);
+}
+
+int Arc_InitializePCI() {
+	ARC_DEBUG(INFO, "Scanning PCI\n");
+
+	for (int bus = 0; bus < 256; bus++) {
+		for (int slot = 0; slot < 32; slot++) {
+			struct ARC_PCIDevice dev = { .bus = bus, .slot = slot, .function = 0 };
+
+			if (Arc_PCIRead16(&dev, ARC_PCI_CFG_VENDOR) == 0xFFFF) {
+				continue;
+			}
+
+			int functions = (Arc_PCIRead8(&dev, ARC_PCI_CFG_HEADER) & 0x80) ? 8 : 1;
+
+			for (int function = 0; function < functions; function++) {
+				pci_scan_function(bus, slot, function);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file percpu.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Per-CPU data areas, and pointing each CPU's GS base at its own.
+*/
+#include <arch/x86-64/percpu.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <global.h>
+
+#define PERCPU_GS_BASE        0xC0000101
+#define PERCPU_KERNEL_GS_BASE 0xC0000102
+
+_Static_assert(ARC_PERCPU_OFFSET(self) == 0, "self must be the first field of struct ARC_PerCPU");
+
+static struct ARC_PerCPU percpu_areas[ARC_SMP_MAX_CPUS] = { 0 };
+
+int Arc_InitPerCPU(int cpu) {
+	if (cpu < 0 || cpu >= ARC_SMP_MAX_CPUS) {
+		return 1;
+	}
+
+	struct ARC_PerCPU *area = &percpu_areas[cpu];
+
+	area->self = area;
+	area->cpu = cpu;
+	area->current = NULL;
+
+	_x86_WRMSR(PERCPU_GS_BASE, (uintptr_t)area);
+	// There is no user GS yet, until there is both halves of a swapgs
+	// point at the area
+	_x86_WRMSR(PERCPU_KERNEL_GS_BASE, (uintptr_t)area);
+
+	return 0;
+}
+
+struct ARC_PerCPU *Arc_GetPerCPU(int cpu) {
+	if (cpu < 0 || cpu >= ARC_SMP_MAX_CPUS) {
+		return NULL;
+	}
+
+	return &percpu_areas[cpu];
+}
@@ -0,0 +1,278 @@
+/**
+ * @file smp.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Starting the application processors.
+ *
+ * The real mode trampoline is copied to ARC_SMP_TRAMPOLINE and
+ * identity mapped, so it keeps running once it turns on paging with
+ * the bootstrap processor's page tables. Processors are started one at
+ * a time, as they share the trampoline's data block. The identity
+ * mapping is removed once all of them are up.
+*/
+#include <arch/x86-64/smp.h>
+#include <arch/x86-64/apic/lapic.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <arch/x86-64/gdt.h>
+#include <arch/x86-64/idt.h>
+#include <arch/x86-64/percpu.h>
+#include <arch/x86-64/syscall.h>
+#include <arctan.h>
+#include <lib/atomics.h>
+#include <lib/clock.h>
+#include <lib/rcu.h>
+#include <lib/timer.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <mp/sched/mlfq.h>
+#include <mp/thread.h>
+#include <global.h>
+#include <util.h>
+
+/// How long to wait for a processor to come up, in nanoseconds.
+#define SMP_START_TIMEOUT 200000000
+
+extern uint8_t _x86_trampoline_start[];
+extern uint8_t _x86_trampoline_end[];
+extern uint8_t _x86_trampoline_data[];
+
+/**
+ * Layout of _x86_trampoline_data.
+ * */
+struct smp_trampoline_data {
+	uint64_t cr3;
+	uint64_t efer;
+	uint64_t stack;
+	uint64_t entry;
+	uint64_t cpu;
+}__attribute__((packed));
+
+static uint32_t smp_cpu_to_apic[ARC_SMP_MAX_CPUS] = { 0 };
+/// Top of the stack each AP enters ring 0 on from userland.
+static void *smp_kernel_stacks[ARC_SMP_MAX_CPUS] = { 0 };
+/// CPUs registered, the BSP included.
+static int smp_registered = 1;
+static _Atomic int smp_running = 1;
+static _Atomic uint64_t smp_online = 1;
+/// Set by the processor being started once it is up.
+static _Atomic int smp_started = 0;
+
+// Of the BSP, the APs copy them
+static uint64_t smp_cr4 = 0;
+static uint64_t smp_pat = 0;
+
+int Arc_SMPRegisterCPU(uint32_t lapic_id, uint32_t flags) {
+	if ((flags & 1) == 0) {
+		ARC_DEBUG(INFO, "LAPIC %d is disabled\n", lapic_id);
+		return -1;
+	}
+
+	if (lapic_id > 0xFF) {
+		return -1;
+	}
+
+	if (lapic_id == Arc_LAPICID()) {
+		smp_cpu_to_apic[0] = lapic_id;
+
+		return 0;
+	}
+
+	if (smp_registered >= ARC_SMP_MAX_CPUS) {
+		ARC_DEBUG(WARN, "Too many CPUs, ignoring LAPIC %d\n", lapic_id);
+		return -1;
+	}
+
+	int cpu = smp_registered++;
+
+	smp_cpu_to_apic[cpu] = lapic_id;
+
+	return cpu;
+}
+
+int Arc_SMPCPUCount() {
+	return atomic_load_explicit(&smp_running, memory_order_relaxed);
+}
+
+void Arc_WakeCPU(int cpu) {
+	if (cpu < 0 || cpu >= ARC_SMP_MAX_CPUS || (atomic_load_explicit(&smp_online, memory_order_acquire) & (1ULL << cpu)) == 0) {
+		return;
+	}
+
+	Arc_LAPICSendIPI(smp_cpu_to_apic[cpu], ARC_LAPIC_WAKE_VECTOR);
+}
+
+/**
+ * Where an AP goes once the trampoline has it in long mode.
+ *
+ * Runs on the stack it was given, which becomes its boot thread's.
+ * */
+static void smp_ap_entry(uint64_t cpu) {
+	__asm__ volatile("mov cr4, %0" : : "r"(smp_cr4) : "memory");
+	_x86_WRMSR(0x277, smp_pat);
+	// Off the trampoline now, drop its identity mapping so that it does
+	// not outlive the unmap in Arc_StartAPs
+	__asm__ volatile("invlpg [%0]" : : "r"((uintptr_t)ARC_SMP_TRAMPOLINE) : "memory");
+
+	Arc_InstallGDT(cpu, smp_kernel_stacks[cpu]);
+	Arc_InitPerCPU(cpu);
+	Arc_LoadIDT();
+	Arc_InitLAPIC();
+	Arc_InitializeSyscall();
+
+	if (Arc_MLFQInitCPU(cpu) != 0 || Arc_InitializeThreads(cpu) != 0 || Arc_InitializeTimers(cpu) != 0) {
+		ARC_DEBUG(ERR, "Failed to initialize CPU %lu\n", cpu);
+		ARC_HANG;
+	}
+
+	Arc_RCUOnlineCPU(cpu);
+
+	atomic_fetch_or_explicit(&smp_online, 1ULL << cpu, memory_order_release);
+	atomic_fetch_add_explicit(&smp_running, 1, memory_order_relaxed);
+	atomic_store_explicit(&smp_started, 1, memory_order_release);
+
+	__asm__ volatile("sti" : : : "memory");
+
+	for (;;) {
+		Arc_RCUQuiescent();
+		Arc_IdleCPU();
+	}
+}
+
+/**
+ * Wait up to \a ns nanoseconds for the processor being started to come up.
+ *
+ * @return 1 if it came up.
+ * */
+static int smp_wait_started(uint64_t ns) {
+	uint64_t end = Arc_ClockMonotonic() + ns;
+
+	do {
+		if (atomic_load_explicit(&smp_started, memory_order_acquire)) {
+			return 1;
+		}
+
+		__builtin_ia32_pause();
+	} while (Arc_ClockMonotonic() < end);
+
+	return 0;
+}
+
+static int smp_start_cpu(int cpu, struct smp_trampoline_data *data) {
+	void *stack = Arc_ContiguousAllocPMM(ARC_THREAD_STACK_PAGES);
+
+	if (stack == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate a stack for CPU %d\n", cpu);
+		return 1;
+	}
+
+	if (smp_kernel_stacks[cpu] == NULL) {
+		void *kernel_stack = Arc_ContiguousAllocPMM(ARC_THREAD_STACK_PAGES);
+
+		if (kernel_stack == NULL) {
+			ARC_DEBUG(ERR, "Failed to allocate a kernel stack for CPU %d\n", cpu);
+			Arc_ContiguousFreePMM(stack, ARC_THREAD_STACK_PAGES);
+			return 1;
+		}
+
+		smp_kernel_stacks[cpu] = (void *)((uintptr_t)kernel_stack + ARC_THREAD_STACK_PAGES * 0x1000);
+	}
+
+	data->stack = (uintptr_t)stack + ARC_THREAD_STACK_PAGES * 0x1000;
+	data->cpu = cpu;
+	atomic_store_explicit(&smp_started, 0, memory_order_release);
+
+	uint32_t apic = smp_cpu_to_apic[cpu];
+
+	Arc_LAPICSendIPI(apic, ARC_LAPIC_ICR_INIT | ARC_LAPIC_ICR_LEVEL_ASSERT);
+	// Only used as a delay, nothing runs until the SIPI
+	smp_wait_started(10000000);
+
+	// A second SIPI is only needed, and only acted on, if the first was missed
+	for (int i = 0; i < 2; i++) {
+		Arc_LAPICSendIPI(apic, ARC_LAPIC_ICR_STARTUP | (ARC_SMP_TRAMPOLINE >> 12));
+
+		if (smp_wait_started(i == 0 ? 200000 : SMP_START_TIMEOUT)) {
+			ARC_DEBUG(INFO, "Started CPU %d (LAPIC %d)\n", cpu, apic);
+			return 0;
+		}
+	}
+
+	// The stacks are leaked, the processor may still wake up on them
+	ARC_DEBUG(ERR, "CPU %d (LAPIC %d) did not start\n", cpu, apic);
+
+	return 1;
+}
+
+int Arc_StartAPs() {
+	if (smp_registered <= 1) {
+		ARC_DEBUG(INFO, "No application processors\n");
+		return 0;
+	}
+
+	uint64_t cr3 = 0;
+	__asm__ volatile("mov %0, cr3" : "=r"(cr3));
+
+	if (cr3 > UINT32_MAX) {
+		// The trampoline loads CR3 in protected mode
+		ARC_DEBUG(ERR, "PML4 is above 4 GiB, cannot start application processors\n");
+		return 0;
+	}
+
+	size_t size = _x86_trampoline_end - _x86_trampoline_start;
+
+	memcpy((void *)ARC_PHYS_TO_HHDM(ARC_SMP_TRAMPOLINE), _x86_trampoline_start, size);
+
+	if (Arc_MapPageVMM(ARC_SMP_TRAMPOLINE, ARC_SMP_TRAMPOLINE, ARC_VMM_OVERW_FLAG | 3) != 0) {
+		ARC_DEBUG(ERR, "Failed to identity map the trampoline\n");
+		return 0;
+	}
+
+	struct smp_trampoline_data *data = (struct smp_trampoline_data *)ARC_PHYS_TO_HHDM(ARC_SMP_TRAMPOLINE + (_x86_trampoline_data - _x86_trampoline_start));
+
+	data->cr3 = cr3;
+	// LMA is read only
+	data->efer = _x86_RDMSR(0xC0000080) & ~(1 << 10);
+	data->entry = (uintptr_t)smp_ap_entry;
+
+	__asm__ volatile("mov %0, cr4" : "=r"(smp_cr4));
+	smp_pat = _x86_RDMSR(0x277);
+
+	int started = 0;
+
+	for (int cpu = 1; cpu < smp_registered; cpu++) {
+		started += smp_start_cpu(cpu, data) == 0;
+	}
+
+	ARC_DEBUG(INFO, "Started %d of %d application processors\n", started, smp_registered - 1);
+
+	if (started == smp_registered - 1) {
+		// Every AP has flushed the mapping itself in smp_ap_entry
+		Arc_UnmapPageVMM(ARC_SMP_TRAMPOLINE);
+	} else {
+		// A processor that missed its SIPI may still run the trampoline
+		ARC_DEBUG(WARN, "Leaving the trampoline mapped\n");
+	}
+
+	return started;
+}
@@ -27,7 +27,11 @@
 #include <global.h>
 #include <arch/x86-64/syscall.h>
 #include <arch/x86-64/ctrl_regs.h>
+#include <mp/futex.h>
+#include <abi-bits/errno.h>
+#include <lib/clock.h>
 #include <stdint.h>
+#include <time.h>
 
 struct ARC_SyscallArgs {
 	uint64_t a;
@@ -39,6 +43,15 @@ struct ARC_SyscallArgs {
 	uint64_t g;
 }__attribute__((packed));
 
+/// End of the canonical lower half, userland lives below it.
+#define SYSCALL_USER_END 0x0000800000000000ULL
+
+/**
+ * Check that a range lies wholly in userland.
+ * */
+static int syscall_user_range(uint64_t address, uint64_t size) {
+	return address != 0 && address < SYSCALL_USER_END && size <= SYSCALL_USER_END - address;
+}
 
 static int syscall_0(struct ARC_SyscallArgs *args) {
 	(void)args;
@@ -47,19 +60,65 @@ static int syscall_0(struct ARC_SyscallArgs *args) {
 }
 
 static int syscall_1(struct ARC_SyscallArgs *args) {
-	(void)args;
 	// FUTEX_WAIT
-	return 0;
+	// a: address, b: expected, c: relative struct timespec (NULL: none), d: bitset (0: any)
+	// Errors are negated, as Arc_FutexWait returns them
+	struct timespec *time = (struct timespec *)args->c;
+	uint64_t timeout = 0;
+
+	if (!syscall_user_range(args->a, sizeof(uint32_t))) {
+		return -EFAULT;
+	}
+
+	if (time != NULL) {
+		if (!syscall_user_range(args->c, sizeof(struct timespec))) {
+			return -EFAULT;
+		}
+
+		int64_t sec = time->tv_sec;
+		int64_t nsec = time->tv_nsec;
+
+		if (sec < 0 || nsec < 0 || nsec >= 1000000000 || (uint64_t)sec > (UINT64_MAX - (uint64_t)nsec) / 1000000000ULL) {
+			return -EINVAL;
+		}
+
+		timeout = (uint64_t)sec * 1000000000ULL + (uint64_t)nsec;
+		// Zero means no timeout to Arc_FutexWait, expire right away instead
+		timeout = timeout == 0 ? 1 : timeout;
+	}
+
+	return Arc_FutexWait((uint32_t *)args->a, args->b, timeout, args->d == 0 ? ARC_FUTEX_BITSET_ANY : args->d);
 }
 static int syscall_2(struct ARC_SyscallArgs *args) {
-	(void)args;
 	// FUTEX_WAKE
-	return 0;
+	// a: address, b: most to wake, c: bitset (0: any)
+	if (!syscall_user_range(args->a, sizeof(uint32_t))) {
+		return -EFAULT;
+	}
+
+	return Arc_FutexWake((uint32_t *)args->a, args->b, args->c == 0 ? ARC_FUTEX_BITSET_ANY : args->c);
 }
 
 static int syscall_3(struct ARC_SyscallArgs *args) {
-	(void)args;
 	// CLOCK_GET
+	// a: clock, b: struct timespec to fill
+	// Userland reads the clock page instead where it can
+	struct timespec *time = (struct timespec *)args->b;
+	uint64_t ns = 0;
+
+	if (!syscall_user_range(args->b, sizeof(struct timespec))) {
+		return EFAULT;
+	}
+
+	int err = Arc_ClockGet(args->a, &ns);
+
+	if (err != 0) {
+		return err;
+	}
+
+	time->tv_sec = ns / 1000000000;
+	time->tv_nsec = ns % 1000000000;
+
 	return 0;
 }
 
@@ -98,9 +157,28 @@ static int syscall_9(struct ARC_SyscallArgs *args) {
 	return 0;
 }
 static int syscall_A(struct ARC_SyscallArgs *args) {
-	(void)args;
 	// VM_MAP
-	return 0;
+	// a: hint, b: size, c: prot, d: flags, e: file, f: offset, g: window
+	if (args->e == 0) {
+		// TODO: Anonymous mappings
+		return ENOSYS;
+	}
+
+	// Nothing picks an address yet, and without one the data would be
+	// handed out through the HHDM. The mapping may start a page early
+	// as the data need not be page aligned.
+	if (args->a == 0 || (args->a & 0xFFF) != 0 || args->b == 0 || !syscall_user_range(args->a, args->b + 0x1000)) {
+		return EINVAL;
+	}
+
+	if (!syscall_user_range(args->g, sizeof(void *))) {
+		return EFAULT;
+	}
+
+	// TODO: Translate e through the file descriptor table of the calling
+	//       process once one exists, and map it with Arc_MMapVFS. It is
+	//       never taken to be a kernel pointer.
+	return EBADF;
 }
 
 static int syscall_B(struct ARC_SyscallArgs *args) {
@@ -128,8 +206,13 @@ static int syscall_E(struct ARC_SyscallArgs *args) {
 }
 
 static int syscall_F(struct ARC_SyscallArgs *args) {
-	(void)args;
-	return 0;
+	// FUTEX_REQUEUE
+	// a: address, b: most to wake, c: target, d: most to move, e: expected
+	if (!syscall_user_range(args->a, sizeof(uint32_t)) || !syscall_user_range(args->c, sizeof(uint32_t))) {
+		return -EFAULT;
+	}
+
+	return Arc_FutexRequeue((uint32_t *)args->a, args->b, (uint32_t *)args->c, args->d, args->e);
 }
 
 int (*Arc_SyscallTable[])(struct ARC_SyscallArgs *args) = {
@@ -23,29 +23,108 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  *
  * @DESCRIPTION
+ * Driver for the HPET ACPI table. The main counter is mapped and
+ * started, reading the node gives its current value.
 */
 #include <arch/x86-64/acpi/acpi.h>
+#include <arch/x86-64/acpi/hpet.h>
 #include <lib/resource.h>
+#include <mm/vmm.h>
+#include <global.h>
+#include <util.h>
+
+#define HPET_REG_CAPABILITIES 0x00
+#define HPET_REG_CONFIG       0x10
+#define HPET_REG_COUNTER      0xF0
+
+#define HPET_CAP_COUNT_SIZE (1 << 13)
+#define HPET_CONFIG_ENABLE  (1 << 0)
+
+/// Longest period the specification allows, 100ns.
+#define HPET_MAX_PERIOD_FS 100000000
 
 struct hpet {
 	struct ARC_RSDTBaseEntry base;
-	union {
-		uint8_t hardware_rev_id;
-		uint8_t first_n_cmps : 5;
-		uint8_t count_size_cap : 1;
-		uint8_t resv0 : 1;
-		uint8_t legacy_irq_routing : 1;
-		uint16_t pci_vendor_id;
-	} event_timer_blk_id;
-	uint32_t base_addr[3];
+	uint32_t event_timer_blk_id;
+	struct {
+		uint8_t space_id;
+		uint8_t bit_width;
+		uint8_t bit_offset;
+		uint8_t access_size;
+		uint64_t address;
+	}__attribute__((packed)) base_addr;
 	uint8_t hpet_number;
 	uint16_t main_counter_min;
 	uint8_t prot_oem_attr;
-};
+}__attribute__((packed));
+
+static volatile uint8_t *hpet_regs = NULL;
+static uint64_t hpet_period = 0;
+static int hpet_64bit = 0;
+
+static uint64_t hpet_read(int reg) {
+	return *(volatile uint64_t *)(hpet_regs + reg);
+}
+
+static void hpet_write(int reg, uint64_t value) {
+	*(volatile uint64_t *)(hpet_regs + reg) = value;
+}
+
+uint64_t Arc_HPETPeriod() {
+	return hpet_period;
+}
+
+uint64_t Arc_HPETCounter() {
+	if (hpet_regs == NULL) {
+		return 0;
+	}
+
+	return hpet_read(HPET_REG_COUNTER);
+}
+
+int Arc_HPETIs64Bit() {
+	return hpet_64bit;
+}
 
 int init_hpet(struct ARC_Resource *res, void *arg) {
+	(void)res;
+
 	struct hpet *hpet = (struct hpet *)arg;
 
+	if (hpet_regs != NULL) {
+		// Only the first block is used
+		return 0;
+	}
+
+	if (hpet->base_addr.space_id != 0) {
+		ARC_DEBUG(WARN, "HPET is not memory mapped\n");
+		return 1;
+	}
+
+	uint64_t page = hpet->base_addr.address & ~0xFFFULL;
+
+	if (Arc_MapPageVMM(page, ARC_PHYS_TO_HHDM(page), ARC_VMM_OVERW_FLAG | 3 | ARC_VMM_PAT_UC(0)) != 0) {
+		ARC_DEBUG(ERR, "Failed to map HPET\n");
+		return 1;
+	}
+
+	hpet_regs = (volatile uint8_t *)ARC_PHYS_TO_HHDM(hpet->base_addr.address);
+
+	uint64_t capabilities = hpet_read(HPET_REG_CAPABILITIES);
+	uint64_t period = capabilities >> 32;
+
+	if (period == 0 || period > HPET_MAX_PERIOD_FS) {
+		ARC_DEBUG(WARN, "HPET has a bad period (%"PRIu64"fs)\n", period);
+		hpet_regs = NULL;
+		return 1;
+	}
+
+	hpet_write(HPET_REG_CONFIG, hpet_read(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE);
+	hpet_period = period;
+	hpet_64bit = (capabilities & HPET_CAP_COUNT_SIZE) != 0;
+
+	ARC_DEBUG(INFO, "HPET at 0x%"PRIX64", %"PRIu64"fs period\n", hpet->base_addr.address, period);
+
 	return 0;
 };
 
@@ -55,11 +134,27 @@ int uninit_hpet() {
 
 int read_hpet(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
 	(void)file;
-	return 0;
+	(void)res;
+
+	if (buffer == NULL || hpet_regs == NULL) {
+		return 0;
+	}
+
+	uint64_t counter = Arc_HPETCounter();
+	size_t given = min(size * count, sizeof(counter));
+
+	memcpy(buffer, &counter, given);
+
+	return given;
 }
 
 int write_hpet(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	(void)buffer;
+	(void)size;
+	(void)count;
 	(void)file;
+	(void)res;
+
 	return 0;
 }
 
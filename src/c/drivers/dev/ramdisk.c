@@ -0,0 +1,187 @@
+/**
+ * @file ramdisk.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Block device backed by physical pages.
+ *
+ * The resource is initialized with a pointer to the size of the disk
+ * in bytes, and its driver state is the struct ARC_BlockDevice. Pages
+ * are allocated when they are first written, unwritten sectors read
+ * as zeroes.
+*/
+#include <abi-bits/errno.h>
+#include <lib/resource.h>
+#include <fs/block.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <global.h>
+#include <util.h>
+
+#define RAMDISK_PAGE_SIZE 0x1000
+#define RAMDISK_PAGE_SHIFT 12
+#define RAMDISK_SECTOR_SIZE 512
+// Largest request taken at once, 1MiB
+#define RAMDISK_MAX_SECTORS 2048
+
+struct ramdisk_dri_state {
+	struct ARC_BlockDevice device;
+	/// Page of each 4KiB of the disk (NULL: never written).
+	uint8_t **pages;
+	size_t page_count;
+	/// Number of pages taken up by the pages array.
+	size_t table_pages;
+};
+
+/**
+ * Copy between the disk and memory.
+ *
+ * @return zero on success.
+ * */
+static int ramdisk_copy(struct ramdisk_dri_state *state, uint8_t *buffer, uint64_t offset, uint64_t size, int write) {
+	while (size > 0) {
+		size_t index = offset >> RAMDISK_PAGE_SHIFT;
+		size_t in_page = offset & (RAMDISK_PAGE_SIZE - 1);
+		size_t chunk = min(size, RAMDISK_PAGE_SIZE - in_page);
+		uint8_t *page = state->pages[index];
+
+		if (write) {
+			if (page == NULL) {
+				if ((page = (uint8_t *)Arc_AllocPMM()) == NULL) {
+					return ENOMEM;
+				}
+
+				memset(page, 0, RAMDISK_PAGE_SIZE);
+				state->pages[index] = page;
+			}
+
+			memcpy(page + in_page, buffer, chunk);
+		} else if (page == NULL) {
+			memset(buffer, 0, chunk);
+		} else {
+			memcpy(buffer, page + in_page, chunk);
+		}
+
+		buffer += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+
+	return 0;
+}
+
+static int ramdisk_submit(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct ramdisk_dri_state *state = (struct ramdisk_dri_state *)dev->driver_state;
+	int status = 0;
+
+	for (struct ARC_Bio *bio = req->head; bio != NULL && status == 0; bio = bio->next) {
+		status = ramdisk_copy(state, bio->buffer, bio->sector * RAMDISK_SECTOR_SIZE, bio->count * RAMDISK_SECTOR_SIZE, bio->op == ARC_BIO_WRITE);
+	}
+
+	Arc_BlockEndRequest(dev, req, status);
+
+	return 0;
+}
+
+static struct ARC_BlockDeviceOps ramdisk_ops = {
+	.submit = ramdisk_submit,
+};
+
+static int ramdisk_init(struct ARC_Resource *res, void *args) {
+	if (args == NULL || *(size_t *)args < RAMDISK_SECTOR_SIZE) {
+		ARC_DEBUG(ERR, "No size given for RAM disk\n");
+		return 1;
+	}
+
+	struct ramdisk_dri_state *state = (struct ramdisk_dri_state *)Arc_SlabAlloc(sizeof(struct ramdisk_dri_state));
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	memset(state, 0, sizeof(struct ramdisk_dri_state));
+
+	size_t size = ALIGN(*(size_t *)args, RAMDISK_PAGE_SIZE);
+
+	state->page_count = size >> RAMDISK_PAGE_SHIFT;
+	state->table_pages = ALIGN(state->page_count * sizeof(uint8_t *), RAMDISK_PAGE_SIZE) >> RAMDISK_PAGE_SHIFT;
+	state->pages = (uint8_t **)Arc_ContiguousAllocPMM(state->table_pages);
+
+	if (state->pages == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate page table for RAM disk\n");
+		Arc_SlabFree(state);
+		return 1;
+	}
+
+	memset(state->pages, 0, state->table_pages << RAMDISK_PAGE_SHIFT);
+
+	struct ARC_BlockDevice *dev = &state->device;
+
+	dev->name = res->name;
+	dev->sector_size = RAMDISK_SECTOR_SIZE;
+	dev->sector_count = size / RAMDISK_SECTOR_SIZE;
+	dev->max_sectors = RAMDISK_MAX_SECTORS;
+	dev->ops = &ramdisk_ops;
+	dev->driver_state = state;
+
+	// Seeking is free, arrival order is as good as any
+	if (Arc_BlockRegister(dev, "noop") != 0) {
+		Arc_ContiguousFreePMM(state->pages, state->table_pages);
+		Arc_SlabFree(state);
+		return 1;
+	}
+
+	res->driver_state = dev;
+
+	return 0;
+}
+
+static int ramdisk_uninit(struct ARC_Resource *res) {
+	struct ARC_BlockDevice *dev = (struct ARC_BlockDevice *)res->driver_state;
+
+	if (dev == NULL) {
+		return 1;
+	}
+
+	struct ramdisk_dri_state *state = (struct ramdisk_dri_state *)dev->driver_state;
+
+	Arc_BlockUnregister(dev);
+
+	for (size_t i = 0; i < state->page_count; i++) {
+		if (state->pages[i] != NULL) {
+			Arc_FreePMM(state->pages[i]);
+		}
+	}
+
+	Arc_ContiguousFreePMM(state->pages, state->table_pages);
+	Arc_SlabFree(state);
+	res->driver_state = NULL;
+
+	return 0;
+}
+
+ARC_REGISTER_DRIVER(1, ramdisk) = {
+	.index = ARC_DRI_RAMDISK,
+	.init = ramdisk_init,
+	.uninit = ramdisk_uninit,
+};
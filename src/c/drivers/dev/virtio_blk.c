@@ -0,0 +1,696 @@
+/**
+ * @file virtio_blk.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * virtio-blk over the modern (virtio 1.0) PCI transport.
+ *
+ * The resource is initialized with a pointer to the struct ARC_PCIDevice,
+ * and its driver state is the struct ARC_BlockDevice.
+ *
+ * Every block request takes a single ring descriptor, which points to
+ * an indirect table holding the request header, the data buffers and
+ * the status byte. Each queue has a slot per ring descriptor which
+ * holds that table, so nothing is allocated per request.
+ *
+ * Each CPU submits to its own virtqueue when the device has several.
+ * With VIRTIO_F_EVENT_IDX the device is only notified when it asks to
+ * be. Completions are polled, no interrupt vectors are assigned yet,
+ * and used_event is kept out of reach so the device does not try to
+ * raise any.
+*/
+#include <abi-bits/errno.h>
+#include <arch/x86-64/pci/pci.h>
+#include <arctan.h>
+#include <lib/resource.h>
+#include <fs/block.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/vmm.h>
+#include <mp/sched/abstract.h>
+#include <global.h>
+#include <util.h>
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED      128
+
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+#define VIRTIO_BLK_F_SIZE_MAX  (1ULL << 1)
+#define VIRTIO_BLK_F_SEG_MAX   (1ULL << 2)
+#define VIRTIO_BLK_F_RO        (1ULL << 5)
+#define VIRTIO_BLK_F_BLK_SIZE  (1ULL << 6)
+#define VIRTIO_BLK_F_MQ        (1ULL << 12)
+#define VIRTIO_F_INDIRECT_DESC (1ULL << 28)
+#define VIRTIO_F_EVENT_IDX     (1ULL << 29)
+#define VIRTIO_F_VERSION_1     (1ULL << 32)
+
+#define VIRTQ_DESC_F_NEXT     1
+#define VIRTQ_DESC_F_WRITE    2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK  0
+
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
+// Most virtqueues driven at once
+#define VIRTIO_BLK_MAX_QUEUES 16
+// Most ring descriptors per virtqueue
+#define VIRTIO_BLK_QUEUE_SIZE 128
+// Most data descriptors in an indirect table
+#define VIRTIO_BLK_MAX_DATA 64
+
+struct virtio_pci_common_cfg {
+	uint32_t device_feature_select;
+	uint32_t device_feature;
+	uint32_t driver_feature_select;
+	uint32_t driver_feature;
+	uint16_t msix_config;
+	uint16_t num_queues;
+	uint8_t device_status;
+	uint8_t config_generation;
+	uint16_t queue_select;
+	uint16_t queue_size;
+	uint16_t queue_msix_vector;
+	uint16_t queue_enable;
+	uint16_t queue_notify_off;
+	// 64-bit fields are written as two halves
+	uint32_t queue_desc_lo;
+	uint32_t queue_desc_hi;
+	uint32_t queue_driver_lo;
+	uint32_t queue_driver_hi;
+	uint32_t queue_device_lo;
+	uint32_t queue_device_hi;
+}__attribute__((packed));
+
+struct virtio_blk_config {
+	uint32_t capacity_lo;
+	uint32_t capacity_hi;
+	uint32_t size_max;
+	uint32_t seg_max;
+	uint32_t geometry;
+	uint32_t blk_size;
+	uint8_t topology[8];
+	uint8_t writeback;
+	uint8_t unused;
+	uint16_t num_queues;
+}__attribute__((packed));
+
+struct virtq_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+}__attribute__((packed));
+
+struct virtq_avail {
+	uint16_t flags;
+	uint16_t idx;
+	/// Followed by used_event.
+	uint16_t ring[];
+};
+
+struct virtq_used_elem {
+	uint32_t id;
+	uint32_t len;
+}__attribute__((packed));
+
+struct virtq_used {
+	uint16_t flags;
+	uint16_t idx;
+	/// Followed by avail_event.
+	struct virtq_used_elem ring[];
+};
+
+struct virtio_blk_outhdr {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+}__attribute__((packed));
+
+/**
+ * Everything a request in flight needs, one per ring descriptor.
+ * */
+struct virtio_blk_slot {
+	/// Header, data buffers, status.
+	struct virtq_desc table[VIRTIO_BLK_MAX_DATA + 2];
+	struct virtio_blk_outhdr header;
+	uint8_t status;
+	struct ARC_BlockRequest *req;
+	uint16_t next_free;
+}__attribute__((aligned(16)));
+
+struct virtio_blk_queue {
+	ARC_GenericMutex lock;
+	uint16_t index;
+	uint16_t size;
+	volatile struct virtq_desc *desc;
+	volatile struct virtq_avail *avail;
+	volatile struct virtq_used *used;
+	volatile uint16_t *notify;
+	/// Next entry of the used ring to look at.
+	uint16_t last_used;
+	uint16_t free_head;
+	uint16_t free_count;
+	struct virtio_blk_slot *slots;
+	void *ring;
+	size_t ring_pages;
+	size_t slot_pages;
+};
+
+struct virtio_blk_dri_state {
+	struct ARC_BlockDevice device;
+	struct ARC_PCIDevice pci;
+	volatile struct virtio_pci_common_cfg *common;
+	volatile struct virtio_blk_config *config;
+	uint8_t *notify_base;
+	uint32_t notify_multiplier;
+	uint64_t features;
+	/// log2(sector_size / 512), the device addresses 512 byte sectors.
+	uint32_t sector_shift;
+	/// Largest data descriptor.
+	uint32_t size_max;
+	/// Data descriptors usable per request.
+	uint32_t data_max;
+	int queue_count;
+	struct virtio_blk_queue queues[VIRTIO_BLK_MAX_QUEUES];
+};
+
+/**
+ * True if the other side asked to be told once idx moved past event.
+ * */
+static int virtq_need_event(uint16_t event, uint16_t new, uint16_t old) {
+	return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+static volatile uint16_t *virtq_used_event(struct virtio_blk_queue *queue) {
+	return &queue->avail->ring[queue->size];
+}
+
+static volatile uint16_t *virtq_avail_event(struct virtio_blk_queue *queue) {
+	return (volatile uint16_t *)&queue->used->ring[queue->size];
+}
+
+static uint64_t virtio_blk_get_features(struct virtio_blk_dri_state *state) {
+	state->common->device_feature_select = 0;
+	uint64_t features = state->common->device_feature;
+	state->common->device_feature_select = 1;
+	features |= (uint64_t)state->common->device_feature << 32;
+
+	return features;
+}
+
+static void virtio_blk_set_features(struct virtio_blk_dri_state *state, uint64_t features) {
+	state->common->driver_feature_select = 0;
+	state->common->driver_feature = features & 0xFFFFFFFF;
+	state->common->driver_feature_select = 1;
+	state->common->driver_feature = features >> 32;
+}
+
+/**
+ * Find and map the common, notify and device configuration structures.
+ * */
+static int virtio_blk_find_caps(struct virtio_blk_dri_state *state) {
+	struct ARC_PCIDevice *pci = &state->pci;
+
+	for (uint8_t cap = Arc_PCIFindCapability(pci, ARC_PCI_CAP_VENDOR, 0); cap != 0; cap = Arc_PCIFindCapability(pci, ARC_PCI_CAP_VENDOR, cap)) {
+		uint8_t type = Arc_PCIRead8(pci, cap + 3);
+		uint8_t bar = Arc_PCIRead8(pci, cap + 4);
+		uint32_t offset = Arc_PCIRead32(pci, cap + 8);
+		uint32_t length = Arc_PCIRead32(pci, cap + 12);
+
+		// The first structure of each type is the preferred one
+		switch (type) {
+		case VIRTIO_PCI_CAP_COMMON: {
+			if (state->common == NULL) {
+				state->common = Arc_PCIMapBAR(pci, bar, offset, length);
+			}
+
+			break;
+		}
+
+		case VIRTIO_PCI_CAP_NOTIFY: {
+			if (state->notify_base == NULL) {
+				state->notify_base = Arc_PCIMapBAR(pci, bar, offset, length);
+				state->notify_multiplier = Arc_PCIRead32(pci, cap + 16);
+			}
+
+			break;
+		}
+
+		case VIRTIO_PCI_CAP_DEVICE: {
+			if (state->config == NULL) {
+				state->config = Arc_PCIMapBAR(pci, bar, offset, length);
+			}
+
+			break;
+		}
+		}
+	}
+
+	if (state->common == NULL || state->notify_base == NULL || state->config == NULL) {
+		ARC_DEBUG(ERR, "Device has no modern virtio capabilities\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void virtio_blk_free_queue(struct virtio_blk_queue *queue) {
+	if (queue->ring != NULL) {
+		Arc_ContiguousFreePMM(queue->ring, queue->ring_pages);
+	}
+
+	if (queue->slots != NULL) {
+		Arc_ContiguousFreePMM(queue->slots, queue->slot_pages);
+	}
+
+	memset(queue, 0, sizeof(struct virtio_blk_queue));
+}
+
+static int virtio_blk_setup_queue(struct virtio_blk_dri_state *state, int index) {
+	struct virtio_blk_queue *queue = &state->queues[index];
+	volatile struct virtio_pci_common_cfg *common = state->common;
+
+	common->queue_select = index;
+
+	uint16_t size = min(common->queue_size, VIRTIO_BLK_QUEUE_SIZE);
+
+	if (size == 0) {
+		return 1;
+	}
+
+	// Descriptors and available ring, then the used ring on a page
+	// of its own as the device writes it
+	size_t avail_offset = size * sizeof(struct virtq_desc);
+	size_t used_offset = ALIGN(avail_offset + sizeof(struct virtq_avail) + (size + 1) * sizeof(uint16_t), 0x1000);
+	size_t ring_size = used_offset + sizeof(struct virtq_used) + size * sizeof(struct virtq_used_elem) + sizeof(uint16_t);
+
+	queue->index = index;
+	queue->size = size;
+	queue->ring_pages = ALIGN(ring_size, 0x1000) >> 12;
+	queue->slot_pages = ALIGN(size * sizeof(struct virtio_blk_slot), 0x1000) >> 12;
+	queue->ring = Arc_ContiguousAllocPMM(queue->ring_pages);
+	queue->slots = (struct virtio_blk_slot *)Arc_ContiguousAllocPMM(queue->slot_pages);
+
+	if (queue->ring == NULL || queue->slots == NULL) {
+		virtio_blk_free_queue(queue);
+		return 1;
+	}
+
+	memset(queue->ring, 0, queue->ring_pages << 12);
+	memset(queue->slots, 0, queue->slot_pages << 12);
+
+	queue->desc = (struct virtq_desc *)queue->ring;
+	queue->avail = (struct virtq_avail *)((uint8_t *)queue->ring + avail_offset);
+	queue->used = (struct virtq_used *)((uint8_t *)queue->ring + used_offset);
+
+	for (int i = 0; i < size; i++) {
+		queue->slots[i].next_free = i + 1;
+	}
+
+	queue->free_head = 0;
+	queue->free_count = size;
+	queue->last_used = 0;
+	Arc_MutexStaticInit(&queue->lock);
+
+	// Half the index space away, never reached while polling
+	*virtq_used_event(queue) = 0x8000;
+
+	uint64_t desc = ARC_HHDM_TO_PHYS(queue->desc);
+	uint64_t driver = ARC_HHDM_TO_PHYS(queue->avail);
+	uint64_t device = ARC_HHDM_TO_PHYS(queue->used);
+
+	common->queue_size = size;
+	common->queue_msix_vector = VIRTIO_MSI_NO_VECTOR;
+	common->queue_desc_lo = desc & 0xFFFFFFFF;
+	common->queue_desc_hi = desc >> 32;
+	common->queue_driver_lo = driver & 0xFFFFFFFF;
+	common->queue_driver_hi = driver >> 32;
+	common->queue_device_lo = device & 0xFFFFFFFF;
+	common->queue_device_hi = device >> 32;
+
+	queue->notify = (volatile uint16_t *)(state->notify_base + common->queue_notify_off * state->notify_multiplier);
+
+	common->queue_enable = 1;
+
+	return 0;
+}
+
+/**
+ * Add the pages of a buffer to the indirect table, joining
+ * physically contiguous pages into one descriptor.
+ * */
+static int virtio_blk_map(struct virtio_blk_dri_state *state, struct virtio_blk_slot *slot, int *count, uint8_t *buffer, size_t length, uint16_t flags) {
+	flags |= VIRTQ_DESC_F_NEXT;
+
+	while (length > 0) {
+		uint64_t phys = Arc_TranslateVMM((uintptr_t)buffer);
+
+		if (phys == 0) {
+			return EFAULT;
+		}
+
+		size_t chunk = min(length, 0x1000 - (phys & 0xFFF));
+		// The header is always at 0
+		struct virtq_desc *last = *count > 1 ? &slot->table[*count - 1] : NULL;
+
+		if (last != NULL && last->flags == flags && last->addr + last->len == phys && last->len + chunk <= state->size_max) {
+			last->len += chunk;
+		} else if ((uint32_t)*count > state->data_max) {
+			return E2BIG;
+		} else {
+			slot->table[*count].addr = phys;
+			slot->table[*count].len = chunk;
+			slot->table[*count].flags = flags;
+			slot->table[*count].next = *count + 1;
+			(*count)++;
+		}
+
+		buffer += chunk;
+		length -= chunk;
+	}
+
+	return 0;
+}
+
+static int virtio_blk_submit(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct virtio_blk_dri_state *state = (struct virtio_blk_dri_state *)dev->driver_state;
+	// CPU indices are dense, unlike APIC IDs, so each CPU gets a queue of its own
+	struct virtio_blk_queue *queue = &state->queues[Arc_GetCurrentCPU() % state->queue_count];
+
+	if (req->op == ARC_BIO_WRITE && (state->features & VIRTIO_BLK_F_RO)) {
+		return EROFS;
+	}
+
+	Arc_MutexLock(&queue->lock);
+
+	if (queue->free_count == 0) {
+		Arc_MutexUnlock(&queue->lock);
+		return EBUSY;
+	}
+
+	uint16_t id = queue->free_head;
+	struct virtio_blk_slot *slot = &queue->slots[id];
+
+	queue->free_head = slot->next_free;
+	queue->free_count--;
+
+	slot->req = req;
+	slot->status = 0xFF;
+	slot->header.type = req->op == ARC_BIO_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	slot->header.reserved = 0;
+	slot->header.sector = req->sector << state->sector_shift;
+
+	slot->table[0].addr = ARC_HHDM_TO_PHYS(&slot->header);
+	slot->table[0].len = sizeof(struct virtio_blk_outhdr);
+	slot->table[0].flags = VIRTQ_DESC_F_NEXT;
+	slot->table[0].next = 1;
+
+	int count = 1;
+	int err = 0;
+	uint16_t flags = req->op == ARC_BIO_WRITE ? 0 : VIRTQ_DESC_F_WRITE;
+
+	for (struct ARC_Bio *bio = req->head; bio != NULL && err == 0; bio = bio->next) {
+		err = virtio_blk_map(state, slot, &count, bio->buffer, bio->count * dev->sector_size, flags);
+	}
+
+	if (err != 0) {
+		slot->req = NULL;
+		slot->next_free = queue->free_head;
+		queue->free_head = id;
+		queue->free_count++;
+		Arc_MutexUnlock(&queue->lock);
+
+		return err;
+	}
+
+	slot->table[count].addr = ARC_HHDM_TO_PHYS(&slot->status);
+	slot->table[count].len = 1;
+	slot->table[count].flags = VIRTQ_DESC_F_WRITE;
+	slot->table[count].next = 0;
+	count++;
+
+	queue->desc[id].addr = ARC_HHDM_TO_PHYS(slot->table);
+	queue->desc[id].len = count * sizeof(struct virtq_desc);
+	queue->desc[id].flags = VIRTQ_DESC_F_INDIRECT;
+	queue->desc[id].next = 0;
+
+	uint16_t old = queue->avail->idx;
+
+	queue->avail->ring[old % queue->size] = id;
+	// The entry must be visible before the index which publishes it
+	atomic_thread_fence(memory_order_release);
+	queue->avail->idx = old + 1;
+	// And the index before looking at whether the device wants a kick
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (!(state->features & VIRTIO_F_EVENT_IDX) || virtq_need_event(*virtq_avail_event(queue), old + 1, old)) {
+		*queue->notify = queue->index;
+	}
+
+	Arc_MutexUnlock(&queue->lock);
+
+	return 0;
+}
+
+static int virtio_blk_poll(struct ARC_BlockDevice *dev) {
+	struct virtio_blk_dri_state *state = (struct virtio_blk_dri_state *)dev->driver_state;
+	int completed = 0;
+
+	for (int i = 0; i < state->queue_count; i++) {
+		struct virtio_blk_queue *queue = &state->queues[i];
+		struct ARC_BlockRequest *finished = NULL;
+
+		if (queue->last_used == queue->used->idx) {
+			continue;
+		}
+
+		Arc_MutexLock(&queue->lock);
+
+		while (queue->last_used != queue->used->idx) {
+			// Read the entry only after seeing the index
+			atomic_thread_fence(memory_order_acquire);
+
+			uint16_t id = queue->used->ring[queue->last_used % queue->size].id;
+			struct virtio_blk_slot *slot = &queue->slots[id];
+			struct ARC_BlockRequest *req = slot->req;
+
+			// Requests are no longer queued, so their links are free
+			// to chain the finished ones, and driver_data to carry the status
+			req->driver_data = (void *)(uintptr_t)(slot->status == VIRTIO_BLK_S_OK ? 0 : EIO);
+			req->next = finished;
+			finished = req;
+
+			slot->req = NULL;
+			slot->next_free = queue->free_head;
+			queue->free_head = id;
+			queue->free_count++;
+			queue->last_used++;
+		}
+
+		*virtq_used_event(queue) = queue->last_used + 0x8000;
+
+		Arc_MutexUnlock(&queue->lock);
+
+		while (finished != NULL) {
+			struct ARC_BlockRequest *next = finished->next;
+
+			Arc_BlockEndRequest(dev, finished, (int)(uintptr_t)finished->driver_data);
+			finished = next;
+			completed++;
+		}
+	}
+
+	return completed;
+}
+
+static struct ARC_BlockDeviceOps virtio_blk_ops = {
+	.submit = virtio_blk_submit,
+	.poll = virtio_blk_poll,
+};
+
+static void virtio_blk_free(struct virtio_blk_dri_state *state) {
+	if (state->common != NULL) {
+		state->common->device_status = 0;
+	}
+
+	for (int i = 0; i < VIRTIO_BLK_MAX_QUEUES; i++) {
+		virtio_blk_free_queue(&state->queues[i]);
+	}
+
+	Arc_SlabFree(state);
+}
+
+static int virtio_blk_init(struct ARC_Resource *res, void *args) {
+	if (args == NULL) {
+		ARC_DEBUG(ERR, "No PCI device given\n");
+		return 1;
+	}
+
+	struct virtio_blk_dri_state *state = (struct virtio_blk_dri_state *)Arc_SlabAlloc(sizeof(struct virtio_blk_dri_state));
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	memset(state, 0, sizeof(struct virtio_blk_dri_state));
+	state->pci = *(struct ARC_PCIDevice *)args;
+
+	if (virtio_blk_find_caps(state) != 0) {
+		Arc_SlabFree(state);
+		return 1;
+	}
+
+	Arc_PCIEnableDevice(&state->pci);
+
+	volatile struct virtio_pci_common_cfg *common = state->common;
+
+	common->device_status = 0;
+
+	while (common->device_status != 0) {
+		__builtin_ia32_pause();
+	}
+
+	common->device_status |= VIRTIO_STATUS_ACKNOWLEDGE;
+	common->device_status |= VIRTIO_STATUS_DRIVER;
+
+	uint64_t offered = virtio_blk_get_features(state);
+
+	if (!(offered & VIRTIO_F_VERSION_1) || !(offered & VIRTIO_F_INDIRECT_DESC)) {
+		ARC_DEBUG(ERR, "Device lacks VIRTIO_F_VERSION_1 or VIRTIO_F_INDIRECT_DESC\n");
+		common->device_status |= VIRTIO_STATUS_FAILED;
+		virtio_blk_free(state);
+		return 1;
+	}
+
+	state->features = offered & (VIRTIO_F_VERSION_1 | VIRTIO_F_INDIRECT_DESC | VIRTIO_F_EVENT_IDX | VIRTIO_BLK_F_SIZE_MAX
+				     | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_MQ);
+	virtio_blk_set_features(state, state->features);
+
+	common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+
+	if (!(common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+		ARC_DEBUG(ERR, "Device did not accept features\n");
+		common->device_status |= VIRTIO_STATUS_FAILED;
+		virtio_blk_free(state);
+		return 1;
+	}
+
+	volatile struct virtio_blk_config *config = state->config;
+	uint64_t capacity = 0;
+	uint8_t generation = 0;
+
+	do {
+		generation = common->config_generation;
+		capacity = config->capacity_lo | ((uint64_t)config->capacity_hi << 32);
+	} while (generation != common->config_generation);
+
+	uint32_t sector_size = 512;
+
+	if ((state->features & VIRTIO_BLK_F_BLK_SIZE) && config->blk_size >= 512 && config->blk_size <= 0x1000 && (config->blk_size & (config->blk_size - 1)) == 0) {
+		sector_size = config->blk_size;
+	}
+
+	while ((512U << state->sector_shift) < sector_size) {
+		state->sector_shift++;
+	}
+
+	state->size_max = (state->features & VIRTIO_BLK_F_SIZE_MAX) && config->size_max != 0 ? config->size_max : 0xFFFFFFFF;
+	state->data_max = VIRTIO_BLK_MAX_DATA;
+
+	if ((state->features & VIRTIO_BLK_F_SEG_MAX) && config->seg_max != 0) {
+		state->data_max = min(state->data_max, config->seg_max);
+	}
+
+	int wanted = (state->features & VIRTIO_BLK_F_MQ) ? min(max(config->num_queues, 1), VIRTIO_BLK_MAX_QUEUES) : 1;
+
+	for (int i = 0; i < wanted; i++) {
+		if (virtio_blk_setup_queue(state, i) != 0) {
+			break;
+		}
+
+		state->queue_count++;
+	}
+
+	if (state->queue_count == 0) {
+		ARC_DEBUG(ERR, "Failed to set up any virtqueue\n");
+		common->device_status |= VIRTIO_STATUS_FAILED;
+		virtio_blk_free(state);
+		return 1;
+	}
+
+	common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+
+	struct ARC_BlockDevice *dev = &state->device;
+
+	// Every bio may start and end part way into a page, so a request
+	// of n pages in m bios takes up to n + 2m descriptors
+	dev->name = res->name;
+	dev->sector_size = sector_size;
+	dev->sector_count = capacity >> state->sector_shift;
+	dev->max_segments = max(state->data_max / 4, 1U);
+	dev->max_sectors = max((state->data_max / 2) * 0x1000 / sector_size, 1U);
+	dev->max_in_flight = state->queues[0].size;
+	dev->ops = &virtio_blk_ops;
+	dev->driver_state = state;
+
+	if (Arc_BlockRegister(dev, NULL) != 0) {
+		virtio_blk_free(state);
+		return 1;
+	}
+
+	ARC_DEBUG(INFO, "virtio-blk %s: %d queue(s)%s%s\n", res->name, state->queue_count, (state->features & VIRTIO_F_EVENT_IDX) ? ", event index" : "", (state->features & VIRTIO_BLK_F_RO) ? ", read only" : "");
+
+	res->driver_state = dev;
+
+	return 0;
+}
+
+static int virtio_blk_uninit(struct ARC_Resource *res) {
+	struct ARC_BlockDevice *dev = (struct ARC_BlockDevice *)res->driver_state;
+
+	if (dev == NULL) {
+		return 1;
+	}
+
+	// Unregistering waits for everything in flight
+	Arc_BlockUnregister(dev);
+	virtio_blk_free((struct virtio_blk_dri_state *)dev->driver_state);
+	res->driver_state = NULL;
+
+	return 0;
+}
+
+ARC_REGISTER_DRIVER(1, virtio_blk) = {
+	.index = ARC_DRI_VIRTIO_BLK,
+	.init = virtio_blk_init,
+	.uninit = virtio_blk_uninit,
+};
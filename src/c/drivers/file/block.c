@@ -0,0 +1,276 @@
+/**
+ * @file block.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Driver for files which are block devices.
+ *
+ * The node is created with the struct ARC_BlockDevice as its argument.
+ * Whole sectors go straight to the block layer, partial sectors at
+ * either end of a transfer are read (and written back) through a
+ * bounce page.
+*/
+#include <lib/resource.h>
+#include <fs/block.h>
+#include <fs/vfs.h>
+#include <mm/pmm.h>
+#include <global.h>
+#include <util.h>
+
+static int block_init(struct ARC_Resource *res, void *args) {
+	if (args == NULL) {
+		ARC_DEBUG(ERR, "No block device given\n");
+		return 1;
+	}
+
+	res->driver_state = args;
+
+	return 0;
+}
+
+static int block_uninit(struct ARC_Resource *res) {
+	res->driver_state = NULL;
+
+	return 0;
+}
+
+static int block_open(struct ARC_File *file, struct ARC_Resource *res, char *path, int flags, uint32_t mode) {
+	(void)path;
+	(void)flags;
+	(void)mode;
+
+	struct ARC_BlockDevice *dev = (struct ARC_BlockDevice *)res->driver_state;
+
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	file->node->stat.st_mode = S_IFBLK | (file->node->stat.st_mode & 07777);
+	file->node->stat.st_size = dev->sector_count * dev->sector_size;
+	file->node->stat.st_blksize = dev->sector_size;
+	file->node->stat.st_blocks = (dev->sector_count * dev->sector_size) / 512;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	return 0;
+}
+
+static int block_close(struct ARC_File *file, struct ARC_Resource *res) {
+	(void)file;
+	(void)res;
+
+	return 0;
+}
+
+/**
+ * Transfer bytes to or from the device.
+ *
+ * @return The number of bytes transferred.
+ * */
+static size_t block_transfer(struct ARC_BlockDevice *dev, uint8_t *buffer, size_t wanted, long offset, int write) {
+	uint64_t size = dev->sector_count * dev->sector_size;
+
+	if (offset < 0 || (uint64_t)offset >= size) {
+		return 0;
+	}
+
+	wanted = min(wanted, size - offset);
+
+	uint32_t sector_size = dev->sector_size;
+	uint8_t *bounce = NULL;
+	size_t done = 0;
+
+	while (done < wanted) {
+		uint64_t position = offset + done;
+		uint64_t sector = position / sector_size;
+		size_t in_sector = position & (sector_size - 1);
+
+		if (in_sector == 0 && wanted - done >= sector_size) {
+			uint64_t count = (wanted - done) / sector_size;
+
+			if (Arc_BlockIO(dev, write ? ARC_BIO_WRITE : ARC_BIO_READ, sector, count, buffer + done) != 0) {
+				break;
+			}
+
+			done += count * sector_size;
+			continue;
+		}
+
+		if (bounce == NULL && (bounce = (uint8_t *)Arc_AllocPMM()) == NULL) {
+			break;
+		}
+
+		size_t chunk = min(wanted - done, sector_size - in_sector);
+
+		if (Arc_BlockIO(dev, ARC_BIO_READ, sector, 1, bounce) != 0) {
+			break;
+		}
+
+		if (write) {
+			memcpy(bounce + in_sector, buffer + done, chunk);
+
+			if (Arc_BlockIO(dev, ARC_BIO_WRITE, sector, 1, bounce) != 0) {
+				break;
+			}
+		} else {
+			memcpy(buffer + done, bounce + in_sector, chunk);
+		}
+
+		done += chunk;
+	}
+
+	if (bounce != NULL) {
+		Arc_FreePMM(bounce);
+	}
+
+	return done;
+}
+
+static int block_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || size == 0 || count == 0 || file == NULL || res == NULL) {
+		return -1;
+	}
+
+	return block_transfer((struct ARC_BlockDevice *)res->driver_state, buffer, size * count, offset, 0);
+}
+
+static int block_pwrite(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || size == 0 || count == 0 || file == NULL || res == NULL) {
+		return -1;
+	}
+
+	return block_transfer((struct ARC_BlockDevice *)res->driver_state, buffer, size * count, offset, 1);
+}
+
+static int block_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return block_pread(buffer, size, count, file->offset, file, res);
+}
+
+static int block_write(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return block_pwrite(buffer, size, count, file->offset, file, res);
+}
+
+/**
+ * Sector aligned vectors go to the block layer as one bio per buffer,
+ * which it merges back together. Anything else is done one buffer
+ * at a time.
+ * */
+static int block_vector(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res, int write) {
+	if (iov == NULL || iovcnt < 0 || file == NULL || res == NULL || offset < 0) {
+		return -1;
+	}
+
+	struct ARC_BlockDevice *dev = (struct ARC_BlockDevice *)res->driver_state;
+	uint64_t size = dev->sector_count * dev->sector_size;
+	uint64_t total = 0;
+	int aligned = (offset & (dev->sector_size - 1)) == 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		aligned &= (iov[i].length & (dev->sector_size - 1)) == 0;
+		total += iov[i].length;
+	}
+
+	if (aligned && (uint64_t)offset + total <= size) {
+		if (Arc_BlockIOV(dev, write ? ARC_BIO_WRITE : ARC_BIO_READ, offset / dev->sector_size, iov, iovcnt) != 0) {
+			return -1;
+		}
+
+		return total;
+	}
+
+	size_t done = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		size_t given = block_transfer(dev, iov[i].base, iov[i].length, offset + done, write);
+		done += given;
+
+		if (given < iov[i].length) {
+			break;
+		}
+	}
+
+	return done;
+}
+
+static int block_readv(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	return block_vector(iov, iovcnt, offset, file, res, 0);
+}
+
+static int block_writev(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	return block_vector(iov, iovcnt, offset, file, res, 1);
+}
+
+static int block_seek(struct ARC_File *file, struct ARC_Resource *res, long offset, int whence) {
+	(void)res;
+
+	if (file == NULL) {
+		return 1;
+	}
+
+	long size = file->node->stat.st_size;
+	long position = file->offset;
+
+	switch (whence) {
+	case ARC_VFS_SEEK_SET: {
+		position = offset;
+		break;
+	}
+
+	case ARC_VFS_SEEK_CUR: {
+		position += offset;
+		break;
+	}
+
+	case ARC_VFS_SEEK_END: {
+		position = size - offset;
+		break;
+	}
+	}
+
+	if (position < 0 || position > size) {
+		return 1;
+	}
+
+	file->offset = position;
+
+	return 0;
+}
+
+ARC_REGISTER_DRIVER(0, block) = {
+	.index = 9,
+	.init = block_init,
+	.uninit = block_uninit,
+	.open = block_open,
+	.close = block_close,
+	.read = block_read,
+	.write = block_write,
+	.pread = block_pread,
+	.pwrite = block_pwrite,
+	.readv = block_readv,
+	.writev = block_writev,
+	.seek = block_seek,
+};
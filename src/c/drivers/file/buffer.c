@@ -28,18 +28,134 @@
 #include <lib/resource.h>
 #include <global.h>
 #include <mm/slab.h>
+#include <mm/pmm.h>
 #include <util.h>
 
+#define BUFFER_PAGE_SIZE 0x1000
+#define BUFFER_PAGE_SHIFT 12
+// Number of pointers in a directory or table page
+#define BUFFER_TABLE_ENTRIES (BUFFER_PAGE_SIZE / sizeof(void *))
+// Largest size a buffer file may grow to (1 GiB)
+#define BUFFER_MAX_SIZE (BUFFER_TABLE_ENTRIES * BUFFER_TABLE_ENTRIES * BUFFER_PAGE_SIZE)
+
+/**
+ * Buffer files are a sparse, two level array of pages. The
+ * directory points to tables, which point to pages. Holes
+ * read as zeroes and are filled in on write.
+ * */
 struct buffer_dri_state {
 	size_t size;
-	void *buffer;
+	/// End of the highest page handed out by mmap, pages below it are
+	/// never freed while the buffer lives as mappings may still use them.
+	size_t mapped_end;
+	/// Page of BUFFER_TABLE_ENTRIES tables, NULL until the first page is allocated.
+	uint8_t ***directory;
 };
 
+/**
+ * Get the page containing the byte at offset.
+ *
+ * @param struct buffer_dri_state *state - The state of the buffer file.
+ * @param size_t offset - The offset into the file.
+ * @param int create - Non-zero to allocate the page if it is a hole.
+ * @return The page, NULL if it is a hole and create is zero, or allocation failed.
+ * */
+static uint8_t *buffer_page(struct buffer_dri_state *state, size_t offset, int create) {
+	if (offset >= BUFFER_MAX_SIZE) {
+		return NULL;
+	}
+
+	size_t page = offset >> BUFFER_PAGE_SHIFT;
+	size_t dir_index = page / BUFFER_TABLE_ENTRIES;
+	size_t table_index = page % BUFFER_TABLE_ENTRIES;
+
+	if (state->directory == NULL) {
+		if (!create || (state->directory = (uint8_t ***)Arc_AllocPMM()) == NULL) {
+			return NULL;
+		}
+
+		memset(state->directory, 0, BUFFER_PAGE_SIZE);
+	}
+
+	uint8_t **table = state->directory[dir_index];
+
+	if (table == NULL) {
+		if (!create || (table = (uint8_t **)Arc_AllocPMM()) == NULL) {
+			return NULL;
+		}
+
+		memset(table, 0, BUFFER_PAGE_SIZE);
+		state->directory[dir_index] = table;
+	}
+
+	if (table[table_index] == NULL) {
+		if (!create || (table[table_index] = (uint8_t *)Arc_AllocPMM()) == NULL) {
+			return NULL;
+		}
+
+		memset(table[table_index], 0, BUFFER_PAGE_SIZE);
+	}
+
+	return table[table_index];
+}
+
+/**
+ * Free all pages which lie wholly at or past offset.
+ * */
+static void buffer_free_from(struct buffer_dri_state *state, size_t offset) {
+	if (state->directory == NULL) {
+		return;
+	}
+
+	size_t first = ALIGN(offset, BUFFER_PAGE_SIZE) >> BUFFER_PAGE_SHIFT;
+
+	for (size_t i = 0; i < BUFFER_TABLE_ENTRIES; i++) {
+		uint8_t **table = state->directory[i];
+
+		if (table == NULL) {
+			continue;
+		}
+
+		int empty = 1;
+
+		for (size_t j = 0; j < BUFFER_TABLE_ENTRIES; j++) {
+			if (table[j] == NULL) {
+				continue;
+			}
+
+			if (i * BUFFER_TABLE_ENTRIES + j >= first) {
+				Arc_FreePMM(table[j]);
+				table[j] = NULL;
+				continue;
+			}
+
+			empty = 0;
+		}
+
+		if (empty) {
+			Arc_FreePMM(table);
+			state->directory[i] = NULL;
+		}
+	}
+
+	if (offset == 0) {
+		Arc_FreePMM(state->directory);
+		state->directory = NULL;
+	}
+}
+
 int buffer_init(struct ARC_Resource *res, void *arg) {
-	size_t size = *(size_t *)arg;
 	struct buffer_dri_state *state = (struct buffer_dri_state *)Arc_SlabAlloc(sizeof(struct buffer_dri_state));
-	state->buffer = (void *)Arc_SlabAlloc(size);
-	state->size = size;
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	// Pages are allocated as they are written, the initial
+	// size is a hole
+	state->size = arg == NULL ? 0 : min(*(size_t *)arg, BUFFER_MAX_SIZE);
+	state->mapped_end = 0;
+	state->directory = NULL;
 
 	res->driver_state = state;
 
@@ -49,7 +165,7 @@ int buffer_init(struct ARC_Resource *res, void *arg) {
 int buffer_uninit(struct ARC_Resource *res) {
 	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
 
-	Arc_SlabFree(state->buffer);
+	buffer_free_from(state, 0);
 	Arc_SlabFree(state);
 
 	return 0;
@@ -65,67 +181,228 @@ int buffer_open(struct ARC_File *file, struct ARC_Resource *res, char *path, int
 
 	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
 
+	Arc_SeqWriteLock(&file->node->stat_lock);
 	file->node->stat.st_size = state->size;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
 
 	return 0;
 }
 
-int buffer_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+/**
+ * Copy between the buffer and memory.
+ *
+ * Reads stop at the end of the file, writes extend it.
+ * The caller must hold res->dri_state_mutex.
+ *
+ * @param void *buffer - The memory to copy to or from.
+ * @param size_t wanted - The number of bytes to copy.
+ * @param long offset - The offset into the buffer file.
+ * @param struct buffer_dri_state *state - The state of the buffer file.
+ * @param int write - Non-zero to copy from /a buffer into the buffer file.
+ * @return The number of bytes copied.
+ * */
+static size_t buffer_copy(void *buffer, size_t wanted, long offset, struct buffer_dri_state *state, int write) {
+	if (offset < 0) {
+		return 0;
+	}
+
+	size_t end = write ? BUFFER_MAX_SIZE : state->size;
+
+	if ((size_t)offset >= end) {
+		return 0;
+	}
+
+	size_t given = min(wanted, end - offset);
+	size_t done = 0;
+
+	while (done < given) {
+		size_t position = offset + done;
+		size_t in_page = position & (BUFFER_PAGE_SIZE - 1);
+		size_t chunk = min(given - done, BUFFER_PAGE_SIZE - in_page);
+		uint8_t *page = buffer_page(state, position, write);
+
+		if (write) {
+			if (page == NULL) {
+				break;
+			}
+
+			memcpy(page + in_page, buffer + done, chunk);
+		} else if (page == NULL) {
+			memset(buffer + done, 0, chunk);
+		} else {
+			memcpy(buffer + done, page + in_page, chunk);
+		}
+
+		done += chunk;
+	}
+
+	if (write && offset + done > state->size) {
+		state->size = offset + done;
+	}
+
+	return done;
+}
+
+int buffer_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
 	if (buffer == NULL || size == 0 || count == 0 || file == NULL || res == NULL) {
 		return -1;
 	}
 
 	Arc_MutexLock(&res->dri_state_mutex);
+	size_t given = buffer_copy(buffer, size * count, offset, (struct buffer_dri_state *)res->driver_state, 0);
+	Arc_MutexUnlock(&res->dri_state_mutex);
 
-	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
-
-	size_t wanted = size * count;
-	size_t accessible = state->size - file->offset;
+	return given;
+}
 
-	if (accessible == 0) {
-		return 0;
-		Arc_MutexUnlock(&res->dri_state_mutex);
+int buffer_pwrite(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || size == 0 || count == 0 || file == NULL || res == NULL) {
+		return -1;
 	}
 
-	int64_t delta = wanted - accessible;
-	size_t given = delta > 0 ? wanted - delta : wanted;
-	given = given > 0 ? given : 0;
-
-	// Do the actual giving
-	memcpy(buffer, state->buffer + file->offset, given);
+	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
 
+	Arc_MutexLock(&res->dri_state_mutex);
+	size_t given = buffer_copy(buffer, size * count, offset, state, 1);
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	file->node->stat.st_size = state->size;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
 	Arc_MutexUnlock(&res->dri_state_mutex);
 
 	return given;
 }
 
+int buffer_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return buffer_pread(buffer, size, count, file->offset, file, res);
+}
+
 int buffer_write(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
-	if (buffer == NULL || size == 0 || count == 0 || file == NULL || res == NULL) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return buffer_pwrite(buffer, size, count, file->offset, file, res);
+}
+
+/**
+ * Scatter or gather a list of buffers under a single lock.
+ * */
+static int buffer_vector(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res, int write) {
+	if (iov == NULL || file == NULL || res == NULL) {
 		return -1;
 	}
 
+	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
+	size_t total = 0;
+
 	Arc_MutexLock(&res->dri_state_mutex);
 
+	for (int i = 0; i < iovcnt; i++) {
+		size_t given = buffer_copy(iov[i].base, iov[i].length, offset + total, state, write);
+
+		total += given;
+
+		if (given < iov[i].length) {
+			break;
+		}
+	}
+
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	file->node->stat.st_size = state->size;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	Arc_MutexUnlock(&res->dri_state_mutex);
+
+	return total;
+}
+
+int buffer_readv(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	return buffer_vector(iov, iovcnt, offset, file, res, 0);
+}
+
+int buffer_writev(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	return buffer_vector(iov, iovcnt, offset, file, res, 1);
+}
+
+int buffer_mmap(struct ARC_File *file, struct ARC_Resource *res, long offset, int write, uint64_t *paddr) {
+	(void)file;
+	(void)write;
+
+	if (res == NULL || paddr == NULL) {
+		return 1;
+	}
+
 	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
 
-	size_t wanted = size * count;
-	size_t accessible = state->size - file->offset;
+	Arc_MutexLock(&res->dri_state_mutex);
 
-	if (accessible == 0) {
-		return 0;
+	if (offset < 0 || (size_t)offset >= state->size) {
 		Arc_MutexUnlock(&res->dri_state_mutex);
+		return 1;
 	}
 
-	int64_t delta = wanted - accessible;
-	size_t given = delta > 0 ? wanted - delta : wanted;
-	given = given > 0 ? given : 0;
+	// Holes are filled in so the mapping stays backed by
+	// the file
+	uint8_t *page = buffer_page(state, offset, 1);
 
-	// Do the actual receiving
-	memcpy(state->buffer + file->offset, buffer, given);
+	if (page != NULL) {
+		state->mapped_end = max(state->mapped_end, ALIGN((size_t)offset + 1, BUFFER_PAGE_SIZE));
+	}
 
 	Arc_MutexUnlock(&res->dri_state_mutex);
 
-	return given;
+	if (page == NULL) {
+		return 1;
+	}
+
+	*paddr = ARC_HHDM_TO_PHYS(page + (offset & (BUFFER_PAGE_SIZE - 1)));
+
+	return 0;
+}
+
+int buffer_truncate(struct ARC_File *file, struct ARC_Resource *res, size_t length) {
+	if (file == NULL || res == NULL || length > BUFFER_MAX_SIZE) {
+		return 1;
+	}
+
+	struct buffer_dri_state *state = (struct buffer_dri_state *)res->driver_state;
+
+	Arc_MutexLock(&res->dri_state_mutex);
+
+	if (length < state->size) {
+		// Mapped pages may still be in use, they are kept and only
+		// the pages past them freed
+		buffer_free_from(state, max(length, state->mapped_end));
+
+		// Clear what is left past the end so that growing
+		// the file again reads back zeroes
+		size_t position = length;
+		size_t end = max(ALIGN(length, BUFFER_PAGE_SIZE), min(state->mapped_end, ALIGN(state->size, BUFFER_PAGE_SIZE)));
+
+		while (position < end) {
+			uint8_t *page = buffer_page(state, position, 0);
+			size_t in_page = position & (BUFFER_PAGE_SIZE - 1);
+
+			if (page != NULL) {
+				memset(page + in_page, 0, BUFFER_PAGE_SIZE - in_page);
+			}
+
+			position += BUFFER_PAGE_SIZE - in_page;
+		}
+	}
+
+	state->size = length;
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	file->node->stat.st_size = length;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	Arc_MutexUnlock(&res->dri_state_mutex);
+
+	return 0;
 }
 
 int buffer_seek(struct ARC_File *file, struct ARC_Resource *res, long offset, int whence) {
@@ -139,7 +416,9 @@ int buffer_seek(struct ARC_File *file, struct ARC_Resource *res, long offset, in
 
 	switch (whence) {
 	case ARC_VFS_SEEK_SET: {
-		if (offset < size) {
+		// Seeking past the end is allowed, writing there
+		// extends the file
+		if (offset >= 0) {
 			file->offset = offset;
 		}
 
@@ -176,5 +455,11 @@ ARC_REGISTER_DRIVER(0, buffer) = {
 	.open = buffer_open,
 	.read = buffer_read,
 	.write = buffer_write,
+	.pread = buffer_pread,
+	.pwrite = buffer_pwrite,
+	.readv = buffer_readv,
+	.writev = buffer_writev,
 	.seek = buffer_seek,
+	.mmap = buffer_mmap,
+	.truncate = buffer_truncate,
 };
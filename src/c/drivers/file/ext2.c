@@ -25,8 +25,320 @@
  * @DESCRIPTION
  * File driver for the EXT2 filesystem.
 */
+#include <abi-bits/errno.h>
 #include <lib/resource.h>
+#include <lib/atomics.h>
+#include <fs/vfs.h>
+#include <fs/ext2.h>
+#include <mm/slab.h>
+#include <global.h>
+#include <util.h>
+#include <sys/stat.h>
+
+struct internal_driver_state {
+	struct ARC_Ext2State *super;
+	uint32_t ino;
+	struct ARC_Ext2MapCache cache;
+};
+
+static int ext2_init(struct ARC_Resource *res, void *args) {
+	struct internal_driver_state *state = (struct internal_driver_state *)Arc_SlabAlloc(sizeof(struct internal_driver_state));
+
+	if (state == NULL) {
+		return ENOMEM;
+	}
+
+	memset(state, 0, sizeof(struct internal_driver_state));
+
+	// Arguments are the state of the EXT2 super driver
+	state->super = (struct ARC_Ext2State *)args;
+	res->driver_state = state;
+
+	return 0;
+}
+
+static int ext2_uninit(struct ARC_Resource *res) {
+	Arc_SlabFree(res->driver_state);
+
+	return 0;
+}
+
+static int ext2_open(struct ARC_File *file, struct ARC_Resource *res, char *path, int flags, uint32_t mode) {
+	(void)flags;
+	(void)mode;
+
+	if (file == NULL || res == NULL) {
+		return EINVAL;
+	}
+
+	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_Ext2State *fs = state->super;
+	struct ARC_Ext2Inode inode;
+	int ret = 0;
+
+	Arc_MutexLock(&fs->lock);
+
+	state->ino = Arc_Ext2Lookup(fs, path);
+
+	if (state->ino == 0 || Arc_Ext2ReadInode(fs, state->ino, &inode) != 0) {
+		ARC_DEBUG(ERR, "Failed to open %s\n", path);
+		ret = ENOENT;
+	} else {
+		Arc_SeqWriteLock(&file->node->stat_lock);
+		Arc_Ext2InodeStat(fs, state->ino, &inode, &file->node->stat);
+		Arc_SeqWriteUnlock(&file->node->stat_lock);
+	}
+
+	Arc_MutexUnlock(&fs->lock);
+
+	return ret;
+}
+
+static int ext2_close(struct ARC_File *file, struct ARC_Resource *res) {
+	(void)file;
+
+	struct ARC_Ext2State *fs = ((struct internal_driver_state *)res->driver_state)->super;
+
+	Arc_MutexLock(&fs->lock);
+	int ret = Arc_Ext2Sync(fs);
+	Arc_MutexUnlock(&fs->lock);
+
+	return ret;
+}
+
+static int ext2_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || file == NULL || res == NULL || offset < 0) {
+		return -1;
+	}
+
+	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_Ext2State *fs = state->super;
+	struct ARC_Ext2Inode inode;
+	struct stat stat;
+	size_t done = 0;
+
+	Arc_MutexLock(&fs->lock);
+
+	if (Arc_Ext2ReadInode(fs, state->ino, &inode) != 0) {
+		Arc_MutexUnlock(&fs->lock);
+		return -1;
+	}
+
+	Arc_Ext2InodeStat(fs, state->ino, &inode, &stat);
+
+	size_t wanted = offset >= stat.st_size ? 0 : min(size * count, (size_t)(stat.st_size - offset));
+
+	while (done < wanted) {
+		uint64_t position = offset + done;
+		uint32_t in_block = position % fs->block_size;
+		size_t chunk = min(wanted - done, fs->block_size - in_block);
+		uint32_t block = Arc_Ext2MapBlock(fs, state->ino, &inode, position / fs->block_size, 0, &state->cache);
+
+		if (block == 0) {
+			// Hole
+			memset(buffer + done, 0, chunk);
+		} else {
+			struct ARC_Ext2Buffer *data = Arc_Ext2GetBuffer(fs, block, 1);
+
+			if (data == NULL) {
+				break;
+			}
+
+			memcpy(buffer + done, data->data + in_block, chunk);
+			Arc_Ext2PutBuffer(fs, data, 0);
+		}
+
+		done += chunk;
+	}
+
+	Arc_MutexUnlock(&fs->lock);
+
+	return done;
+}
+
+static int ext2_pwrite(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || file == NULL || res == NULL || offset < 0) {
+		return -1;
+	}
+
+	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_Ext2State *fs = state->super;
+	struct ARC_Ext2Inode inode;
+	size_t wanted = size * count;
+	size_t done = 0;
+
+	if (fs->read_only) {
+		return -1;
+	}
+
+	Arc_MutexLock(&fs->lock);
+
+	if (Arc_Ext2ReadInode(fs, state->ino, &inode) != 0) {
+		Arc_MutexUnlock(&fs->lock);
+		return -1;
+	}
+
+	while (done < wanted) {
+		uint64_t position = offset + done;
+		uint32_t in_block = position % fs->block_size;
+		size_t chunk = min(wanted - done, fs->block_size - in_block);
+		uint32_t block = Arc_Ext2MapBlock(fs, state->ino, &inode, position / fs->block_size, 1, &state->cache);
+
+		if (block == 0) {
+			ARC_DEBUG(ERR, "No space left on device\n");
+			break;
+		}
+
+		// Whole blocks need not be read first
+		struct ARC_Ext2Buffer *data = Arc_Ext2GetBuffer(fs, block, chunk != fs->block_size);
+
+		if (data == NULL) {
+			break;
+		}
+
+		memcpy(data->data + in_block, buffer + done, chunk);
+		Arc_Ext2PutBuffer(fs, data, 1);
+
+		done += chunk;
+	}
+
+	uint64_t size_now = inode.size | ((uint64_t)inode.size_high << 32);
+
+	if (offset + done > size_now) {
+		inode.size = (offset + done) & 0xFFFFFFFF;
+		inode.size_high = (uint64_t)(offset + done) >> 32;
+	}
+
+	Arc_Ext2WriteInode(fs, state->ino, &inode);
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	Arc_Ext2InodeStat(fs, state->ino, &inode, &file->node->stat);
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	Arc_MutexUnlock(&fs->lock);
+
+	return done;
+}
+
+static int ext2_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return ext2_pread(buffer, size, count, file->offset, file, res);
+}
+
+static int ext2_write(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	return ext2_pwrite(buffer, size, count, file->offset, file, res);
+}
+
+static int ext2_truncate(struct ARC_File *file, struct ARC_Resource *res, size_t length) {
+	if (file == NULL || res == NULL) {
+		return 1;
+	}
+
+	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_Ext2State *fs = state->super;
+	struct ARC_Ext2Inode inode;
+
+	if (fs->read_only) {
+		return 1;
+	}
+
+	Arc_MutexLock(&fs->lock);
+
+	if (Arc_Ext2ReadInode(fs, state->ino, &inode) != 0) {
+		Arc_MutexUnlock(&fs->lock);
+		return 1;
+	}
+
+	uint64_t keep = (length + fs->block_size - 1) / fs->block_size;
+	Arc_Ext2Trim(fs, &inode, keep);
+
+	// Clear the tail of the last block so that growing
+	// the file again reads back zeroes
+	uint32_t in_block = length % fs->block_size;
+	uint32_t block = in_block == 0 ? 0 : Arc_Ext2MapBlock(fs, state->ino, &inode, length / fs->block_size, 0, NULL);
+
+	if (block != 0) {
+		struct ARC_Ext2Buffer *data = Arc_Ext2GetBuffer(fs, block, 1);
+
+		if (data != NULL) {
+			memset(data->data + in_block, 0, fs->block_size - in_block);
+			Arc_Ext2PutBuffer(fs, data, 1);
+		}
+	}
+
+	inode.size = length & 0xFFFFFFFF;
+	inode.size_high = (uint64_t)length >> 32;
+
+	memset(&state->cache, 0, sizeof(struct ARC_Ext2MapCache));
+
+	Arc_Ext2WriteInode(fs, state->ino, &inode);
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	Arc_Ext2InodeStat(fs, state->ino, &inode, &file->node->stat);
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	Arc_MutexUnlock(&fs->lock);
+
+	return 0;
+}
+
+static int ext2_seek(struct ARC_File *file, struct ARC_Resource *res, long offset, int whence) {
+	(void)res;
+
+	if (file == NULL) {
+		return 1;
+	}
+
+	long size = file->node->stat.st_size;
+
+	switch (whence) {
+	case ARC_VFS_SEEK_SET: {
+		if (offset >= 0) {
+			file->offset = offset;
+		}
+
+		return 0;
+	}
+
+	case ARC_VFS_SEEK_CUR: {
+		file->offset += offset;
+
+		if (file->offset < 0) {
+			file->offset = 0;
+		}
+
+		return 0;
+	}
+
+	case ARC_VFS_SEEK_END: {
+		file->offset = size - offset - 1;
+
+		if (file->offset < 0) {
+			file->offset = 0;
+		}
+
+		return 0;
+	}
+	}
+
+	return 0;
+}
 
 ARC_REGISTER_DRIVER(0, ext2_file) = {
 	.index = 3,
+	.init = ext2_init,
+	.uninit = ext2_uninit,
+	.open = ext2_open,
+	.close = ext2_close,
+	.read = ext2_read,
+	.write = ext2_write,
+	.pread = ext2_pread,
+	.pwrite = ext2_pwrite,
+	.seek = ext2_seek,
+	.truncate = ext2_truncate,
 };
@@ -25,3 +25,331 @@
  * @DESCRIPTION
  * Driver for RAM files which are FIFO queues.
 */
+#include <lib/resource.h>
+#include <lib/atomics.h>
+#include <global.h>
+#include <mm/slab.h>
+#include <mm/pmm.h>
+#include <mp/futex.h>
+#include <abi-bits/fcntl.h>
+#include <abi-bits/errno.h>
+#include <util.h>
+
+#define FIFO_CACHE_LINE 64
+// Size of the ring if none is given on creation
+#define FIFO_DEFAULT_SIZE 0x1000
+
+/**
+ * The ring is indexed by free running counters, tail - head is
+ * the number of bytes in the ring. Each side keeps to its own
+ * cache line: the consumer only writes head, the producer only
+ * writes tail, and each caches the other's index, only going to
+ * the other's cache line once the cached value runs out.
+ *
+ * Only one producer and one consumer are in the ring at a time,
+ * which they claim by taking write_lock or read_lock. Uncontended
+ * that is a single compare and swap, further producers or consumers
+ * sleep on the mutex until it is their turn.
+ *
+ * A side which has to wait for the other sleeps on the other's event
+ * counter as a futex, after raising its sleeping flag so the other
+ * knows to wake it when it bumps the counter.
+ * */
+struct fifo_dri_state {
+	/// Consumer side.
+	struct {
+		_Atomic size_t head;
+		size_t tail_cache;
+		/// Bumped whenever space is freed.
+		_Atomic uint32_t space_event;
+		/// Set while the consumer sleeps on data_event.
+		_Atomic int consumer_sleeping;
+		ARC_GenericMutex read_lock;
+	} __attribute__((aligned(FIFO_CACHE_LINE)));
+	/// Producer side.
+	struct {
+		_Atomic size_t tail;
+		size_t head_cache;
+		/// Bumped whenever data is added, or a writer goes away.
+		_Atomic uint32_t data_event;
+		/// Set while the producer sleeps on space_event.
+		_Atomic int producer_sleeping;
+		ARC_GenericMutex write_lock;
+	} __attribute__((aligned(FIFO_CACHE_LINE)));
+	/// Read only after creation, but for writers.
+	struct {
+		uint8_t *buffer;
+		size_t size;
+		size_t mask;
+		size_t pages;
+		/// Open handles which can write, reads see the end of the
+		/// stream once it drops to zero and the ring is empty.
+		_Atomic int writers;
+	} __attribute__((aligned(FIFO_CACHE_LINE)));
+};
+
+/**
+ * Tell the other side an event happened, waking it if it sleeps.
+ * */
+static void fifo_signal(_Atomic uint32_t *event, _Atomic int *sleeping) {
+	atomic_fetch_add_explicit(event, 1, memory_order_seq_cst);
+
+	if (atomic_load_explicit(sleeping, memory_order_seq_cst)) {
+		Arc_FutexWake((uint32_t *)event, 1, ARC_FUTEX_BITSET_ANY);
+	}
+}
+
+/**
+ * Wait for the other side, once a look at the ring came up empty
+ * handed.
+ *
+ * @param uint32_t seen - The event counter, read before that look.
+ * */
+static void fifo_sleep(_Atomic uint32_t *event, _Atomic int *sleeping, uint32_t seen) {
+	atomic_store_explicit(sleeping, 1, memory_order_seq_cst);
+	// An event since the look fails the compare, it is not slept through
+	Arc_FutexWait((uint32_t *)event, seen, 0, ARC_FUTEX_BITSET_ANY);
+	atomic_store_explicit(sleeping, 0, memory_order_relaxed);
+}
+
+int fifo_init(struct ARC_Resource *res, void *arg) {
+	size_t wanted = arg == NULL ? FIFO_DEFAULT_SIZE : *(size_t *)arg;
+	size_t size = 0x1000;
+
+	while (size < wanted) {
+		size <<= 1;
+	}
+
+	struct fifo_dri_state *state = (struct fifo_dri_state *)Arc_SlabAlloc(sizeof(struct fifo_dri_state));
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	memset(state, 0, sizeof(struct fifo_dri_state));
+
+	state->pages = size >> 12;
+	state->buffer = (uint8_t *)Arc_ContiguousAllocPMM(state->pages);
+
+	if (state->buffer == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate %lu byte ring\n", size);
+		Arc_SlabFree(state);
+		return 1;
+	}
+
+	state->size = size;
+	state->mask = size - 1;
+
+	res->driver_state = state;
+
+	return 0;
+}
+
+int fifo_uninit(struct ARC_Resource *res) {
+	struct fifo_dri_state *state = (struct fifo_dri_state *)res->driver_state;
+
+	Arc_ContiguousFreePMM(state->buffer, state->pages);
+	Arc_SlabFree(state);
+
+	return 0;
+}
+
+int fifo_open(struct ARC_File *file, struct ARC_Resource *res, char *path, int flags, uint32_t mode) {
+	(void)path;
+	(void)mode;
+
+	struct fifo_dri_state *state = (struct fifo_dri_state *)res->driver_state;
+
+	// Called for every handle, so the writers can be counted
+	if ((flags & O_ACCMODE) != O_RDONLY) {
+		atomic_fetch_add_explicit(&state->writers, 1, memory_order_relaxed);
+	}
+
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	file->node->stat.st_size = 0;
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
+
+	return 0;
+}
+
+int fifo_close(struct ARC_File *file, struct ARC_Resource *res) {
+	struct fifo_dri_state *state = (struct fifo_dri_state *)res->driver_state;
+
+	if ((file->flags & O_ACCMODE) != O_RDONLY && atomic_fetch_sub_explicit(&state->writers, 1, memory_order_release) == 1) {
+		// Last writer gone, a sleeping reader has to see the end
+		fifo_signal(&state->data_event, &state->consumer_sleeping);
+	}
+
+	return 0;
+}
+
+/**
+ * Copy out of the ring, the caller must have claimed the consumer side.
+ *
+ * @return The number of bytes copied.
+ * */
+static size_t fifo_consume(struct fifo_dri_state *state, uint8_t *buffer, size_t wanted) {
+	size_t head = atomic_load_explicit(&state->head, memory_order_relaxed);
+	size_t available = state->tail_cache - head;
+
+	if (available < wanted) {
+		state->tail_cache = atomic_load_explicit(&state->tail, memory_order_acquire);
+		available = state->tail_cache - head;
+	}
+
+	size_t given = min(wanted, available);
+
+	if (given == 0) {
+		return 0;
+	}
+
+	size_t index = head & state->mask;
+	size_t first = min(given, state->size - index);
+
+	memcpy(buffer, state->buffer + index, first);
+	memcpy(buffer + first, state->buffer, given - first);
+
+	atomic_store_explicit(&state->head, head + given, memory_order_release);
+	fifo_signal(&state->space_event, &state->producer_sleeping);
+
+	return given;
+}
+
+/**
+ * Copy into the ring, the caller must have claimed the producer side.
+ *
+ * @return The number of bytes copied.
+ * */
+static size_t fifo_produce(struct fifo_dri_state *state, uint8_t *buffer, size_t wanted) {
+	size_t tail = atomic_load_explicit(&state->tail, memory_order_relaxed);
+	size_t space = state->size - (tail - state->head_cache);
+
+	if (space < wanted) {
+		state->head_cache = atomic_load_explicit(&state->head, memory_order_acquire);
+		space = state->size - (tail - state->head_cache);
+	}
+
+	size_t given = min(wanted, space);
+
+	if (given == 0) {
+		return 0;
+	}
+
+	size_t index = tail & state->mask;
+	size_t first = min(given, state->size - index);
+
+	memcpy(state->buffer + index, buffer, first);
+	memcpy(state->buffer, buffer + first, given - first);
+
+	atomic_store_explicit(&state->tail, tail + given, memory_order_release);
+	fifo_signal(&state->data_event, &state->consumer_sleeping);
+
+	return given;
+}
+
+/**
+ * Read what is in the ring, sleeping until there is something.
+ *
+ * @return Bytes read, 0 once the ring is empty with no writers left,
+ * -EAGAIN if the file is non-blocking and the ring is empty.
+ * */
+int fifo_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || file == NULL || res == NULL) {
+		return -1;
+	}
+
+	struct fifo_dri_state *state = (struct fifo_dri_state *)res->driver_state;
+	size_t wanted = size * count;
+
+	if (wanted == 0) {
+		return 0;
+	}
+
+	Arc_MutexLock(&state->read_lock);
+
+	int given = 0;
+
+	for (;;) {
+		uint32_t seen = atomic_load_explicit(&state->data_event, memory_order_acquire);
+
+		if ((given = fifo_consume(state, buffer, wanted)) != 0) {
+			break;
+		}
+
+		if (atomic_load_explicit(&state->writers, memory_order_acquire) == 0) {
+			// End of the stream, data of the last writers was taken above
+			given = fifo_consume(state, buffer, wanted);
+			break;
+		}
+
+		if (file->flags & O_NONBLOCK) {
+			given = -EAGAIN;
+			break;
+		}
+
+		fifo_sleep(&state->data_event, &state->consumer_sleeping, seen);
+	}
+
+	Arc_MutexUnlock(&state->read_lock);
+
+	return given;
+}
+
+/**
+ * Write everything, sleeping until the consumer makes space.
+ *
+ * @return Bytes written, -EAGAIN if the file is non-blocking and the
+ * ring was full.
+ * */
+int fifo_write(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (buffer == NULL || file == NULL || res == NULL) {
+		return -1;
+	}
+
+	struct fifo_dri_state *state = (struct fifo_dri_state *)res->driver_state;
+	size_t wanted = size * count;
+
+	Arc_MutexLock(&state->write_lock);
+
+	size_t given = 0;
+
+	while (given < wanted) {
+		uint32_t seen = atomic_load_explicit(&state->space_event, memory_order_acquire);
+		size_t done = fifo_produce(state, buffer + given, wanted - given);
+		given += done;
+
+		if (done != 0) {
+			continue;
+		}
+
+		if (file->flags & O_NONBLOCK) {
+			break;
+		}
+
+		fifo_sleep(&state->space_event, &state->producer_sleeping, seen);
+	}
+
+	Arc_MutexUnlock(&state->write_lock);
+
+	if (given == 0 && wanted != 0 && (file->flags & O_NONBLOCK)) {
+		return -EAGAIN;
+	}
+
+	return given;
+}
+
+int fifo_seek() {
+	// FIFOs have no position
+	return 1;
+}
+
+ARC_REGISTER_DRIVER(0, fifo) = {
+	.index = 7,
+	.init = fifo_init,
+	.uninit = fifo_uninit,
+	.open = fifo_open,
+	.close = fifo_close,
+	.read = fifo_read,
+	.write = fifo_write,
+	.seek = fifo_seek,
+};
@@ -29,92 +29,32 @@
 #include <lib/atomics.h>
 #include <lib/perms.h>
 #include <fs/vfs.h>
+#include <fs/initramfs.h>
 #include <mm/slab.h>
 #include <global.h>
 #include <time.h>
 #include <util.h>
 #include <sys/stat.h>
 
-#define ARC_NAME_OFFSET (sizeof(struct ARC_HeaderCPIO))
-#define ARC_NAME_SIZE(header) (header->namesize + (header->namesize & 1))
-#define ARC_DATA_OFFSET(header) (ARC_NAME_OFFSET + ARC_NAME_SIZE(header))
-#define ARC_DATA_SIZE(header) (((header->filesize[0] << 16) | header->filesize[1]) + (((header->filesize[0] << 16) | header->filesize[1]) & 1))
-
-struct ARC_HeaderCPIO {
-	uint16_t magic;
-	uint16_t device;
-	uint16_t inode;
-	uint16_t mode;
-	uint16_t uid;
-	uint16_t gid;
-	uint16_t nlink;
-	uint16_t rdev;
-	uint16_t mod_time[2];
-	uint16_t namesize;
-	uint16_t filesize[2];
-}__attribute__((packed));
-
 struct internal_driver_state {
-	struct ARC_Resource *resource;
-	void *initramfs_base;
+	struct ARC_InitramfsState *super;
+	struct ARC_InitramfsEntry *entry;
 };
 
-static void *initramfs_find_file(void *fs, char *filename) {
-	if (fs == NULL || filename == NULL) {
-		ARC_DEBUG(ERR, "Either fs %p or filename %p is NULL\n", fs, filename);
-		return NULL;
-	}
-
-	struct ARC_HeaderCPIO *header = (struct ARC_HeaderCPIO *)fs;
-	uint64_t offset = 0;
-
-	while (header->magic == 0070707) {
-		char *name = ((char *)header) + ARC_NAME_OFFSET;
-
-		if (strcmp(name, filename) != 0) {
-			goto next;
-		}
-
-		ARC_DEBUG(INFO, "Found file \"%s\"\n", name);
-
-		return (void *)header;
-
-		next:;
-		offset += ARC_DATA_OFFSET(header) + ARC_DATA_SIZE(header);
-		header = (struct ARC_HeaderCPIO *)(fs + offset);
-	}
-
-	ARC_DEBUG(ERR, "Could not find file \"%s\"\n", filename);
-
-	return NULL;
-}
-
-static int initramfs_internal_stat(struct ARC_HeaderCPIO *header, struct stat *stat) {
-	stat->st_uid = header->uid;
-	stat->st_gid = header->gid;
-	stat->st_mode = header->mode;
-	stat->st_dev = header->device;
-	stat->st_ino = header->inode;
-	stat->st_nlink = header->nlink;
-	stat->st_rdev = header->rdev;
-	stat->st_size = ARC_DATA_SIZE(header);
-	stat->st_mtim.tv_nsec = 0;
-	stat->st_mtim.tv_sec = (header->mod_time[0] << 16) | header->mod_time[1];
-
-	return 0;
-}
-
 static int initramfs_empty() {
 	return 0;
 }
 
 static int initramfs_init(struct ARC_Resource *res, void *args) {
-	struct internal_driver_state *org_state = (struct internal_driver_state *)args;
 	struct internal_driver_state *state = (struct internal_driver_state *)Arc_SlabAlloc(sizeof(struct internal_driver_state));
 
+	if (state == NULL) {
+		return ENOMEM;
+	}
 
-	state->initramfs_base = org_state->initramfs_base;
-	state->resource = res;
+	// Arguments are the state of the initramfs super driver
+	state->super = (struct ARC_InitramfsState *)args;
+	state->entry = NULL;
 	res->driver_state = state;
 
 	return 0;
@@ -141,54 +81,116 @@ static int initramfs_open(struct ARC_File *file, struct ARC_Resource *res, char
 	Arc_MutexLock(&res->dri_state_mutex);
 
 	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
-	struct ARC_HeaderCPIO *header = initramfs_find_file(state->initramfs_base, path);
+	struct ARC_InitramfsEntry *entry = Arc_InitramfsFind(state->super, path);
 
-	if (header == NULL) {
-		ARC_DEBUG(ERR, "Failed to open file\n");
+	if (entry == NULL) {
+		ARC_DEBUG(ERR, "Failed to open file %s\n", path);
 		// Unlock dri_state
 		Arc_MutexUnlock(&res->dri_state_mutex);
 
 		return 1;
 	}
 
-	state->initramfs_base = (void *)header;
+	state->entry = entry;
 
 	// Unlock dri_state
 	Arc_MutexUnlock(&res->dri_state_mutex);
 
-	initramfs_internal_stat(header, &file->node->stat);
+	Arc_SeqWriteLock(&file->node->stat_lock);
+	memcpy(&file->node->stat, &entry->stat, sizeof(struct stat));
+	Arc_SeqWriteUnlock(&file->node->stat_lock);
 
 	return 0;
 }
 
-static int initramfs_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
-	if (file == NULL || res->driver_state == NULL) {
+static int initramfs_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL || res->driver_state == NULL || offset < 0) {
 		return 0;
 	}
 
 	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
-	void *addfiles = state->initramfs_base;
+	struct ARC_InitramfsEntry *entry = state->entry;
 
-	if (addfiles == NULL) {
+	if (entry == NULL || entry->data == NULL || offset >= entry->stat.st_size) {
 		return 0;
 	}
 
-	struct ARC_HeaderCPIO *header = (struct ARC_HeaderCPIO *)addfiles;
+	size_t span = min(size * count, (size_t)(entry->stat.st_size - offset));
 
-	uint8_t *data = (uint8_t *)(addfiles + ARC_DATA_OFFSET(header));
+	memcpy(buffer, (uint8_t *)entry->data + offset, span);
+
+	return span;
+}
+
+static int initramfs_read(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res) {
+	if (file == NULL) {
+		return 0;
+	}
+
+	return initramfs_pread(buffer, size, count, file->offset, file, res);
+}
 
-	// Copy file data to buffer
-	for (size_t i = 0; i < size * count; i++) {
-		uint8_t value = 0;
+static int initramfs_readv(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	int total = 0;
 
-		if (i + file->offset < (size_t)file->node->stat.st_size) {
-			value = *((uint8_t *)(data + file->offset + i));
+	for (int i = 0; i < iovcnt; i++) {
+		int ret = initramfs_pread(iov[i].base, 1, iov[i].length, offset + total, file, res);
+
+		if (ret <= 0) {
+			break;
 		}
 
-		*((uint8_t *)(buffer + i)) = value;
+		total += ret;
+	}
+
+	return total;
+}
+
+static int initramfs_mmap(struct ARC_File *file, struct ARC_Resource *res, long offset, int write, uint64_t *paddr) {
+	if (file == NULL || res->driver_state == NULL || paddr == NULL) {
+		return EINVAL;
+	}
+
+	if (write) {
+		// The pages are the archive itself
+		return EROFS;
 	}
 
-	return count;
+	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_InitramfsEntry *entry = state->entry;
+
+	if (entry == NULL || entry->data == NULL || offset < 0 || offset >= entry->stat.st_size) {
+		return EINVAL;
+	}
+
+	// The archive is resident in memory, hand out the
+	// data in place
+	*paddr = ARC_HHDM_TO_PHYS((uint8_t *)entry->data + offset);
+
+	return 0;
+}
+
+const void *Arc_InitramfsBorrow(struct ARC_File *file, long offset, size_t *length) {
+	if (file == NULL || file->node == NULL || length == NULL) {
+		return NULL;
+	}
+
+	struct ARC_Resource *res = file->node->resource;
+
+	if (res == NULL || res->driver->open != initramfs_open || res->driver_state == NULL) {
+		// Not an initramfs file, caller falls back to reading
+		return NULL;
+	}
+
+	struct ARC_InitramfsEntry *entry = ((struct internal_driver_state *)res->driver_state)->entry;
+
+	if (entry == NULL || entry->data == NULL || offset < 0 || offset > entry->stat.st_size) {
+		return NULL;
+	}
+
+	*length = entry->stat.st_size - offset;
+
+	return (const void *)((uint8_t *)entry->data + offset);
 }
 
 static int initramfs_write() {
@@ -247,5 +249,8 @@ ARC_REGISTER_DRIVER(0, initramfs_file) = {
 	.close = initramfs_empty,
 	.read = initramfs_read,
 	.write = initramfs_write,
+	.pread = initramfs_pread,
+	.readv = initramfs_readv,
 	.seek = initramfs_seek,
+	.mmap = initramfs_mmap,
 };
@@ -25,8 +25,1520 @@
  * @DESCRIPTION
  * Superblock dirvers for the EXT2 filesystem.
 */
+#include <abi-bits/errno.h>
 #include <lib/resource.h>
+#include <lib/atomics.h>
+#include <fs/vfs.h>
+#include <fs/ext2.h>
+#include <mm/slab.h>
+#include <mm/pmm.h>
+#include <global.h>
+#include <util.h>
+#include <sys/stat.h>
+
+#define EXT2_STATE_PAGES (ALIGN(sizeof(struct ARC_Ext2State), 0x1000) >> 12)
+
+// Number of group descriptors in a block
+#define EXT2_DESC_PER_BLOCK(state) ((state)->block_size / sizeof(struct ARC_Ext2GroupDesc))
+// Number of block pointers in a block
+#define EXT2_PTRS(state) ((state)->block_size / sizeof(uint32_t))
+
+/*
+ * Buffer cache
+ * */
+
+static void ext2_lru_remove(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer) {
+	if (buffer->lru_prev != NULL) {
+		buffer->lru_prev->lru_next = buffer->lru_next;
+	} else {
+		state->lru_head = buffer->lru_next;
+	}
+
+	if (buffer->lru_next != NULL) {
+		buffer->lru_next->lru_prev = buffer->lru_prev;
+	} else {
+		state->lru_tail = buffer->lru_prev;
+	}
+
+	buffer->lru_prev = NULL;
+	buffer->lru_next = NULL;
+}
+
+static void ext2_lru_push(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer) {
+	buffer->lru_prev = NULL;
+	buffer->lru_next = state->lru_head;
+
+	if (state->lru_head != NULL) {
+		state->lru_head->lru_prev = buffer;
+	}
+
+	state->lru_head = buffer;
+
+	if (state->lru_tail == NULL) {
+		state->lru_tail = buffer;
+	}
+}
+
+static void ext2_hash_remove(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer) {
+	struct ARC_Ext2Buffer **link = &state->hash[buffer->block % ARC_EXT2_CACHE_BUCKETS];
+
+	while (*link != NULL && *link != buffer) {
+		link = &(*link)->hash_next;
+	}
+
+	if (*link != NULL) {
+		*link = buffer->hash_next;
+	}
+
+	buffer->hash_next = NULL;
+}
+
+static int ext2_write_buffer(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer) {
+	if (!buffer->dirty) {
+		return 0;
+	}
+
+	if (Arc_PWriteVFS(buffer->data, 1, state->block_size, buffer->block * state->block_size, state->device) != (int)state->block_size) {
+		ARC_DEBUG(ERR, "Failed to write block %lu\n", buffer->block);
+		return EIO;
+	}
+
+	buffer->dirty = 0;
+
+	return 0;
+}
+
+struct ARC_Ext2Buffer *Arc_Ext2GetBuffer(struct ARC_Ext2State *state, uint64_t block, int read) {
+	struct ARC_Ext2Buffer *buffer = state->hash[block % ARC_EXT2_CACHE_BUCKETS];
+
+	while (buffer != NULL && buffer->block != block) {
+		buffer = buffer->hash_next;
+	}
+
+	if (buffer != NULL) {
+		buffer->refs++;
+		ext2_lru_remove(state, buffer);
+		ext2_lru_push(state, buffer);
+
+		return buffer;
+	}
+
+	// Evict the least recently used buffer which is not in use
+	buffer = state->lru_tail;
+
+	while (buffer != NULL && buffer->refs > 0) {
+		buffer = buffer->lru_prev;
+	}
+
+	if (buffer == NULL) {
+		ARC_DEBUG(ERR, "All buffers are in use\n");
+		return NULL;
+	}
+
+	if (ext2_write_buffer(state, buffer) != 0) {
+		return NULL;
+	}
+
+	if (buffer->block != (uint64_t)-1) {
+		ext2_hash_remove(state, buffer);
+	}
+
+	buffer->block = (uint64_t)-1;
+
+	if (read && Arc_PReadVFS(buffer->data, 1, state->block_size, block * state->block_size, state->device) != (int)state->block_size) {
+		ARC_DEBUG(ERR, "Failed to read block %lu\n", block);
+		return NULL;
+	}
+
+	buffer->block = block;
+	buffer->refs = 1;
+	buffer->hash_next = state->hash[block % ARC_EXT2_CACHE_BUCKETS];
+	state->hash[block % ARC_EXT2_CACHE_BUCKETS] = buffer;
+
+	ext2_lru_remove(state, buffer);
+	ext2_lru_push(state, buffer);
+
+	return buffer;
+}
+
+void Arc_Ext2PutBuffer(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer, int dirty) {
+	(void)state;
+
+	if (buffer == NULL) {
+		return;
+	}
+
+	buffer->dirty |= dirty;
+	buffer->refs--;
+}
+
+int Arc_Ext2Sync(struct ARC_Ext2State *state) {
+	struct ARC_Ext2Buffer **order = state->sync_order;
+	struct ARC_IOVec *iov = state->sync_iov;
+	int count = 0;
+
+	// Sort the dirty buffers by block
+	for (int i = 0; i < ARC_EXT2_CACHE_BUFFERS; i++) {
+		struct ARC_Ext2Buffer *buffer = &state->buffers[i];
+
+		if (!buffer->dirty) {
+			continue;
+		}
+
+		int j = count++;
+
+		while (j > 0 && order[j - 1]->block > buffer->block) {
+			order[j] = order[j - 1];
+			j--;
+		}
+
+		order[j] = buffer;
+	}
+
+	int ret = 0;
+
+	// Runs of adjacent blocks go out as one vectored write, which
+	// a block device takes as a single request
+	for (int i = 0; i < count;) {
+		int run = 0;
+
+		do {
+			iov[run].base = order[i + run]->data;
+			iov[run].length = state->block_size;
+			run++;
+		} while (i + run < count && order[i + run]->block == order[i]->block + run);
+
+		int length = run * state->block_size;
+
+		if (Arc_PWriteVVFS(iov, run, order[i]->block * state->block_size, state->device) != length) {
+			ARC_DEBUG(ERR, "Failed to write blocks %lu-%lu\n", order[i]->block, order[i]->block + run - 1);
+			ret = EIO;
+		} else {
+			for (int j = 0; j < run; j++) {
+				order[i + j]->dirty = 0;
+			}
+		}
+
+		i += run;
+	}
+
+	return ret;
+}
+
+/*
+ * Metadata
+ * */
+
+static struct ARC_Ext2GroupDesc *ext2_group(struct ARC_Ext2State *state, uint32_t group, struct ARC_Ext2Buffer **buffer) {
+	*buffer = state->gdt_buffers[group / EXT2_DESC_PER_BLOCK(state)];
+
+	return (struct ARC_Ext2GroupDesc *)(*buffer)->data + group % EXT2_DESC_PER_BLOCK(state);
+}
+
+static int ext2_inode_location(struct ARC_Ext2State *state, uint32_t ino, uint64_t *block, uint32_t *offset) {
+	if (ino == 0 || ino > state->super->inodes_count) {
+		return EINVAL;
+	}
+
+	struct ARC_Ext2Buffer *gdt = NULL;
+	struct ARC_Ext2GroupDesc *desc = ext2_group(state, (ino - 1) / state->super->inodes_per_group, &gdt);
+	uint64_t byte = (uint64_t)((ino - 1) % state->super->inodes_per_group) * state->inode_size;
+
+	*block = desc->inode_table + byte / state->block_size;
+	*offset = byte % state->block_size;
+
+	return 0;
+}
+
+int Arc_Ext2ReadInode(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode) {
+	uint64_t block = 0;
+	uint32_t offset = 0;
+
+	if (ext2_inode_location(state, ino, &block, &offset) != 0) {
+		return EINVAL;
+	}
+
+	struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, block, 1);
+
+	if (buffer == NULL) {
+		return EIO;
+	}
+
+	memcpy(inode, buffer->data + offset, sizeof(struct ARC_Ext2Inode));
+	Arc_Ext2PutBuffer(state, buffer, 0);
+
+	return 0;
+}
+
+int Arc_Ext2WriteInode(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode) {
+	uint64_t block = 0;
+	uint32_t offset = 0;
+
+	if (ext2_inode_location(state, ino, &block, &offset) != 0) {
+		return EINVAL;
+	}
+
+	struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, block, 1);
+
+	if (buffer == NULL) {
+		return EIO;
+	}
+
+	// Only the revision 0 portion is known, leave the
+	// rest of larger inodes be
+	memcpy(buffer->data + offset, inode, sizeof(struct ARC_Ext2Inode));
+	Arc_Ext2PutBuffer(state, buffer, 1);
+
+	return 0;
+}
+
+void Arc_Ext2InodeStat(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode, struct stat *stat) {
+	memset(stat, 0, sizeof(struct stat));
+
+	stat->st_ino = ino;
+	stat->st_mode = inode->mode;
+	stat->st_uid = inode->uid;
+	stat->st_gid = inode->gid;
+	stat->st_nlink = inode->links_count;
+	stat->st_size = inode->size;
+	stat->st_blksize = state->block_size;
+	stat->st_blocks = inode->blocks;
+	stat->st_atim.tv_sec = inode->atime;
+	stat->st_mtim.tv_sec = inode->mtime;
+	stat->st_ctim.tv_sec = inode->ctime;
+
+	if (S_ISREG(inode->mode)) {
+		stat->st_size |= (off_t)inode->size_high << 32;
+	}
+}
+
+/*
+ * Allocation
+ * */
+
+/**
+ * Find and set the first clear bit at or after start, wrapping around.
+ *
+ * @return The bit, -1 if all are set.
+ * */
+static int64_t ext2_bitmap_take(uint8_t *bitmap, uint32_t bits, uint32_t start) {
+	for (uint32_t i = 0; i < bits; i++) {
+		uint32_t bit = (start + i) % bits;
+
+		if (bitmap[bit / 8] == 0xFF) {
+			// Skip to the next byte
+			i += 7 - (bit % 8);
+			continue;
+		}
+
+		if ((bitmap[bit / 8] & (1 << (bit % 8))) == 0) {
+			bitmap[bit / 8] |= 1 << (bit % 8);
+			return bit;
+		}
+	}
+
+	return -1;
+}
+
+uint32_t Arc_Ext2AllocBlock(struct ARC_Ext2State *state, uint32_t ino, uint32_t goal) {
+	struct ARC_Ext2Super *super = state->super;
+
+	if (state->read_only || super->free_blocks_count == 0) {
+		return 0;
+	}
+
+	uint32_t goal_group = (ino - 1) / super->inodes_per_group;
+	uint32_t goal_bit = 0;
+
+	if (goal >= super->first_data_block && goal < super->blocks_count) {
+		goal_group = (goal - super->first_data_block) / super->blocks_per_group;
+		goal_bit = (goal - super->first_data_block) % super->blocks_per_group;
+	}
+
+	for (uint32_t i = 0; i < state->group_count; i++) {
+		uint32_t group = (goal_group + i) % state->group_count;
+		struct ARC_Ext2Buffer *gdt = NULL;
+		struct ARC_Ext2GroupDesc *desc = ext2_group(state, group, &gdt);
+
+		if (desc->free_blocks_count == 0) {
+			continue;
+		}
+
+		uint32_t bits = min(super->blocks_per_group, super->blocks_count - super->first_data_block - group * super->blocks_per_group);
+		struct ARC_Ext2Buffer *bitmap = Arc_Ext2GetBuffer(state, desc->block_bitmap, 1);
+
+		if (bitmap == NULL) {
+			return 0;
+		}
+
+		int64_t bit = ext2_bitmap_take(bitmap->data, bits, group == goal_group ? goal_bit : 0);
+
+		if (bit < 0) {
+			Arc_Ext2PutBuffer(state, bitmap, 0);
+			continue;
+		}
+
+		uint32_t block = super->first_data_block + group * super->blocks_per_group + bit;
+
+		// Zero the block in the cache so that partially
+		// written blocks do not expose stale data
+		struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, block, 0);
+
+		if (buffer == NULL) {
+			// It cannot be handed out holding whatever was on disk,
+			// put the bit back
+			bitmap->data[bit / 8] &= ~(1 << (bit % 8));
+			Arc_Ext2PutBuffer(state, bitmap, 0);
+			ARC_DEBUG(ERR, "Failed to get a buffer to zero block %u\n", block);
+
+			return 0;
+		}
+
+		memset(buffer->data, 0, state->block_size);
+		Arc_Ext2PutBuffer(state, buffer, 1);
+		Arc_Ext2PutBuffer(state, bitmap, 1);
+
+		desc->free_blocks_count--;
+		gdt->dirty = 1;
+		super->free_blocks_count--;
+		state->super_buffer->dirty = 1;
+
+		return block;
+	}
+
+	return 0;
+}
+
+void Arc_Ext2FreeBlock(struct ARC_Ext2State *state, uint32_t block) {
+	struct ARC_Ext2Super *super = state->super;
+
+	if (block < super->first_data_block || block >= super->blocks_count) {
+		return;
+	}
+
+	uint32_t group = (block - super->first_data_block) / super->blocks_per_group;
+	uint32_t bit = (block - super->first_data_block) % super->blocks_per_group;
+	struct ARC_Ext2Buffer *gdt = NULL;
+	struct ARC_Ext2GroupDesc *desc = ext2_group(state, group, &gdt);
+	struct ARC_Ext2Buffer *bitmap = Arc_Ext2GetBuffer(state, desc->block_bitmap, 1);
+
+	if (bitmap == NULL) {
+		return;
+	}
+
+	if ((bitmap->data[bit / 8] & (1 << (bit % 8))) == 0) {
+		ARC_DEBUG(WARN, "Freeing free block %u\n", block);
+		Arc_Ext2PutBuffer(state, bitmap, 0);
+		return;
+	}
+
+	bitmap->data[bit / 8] &= ~(1 << (bit % 8));
+	Arc_Ext2PutBuffer(state, bitmap, 1);
+
+	desc->free_blocks_count++;
+	gdt->dirty = 1;
+	super->free_blocks_count++;
+	state->super_buffer->dirty = 1;
+}
+
+/**
+ * There is no wall clock yet, the last write time of the superblock is
+ * the closest thing to "now". Never go below s_inodes_count, as fsck
+ * reads such a dtime as an orphan list link.
+ * */
+static uint32_t ext2_now(struct ARC_Ext2State *state) {
+	uint32_t now = state->super->wtime;
+
+	return now > state->super->inodes_count ? now : state->super->inodes_count;
+}
+
+/**
+ * Allocate an inode.
+ *
+ * Directories are spread to the group with the most free inodes,
+ * everything else is kept in the group of its parent.
+ * */
+static uint32_t ext2_alloc_inode(struct ARC_Ext2State *state, uint32_t parent, int dir) {
+	struct ARC_Ext2Super *super = state->super;
+
+	if (state->read_only || super->free_inodes_count == 0) {
+		return 0;
+	}
+
+	uint32_t start = (parent - 1) / super->inodes_per_group;
+
+	if (dir) {
+		uint32_t best = 0;
+
+		for (uint32_t group = 0; group < state->group_count; group++) {
+			struct ARC_Ext2Buffer *gdt = NULL;
+			struct ARC_Ext2GroupDesc *desc = ext2_group(state, group, &gdt);
+
+			if (desc->free_inodes_count > best) {
+				best = desc->free_inodes_count;
+				start = group;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < state->group_count; i++) {
+		uint32_t group = (start + i) % state->group_count;
+		struct ARC_Ext2Buffer *gdt = NULL;
+		struct ARC_Ext2GroupDesc *desc = ext2_group(state, group, &gdt);
+
+		if (desc->free_inodes_count == 0) {
+			continue;
+		}
+
+		struct ARC_Ext2Buffer *bitmap = Arc_Ext2GetBuffer(state, desc->inode_bitmap, 1);
+
+		if (bitmap == NULL) {
+			return 0;
+		}
+
+		// Skip the reserved inodes of the first group
+		uint32_t first = group == 0 ? state->first_ino - 1 : 0;
+		int64_t bit = ext2_bitmap_take(bitmap->data, super->inodes_per_group, first);
+
+		if (bit < 0 || (uint32_t)bit < first) {
+			if (bit >= 0) {
+				bitmap->data[bit / 8] &= ~(1 << (bit % 8));
+			}
+
+			Arc_Ext2PutBuffer(state, bitmap, 0);
+			continue;
+		}
+
+		Arc_Ext2PutBuffer(state, bitmap, 1);
+
+		desc->free_inodes_count--;
+
+		if (dir) {
+			desc->used_dirs_count++;
+		}
+
+		gdt->dirty = 1;
+		super->free_inodes_count--;
+		state->super_buffer->dirty = 1;
+
+		return group * super->inodes_per_group + bit + 1;
+	}
+
+	return 0;
+}
+
+static void ext2_free_inode(struct ARC_Ext2State *state, uint32_t ino, int dir) {
+	struct ARC_Ext2Super *super = state->super;
+	uint32_t group = (ino - 1) / super->inodes_per_group;
+	uint32_t bit = (ino - 1) % super->inodes_per_group;
+	struct ARC_Ext2Buffer *gdt = NULL;
+	struct ARC_Ext2GroupDesc *desc = ext2_group(state, group, &gdt);
+	struct ARC_Ext2Buffer *bitmap = Arc_Ext2GetBuffer(state, desc->inode_bitmap, 1);
+
+	if (bitmap == NULL) {
+		return;
+	}
+
+	bitmap->data[bit / 8] &= ~(1 << (bit % 8));
+	Arc_Ext2PutBuffer(state, bitmap, 1);
+
+	desc->free_inodes_count++;
+
+	if (dir) {
+		desc->used_dirs_count--;
+	}
+
+	gdt->dirty = 1;
+	super->free_inodes_count++;
+	state->super_buffer->dirty = 1;
+}
+
+/*
+ * Block mapping
+ * */
+
+static uint32_t ext2_alloc_into(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode, uint32_t goal, struct ARC_Ext2MapCache *cache) {
+	if (goal == 0 && cache != NULL && cache->last_alloc != 0) {
+		goal = cache->last_alloc + 1;
+	}
+
+	uint32_t block = Arc_Ext2AllocBlock(state, ino, goal);
+
+	if (block != 0) {
+		inode->blocks += state->block_size / 512;
+
+		if (cache != NULL) {
+			cache->last_alloc = block;
+		}
+	}
+
+	return block;
+}
+
+uint32_t Arc_Ext2MapBlock(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode, uint64_t index, int create, struct ARC_Ext2MapCache *cache) {
+	uint64_t ptrs = EXT2_PTRS(state);
+
+	if (index < ARC_EXT2_NDIR_BLOCKS) {
+		if (inode->block[index] == 0 && create) {
+			uint32_t goal = index > 0 && inode->block[index - 1] != 0 ? inode->block[index - 1] + 1 : 0;
+			inode->block[index] = ext2_alloc_into(state, ino, inode, goal, cache);
+		}
+
+		return inode->block[index];
+	}
+
+	uint32_t leaf = 0;
+	uint64_t slot = 0;
+
+	if (cache != NULL && cache->leaf != 0 && index >= cache->first && index < cache->first + ptrs) {
+		// The table mapping this block is known
+		leaf = cache->leaf;
+		slot = index - cache->first;
+	} else {
+		uint64_t rel = index - ARC_EXT2_NDIR_BLOCKS;
+		int levels = 1;
+		int root = ARC_EXT2_IND_BLOCK;
+
+		if (rel >= ptrs) {
+			rel -= ptrs;
+			levels = 2;
+			root = ARC_EXT2_DIND_BLOCK;
+
+			if (rel >= ptrs * ptrs) {
+				rel -= ptrs * ptrs;
+				levels = 3;
+				root = ARC_EXT2_TIND_BLOCK;
+
+				if (rel >= ptrs * ptrs * ptrs) {
+					return 0;
+				}
+			}
+		}
+
+		if (inode->block[root] == 0) {
+			if (!create) {
+				return 0;
+			}
+
+			inode->block[root] = ext2_alloc_into(state, ino, inode, 0, cache);
+
+			if (inode->block[root] == 0) {
+				return 0;
+			}
+		}
+
+		uint32_t table = inode->block[root];
+
+		// Walk down to the last level table
+		for (int level = levels - 1; level > 0; level--) {
+			uint64_t span = 1;
+			for (int i = 0; i < level; i++) {
+				span *= ptrs;
+			}
+
+			struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, table, 1);
+
+			if (buffer == NULL) {
+				return 0;
+			}
+
+			uint32_t *entries = (uint32_t *)buffer->data;
+			uint64_t entry = (rel / span) % ptrs;
+			int dirty = 0;
+
+			if (entries[entry] == 0 && create) {
+				entries[entry] = ext2_alloc_into(state, ino, inode, table + 1, cache);
+				dirty = 1;
+			}
+
+			table = entries[entry];
+			Arc_Ext2PutBuffer(state, buffer, dirty);
+
+			if (table == 0) {
+				return 0;
+			}
+		}
+
+		leaf = table;
+		slot = rel % ptrs;
+
+		if (cache != NULL) {
+			cache->leaf = leaf;
+			cache->first = index - slot;
+		}
+	}
+
+	struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, leaf, 1);
+
+	if (buffer == NULL) {
+		return 0;
+	}
+
+	uint32_t *entries = (uint32_t *)buffer->data;
+	int dirty = 0;
+
+	if (entries[slot] == 0 && create) {
+		uint32_t goal = slot > 0 && entries[slot - 1] != 0 ? entries[slot - 1] + 1 : leaf + 1;
+		entries[slot] = ext2_alloc_into(state, ino, inode, goal, cache);
+		dirty = 1;
+	}
+
+	uint32_t block = entries[slot];
+	Arc_Ext2PutBuffer(state, buffer, dirty);
+
+	return block;
+}
+
+/**
+ * Free the blocks under *slot which map logical blocks at or after keep.
+ *
+ * @param uint32_t *slot - Pointer to the block, cleared if it is freed.
+ * @param int level - 0 for a data block, otherwise the depth of the table.
+ * @param uint64_t first - The first logical block mapped under *slot.
+ * @return Non-zero if *slot was modified.
+ * */
+static int ext2_trim(struct ARC_Ext2State *state, struct ARC_Ext2Inode *inode, uint32_t *slot, int level, uint64_t first, uint64_t keep) {
+	if (*slot == 0) {
+		return 0;
+	}
+
+	uint64_t ptrs = EXT2_PTRS(state);
+
+	if (level > 0) {
+		uint64_t span = 1;
+		for (int i = 1; i < level; i++) {
+			span *= ptrs;
+		}
+
+		struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, *slot, 1);
+
+		if (buffer == NULL) {
+			return 0;
+		}
+
+		uint32_t *entries = (uint32_t *)buffer->data;
+		int dirty = 0;
+
+		for (uint64_t i = 0; i < ptrs; i++) {
+			if (first + (i + 1) * span <= keep) {
+				continue;
+			}
+
+			dirty |= ext2_trim(state, inode, &entries[i], level - 1, first + i * span, keep);
+		}
+
+		Arc_Ext2PutBuffer(state, buffer, dirty);
+	}
+
+	if (first < keep) {
+		// Still maps kept blocks
+		return 0;
+	}
+
+	Arc_Ext2FreeBlock(state, *slot);
+	inode->blocks -= state->block_size / 512;
+	*slot = 0;
+
+	return 1;
+}
+
+void Arc_Ext2Trim(struct ARC_Ext2State *state, struct ARC_Ext2Inode *inode, uint64_t keep) {
+	uint64_t ptrs = EXT2_PTRS(state);
+
+	for (uint64_t i = 0; i < ARC_EXT2_NDIR_BLOCKS; i++) {
+		ext2_trim(state, inode, &inode->block[i], 0, i, keep);
+	}
+
+	uint64_t first = ARC_EXT2_NDIR_BLOCKS;
+	ext2_trim(state, inode, &inode->block[ARC_EXT2_IND_BLOCK], 1, first, keep);
+	first += ptrs;
+	ext2_trim(state, inode, &inode->block[ARC_EXT2_DIND_BLOCK], 2, first, keep);
+	first += ptrs * ptrs;
+	ext2_trim(state, inode, &inode->block[ARC_EXT2_TIND_BLOCK], 3, first, keep);
+}
+
+/*
+ * Directories
+ * */
+
+/**
+ * Call back for each entry of a directory until it returns non-zero.
+ *
+ * @return The value returned by the call back, 0 if it never returned non-zero.
+ * */
+static int ext2_dir_iterate(struct ARC_Ext2State *state, uint32_t dir, int (*callback)(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg), void *arg) {
+	struct ARC_Ext2Inode inode;
+
+	if (Arc_Ext2ReadInode(state, dir, &inode) != 0 || !S_ISDIR(inode.mode)) {
+		return -1;
+	}
+
+	struct ARC_Ext2MapCache cache = { 0 };
+	uint64_t blocks = inode.size / state->block_size;
+
+	for (uint64_t i = 0; i < blocks; i++) {
+		uint32_t block = Arc_Ext2MapBlock(state, dir, &inode, i, 0, &cache);
+
+		if (block == 0) {
+			continue;
+		}
+
+		struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, block, 1);
+
+		if (buffer == NULL) {
+			return -1;
+		}
+
+		struct ARC_Ext2DirEntry *prev = NULL;
+		uint32_t offset = 0;
+
+		while (offset + sizeof(struct ARC_Ext2DirEntry) <= state->block_size) {
+			struct ARC_Ext2DirEntry *entry = (struct ARC_Ext2DirEntry *)(buffer->data + offset);
+
+			if (entry->rec_len < sizeof(struct ARC_Ext2DirEntry) || offset + entry->rec_len > state->block_size) {
+				ARC_DEBUG(ERR, "Corrupt directory entry in block %u\n", block);
+				break;
+			}
+
+			int ret = callback(entry, prev, buffer, arg);
+
+			if (ret != 0) {
+				Arc_Ext2PutBuffer(state, buffer, 0);
+				return ret;
+			}
+
+			prev = entry;
+			offset += entry->rec_len;
+		}
+
+		Arc_Ext2PutBuffer(state, buffer, 0);
+	}
+
+	return 0;
+}
+
+struct ext2_find_arg {
+	char *name;
+	size_t length;
+	uint32_t ino;
+	/// Set to remove the entry once it is found.
+	int remove;
+};
+
+static int ext2_find_callback(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg) {
+	struct ext2_find_arg *find = (struct ext2_find_arg *)arg;
+
+	if (entry->inode == 0 || entry->name_len != find->length || strncmp(entry->name, find->name, find->length) != 0) {
+		return 0;
+	}
+
+	find->ino = entry->inode;
+
+	if (find->remove) {
+		if (prev != NULL) {
+			prev->rec_len += entry->rec_len;
+		} else {
+			entry->inode = 0;
+		}
+
+		buffer->dirty = 1;
+	}
+
+	return 1;
+}
+
+static uint32_t ext2_dir_find(struct ARC_Ext2State *state, uint32_t dir, char *name, size_t length, int remove) {
+	struct ext2_find_arg find = { .name = name, .length = length, .ino = 0, .remove = remove };
+
+	if (ext2_dir_iterate(state, dir, ext2_find_callback, &find) <= 0) {
+		return 0;
+	}
+
+	return find.ino;
+}
+
+static uint8_t ext2_file_type(struct ARC_Ext2State *state, uint16_t mode) {
+	if ((state->super->feature_incompat & ARC_EXT2_INCOMPAT_FILETYPE) == 0) {
+		return ARC_EXT2_FT_UNKNOWN;
+	}
+
+	switch (mode & S_IFMT) {
+	case S_IFREG: return ARC_EXT2_FT_REG_FILE;
+	case S_IFDIR: return ARC_EXT2_FT_DIR;
+	case S_IFCHR: return ARC_EXT2_FT_CHRDEV;
+	case S_IFBLK: return ARC_EXT2_FT_BLKDEV;
+	case S_IFIFO: return ARC_EXT2_FT_FIFO;
+	case S_IFSOCK: return ARC_EXT2_FT_SOCK;
+	case S_IFLNK: return ARC_EXT2_FT_SYMLINK;
+	}
+
+	return ARC_EXT2_FT_UNKNOWN;
+}
+
+struct ext2_add_arg {
+	char *name;
+	size_t length;
+	uint32_t ino;
+	uint8_t file_type;
+};
+
+static void ext2_fill_entry(struct ARC_Ext2DirEntry *entry, struct ext2_add_arg *add) {
+	entry->inode = add->ino;
+	entry->name_len = add->length;
+	entry->file_type = add->file_type;
+	memcpy(entry->name, add->name, add->length);
+}
+
+static int ext2_add_callback(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg) {
+	(void)prev;
+
+	struct ext2_add_arg *add = (struct ext2_add_arg *)arg;
+	uint16_t needed = ALIGN(sizeof(struct ARC_Ext2DirEntry) + add->length, 4);
+
+	if (entry->inode == 0 && entry->rec_len >= needed) {
+		ext2_fill_entry(entry, add);
+		buffer->dirty = 1;
+
+		return 1;
+	}
+
+	uint16_t used = ALIGN(sizeof(struct ARC_Ext2DirEntry) + entry->name_len, 4);
+
+	if (entry->inode != 0 && entry->rec_len - used >= needed) {
+		// Split the slack off the end of this entry
+		struct ARC_Ext2DirEntry *new = (struct ARC_Ext2DirEntry *)((uint8_t *)entry + used);
+		new->rec_len = entry->rec_len - used;
+		entry->rec_len = used;
+		ext2_fill_entry(new, add);
+		buffer->dirty = 1;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int ext2_dir_add(struct ARC_Ext2State *state, uint32_t dir, char *name, size_t length, uint32_t ino, uint16_t mode) {
+	if (length == 0 || length > 255) {
+		return EINVAL;
+	}
+
+	struct ext2_add_arg add = { .name = name, .length = length, .ino = ino, .file_type = ext2_file_type(state, mode) };
+	int ret = ext2_dir_iterate(state, dir, ext2_add_callback, &add);
+
+	if (ret < 0) {
+		return EIO;
+	}
+
+	struct ARC_Ext2Inode inode;
+	Arc_Ext2ReadInode(state, dir, &inode);
+
+	if (inode.flags & ARC_EXT2_INDEX_FL) {
+		// The hash index no longer covers every entry, fall
+		// back to a linear directory
+		inode.flags &= ~ARC_EXT2_INDEX_FL;
+	}
+
+	if (ret == 0) {
+		// No room, append a block
+		uint32_t block = Arc_Ext2MapBlock(state, dir, &inode, inode.size / state->block_size, 1, NULL);
+
+		if (block == 0) {
+			return ENOSPC;
+		}
+
+		struct ARC_Ext2Buffer *buffer = Arc_Ext2GetBuffer(state, block, 1);
+
+		if (buffer == NULL) {
+			return EIO;
+		}
+
+		struct ARC_Ext2DirEntry *entry = (struct ARC_Ext2DirEntry *)buffer->data;
+		entry->rec_len = state->block_size;
+		ext2_fill_entry(entry, &add);
+		Arc_Ext2PutBuffer(state, buffer, 1);
+
+		inode.size += state->block_size;
+	}
+
+	return Arc_Ext2WriteInode(state, dir, &inode);
+}
+
+/**
+ * Split path into the inode of its parent and its last component.
+ * */
+static uint32_t ext2_parent(struct ARC_Ext2State *state, char *path, char **name, size_t *length) {
+	size_t end = strlen(path);
+
+	while (end > 0 && path[end - 1] == '/') {
+		end--;
+	}
+
+	size_t start = end;
+
+	while (start > 0 && path[start - 1] != '/') {
+		start--;
+	}
+
+	*name = path + start;
+	*length = end - start;
+
+	if (start == 0) {
+		return ARC_EXT2_ROOT_INO;
+	}
+
+	char *parent = strndup(path, start);
+	uint32_t ino = Arc_Ext2Lookup(state, parent);
+	Arc_SlabFree(parent);
+
+	return ino;
+}
+
+uint32_t Arc_Ext2Lookup(struct ARC_Ext2State *state, char *path) {
+	uint32_t ino = ARC_EXT2_ROOT_INO;
+	size_t i = 0;
+
+	while (path[i] != 0 && ino != 0) {
+		while (path[i] == '/') {
+			i++;
+		}
+
+		size_t start = i;
+
+		while (path[i] != 0 && path[i] != '/') {
+			i++;
+		}
+
+		if (i == start) {
+			break;
+		}
+
+		ino = ext2_dir_find(state, ino, path + start, i - start, 0);
+	}
+
+	return ino;
+}
+
+/*
+ * Super driver
+ * */
+
+static int ext2_mode_from_type(int type) {
+	switch (type) {
+	case ARC_VFS_N_DIR: return S_IFDIR;
+	case ARC_VFS_N_FIFO: return S_IFIFO;
+	case ARC_VFS_N_LINK: return S_IFLNK;
+	}
+
+	return S_IFREG;
+}
+
+static int ext2_create(struct ARC_Resource *res, char *path, uint32_t mode, int type) {
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	char *name = NULL;
+	size_t length = 0;
+	int ret = 0;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t parent = ext2_parent(state, path, &name, &length);
+
+	if (parent == 0 || ext2_dir_find(state, parent, name, length, 0) != 0) {
+		ret = parent == 0 ? ENOENT : EEXIST;
+		goto done;
+	}
+
+	int dir = type == ARC_VFS_N_DIR;
+	uint32_t ino = ext2_alloc_inode(state, parent, dir);
+
+	if (ino == 0) {
+		ret = ENOSPC;
+		goto done;
+	}
+
+	struct ARC_Ext2Inode inode;
+	memset(&inode, 0, sizeof(struct ARC_Ext2Inode));
+	inode.mode = ext2_mode_from_type(type) | (mode & 07777);
+	inode.links_count = dir ? 2 : 1;
+	inode.atime = inode.ctime = inode.mtime = ext2_now(state);
+
+	if (dir) {
+		// Make the . and .. entries
+		uint32_t block = Arc_Ext2MapBlock(state, ino, &inode, 0, 1, NULL);
+		struct ARC_Ext2Buffer *buffer = block == 0 ? NULL : Arc_Ext2GetBuffer(state, block, 1);
+
+		if (buffer == NULL) {
+			ext2_free_inode(state, ino, dir);
+			ret = ENOSPC;
+			goto done;
+		}
+
+		struct ARC_Ext2DirEntry *dot = (struct ARC_Ext2DirEntry *)buffer->data;
+		dot->inode = ino;
+		dot->rec_len = 12;
+		dot->name_len = 1;
+		dot->file_type = ext2_file_type(state, S_IFDIR);
+		dot->name[0] = '.';
+
+		struct ARC_Ext2DirEntry *dotdot = (struct ARC_Ext2DirEntry *)(buffer->data + 12);
+		dotdot->inode = parent;
+		dotdot->rec_len = state->block_size - 12;
+		dotdot->name_len = 2;
+		dotdot->file_type = dot->file_type;
+		dotdot->name[0] = '.';
+		dotdot->name[1] = '.';
+
+		Arc_Ext2PutBuffer(state, buffer, 1);
+
+		inode.size = state->block_size;
+	}
+
+	Arc_Ext2WriteInode(state, ino, &inode);
+
+	ret = ext2_dir_add(state, parent, name, length, ino, inode.mode);
+
+	if (ret == 0 && dir) {
+		struct ARC_Ext2Inode parent_inode;
+		Arc_Ext2ReadInode(state, parent, &parent_inode);
+		parent_inode.links_count++;
+		Arc_Ext2WriteInode(state, parent, &parent_inode);
+	}
+
+	done:;
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+static int ext2_is_dot(struct ARC_Ext2DirEntry *entry) {
+	return (entry->name_len == 1 && entry->name[0] == '.') || (entry->name_len == 2 && entry->name[0] == '.' && entry->name[1] == '.');
+}
+
+struct ext2_empty_arg {
+	int entries;
+};
+
+static int ext2_empty_callback(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg) {
+	(void)prev;
+	(void)buffer;
+
+	if (entry->inode == 0 || ext2_is_dot(entry)) {
+		return 0;
+	}
+
+	((struct ext2_empty_arg *)arg)->entries++;
+
+	return 1;
+}
+
+/**
+ * Drop a link to ino, freeing it once nothing refers to it.
+ * */
+static void ext2_unlink_inode(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode) {
+	int dir = S_ISDIR(inode->mode);
+
+	// Directories are referred to by their own "."
+	inode->links_count = dir ? 0 : inode->links_count - 1;
+
+	if (inode->links_count == 0) {
+		Arc_Ext2Trim(state, inode, 0);
+		inode->size = 0;
+		inode->size_high = 0;
+		inode->dtime = ext2_now(state);
+		ext2_free_inode(state, ino, dir);
+	}
+
+	Arc_Ext2WriteInode(state, ino, inode);
+}
+
+static int ext2_remove(struct ARC_Resource *res, char *path) {
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	char *name = NULL;
+	size_t length = 0;
+	int ret = 0;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t parent = ext2_parent(state, path, &name, &length);
+	uint32_t ino = parent == 0 ? 0 : ext2_dir_find(state, parent, name, length, 0);
+
+	if (ino == 0 || state->read_only) {
+		ret = ino == 0 ? ENOENT : EROFS;
+		goto done;
+	}
+
+	struct ARC_Ext2Inode inode;
+	Arc_Ext2ReadInode(state, ino, &inode);
+
+	if (S_ISDIR(inode.mode)) {
+		struct ext2_empty_arg empty = { 0 };
+		ext2_dir_iterate(state, ino, ext2_empty_callback, &empty);
+
+		if (empty.entries != 0) {
+			ret = ENOTEMPTY;
+			goto done;
+		}
+
+		struct ARC_Ext2Inode parent_inode;
+		Arc_Ext2ReadInode(state, parent, &parent_inode);
+		parent_inode.links_count--;
+		Arc_Ext2WriteInode(state, parent, &parent_inode);
+	}
+
+	ext2_dir_find(state, parent, name, length, 1);
+	ext2_unlink_inode(state, ino, &inode);
+
+	done:;
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+static int ext2_link(struct ARC_Resource *res, char *a, char *b) {
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	char *name = NULL;
+	size_t length = 0;
+	int ret = 0;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t ino = Arc_Ext2Lookup(state, a);
+	uint32_t parent = ext2_parent(state, b, &name, &length);
+
+	if (ino == 0 || parent == 0) {
+		ret = ENOENT;
+		goto done;
+	}
+
+	struct ARC_Ext2Inode inode;
+	Arc_Ext2ReadInode(state, ino, &inode);
+
+	if (S_ISDIR(inode.mode)) {
+		// No hard links to directories
+		ret = EPERM;
+		goto done;
+	}
+
+	if (ext2_dir_find(state, parent, name, length, 0) != 0) {
+		ret = EEXIST;
+		goto done;
+	}
+
+	ret = ext2_dir_add(state, parent, name, length, ino, inode.mode);
+
+	if (ret == 0) {
+		inode.links_count++;
+		Arc_Ext2WriteInode(state, ino, &inode);
+	}
+
+	done:;
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+struct ext2_reparent_arg {
+	uint32_t parent;
+};
+
+static int ext2_reparent_callback(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg) {
+	(void)prev;
+
+	if (entry->name_len == 2 && ext2_is_dot(entry)) {
+		entry->inode = ((struct ext2_reparent_arg *)arg)->parent;
+		buffer->dirty = 1;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int ext2_rename(struct ARC_Resource *res, char *a, char *b) {
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	char *name_a = NULL;
+	char *name_b = NULL;
+	size_t length_a = 0;
+	size_t length_b = 0;
+	int ret = 0;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t parent_a = ext2_parent(state, a, &name_a, &length_a);
+	uint32_t parent_b = ext2_parent(state, b, &name_b, &length_b);
+	uint32_t ino = parent_a == 0 ? 0 : ext2_dir_find(state, parent_a, name_a, length_a, 0);
+
+	if (ino == 0 || parent_b == 0) {
+		ret = ENOENT;
+		goto done;
+	}
+
+	if (ext2_dir_find(state, parent_b, name_b, length_b, 0) != 0) {
+		ret = EEXIST;
+		goto done;
+	}
+
+	struct ARC_Ext2Inode inode;
+	Arc_Ext2ReadInode(state, ino, &inode);
+
+	ret = ext2_dir_add(state, parent_b, name_b, length_b, ino, inode.mode);
+
+	if (ret != 0) {
+		goto done;
+	}
+
+	ext2_dir_find(state, parent_a, name_a, length_a, 1);
+
+	if (S_ISDIR(inode.mode) && parent_a != parent_b) {
+		struct ext2_reparent_arg reparent = { .parent = parent_b };
+		ext2_dir_iterate(state, ino, ext2_reparent_callback, &reparent);
+
+		struct ARC_Ext2Inode parent_inode;
+		Arc_Ext2ReadInode(state, parent_a, &parent_inode);
+		parent_inode.links_count--;
+		Arc_Ext2WriteInode(state, parent_a, &parent_inode);
+
+		Arc_Ext2ReadInode(state, parent_b, &parent_inode);
+		parent_inode.links_count++;
+		Arc_Ext2WriteInode(state, parent_b, &parent_inode);
+	}
+
+	done:;
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+static int ext2_stat(struct ARC_Resource *res, char *filename, struct stat *stat) {
+	if (res == NULL || filename == NULL || stat == NULL) {
+		return 1;
+	}
+
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	struct ARC_Ext2Inode inode;
+	int ret = 1;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t ino = Arc_Ext2Lookup(state, filename);
+
+	if (ino != 0 && Arc_Ext2ReadInode(state, ino, &inode) == 0) {
+		Arc_Ext2InodeStat(state, ino, &inode, stat);
+		ret = 0;
+	}
+
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+struct ext2_readdir_arg {
+	uint64_t index;
+	uint32_t ino;
+	char *name;
+};
+
+static int ext2_readdir_callback(struct ARC_Ext2DirEntry *entry, struct ARC_Ext2DirEntry *prev, struct ARC_Ext2Buffer *buffer, void *arg) {
+	(void)prev;
+	(void)buffer;
+
+	struct ext2_readdir_arg *readdir = (struct ext2_readdir_arg *)arg;
+
+	if (entry->inode == 0 || ext2_is_dot(entry)) {
+		return 0;
+	}
+
+	if (readdir->index-- > 0) {
+		return 0;
+	}
+
+	readdir->ino = entry->inode;
+	memcpy(readdir->name, entry->name, entry->name_len);
+	readdir->name[entry->name_len] = 0;
+
+	return 1;
+}
+
+static int ext2_readdir(struct ARC_Resource *res, char *path, uint64_t index, char **name, struct stat *stat) {
+	if (res == NULL || path == NULL || name == NULL) {
+		return 1;
+	}
+
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+	struct ext2_readdir_arg readdir = { .index = index, .ino = 0, .name = state->readdir_name };
+	int ret = 1;
+
+	Arc_MutexLock(&state->lock);
+
+	uint32_t dir = Arc_Ext2Lookup(state, path);
+
+	if (dir != 0 && ext2_dir_iterate(state, dir, ext2_readdir_callback, &readdir) > 0) {
+		*name = state->readdir_name;
+
+		if (stat != NULL) {
+			struct ARC_Ext2Inode inode;
+			Arc_Ext2ReadInode(state, readdir.ino, &inode);
+			Arc_Ext2InodeStat(state, readdir.ino, &inode, stat);
+		}
+
+		ret = 0;
+	}
+
+	Arc_MutexUnlock(&state->lock);
+
+	return ret;
+}
+
+static void ext2_free_state(struct ARC_Ext2State *state) {
+	for (int i = 0; i < ARC_EXT2_CACHE_BUFFERS; i++) {
+		if (state->buffers[i].data != NULL) {
+			Arc_FreePMM(state->buffers[i].data);
+		}
+	}
+
+	if (state->gdt_buffers != NULL) {
+		Arc_SlabFree(state->gdt_buffers);
+	}
+
+	Arc_ContiguousFreePMM(state, EXT2_STATE_PAGES);
+}
+
+static int ext2_init(struct ARC_Resource *res, void *args) {
+	struct ARC_File *device = (struct ARC_File *)args;
+
+	if (device == NULL) {
+		return EINVAL;
+	}
+
+	struct ARC_Ext2Super *raw = (struct ARC_Ext2Super *)Arc_SlabAlloc(sizeof(struct ARC_Ext2Super));
+
+	if (raw == NULL) {
+		return ENOMEM;
+	}
+
+	if (Arc_PReadVFS(raw, 1, sizeof(struct ARC_Ext2Super), ARC_EXT2_SUPER_OFFSET, device) != sizeof(struct ARC_Ext2Super) || raw->magic != ARC_EXT2_MAGIC) {
+		ARC_DEBUG(ERR, "No EXT2 filesystem found\n");
+		Arc_SlabFree(raw);
+		return EINVAL;
+	}
+
+	uint32_t incompat = raw->rev_level == 0 ? 0 : raw->feature_incompat;
+	uint32_t ro_compat = raw->rev_level == 0 ? 0 : raw->feature_ro_compat;
+	uint32_t block_size = 1024 << raw->log_block_size;
+
+	if ((incompat & ~ARC_EXT2_INCOMPAT_FILETYPE) != 0 || block_size > 0x1000 || raw->blocks_per_group == 0 || raw->inodes_per_group == 0) {
+		ARC_DEBUG(ERR, "Unsupported EXT2 filesystem (incompat %x, block size %u)\n", incompat, block_size);
+		Arc_SlabFree(raw);
+		return EINVAL;
+	}
+
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)Arc_ContiguousAllocPMM(EXT2_STATE_PAGES);
+
+	if (state == NULL) {
+		Arc_SlabFree(raw);
+		return ENOMEM;
+	}
+
+	memset(state, 0, sizeof(struct ARC_Ext2State));
+
+	state->resource = res;
+	state->device = device;
+	state->block_size = block_size;
+	state->group_count = (raw->blocks_count - raw->first_data_block + raw->blocks_per_group - 1) / raw->blocks_per_group;
+	state->inode_size = raw->rev_level == 0 ? ARC_EXT2_GOOD_OLD_INODE_SIZE : raw->inode_size;
+	state->first_ino = raw->rev_level == 0 ? ARC_EXT2_GOOD_OLD_FIRST_INO : raw->first_ino;
+	state->read_only = (ro_compat & ~(ARC_EXT2_RO_COMPAT_SPARSE_SUPER | ARC_EXT2_RO_COMPAT_LARGE_FILE | ARC_EXT2_RO_COMPAT_BTREE_DIR)) != 0;
+	Arc_MutexStaticInit(&state->lock);
+
+	Arc_SlabFree(raw);
+
+	for (int i = 0; i < ARC_EXT2_CACHE_BUFFERS; i++) {
+		struct ARC_Ext2Buffer *buffer = &state->buffers[i];
+		buffer->block = (uint64_t)-1;
+		buffer->data = (uint8_t *)Arc_AllocPMM();
+
+		if (buffer->data == NULL) {
+			ext2_free_state(state);
+			return ENOMEM;
+		}
+
+		ext2_lru_push(state, buffer);
+	}
+
+	// Pin the superblock and group descriptors
+	state->super_buffer = Arc_Ext2GetBuffer(state, ARC_EXT2_SUPER_OFFSET / block_size, 1);
+
+	if (state->super_buffer == NULL) {
+		ext2_free_state(state);
+		return EIO;
+	}
+
+	state->super = (struct ARC_Ext2Super *)(state->super_buffer->data + ARC_EXT2_SUPER_OFFSET % block_size);
+	state->gdt_blocks = (state->group_count + EXT2_DESC_PER_BLOCK(state) - 1) / EXT2_DESC_PER_BLOCK(state);
+
+	if (state->gdt_blocks > ARC_EXT2_CACHE_BUFFERS / 4) {
+		ARC_DEBUG(ERR, "Too many groups (%u)\n", state->group_count);
+		ext2_free_state(state);
+		return EINVAL;
+	}
+
+	state->gdt_buffers = (struct ARC_Ext2Buffer **)Arc_SlabAlloc(state->gdt_blocks * sizeof(struct ARC_Ext2Buffer *));
+
+	if (state->gdt_buffers == NULL) {
+		ext2_free_state(state);
+		return ENOMEM;
+	}
+
+	for (uint32_t i = 0; i < state->gdt_blocks; i++) {
+		state->gdt_buffers[i] = Arc_Ext2GetBuffer(state, state->super->first_data_block + 1 + i, 1);
+
+		if (state->gdt_buffers[i] == NULL) {
+			ext2_free_state(state);
+			return EIO;
+		}
+	}
+
+	res->driver_state = state;
+
+	ARC_DEBUG(INFO, "Mounted EXT2 filesystem: %u blocks of %u bytes, %u groups%s\n", state->super->blocks_count, block_size, state->group_count, state->read_only ? ", read only" : "");
+
+	return 0;
+}
+
+static int ext2_uninit(struct ARC_Resource *res) {
+	struct ARC_Ext2State *state = (struct ARC_Ext2State *)res->driver_state;
+
+	Arc_MutexLock(&state->lock);
+	Arc_Ext2Sync(state);
+	Arc_MutexUnlock(&state->lock);
+
+	ext2_free_state(state);
+
+	return 0;
+}
+
+static int ext2_empty() {
+	return 0;
+}
+
+struct ARC_SuperDriverDef ext2_super_spec = {
+	.create = ext2_create,
+	.remove = ext2_remove,
+	.link = ext2_link,
+	.rename = ext2_rename,
+	.stat = ext2_stat,
+	.readdir = ext2_readdir,
+};
 
 ARC_REGISTER_DRIVER(0, ext2_super) = {
 	.index = 2,
+	.init = ext2_init,
+	.uninit = ext2_uninit,
+	.open = ext2_empty,
+	.close = ext2_empty,
+	.read = ext2_empty,
+	.write = ext2_empty,
+	.seek = ext2_empty,
+	.identifer = ARC_DRIVER_IDEN_SUPER,
+	.driver = (void *)&ext2_super_spec,
 };
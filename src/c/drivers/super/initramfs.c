@@ -29,77 +29,369 @@
 #include <lib/atomics.h>
 #include <lib/perms.h>
 #include <fs/vfs.h>
+#include <fs/initramfs.h>
+#include <lib/inflate.h>
+#include <arch/x86-64/ctrl_regs.h>
 #include <mm/slab.h>
+#include <mm/pmm.h>
 #include <global.h>
 #include <time.h>
 #include <util.h>
 #include <sys/stat.h>
 
-#define ARC_NAME_OFFSET (sizeof(struct ARC_HeaderCPIO))
-#define ARC_NAME_SIZE(header) (header->namesize + (header->namesize & 1))
-#define ARC_DATA_OFFSET(header) (ARC_NAME_OFFSET + ARC_NAME_SIZE(header))
-#define ARC_DATA_SIZE(header) (((header->filesize[0] << 16) | header->filesize[1]) + (((header->filesize[0] << 16) | header->filesize[1]) & 1))
-
-struct ARC_HeaderCPIO {
-	uint16_t magic;
-	uint16_t device;
-	uint16_t inode;
-	uint16_t mode;
-	uint16_t uid;
-	uint16_t gid;
-	uint16_t nlink;
-	uint16_t rdev;
-	uint16_t mod_time[2];
-	uint16_t namesize;
-	uint16_t filesize[2];
-}__attribute__((packed));
-
-struct internal_driver_state {
-	struct ARC_Resource *resource;
-	void *initramfs_base;
-};
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325
+#define FNV_PRIME        0x100000001B3
+
+static uint64_t initramfs_hash(char *name, size_t length) {
+	uint64_t hash = FNV_OFFSET_BASIS;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
 
-static void *initramfs_find_file(void *fs, char *filename) {
-	if (fs == NULL || filename == NULL) {
-		ARC_DEBUG(ERR, "Either fs %p or filename %p is NULL\n", fs, filename);
+/**
+ * Strip leading "/" and "./", and trailing "/" from a path.
+ *
+ * @param char *path - The path to normalize.
+ * @param size_t *length - Set to the length of the normalized path.
+ * @return A pointer to the start of the normalized path within /a path.
+ * */
+static char *initramfs_normalize(char *path, size_t *length) {
+	while (*path == '/' || (*path == '.' && *(path + 1) == '/')) {
+		path += *path == '/' ? 1 : 2;
+	}
+
+	size_t len = strlen(path);
+
+	while (len > 0 && path[len - 1] == '/') {
+		len--;
+	}
+
+	if (len == 1 && *path == '.') {
+		len = 0;
+	}
+
+	*length = len;
+
+	return path;
+}
+
+static struct ARC_InitramfsEntry *initramfs_lookup(struct ARC_InitramfsState *state, char *name, size_t length) {
+	if (length == 0) {
+		return &state->root;
+	}
+
+	if (state->table == NULL) {
 		return NULL;
 	}
 
-	struct ARC_HeaderCPIO *header = (struct ARC_HeaderCPIO *)fs;
-	uint64_t offset = 0;
+	struct ARC_InitramfsEntry *entry = state->table[initramfs_hash(name, length) & (state->table_size - 1)];
 
-	while (header->magic == 0070707) {
-		char *name = ((char *)header) + ARC_NAME_OFFSET;
+	while (entry != NULL) {
+		if (entry->name_length == length && strncmp(entry->name, name, length) == 0) {
+			return entry;
+		}
+
+		entry = entry->hash_next;
+	}
 
-		if (strcmp(name, filename) != 0) {
-			goto next;
+	return NULL;
+}
+
+struct ARC_InitramfsEntry *Arc_InitramfsFind(struct ARC_InitramfsState *state, char *path) {
+	if (state == NULL || path == NULL) {
+		ARC_DEBUG(ERR, "Either state %p or path %p is NULL\n", state, path);
+		return NULL;
+	}
+
+	size_t length = 0;
+	char *name = initramfs_normalize(path, &length);
+
+	return initramfs_lookup(state, name, length);
+}
+
+/**
+ * A single entry of the archive, independent of its format.
+ * */
+struct initramfs_record {
+	char *name;
+	void *data;
+	struct stat stat;
+	/// Sum of the bytes of the data (crc format only).
+	uint32_t check;
+	int has_check;
+};
+
+static uint32_t initramfs_hex(char *field, int *valid) {
+	uint32_t value = 0;
+
+	for (int i = 0; i < 8; i++) {
+		char c = field[i];
+		value <<= 4;
+
+		if (c >= '0' && c <= '9') {
+			value |= c - '0';
+		} else if (c >= 'A' && c <= 'F') {
+			value |= c - 'A' + 10;
+		} else if (c >= 'a' && c <= 'f') {
+			value |= c - 'a' + 10;
+		} else {
+			*valid = 0;
 		}
+	}
 
-		ARC_DEBUG(INFO, "Found file \"%s\"\n", name);
+	return value;
+}
 
-		return (void *)header;
+static int initramfs_parse_bin(struct ARC_HeaderCPIO *header, size_t remaining, struct initramfs_record *record, size_t *next) {
+	if (remaining < sizeof(struct ARC_HeaderCPIO) || ARC_DATA_OFFSET(header) + ARC_DATA_SIZE(header) > remaining) {
+		return -1;
+	}
 
-		next:;
-		offset += ARC_DATA_OFFSET(header) + ARC_DATA_SIZE(header);
-		header = (struct ARC_HeaderCPIO *)(fs + offset);
+	record->name = ((char *)header) + ARC_NAME_OFFSET;
+	record->data = (void *)header + ARC_DATA_OFFSET(header);
+
+	record->has_check = 0;
+
+	record->stat.st_uid = header->uid;
+	record->stat.st_gid = header->gid;
+	record->stat.st_mode = header->mode;
+	record->stat.st_dev = header->device;
+	record->stat.st_ino = header->inode;
+	record->stat.st_nlink = header->nlink;
+	record->stat.st_rdev = header->rdev;
+	record->stat.st_size = ARC_FILE_SIZE(header);
+	record->stat.st_mtim.tv_nsec = 0;
+	record->stat.st_mtim.tv_sec = (header->mod_time[0] << 16) | header->mod_time[1];
+
+	*next = ARC_DATA_OFFSET(header) + ARC_DATA_SIZE(header);
+
+	return 0;
+}
+
+static int initramfs_parse_newc(struct ARC_HeaderNewc *header, size_t remaining, struct initramfs_record *record, size_t *next) {
+	if (remaining < sizeof(struct ARC_HeaderNewc)) {
+		return -1;
 	}
 
-	ARC_DEBUG(ERR, "Could not find file \"%s\"\n", filename);
+	int valid = 1;
+	size_t namesize = initramfs_hex(header->namesize, &valid);
+	size_t filesize = initramfs_hex(header->filesize, &valid);
+	size_t data_offset = ALIGN(sizeof(struct ARC_HeaderNewc) + namesize, 4);
 
-	return NULL;
+	if (!valid || data_offset + ALIGN(filesize, 4) > remaining) {
+		return -1;
+	}
+
+	record->name = ((char *)header) + sizeof(struct ARC_HeaderNewc);
+	record->data = (void *)header + data_offset;
+
+	record->stat.st_uid = initramfs_hex(header->uid, &valid);
+	record->stat.st_gid = initramfs_hex(header->gid, &valid);
+	record->stat.st_mode = initramfs_hex(header->mode, &valid);
+	record->stat.st_dev = (initramfs_hex(header->dev_major, &valid) << 8) | initramfs_hex(header->dev_minor, &valid);
+	record->stat.st_ino = initramfs_hex(header->inode, &valid);
+	record->stat.st_nlink = initramfs_hex(header->nlink, &valid);
+	record->stat.st_rdev = (initramfs_hex(header->rdev_major, &valid) << 8) | initramfs_hex(header->rdev_minor, &valid);
+	record->stat.st_size = filesize;
+	record->stat.st_mtim.tv_nsec = 0;
+	record->stat.st_mtim.tv_sec = initramfs_hex(header->mod_time, &valid);
+
+	record->check = initramfs_hex(header->check, &valid);
+	record->has_check = strncmp(header->magic, ARC_CPIO_CRC_MAGIC, 6) == 0;
+
+	*next = data_offset + ALIGN(filesize, 4);
+
+	return valid ? 0 : -1;
+}
+
+/**
+ * Parse the entry at offset, skipping over trailers and
+ * the padding between concatenated archives.
+ *
+ * @param struct ARC_InitramfsState *state - The initramfs.
+ * @param size_t *offset - The offset of the entry, set to the offset of the next.
+ * @param struct initramfs_record *record - The parsed entry.
+ * @return 0 if an entry was parsed, 1 at the end of the archive.
+ * */
+static int initramfs_next(struct ARC_InitramfsState *state, size_t *offset, struct initramfs_record *record) {
+	uint8_t *base = (uint8_t *)state->initramfs_base;
+	size_t size = state->initramfs_size;
+
+	while (*offset < size) {
+		void *header = base + *offset;
+		size_t remaining = size - *offset;
+		size_t next = 0;
+		int ret = -1;
+
+		if (remaining >= 6 && (strncmp(header, ARC_CPIO_NEWC_MAGIC, 6) == 0 || strncmp(header, ARC_CPIO_CRC_MAGIC, 6) == 0)) {
+			ret = initramfs_parse_newc((struct ARC_HeaderNewc *)header, remaining, record, &next);
+		} else if (remaining >= 2 && ((struct ARC_HeaderCPIO *)header)->magic == ARC_CPIO_BIN_MAGIC) {
+			ret = initramfs_parse_bin((struct ARC_HeaderCPIO *)header, remaining, record, &next);
+		}
+
+		if (ret != 0) {
+			return 1;
+		}
+
+		*offset += next;
+
+		if (strcmp(record->name, "TRAILER!!!") != 0) {
+			return 0;
+		}
+
+		// Another archive may be concatenated after the trailer
+		while (*offset < size && base[*offset] == 0) {
+			(*offset)++;
+		}
+	}
+
+	return 1;
+}
+
+static void initramfs_insert(struct ARC_InitramfsState *state, struct ARC_InitramfsEntry *entry);
+
+/**
+ * Get the directory with the given name, creating it if the
+ * archive does not contain it.
+ * */
+static struct ARC_InitramfsEntry *initramfs_get_directory(struct ARC_InitramfsState *state, char *name, size_t length) {
+	struct ARC_InitramfsEntry *dir = initramfs_lookup(state, name, length);
+
+	if (dir != NULL) {
+		return dir;
+	}
+
+	dir = (struct ARC_InitramfsEntry *)Arc_SlabAlloc(sizeof(struct ARC_InitramfsEntry));
+
+	if (dir == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate directory\n");
+		return &state->root;
+	}
+
+	memset(dir, 0, sizeof(struct ARC_InitramfsEntry));
+
+	dir->name = strndup(name, length);
+	dir->name_length = length;
+	dir->stat.st_mode = S_IFDIR | 0555;
+	dir->stat.st_nlink = 2;
+
+	initramfs_insert(state, dir);
+
+	return dir;
 }
 
-static int initramfs_internal_stat(struct ARC_HeaderCPIO *header, struct stat *stat) {
-	stat->st_uid = header->uid;
-	stat->st_gid = header->gid;
-	stat->st_mode = header->mode;
-	stat->st_dev = header->device;
-	stat->st_ino = header->inode;
-	stat->st_nlink = header->nlink;
-	stat->st_rdev = header->rdev;
-	stat->st_size = ARC_DATA_SIZE(header);
-	stat->st_mtim.tv_nsec = 0;
-	stat->st_mtim.tv_sec = (header->mod_time[0] << 16) | header->mod_time[1];
+/**
+ * Insert an entry into the hash table and directory tree.
+ * */
+static void initramfs_insert(struct ARC_InitramfsState *state, struct ARC_InitramfsEntry *entry) {
+	struct ARC_InitramfsEntry **bucket = &state->table[initramfs_hash(entry->name, entry->name_length) & (state->table_size - 1)];
+	entry->hash_next = *bucket;
+	*bucket = entry;
+
+	size_t parent_length = entry->name_length;
+	while (parent_length > 0 && entry->name[parent_length - 1] != '/') {
+		parent_length--;
+	}
+
+	if (parent_length > 0) {
+		// Cull off the separator
+		parent_length--;
+	}
+
+	struct ARC_InitramfsEntry *parent = initramfs_get_directory(state, entry->name, parent_length);
+
+	entry->parent = parent;
+	entry->next = parent->children;
+	parent->children = entry;
+}
+
+static size_t initramfs_pages(size_t bytes) {
+	return ALIGN(bytes, 0x1000) >> 12;
+}
+
+/**
+ * Walk the archive once, building the hash table and directory tree.
+ * */
+static int initramfs_build_index(struct ARC_InitramfsState *state) {
+	struct initramfs_record record = { 0 };
+	size_t offset = 0;
+	size_t count = 0;
+
+	while (initramfs_next(state, &offset, &record) == 0) {
+		count++;
+	}
+
+	state->table_size = 16;
+	while (state->table_size < count * 2) {
+		state->table_size <<= 1;
+	}
+
+	state->table = (struct ARC_InitramfsEntry **)Arc_ContiguousAllocPMM(initramfs_pages(state->table_size * sizeof(struct ARC_InitramfsEntry *)));
+
+	if (state->table == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate hash table\n");
+		return ENOMEM;
+	}
+
+	memset(state->table, 0, state->table_size * sizeof(struct ARC_InitramfsEntry *));
+
+	if (count > 0) {
+		state->entries = (struct ARC_InitramfsEntry *)Arc_ContiguousAllocPMM(initramfs_pages(count * sizeof(struct ARC_InitramfsEntry)));
+
+		if (state->entries == NULL) {
+			ARC_DEBUG(ERR, "Failed to allocate entries\n");
+			return ENOMEM;
+		}
+
+		memset(state->entries, 0, count * sizeof(struct ARC_InitramfsEntry));
+		state->entry_capacity = count;
+	}
+
+	offset = 0;
+
+	for (size_t i = 0; i < count && initramfs_next(state, &offset, &record) == 0; i++) {
+		struct ARC_InitramfsEntry *entry = &state->entries[state->entry_count];
+		size_t length = 0;
+		char *name = initramfs_normalize(record.name, &length);
+		struct ARC_InitramfsEntry *existing = initramfs_lookup(state, name, length);
+
+		if (record.has_check) {
+			uint32_t sum = 0;
+
+			for (off_t j = 0; j < record.stat.st_size; j++) {
+				sum += ((uint8_t *)record.data)[j];
+			}
+
+			if (sum != record.check) {
+				ARC_DEBUG(WARN, "Checksum mismatch on %s\n", record.name);
+			}
+		}
+
+		if (existing != NULL) {
+			// Directory which was created before the archive listed
+			// it, the root, or a path listed again, the last record
+			// wins. Data and status go together, the size must
+			// describe the data
+			existing->data = record.data;
+			memcpy(&existing->stat, &record.stat, sizeof(struct stat));
+			continue;
+		}
+
+		entry->name = name;
+		entry->name_length = length;
+		entry->data = record.data;
+		memcpy(&entry->stat, &record.stat, sizeof(struct stat));
+
+		initramfs_insert(state, entry);
+		state->entry_count++;
+	}
+
+	ARC_DEBUG(INFO, "Indexed %lu initramfs entries into %lu buckets\n", state->entry_count, state->table_size);
 
 	return 0;
 }
@@ -108,18 +400,106 @@ static int initramfs_empty() {
 	return 0;
 }
 
+/**
+ * Decompress a gzip'd image into freshly allocated pages.
+ * */
+static int initramfs_unpack(struct ARC_InitramfsState *state, void *image, size_t image_size) {
+	size_t size = Arc_GzipSize(image, image_size);
+	size_t pages = initramfs_pages(size);
+
+	void *archive = Arc_ContiguousAllocPMM(pages);
+
+	if (archive == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate %lu bytes for the archive\n", size);
+		return ENOMEM;
+	}
+
+	size_t produced = 0;
+	uint64_t start = _x86_RDTSC();
+	int ret = Arc_Gunzip(archive, size, image, image_size, &produced);
+	uint64_t cycles = _x86_RDTSC() - start;
+
+	if (ret != ARC_INFLATE_OK) {
+		ARC_DEBUG(ERR, "Failed to decompress initramfs (%d)\n", ret);
+		Arc_ContiguousFreePMM(archive, pages);
+		return EINVAL;
+	}
+
+	ARC_DEBUG(INFO, "Decompressed initramfs %lu -> %lu bytes in %lu cycles (%lu bytes/kcycle)\n", image_size, produced, cycles, (produced * 1000) / (cycles + 1));
+
+	state->initramfs_base = archive;
+	state->initramfs_size = produced;
+	state->unpacked_pages = pages;
+
+	return 0;
+}
+
 static int initramfs_init(struct ARC_Resource *res, void *args) {
-	struct internal_driver_state *state = (struct internal_driver_state *)Arc_SlabAlloc(sizeof(struct internal_driver_state));
+	struct ARC_InitramfsArgs *image = (struct ARC_InitramfsArgs *)args;
 
-	state->initramfs_base = args;
+	if (image == NULL || image->base == NULL) {
+		return EINVAL;
+	}
+
+	struct ARC_InitramfsState *state = (struct ARC_InitramfsState *)Arc_SlabAlloc(sizeof(struct ARC_InitramfsState));
+
+	if (state == NULL) {
+		return ENOMEM;
+	}
+
+	memset(state, 0, sizeof(struct ARC_InitramfsState));
+
+	state->initramfs_base = image->base;
+	state->initramfs_size = image->size;
 	state->resource = res;
+	state->root.name = "";
+	state->root.stat.st_mode = S_IFDIR | 0555;
+	state->root.stat.st_nlink = 2;
 	res->driver_state = state;
 
-	return 0;
+	if (Arc_IsGzip(image->base, image->size)) {
+		int ret = initramfs_unpack(state, image->base, image->size);
+
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return initramfs_build_index(state);
 }
 
 static int initramfs_uninit(struct ARC_Resource *res) {
-	Arc_SlabFree(res->driver_state);
+	struct ARC_InitramfsState *state = (struct ARC_InitramfsState *)res->driver_state;
+
+	if (state->table != NULL) {
+		for (size_t i = 0; i < state->table_size; i++) {
+			struct ARC_InitramfsEntry *entry = state->table[i];
+
+			while (entry != NULL) {
+				struct ARC_InitramfsEntry *next = entry->hash_next;
+
+				if (entry < state->entries || entry >= state->entries + state->entry_count) {
+					// Synthesized directory
+					Arc_SlabFree(entry->name);
+					Arc_SlabFree(entry);
+				}
+
+				entry = next;
+			}
+		}
+
+		Arc_ContiguousFreePMM(state->table, initramfs_pages(state->table_size * sizeof(struct ARC_InitramfsEntry *)));
+	}
+
+	if (state->entries != NULL) {
+		Arc_ContiguousFreePMM(state->entries, initramfs_pages(state->entry_capacity * sizeof(struct ARC_InitramfsEntry)));
+	}
+
+	if (state->unpacked_pages != 0) {
+		Arc_ContiguousFreePMM(state->initramfs_base, state->unpacked_pages);
+	}
+
+	Arc_SlabFree(state);
 
 	return 0;
 }
@@ -129,23 +509,51 @@ static int initramfs_stat(struct ARC_Resource *res, char *filename, struct stat
 		return 1;
 	}
 
-	if (filename[strlen(filename) - 1] == '/') {
-		// The given path is a directory, we do not have
-		// distinct directories, and are unable to provide stats
-		// for them
-		ARC_DEBUG(WARN, "Tried to stat directory %s\n", filename);
-		return 0;
+	struct ARC_InitramfsEntry *entry = Arc_InitramfsFind((struct ARC_InitramfsState *)res->driver_state, filename);
+
+	if (entry == NULL) {
+		return 1;
+	}
+
+	memcpy(stat, &entry->stat, sizeof(struct stat));
+
+	return 0;
+}
+
+static int initramfs_readdir(struct ARC_Resource *res, char *path, uint64_t index, char **name, struct stat *stat) {
+	if (res == NULL || path == NULL || name == NULL) {
+		return 1;
+	}
+
+	struct ARC_InitramfsEntry *dir = Arc_InitramfsFind((struct ARC_InitramfsState *)res->driver_state, path);
+
+	if (dir == NULL || !S_ISDIR(dir->stat.st_mode)) {
+		return 1;
 	}
 
-	struct internal_driver_state *state = (struct internal_driver_state *)res->driver_state;
+	struct ARC_InitramfsEntry *entry = dir->children;
 
-	struct ARC_HeaderCPIO *header = initramfs_find_file(state->initramfs_base, filename);
+	for (uint64_t i = 0; i < index && entry != NULL; i++) {
+		entry = entry->next;
+	}
 
-	if (header == NULL) {
+	if (entry == NULL) {
 		return 1;
 	}
 
-	return initramfs_internal_stat(header, stat);
+	// Give only the last component
+	size_t base = entry->name_length;
+	while (base > 0 && entry->name[base - 1] != '/') {
+		base--;
+	}
+
+	*name = entry->name + base;
+
+	if (stat != NULL) {
+		memcpy(stat, &entry->stat, sizeof(struct stat));
+	}
+
+	return 0;
 }
 
 struct ARC_SuperDriverDef initramfs_super_spec = {
@@ -154,6 +562,7 @@ struct ARC_SuperDriverDef initramfs_super_spec = {
 	.link = initramfs_empty,
 	.rename = initramfs_empty,
 	.stat = initramfs_stat,
+	.readdir = initramfs_readdir,
 };
 
 ARC_REGISTER_DRIVER(0, initramfs_super) = {
@@ -168,4 +577,3 @@ ARC_REGISTER_DRIVER(0, initramfs_super) = {
 	.identifer = ARC_DRIVER_IDEN_SUPER,
 	.driver = (void *)&initramfs_super_spec,
 };
-
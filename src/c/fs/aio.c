@@ -0,0 +1,558 @@
+/**
+ * @file aio.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Asynchronous I/O submission and completion rings for the VFS.
+ *
+ * Sector aligned reads and writes of block devices are handed straight
+ * to the block layer as bios, which post their completion when the
+ * device finishes them, so no worker waits on the device. Everything
+ * else is executed by the worker threads, which sleep while there are
+ * no rings with pending work.
+*/
+#include <abi-bits/errno.h>
+#include <fs/aio.h>
+#include <fs/vfs.h>
+#include <fs/block.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mp/futex.h>
+#include <mp/thread.h>
+#include <global.h>
+#include <util.h>
+
+/// Largest number of entries a ring may have.
+#define AIO_MAX_ENTRIES 4096
+
+/// Rings which have submissions waiting for a worker.
+static struct ARC_AIORing *aio_pending = NULL;
+/// Kernel work waiting for a worker, under aio_pending_lock too.
+static struct ARC_AIOWork *aio_work = NULL;
+static struct ARC_AIOWork *aio_work_tail = NULL;
+static ARC_GenericMutex aio_pending_lock = 0;
+/// Number of workers currently running.
+static _Atomic int aio_workers = 0;
+/// Bumped whenever a ring is queued, idle workers sleep on it.
+static _Atomic uint32_t aio_work_event = 0;
+/// Number of workers asleep on aio_work_event.
+static _Atomic int aio_sleepers = 0;
+
+/**
+ * A submission handed to the block layer, completed from its end_io.
+ * */
+struct aio_bio {
+	struct ARC_Bio bio;
+	struct ARC_AIORing *ring;
+	uint64_t user_data;
+	int64_t size;
+};
+
+static size_t aio_pages(size_t bytes) {
+	return ALIGN(bytes, 0x1000) >> 12;
+}
+
+/**
+ * Get an idle worker going on newly queued work.
+ * */
+static void aio_kick() {
+	atomic_fetch_add_explicit(&aio_work_event, 1, memory_order_seq_cst);
+
+	if (atomic_load_explicit(&aio_sleepers, memory_order_seq_cst) != 0) {
+		Arc_FutexWake((uint32_t *)&aio_work_event, 1, ARC_FUTEX_BITSET_ANY);
+	}
+}
+
+/**
+ * Place the ring into the list of rings with pending work.
+ * */
+static void aio_queue_ring(struct ARC_AIORing *ring) {
+	if (atomic_exchange(&ring->queued, 1) != 0) {
+		// Already queued
+		return;
+	}
+
+	Arc_MutexLock(&aio_pending_lock);
+	ring->next = aio_pending;
+	aio_pending = ring;
+	Arc_MutexUnlock(&aio_pending_lock);
+
+	aio_kick();
+}
+
+/**
+ * Take a ring out of the list of rings with pending work.
+ * */
+static struct ARC_AIORing *aio_dequeue_ring() {
+	Arc_MutexLock(&aio_pending_lock);
+
+	struct ARC_AIORing *ring = aio_pending;
+
+	if (ring != NULL) {
+		aio_pending = ring->next;
+		ring->next = NULL;
+		atomic_store(&ring->queued, 0);
+	}
+
+	Arc_MutexUnlock(&aio_pending_lock);
+
+	return ring;
+}
+
+static int aio_has_work(struct ARC_AIORing *ring) {
+	return atomic_load_explicit(&ring->sq_head, memory_order_acquire) != atomic_load_explicit(&ring->sq_tail, memory_order_acquire);
+}
+
+int Arc_AIOCreateRing(uint32_t entries, struct ARC_AIORing **ring) {
+	if (ring == NULL || entries == 0 || entries > AIO_MAX_ENTRIES) {
+		return EINVAL;
+	}
+
+	uint32_t size = 1;
+	while (size < entries) {
+		size <<= 1;
+	}
+
+	struct ARC_AIORing *new = (struct ARC_AIORing *)Arc_SlabAlloc(sizeof(struct ARC_AIORing));
+
+	if (new == NULL) {
+		return ENOMEM;
+	}
+
+	memset(new, 0, sizeof(struct ARC_AIORing));
+
+	size_t sq_pages = aio_pages(size * sizeof(struct ARC_AIOSubmission));
+	size_t cq_pages = aio_pages(size * sizeof(struct ARC_AIOCompletion));
+
+	new->sq = (struct ARC_AIOSubmission *)Arc_ContiguousAllocPMM(sq_pages);
+	new->cq = (struct ARC_AIOCompletion *)Arc_ContiguousAllocPMM(cq_pages);
+
+	if (new->sq == NULL || new->cq == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate rings\n");
+
+		if (new->sq != NULL) {
+			Arc_ContiguousFreePMM(new->sq, sq_pages);
+		}
+
+		if (new->cq != NULL) {
+			Arc_ContiguousFreePMM(new->cq, cq_pages);
+		}
+
+		Arc_SlabFree(new);
+
+		return ENOMEM;
+	}
+
+	memset(new->sq, 0, sq_pages << 12);
+	memset(new->cq, 0, cq_pages << 12);
+
+	new->mask = size - 1;
+
+	*ring = new;
+
+	ARC_DEBUG(INFO, "Created AIO ring %p with %d entries\n", new, size);
+
+	return 0;
+}
+
+int Arc_AIODestroyRing(struct ARC_AIORing *ring) {
+	if (ring == NULL) {
+		return EINVAL;
+	}
+
+	if (atomic_load(&ring->queued) != 0 || atomic_load(&ring->cq_reserved) != 0) {
+		// Queued, being executed or with bios in flight
+		ARC_DEBUG(ERR, "Ring %p still has pending work\n", ring);
+		return EBUSY;
+	}
+
+	size_t size = ring->mask + 1;
+
+	Arc_ContiguousFreePMM(ring->sq, aio_pages(size * sizeof(struct ARC_AIOSubmission)));
+	Arc_ContiguousFreePMM(ring->cq, aio_pages(size * sizeof(struct ARC_AIOCompletion)));
+	Arc_SlabFree(ring);
+
+	return 0;
+}
+
+struct ARC_AIOSubmission *Arc_AIOGetSubmission(struct ARC_AIORing *ring) {
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	uint32_t tail = atomic_load_explicit(&ring->sq_tail, memory_order_relaxed) + ring->sq_prepared;
+
+	if (tail - atomic_load_explicit(&ring->sq_head, memory_order_acquire) > ring->mask) {
+		// Ring is full
+		return NULL;
+	}
+
+	struct ARC_AIOSubmission *sub = &ring->sq[tail & ring->mask];
+	memset(sub, 0, sizeof(struct ARC_AIOSubmission));
+	ring->sq_prepared++;
+
+	return sub;
+}
+
+int Arc_AIOSubmit(struct ARC_AIORing *ring) {
+	if (ring == NULL) {
+		return -1;
+	}
+
+	uint32_t count = ring->sq_prepared;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	ring->sq_prepared = 0;
+	atomic_fetch_add_explicit(&ring->sq_tail, count, memory_order_release);
+
+	if (atomic_load(&aio_workers) == 0) {
+		// Nobody to hand the work to
+		Arc_AIOWork(ring, 0);
+
+		return count;
+	}
+
+	aio_queue_ring(ring);
+
+	return count;
+}
+
+int Arc_AIOReap(struct ARC_AIORing *ring, struct ARC_AIOCompletion *completions, int max) {
+	if (ring == NULL || completions == NULL) {
+		return -1;
+	}
+
+	uint32_t head = atomic_load_explicit(&ring->cq_head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->cq_tail, memory_order_acquire);
+	int i = 0;
+
+	for (; i < max && head != tail; i++, head++) {
+		completions[i] = ring->cq[head & ring->mask];
+	}
+
+	atomic_store_explicit(&ring->cq_head, head, memory_order_release);
+
+	if (i > 0 && aio_has_work(ring)) {
+		// Workers may have stopped on a full completion
+		// ring, now that there is space, get them going
+		if (atomic_load(&aio_workers) == 0) {
+			Arc_AIOWork(ring, 0);
+		} else {
+			aio_queue_ring(ring);
+		}
+	}
+
+	return i;
+}
+
+/**
+ * Execute a single submission.
+ *
+ * @return The result to be posted as the completion.
+ * */
+static int64_t aio_execute(struct ARC_AIOSubmission *sub) {
+	switch (sub->opcode) {
+	case ARC_AIO_OP_NOP: {
+		return 0;
+	}
+
+	case ARC_AIO_OP_READ: {
+		if (sub->offset == ARC_AIO_OFFSET_CURRENT) {
+			return Arc_ReadVFS(sub->buffer, 1, sub->size, sub->file);
+		}
+
+		return Arc_PReadVFS(sub->buffer, 1, sub->size, sub->offset, sub->file);
+	}
+
+	case ARC_AIO_OP_WRITE: {
+		if (sub->offset == ARC_AIO_OFFSET_CURRENT) {
+			return Arc_WriteVFS(sub->buffer, 1, sub->size, sub->file);
+		}
+
+		return Arc_PWriteVFS(sub->buffer, 1, sub->size, sub->offset, sub->file);
+	}
+
+	case ARC_AIO_OP_OPEN: {
+		return Arc_OpenVFS(sub->path, sub->flags, sub->mode, 0, (void **)sub->buffer);
+	}
+
+	case ARC_AIO_OP_CLOSE: {
+		return Arc_CloseVFS(sub->file);
+	}
+
+	case ARC_AIO_OP_STAT: {
+		return Arc_StatVFS(sub->path, (struct stat *)sub->buffer);
+	}
+	}
+
+	ARC_DEBUG(ERR, "Unknown AIO opcode %d\n", sub->opcode);
+
+	return -1;
+}
+
+/**
+ * Post a completion into the slot reserved for it.
+ *
+ * Called from bio completions too, which may be in interrupt context.
+ * */
+static void aio_post(struct ARC_AIORing *ring, uint64_t user_data, int64_t result) {
+	uint64_t flags = Arc_SpinlockLockIRQSave(&ring->cq_lock);
+	uint32_t tail = atomic_load_explicit(&ring->cq_tail, memory_order_relaxed);
+
+	ring->cq[tail & ring->mask].user_data = user_data;
+	ring->cq[tail & ring->mask].result = result;
+	atomic_store_explicit(&ring->cq_tail, tail + 1, memory_order_release);
+	atomic_fetch_sub(&ring->cq_reserved, 1);
+
+	Arc_SpinlockUnlockIRQRestore(&ring->cq_lock, flags);
+}
+
+static void aio_bio_end(struct ARC_Bio *bio) {
+	struct aio_bio *aio = (struct aio_bio *)bio->private;
+
+	aio_post(aio->ring, aio->user_data, bio->status == 0 ? aio->size : -bio->status);
+	Arc_SlabFree(aio);
+}
+
+/**
+ * Hand a read or write of a block device straight to the block layer.
+ *
+ * Only whole sectors at an explicit offset which the device takes as a
+ * single bio go this way, and only for devices which complete bios on
+ * their own. Those that need polling would only make progress when some
+ * unrelated I/O on the device happens to poll.
+ *
+ * @return Zero if a bio was submitted, it posts the completion itself.
+ * 1 if the submission has to be executed.
+ * */
+static int aio_submit_bio(struct ARC_AIORing *ring, struct ARC_AIOSubmission *sub) {
+	if ((sub->opcode != ARC_AIO_OP_READ && sub->opcode != ARC_AIO_OP_WRITE) || sub->file == NULL || sub->offset < 0) {
+		return 1;
+	}
+
+	struct ARC_VFSNode *node = sub->file->node;
+
+	if (node != NULL && node->type == ARC_VFS_N_LINK) {
+		node = node->link;
+	}
+
+	if (node == NULL || node->type != ARC_VFS_N_BLOCK || node->resource == NULL || node->resource->driver_state == NULL) {
+		return 1;
+	}
+
+	struct ARC_BlockDevice *dev = (struct ARC_BlockDevice *)node->resource->driver_state;
+
+	if (dev->ops->poll != NULL) {
+		return 1;
+	}
+
+	uint64_t sector_size = dev->sector_size;
+	uint64_t count = sub->size / sector_size;
+
+	if (sub->size == 0 || (((uint64_t)sub->offset | sub->size) & (sector_size - 1)) != 0
+	    || (uint64_t)sub->offset / sector_size + count > dev->sector_count
+	    || (dev->max_sectors != 0 && count > dev->max_sectors)) {
+		return 1;
+	}
+
+	struct aio_bio *aio = (struct aio_bio *)Arc_SlabAlloc(sizeof(struct aio_bio));
+
+	if (aio == NULL) {
+		return 1;
+	}
+
+	memset(aio, 0, sizeof(struct aio_bio));
+
+	aio->ring = ring;
+	aio->user_data = sub->user_data;
+	aio->size = sub->size;
+	aio->bio.op = sub->opcode == ARC_AIO_OP_READ ? ARC_BIO_READ : ARC_BIO_WRITE;
+	aio->bio.sector = sub->offset / sector_size;
+	aio->bio.count = count;
+	aio->bio.buffer = sub->buffer;
+	aio->bio.end_io = aio_bio_end;
+	aio->bio.private = aio;
+
+	if (Arc_SubmitBio(dev, &aio->bio) != 0) {
+		Arc_SlabFree(aio);
+		return 1;
+	}
+
+	return 0;
+}
+
+int Arc_AIOWork(struct ARC_AIORing *ring, int max) {
+	if (ring == NULL) {
+		return -1;
+	}
+
+	uint32_t size = ring->mask + 1;
+	int done = 0;
+
+	while (max <= 0 || done < max) {
+		// Reserve a completion slot so the result has
+		// somewhere to go
+		uint32_t reserved = atomic_fetch_add(&ring->cq_reserved, 1);
+
+		if (atomic_load(&ring->cq_tail) + reserved - atomic_load(&ring->cq_head) >= size) {
+			atomic_fetch_sub(&ring->cq_reserved, 1);
+			break;
+		}
+
+		// Claim the next submission, it is copied out before
+		// sq_head is advanced as the slot may be reused after
+		struct ARC_AIOSubmission sub;
+		uint32_t head = atomic_load_explicit(&ring->sq_head, memory_order_acquire);
+		int claimed = 0;
+
+		while (head != atomic_load_explicit(&ring->sq_tail, memory_order_acquire)) {
+			sub = ring->sq[head & ring->mask];
+
+			if (atomic_compare_exchange_weak(&ring->sq_head, &head, head + 1)) {
+				claimed = 1;
+				break;
+			}
+		}
+
+		if (claimed == 0) {
+			atomic_fetch_sub(&ring->cq_reserved, 1);
+			break;
+		}
+
+		done++;
+
+		if (aio_submit_bio(ring, &sub) == 0) {
+			// The bio keeps the reservation until it completes
+			continue;
+		}
+
+		aio_post(ring, sub.user_data, aio_execute(&sub));
+	}
+
+	return done;
+}
+
+int Arc_AIOQueueWork(struct ARC_AIOWork *work) {
+	if (work == NULL || work->func == NULL || atomic_load(&aio_workers) == 0) {
+		return 1;
+	}
+
+	work->next = NULL;
+
+	Arc_MutexLock(&aio_pending_lock);
+
+	if (aio_work_tail == NULL) {
+		aio_work = work;
+	} else {
+		aio_work_tail->next = work;
+	}
+
+	aio_work_tail = work;
+
+	Arc_MutexUnlock(&aio_pending_lock);
+
+	aio_kick();
+
+	return 0;
+}
+
+static struct ARC_AIOWork *aio_dequeue_work() {
+	Arc_MutexLock(&aio_pending_lock);
+
+	struct ARC_AIOWork *work = aio_work;
+
+	if (work != NULL) {
+		aio_work = work->next;
+
+		if (aio_work == NULL) {
+			aio_work_tail = NULL;
+		}
+	}
+
+	Arc_MutexUnlock(&aio_pending_lock);
+
+	return work;
+}
+
+int Arc_AIOWorker() {
+	struct ARC_AIORing *ring = NULL;
+	struct ARC_AIOWork *work = NULL;
+	int total = 0;
+
+	while ((work = aio_dequeue_work()) != NULL) {
+		// The owner may reuse or free it once func is called
+		work->func(work);
+		total++;
+	}
+
+	while ((ring = aio_dequeue_ring()) != NULL) {
+		total += Arc_AIOWork(ring, 0);
+	}
+
+	return total;
+}
+
+void Arc_AIORegisterWorker(int delta) {
+	atomic_fetch_add(&aio_workers, delta);
+}
+
+static void aio_worker_thread(void *arg) {
+	(void)arg;
+
+	for (;;) {
+		// Read before looking for work, a ring queued after the look
+		// changes it and the sleep falls through
+		uint32_t seen = atomic_load_explicit(&aio_work_event, memory_order_seq_cst);
+
+		if (Arc_AIOWorker() != 0) {
+			Arc_CondResched();
+			continue;
+		}
+
+		atomic_fetch_add_explicit(&aio_sleepers, 1, memory_order_seq_cst);
+		Arc_FutexWait((uint32_t *)&aio_work_event, seen, 0, ARC_FUTEX_BITSET_ANY);
+		atomic_fetch_sub_explicit(&aio_sleepers, 1, memory_order_relaxed);
+	}
+}
+
+int Arc_AIOStartWorkers(int count) {
+	int started = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (Arc_CreateKernelThread(aio_worker_thread, NULL) == NULL) {
+			break;
+		}
+
+		// Counted from creation, so submissions are queued for it
+		// rather than run by the submitter
+		Arc_AIORegisterWorker(1);
+		started++;
+	}
+
+	ARC_DEBUG(INFO, "Started %d of %d AIO workers\n", started, count);
+
+	return started == 0;
+}
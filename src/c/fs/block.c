@@ -0,0 +1,689 @@
+/**
+ * @file block.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Generic block device layer: bio merging, dispatch and completion.
+*/
+#include <abi-bits/errno.h>
+#include <fs/block.h>
+#include <mm/pmm.h>
+#include <global.h>
+#include <util.h>
+
+/// Number of bios Arc_BlockIOV keeps in flight at once.
+#define BLOCK_IO_BATCH 32
+
+static struct ARC_Elevator *block_elevators[] = { &Arc_DeadlineElevator, &Arc_NoopElevator };
+
+static struct ARC_BlockDevice *block_devices = NULL;
+// Looked up far more often than devices come and go
+static struct ARC_RWLock block_devices_lock = { 0 };
+
+/**
+ * Completion state shared by the bios of a synchronous transfer.
+ * */
+struct block_wait {
+	_Atomic int pending;
+	_Atomic int status;
+};
+
+static void block_run(struct ARC_BlockDevice *dev, int limit);
+
+static size_t block_pool_pages() {
+	return ALIGN(ARC_BLOCK_QUEUE_DEPTH * sizeof(struct ARC_BlockRequest), 0x1000) >> 12;
+}
+
+static struct ARC_Elevator *block_find_elevator(char *name) {
+	if (name == NULL) {
+		return block_elevators[0];
+	}
+
+	for (size_t i = 0; i < sizeof(block_elevators) / sizeof(*block_elevators); i++) {
+		if (strcmp(block_elevators[i]->name, name) == 0) {
+			return block_elevators[i];
+		}
+	}
+
+	return NULL;
+}
+
+static uint64_t block_hash_key(uint64_t sector) {
+	return (sector ^ (sector >> 7)) & (ARC_BLOCK_HASH_SIZE - 1);
+}
+
+/**
+ * Queued requests are hashed by the sector just past their end,
+ * which is the sector a back merging bio begins at.
+ * */
+static void block_hash_add(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	uint64_t key = block_hash_key(req->sector + req->count);
+
+	req->hash_next = dev->hash[key];
+	dev->hash[key] = req;
+}
+
+static void block_hash_del(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct ARC_BlockRequest **link = &dev->hash[block_hash_key(req->sector + req->count)];
+
+	while (*link != NULL && *link != req) {
+		link = &(*link)->hash_next;
+	}
+
+	if (*link != NULL) {
+		*link = req->hash_next;
+	}
+
+	req->hash_next = NULL;
+}
+
+static int block_fits(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req, int op, uint64_t count, int segments) {
+	if (req->op != op) {
+		return 0;
+	}
+
+	if (dev->max_sectors != 0 && req->count + count > dev->max_sectors) {
+		return 0;
+	}
+
+	if (dev->max_segments != 0 && req->segments + segments > dev->max_segments) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Absorb the request following req if it has grown to touch it.
+ * */
+static void block_merge_next(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	if (dev->elevator->next == NULL) {
+		return;
+	}
+
+	struct ARC_BlockRequest *next = dev->elevator->next(dev, req);
+
+	if (next == NULL || req->sector + req->count != next->sector || !block_fits(dev, req, next->op, next->count, next->segments)) {
+		return;
+	}
+
+	dev->elevator->remove(dev, next);
+	block_hash_del(dev, next);
+	block_hash_del(dev, req);
+
+	req->tail->next = next->head;
+	req->tail = next->tail;
+	req->count += next->count;
+	req->segments += next->segments;
+	req->deadline = min(req->deadline, next->deadline);
+
+	block_hash_add(dev, req);
+
+	if (dev->last_merge == next) {
+		dev->last_merge = req;
+	}
+
+	next->next = dev->free;
+	dev->free = next;
+	dev->queued--;
+	dev->stats.request_merges++;
+}
+
+static int block_back_merge(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req, struct ARC_Bio *bio) {
+	if (req->sector + req->count != bio->sector || !block_fits(dev, req, bio->op, bio->count, 1)) {
+		return 0;
+	}
+
+	block_hash_del(dev, req);
+	req->tail->next = bio;
+	req->tail = bio;
+	req->count += bio->count;
+	req->segments++;
+	block_hash_add(dev, req);
+
+	dev->last_merge = req;
+	block_merge_next(dev, req);
+
+	return 1;
+}
+
+static int block_front_merge(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req, struct ARC_Bio *bio) {
+	if (bio->sector + bio->count != req->sector || !block_fits(dev, req, bio->op, bio->count, 1)) {
+		return 0;
+	}
+
+	// The end sector stays the same, so does the hash
+	bio->next = req->head;
+	req->head = bio;
+	req->sector = bio->sector;
+	req->count += bio->count;
+	req->segments++;
+
+	dev->last_merge = req;
+
+	return 1;
+}
+
+/**
+ * Try to merge bio into a queued request.
+ *
+ * Sequential streams nearly always hit last_merge, the hash and
+ * the elevator catch interleaved streams.
+ *
+ * @return 1 if the bio was merged.
+ * */
+static int block_merge_bio(struct ARC_BlockDevice *dev, struct ARC_Bio *bio) {
+	struct ARC_BlockRequest *req = dev->last_merge;
+
+	if (req != NULL && (block_back_merge(dev, req, bio) || block_front_merge(dev, req, bio))) {
+		return 1;
+	}
+
+	for (req = dev->hash[block_hash_key(bio->sector)]; req != NULL; req = req->hash_next) {
+		if (block_back_merge(dev, req, bio)) {
+			return 1;
+		}
+	}
+
+	if (dev->elevator->find != NULL) {
+		req = dev->elevator->find(dev, bio->op, bio->sector + bio->count);
+
+		if (req != NULL && block_front_merge(dev, req, bio)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Wait until the given number of bios have completed, pushing the
+ * queue along in the meantime.
+ * */
+static void block_wait(struct ARC_BlockDevice *dev, _Atomic int *pending) {
+	while (atomic_load_explicit(pending, memory_order_acquire) > 0) {
+		Arc_BlockRun(dev);
+
+		if (dev->ops->poll != NULL) {
+			dev->ops->poll(dev);
+		} else {
+			__builtin_ia32_pause();
+		}
+	}
+}
+
+/**
+ * Complete everything which is queued or in flight.
+ * */
+static void block_drain(struct ARC_BlockDevice *dev) {
+	while (dev->queued > 0 || dev->in_flight > 0) {
+		Arc_BlockRun(dev);
+
+		if (dev->ops->poll != NULL) {
+			dev->ops->poll(dev);
+		} else {
+			__builtin_ia32_pause();
+		}
+	}
+}
+
+/**
+ * Put a bio which could not be merged into a request of its own.
+ *
+ * The caller must hold dev->lock, which is dropped while waiting
+ * for a free request.
+ * */
+static void block_queue_bio(struct ARC_BlockDevice *dev, struct ARC_Bio *bio) {
+	while (dev->free == NULL) {
+		// Only make room for this one, the rest stay queued
+		// for later bios to merge with
+		Arc_MutexUnlock(&dev->lock);
+		block_run(dev, 1);
+
+		if (dev->ops->poll != NULL) {
+			dev->ops->poll(dev);
+		} else {
+			__builtin_ia32_pause();
+		}
+
+		Arc_MutexLock(&dev->lock);
+	}
+
+	struct ARC_BlockRequest *req = dev->free;
+	dev->free = req->next;
+
+	memset(req, 0, sizeof(struct ARC_BlockRequest));
+	req->op = bio->op;
+	req->sector = bio->sector;
+	req->count = bio->count;
+	req->segments = 1;
+	req->head = bio;
+	req->tail = bio;
+
+	block_hash_add(dev, req);
+	dev->elevator->add(dev, req);
+	dev->queued++;
+	dev->last_merge = req;
+}
+
+int Arc_BlockRegister(struct ARC_BlockDevice *dev, char *elevator) {
+	if (dev == NULL || dev->name == NULL || dev->ops == NULL || dev->ops->submit == NULL) {
+		return EINVAL;
+	}
+
+	if (dev->sector_size == 0 || dev->sector_size > 0x1000 || (dev->sector_size & (dev->sector_size - 1)) != 0 || dev->sector_count == 0) {
+		ARC_DEBUG(ERR, "Block device %s has an invalid geometry\n", dev->name);
+		return EINVAL;
+	}
+
+	struct ARC_Elevator *elv = block_find_elevator(elevator);
+
+	if (elv == NULL) {
+		ARC_DEBUG(ERR, "No elevator called %s\n", elevator);
+		return EINVAL;
+	}
+
+	dev->pool = (struct ARC_BlockRequest *)Arc_ContiguousAllocPMM(block_pool_pages());
+
+	if (dev->pool == NULL) {
+		return ENOMEM;
+	}
+
+	memset(dev->pool, 0, block_pool_pages() << 12);
+	memset(dev->hash, 0, sizeof(dev->hash));
+	memset(&dev->stats, 0, sizeof(dev->stats));
+
+	dev->free = NULL;
+
+	for (int i = ARC_BLOCK_QUEUE_DEPTH - 1; i >= 0; i--) {
+		dev->pool[i].next = dev->free;
+		dev->free = &dev->pool[i];
+	}
+
+	Arc_MutexStaticInit(&dev->lock);
+	dev->plugged = 0;
+	dev->running = 0;
+	dev->queued = 0;
+	dev->in_flight = 0;
+	dev->last_merge = NULL;
+
+	if (dev->max_in_flight <= 0 || dev->max_in_flight > ARC_BLOCK_QUEUE_DEPTH) {
+		dev->max_in_flight = ARC_BLOCK_QUEUE_DEPTH;
+	}
+
+	dev->elevator = elv;
+
+	if (elv->init(dev) != 0) {
+		Arc_ContiguousFreePMM(dev->pool, block_pool_pages());
+		return ENOMEM;
+	}
+
+	Arc_RWWriteLock(&block_devices_lock);
+	dev->next = block_devices;
+	block_devices = dev;
+	Arc_RWWriteUnlock(&block_devices_lock);
+
+	ARC_DEBUG(INFO, "Registered block device %s: %lu sectors of %d bytes, %s elevator\n", dev->name, dev->sector_count, dev->sector_size, elv->name);
+
+	return 0;
+}
+
+int Arc_BlockUnregister(struct ARC_BlockDevice *dev) {
+	if (dev == NULL) {
+		return EINVAL;
+	}
+
+	Arc_RWWriteLock(&block_devices_lock);
+
+	struct ARC_BlockDevice **link = &block_devices;
+
+	while (*link != NULL && *link != dev) {
+		link = &(*link)->next;
+	}
+
+	if (*link != NULL) {
+		*link = dev->next;
+	}
+
+	Arc_RWWriteUnlock(&block_devices_lock);
+
+	block_drain(dev);
+
+	ARC_DEBUG(INFO, "Unregistered block device %s: %lu bios, %lu merged, %lu requests merged, %lu dispatched\n", dev->name, dev->stats.bios, dev->stats.merges, dev->stats.request_merges, dev->stats.dispatched);
+
+	dev->elevator->uninit(dev);
+	Arc_ContiguousFreePMM(dev->pool, block_pool_pages());
+	dev->pool = NULL;
+	dev->free = NULL;
+
+	return 0;
+}
+
+struct ARC_BlockDevice *Arc_BlockFind(char *name) {
+	if (name == NULL) {
+		return NULL;
+	}
+
+	Arc_RWReadLock(&block_devices_lock);
+
+	struct ARC_BlockDevice *dev = block_devices;
+
+	while (dev != NULL && strcmp(dev->name, name) != 0) {
+		dev = dev->next;
+	}
+
+	Arc_RWReadUnlock(&block_devices_lock);
+
+	return dev;
+}
+
+int Arc_BlockSetElevator(struct ARC_BlockDevice *dev, char *name) {
+	if (dev == NULL) {
+		return EINVAL;
+	}
+
+	struct ARC_Elevator *elv = block_find_elevator(name);
+
+	if (elv == NULL) {
+		return EINVAL;
+	}
+
+	Arc_BlockPlug(dev);
+	block_drain(dev);
+
+	Arc_MutexLock(&dev->lock);
+
+	struct ARC_Elevator *old = dev->elevator;
+	int ret = 0;
+
+	old->uninit(dev);
+	dev->elevator = elv;
+
+	if (elv->init(dev) != 0) {
+		// Fall back to what was there
+		dev->elevator = old;
+		old->init(dev);
+		ret = ENOMEM;
+	}
+
+	dev->last_merge = NULL;
+
+	Arc_MutexUnlock(&dev->lock);
+	Arc_BlockUnplug(dev);
+
+	return ret;
+}
+
+int Arc_SubmitBio(struct ARC_BlockDevice *dev, struct ARC_Bio *bio) {
+	if (dev == NULL || bio == NULL || bio->buffer == NULL || bio->count == 0) {
+		return EINVAL;
+	}
+
+	if (bio->op != ARC_BIO_READ && bio->op != ARC_BIO_WRITE) {
+		return EINVAL;
+	}
+
+	if (bio->sector >= dev->sector_count || bio->count > dev->sector_count - bio->sector) {
+		return EINVAL;
+	}
+
+	if (dev->max_sectors != 0 && bio->count > dev->max_sectors) {
+		return EINVAL;
+	}
+
+	bio->next = NULL;
+	bio->status = 0;
+
+	Arc_MutexLock(&dev->lock);
+
+	dev->stats.bios++;
+
+	if (block_merge_bio(dev, bio)) {
+		dev->stats.merges++;
+	} else {
+		block_queue_bio(dev, bio);
+	}
+
+	int run = dev->plugged == 0;
+
+	Arc_MutexUnlock(&dev->lock);
+
+	if (run) {
+		Arc_BlockRun(dev);
+	}
+
+	return 0;
+}
+
+void Arc_BlockPlug(struct ARC_BlockDevice *dev) {
+	if (dev == NULL) {
+		return;
+	}
+
+	Arc_MutexLock(&dev->lock);
+	dev->plugged++;
+	Arc_MutexUnlock(&dev->lock);
+}
+
+void Arc_BlockUnplug(struct ARC_BlockDevice *dev) {
+	if (dev == NULL) {
+		return;
+	}
+
+	Arc_MutexLock(&dev->lock);
+
+	if (dev->plugged > 0) {
+		dev->plugged--;
+	}
+
+	int run = dev->plugged == 0;
+
+	Arc_MutexUnlock(&dev->lock);
+
+	if (run) {
+		Arc_BlockRun(dev);
+	}
+}
+
+/**
+ * Hand at most limit requests to the driver.
+ * */
+static void block_run(struct ARC_BlockDevice *dev, int limit) {
+	Arc_MutexLock(&dev->lock);
+
+	// Drivers which finish requests synchronously end up back here
+	// from Arc_BlockEndRequest, the outer call keeps dispatching
+	if (dev->running) {
+		Arc_MutexUnlock(&dev->lock);
+		return;
+	}
+
+	dev->running = 1;
+
+	while (limit-- > 0 && dev->in_flight < dev->max_in_flight) {
+		struct ARC_BlockRequest *req = dev->elevator->dispatch(dev);
+
+		if (req == NULL) {
+			break;
+		}
+
+		block_hash_del(dev, req);
+
+		if (dev->last_merge == req) {
+			dev->last_merge = NULL;
+		}
+
+		dev->queued--;
+		dev->in_flight++;
+		dev->stats.dispatched++;
+
+		if (req->op == ARC_BIO_READ) {
+			dev->stats.read_sectors += req->count;
+		} else {
+			dev->stats.write_sectors += req->count;
+		}
+
+		Arc_MutexUnlock(&dev->lock);
+
+		int err = dev->ops->submit(dev, req);
+
+		if (err != 0) {
+			Arc_BlockEndRequest(dev, req, err);
+		}
+
+		Arc_MutexLock(&dev->lock);
+	}
+
+	dev->running = 0;
+
+	Arc_MutexUnlock(&dev->lock);
+}
+
+void Arc_BlockRun(struct ARC_BlockDevice *dev) {
+	if (dev == NULL) {
+		return;
+	}
+
+	block_run(dev, dev->max_in_flight);
+}
+
+void Arc_BlockEndRequest(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req, int status) {
+	if (dev == NULL || req == NULL) {
+		return;
+	}
+
+	// end_io may release the bio, so step past it first
+	struct ARC_Bio *bio = req->head;
+
+	while (bio != NULL) {
+		struct ARC_Bio *next = bio->next;
+
+		bio->next = NULL;
+		bio->status = status;
+
+		if (bio->end_io != NULL) {
+			bio->end_io(bio);
+		}
+
+		bio = next;
+	}
+
+	Arc_MutexLock(&dev->lock);
+
+	req->next = dev->free;
+	dev->free = req;
+	dev->in_flight--;
+
+	int run = !dev->running && dev->plugged == 0 && dev->queued > 0;
+
+	Arc_MutexUnlock(&dev->lock);
+
+	if (run) {
+		Arc_BlockRun(dev);
+	}
+}
+
+static void block_io_end(struct ARC_Bio *bio) {
+	struct block_wait *wait = (struct block_wait *)bio->private;
+
+	if (bio->status != 0) {
+		atomic_store_explicit(&wait->status, bio->status, memory_order_relaxed);
+	}
+
+	atomic_fetch_sub_explicit(&wait->pending, 1, memory_order_release);
+}
+
+int Arc_BlockIOV(struct ARC_BlockDevice *dev, int op, uint64_t sector, struct ARC_IOVec *iov, int iovcnt) {
+	if (dev == NULL || iov == NULL || iovcnt < 0) {
+		return EINVAL;
+	}
+
+	uint64_t chunk = dev->max_sectors == 0 ? dev->sector_count : dev->max_sectors;
+	struct ARC_Bio bios[BLOCK_IO_BATCH];
+	struct block_wait wait = { 0 };
+	int i = 0;
+	size_t done = 0;
+
+	while (i < iovcnt) {
+		int batch = 0;
+
+		Arc_BlockPlug(dev);
+
+		while (i < iovcnt && batch < BLOCK_IO_BATCH) {
+			if ((iov[i].length & (dev->sector_size - 1)) != 0) {
+				atomic_store(&wait.status, EINVAL);
+				break;
+			}
+
+			uint64_t count = min((iov[i].length - done) / dev->sector_size, chunk);
+
+			if (count == 0) {
+				i++;
+				done = 0;
+				continue;
+			}
+
+			struct ARC_Bio *bio = &bios[batch];
+
+			bio->op = op;
+			bio->sector = sector;
+			bio->count = count;
+			bio->buffer = (uint8_t *)iov[i].base + done;
+			bio->end_io = block_io_end;
+			bio->private = &wait;
+
+			atomic_fetch_add(&wait.pending, 1);
+
+			int err = Arc_SubmitBio(dev, bio);
+
+			if (err != 0) {
+				atomic_fetch_sub(&wait.pending, 1);
+				atomic_store(&wait.status, err);
+				break;
+			}
+
+			batch++;
+			sector += count;
+			done += count * dev->sector_size;
+		}
+
+		Arc_BlockUnplug(dev);
+		block_wait(dev, &wait.pending);
+
+		if (atomic_load(&wait.status) != 0) {
+			return atomic_load(&wait.status);
+		}
+	}
+
+	return 0;
+}
+
+int Arc_BlockIO(struct ARC_BlockDevice *dev, int op, uint64_t sector, uint64_t count, void *buffer) {
+	if (dev == NULL || buffer == NULL) {
+		return EINVAL;
+	}
+
+	struct ARC_IOVec iov = { .base = buffer, .length = count * dev->sector_size };
+
+	return Arc_BlockIOV(dev, op, sector, &iov, 1);
+}
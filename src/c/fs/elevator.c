@@ -0,0 +1,343 @@
+/**
+ * @file elevator.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * I/O schedulers for the block layer.
+ *
+ * noop hands requests to the device in the order they arrived, for
+ * devices on which seeking costs nothing.
+ *
+ * deadline sweeps each direction in ascending sector order, batching
+ * up to DEADLINE_FIFO_BATCH requests per sweep. Reads are preferred
+ * over writes, but writes are never passed over more than
+ * DEADLINE_WRITES_STARVED times in a row, and a request whose
+ * deadline has passed is taken out of order.
+*/
+#include <lib/clock.h>
+#include <fs/block.h>
+#include <mm/slab.h>
+#include <global.h>
+#include <util.h>
+
+// Deadlines are in monotonic nanoseconds
+#define DEADLINE_NS_PER_MS 1000000ULL
+#define DEADLINE_READ_EXPIRE (500 * DEADLINE_NS_PER_MS)
+#define DEADLINE_WRITE_EXPIRE (5000 * DEADLINE_NS_PER_MS)
+// Requests dispatched in one sweep before looking at deadlines again
+#define DEADLINE_FIFO_BATCH 16
+// Times reads may be chosen over waiting writes
+#define DEADLINE_WRITES_STARVED 2
+
+struct noop_state {
+	struct ARC_BlockRequest *head;
+	struct ARC_BlockRequest *tail;
+};
+
+struct deadline_state {
+	/// Queued requests of each direction in ascending sector order.
+	struct ARC_BlockRequest *sorted[2];
+	/// Queued requests of each direction in order of arrival.
+	struct ARC_BlockRequest *fifo_head[2];
+	struct ARC_BlockRequest *fifo_tail[2];
+	/// Where the sweep of each direction continues.
+	struct ARC_BlockRequest *next[2];
+	/// Direction of the current sweep.
+	int op;
+	/// Requests dispatched in the current sweep.
+	int batching;
+	/// Number of times reads were chosen while writes waited.
+	int starved;
+};
+
+static int noop_init(struct ARC_BlockDevice *dev) {
+	struct noop_state *state = (struct noop_state *)Arc_SlabAlloc(sizeof(struct noop_state));
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	memset(state, 0, sizeof(struct noop_state));
+	dev->elevator_state = state;
+
+	return 0;
+}
+
+static int noop_uninit(struct ARC_BlockDevice *dev) {
+	Arc_SlabFree(dev->elevator_state);
+	dev->elevator_state = NULL;
+
+	return 0;
+}
+
+static void noop_add(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct noop_state *state = (struct noop_state *)dev->elevator_state;
+
+	req->next = NULL;
+	req->prev = state->tail;
+
+	if (state->tail != NULL) {
+		state->tail->next = req;
+	} else {
+		state->head = req;
+	}
+
+	state->tail = req;
+}
+
+static void noop_remove(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct noop_state *state = (struct noop_state *)dev->elevator_state;
+
+	if (req->prev != NULL) {
+		req->prev->next = req->next;
+	} else {
+		state->head = req->next;
+	}
+
+	if (req->next != NULL) {
+		req->next->prev = req->prev;
+	} else {
+		state->tail = req->prev;
+	}
+
+	req->prev = NULL;
+	req->next = NULL;
+}
+
+static struct ARC_BlockRequest *noop_dispatch(struct ARC_BlockDevice *dev) {
+	struct noop_state *state = (struct noop_state *)dev->elevator_state;
+	struct ARC_BlockRequest *req = state->head;
+
+	if (req != NULL) {
+		noop_remove(dev, req);
+	}
+
+	return req;
+}
+
+static struct ARC_BlockRequest *noop_next(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	(void)dev;
+
+	// Not sorted, but arrival order is what a sequential stream
+	// which outgrew its request would meet
+	return req->next;
+}
+
+struct ARC_Elevator Arc_NoopElevator = {
+	.name = "noop",
+	.init = noop_init,
+	.uninit = noop_uninit,
+	.add = noop_add,
+	.remove = noop_remove,
+	.dispatch = noop_dispatch,
+	.next = noop_next,
+};
+
+static int deadline_init(struct ARC_BlockDevice *dev) {
+	struct deadline_state *state = (struct deadline_state *)Arc_SlabAlloc(sizeof(struct deadline_state));
+
+	if (state == NULL) {
+		return 1;
+	}
+
+	memset(state, 0, sizeof(struct deadline_state));
+	dev->elevator_state = state;
+
+	return 0;
+}
+
+static int deadline_uninit(struct ARC_BlockDevice *dev) {
+	Arc_SlabFree(dev->elevator_state);
+	dev->elevator_state = NULL;
+
+	return 0;
+}
+
+static void deadline_add(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct deadline_state *state = (struct deadline_state *)dev->elevator_state;
+	int op = req->op;
+
+	req->deadline = Arc_ClockMonotonic() + (op == ARC_BIO_READ ? DEADLINE_READ_EXPIRE : DEADLINE_WRITE_EXPIRE);
+
+	// Sorted insert, a request usually lands after the ones
+	// already queued so find the tail first and walk back
+	struct ARC_BlockRequest *after = state->sorted[op];
+
+	if (after != NULL) {
+		after = after->prev;
+
+		while (after != NULL && after->sector > req->sector) {
+			after = after == state->sorted[op] ? NULL : after->prev;
+		}
+	}
+
+	if (after == NULL) {
+		// New head, the list is circular through the head's prev
+		struct ARC_BlockRequest *head = state->sorted[op];
+
+		req->next = head;
+		req->prev = head == NULL ? req : head->prev;
+
+		if (head != NULL) {
+			head->prev = req;
+		}
+
+		state->sorted[op] = req;
+	} else {
+		req->next = after->next;
+		req->prev = after;
+
+		if (after->next != NULL) {
+			after->next->prev = req;
+		} else {
+			state->sorted[op]->prev = req;
+		}
+
+		after->next = req;
+	}
+
+	req->fifo_next = NULL;
+	req->fifo_prev = state->fifo_tail[op];
+
+	if (state->fifo_tail[op] != NULL) {
+		state->fifo_tail[op]->fifo_next = req;
+	} else {
+		state->fifo_head[op] = req;
+	}
+
+	state->fifo_tail[op] = req;
+}
+
+static void deadline_remove(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	struct deadline_state *state = (struct deadline_state *)dev->elevator_state;
+	int op = req->op;
+	struct ARC_BlockRequest *head = state->sorted[op];
+
+	if (state->next[op] == req) {
+		state->next[op] = req->next;
+	}
+
+	if (req == head) {
+		state->sorted[op] = req->next;
+
+		if (req->next != NULL) {
+			req->next->prev = req->prev;
+		}
+	} else {
+		req->prev->next = req->next;
+
+		if (req->next != NULL) {
+			req->next->prev = req->prev;
+		} else {
+			head->prev = req->prev;
+		}
+	}
+
+	if (req->fifo_prev != NULL) {
+		req->fifo_prev->fifo_next = req->fifo_next;
+	} else {
+		state->fifo_head[op] = req->fifo_next;
+	}
+
+	if (req->fifo_next != NULL) {
+		req->fifo_next->fifo_prev = req->fifo_prev;
+	} else {
+		state->fifo_tail[op] = req->fifo_prev;
+	}
+
+	req->prev = NULL;
+	req->next = NULL;
+	req->fifo_prev = NULL;
+	req->fifo_next = NULL;
+}
+
+static struct ARC_BlockRequest *deadline_dispatch(struct ARC_BlockDevice *dev) {
+	struct deadline_state *state = (struct deadline_state *)dev->elevator_state;
+	struct ARC_BlockRequest *req = NULL;
+	int op = state->op;
+
+	if (state->next[op] != NULL && state->batching < DEADLINE_FIFO_BATCH) {
+		// Continue the sweep
+		req = state->next[op];
+	} else {
+		int reads = state->sorted[ARC_BIO_READ] != NULL;
+		int writes = state->sorted[ARC_BIO_WRITE] != NULL;
+
+		if (reads && !(writes && state->starved >= DEADLINE_WRITES_STARVED)) {
+			state->starved += writes;
+			op = ARC_BIO_READ;
+		} else if (writes) {
+			state->starved = 0;
+			op = ARC_BIO_WRITE;
+		} else {
+			return NULL;
+		}
+
+		state->op = op;
+		state->batching = 0;
+
+		// Start a new sweep from the oldest request if it is due,
+		// otherwise carry on from where the last one stopped
+		req = state->next[op];
+
+		if (req == NULL || state->fifo_head[op]->deadline <= Arc_ClockMonotonic()) {
+			req = state->fifo_head[op];
+		}
+	}
+
+	struct ARC_BlockRequest *next = req->next;
+
+	deadline_remove(dev, req);
+	state->next[op] = next;
+	state->batching++;
+
+	return req;
+}
+
+static struct ARC_BlockRequest *deadline_find(struct ARC_BlockDevice *dev, int op, uint64_t sector) {
+	struct deadline_state *state = (struct deadline_state *)dev->elevator_state;
+	struct ARC_BlockRequest *req = state->sorted[op];
+
+	while (req != NULL && req->sector < sector) {
+		req = req->next;
+	}
+
+	return req != NULL && req->sector == sector ? req : NULL;
+}
+
+static struct ARC_BlockRequest *deadline_next(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req) {
+	(void)dev;
+
+	return req->next;
+}
+
+struct ARC_Elevator Arc_DeadlineElevator = {
+	.name = "deadline",
+	.init = deadline_init,
+	.uninit = deadline_uninit,
+	.add = deadline_add,
+	.remove = deadline_remove,
+	.dispatch = deadline_dispatch,
+	.find = deadline_find,
+	.next = deadline_next,
+};
@@ -29,10 +29,15 @@
 #include <abi-bits/stat.h>
 #include <lib/atomics.h>
 #include <abi-bits/errno.h>
+#include <abi-bits/fcntl.h>
 #include <lib/resource.h>
 #include <mm/slab.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
 #include <fs/vfs.h>
 #include <fs/dri_defs.h>
+#include <fs/aio.h>
+#include <mp/futex.h>
 #include <global.h>
 #include <util.h>
 
@@ -67,6 +72,38 @@ struct vfs_traverse_info {
 	void *overwrite_arg;
 };
 
+/// Smallest readahead window, used once sequential access is first detected.
+#define VFS_RA_MIN_WINDOW 0x200
+/// Largest readahead window, the size of each readahead buffer.
+#define VFS_RA_MAX_WINDOW 0x10000
+#define VFS_RA_PAGES (VFS_RA_MAX_WINDOW >> 12)
+
+/// States of a background prefetch.
+#define VFS_RA_IDLE    0
+#define VFS_RA_PENDING 1
+#define VFS_RA_READY   2
+
+/**
+ * The window following the readahead buffer, read by an AIO worker
+ * while the reader works through the buffer. Swapped in once the
+ * reader gets to it.
+ * */
+struct ARC_FilePrefetch {
+	/// First, the worker is handed this.
+	struct ARC_AIOWork work;
+	/// VFS_RA_*, slept on while the prefetch is pending.
+	_Atomic uint32_t state;
+	struct ARC_File *file;
+	struct ARC_Resource *res;
+	long offset;
+	size_t size;
+	/// Bytes read in, valid once ready.
+	size_t filled;
+	/// Generation of the node before the read started.
+	uint64_t generation;
+	uint8_t *buffer;
+};
+
 #define VFS_DETERMINE_START(info, path) \
         if (*path == '/') { \
 		info.start = &vfs_root; \
@@ -91,12 +128,27 @@ int vfs_stat2type(struct stat stat) {
 			return ARC_VFS_N_FILE;
 		}
 
+		case S_IFBLK: {
+			return ARC_VFS_N_BLOCK;
+		}
+
 		default: {
 			return ARC_VFS_NULL;
 		}
 	}
 }
 
+/**
+ * Free a node after its grace period.
+ * */
+static void vfs_free_node(struct ARC_RCUHead *head) {
+	struct ARC_VFSNode *node = ARC_RCU_ENTRY(head, struct ARC_VFSNode, rcu);
+
+	Arc_SlabFree(node->name);
+	Arc_UninitializeResource(node->resource);
+	Arc_SlabFree(node);
+}
+
 /**
  * Internal recursive delete function.
  *
@@ -118,9 +170,7 @@ int vfs_delete_node_recurse(struct ARC_VFSNode *node) {
 		child = child->next;
 	}
 
-	Arc_SlabFree(node->name);
-	Arc_UninitializeResource(node->resource);
-	Arc_SlabFree(node);
+	Arc_CallRCU(&node->rcu, vfs_free_node);
 
 	return err;
 }
@@ -154,9 +204,6 @@ int vfs_delete_node(struct ARC_VFSNode *node, bool recurse) {
 		return err + 1;
 	}
 
-	Arc_SlabFree(node->name);
-	Arc_UninitializeResource(node->resource);
-
 	if (node->prev == NULL) {
 		node->parent->children = node->next;
 	} else {
@@ -167,7 +214,8 @@ int vfs_delete_node(struct ARC_VFSNode *node, bool recurse) {
 		node->next->prev = node->prev;
 	}
 
-	Arc_SlabFree(node);
+	// Lockless readers may still be on the node, or walking past it
+	Arc_CallRCU(&node->rcu, vfs_free_node);
 
 	return err;
 }
@@ -280,6 +328,8 @@ int vfs_top_down_prune(struct ARC_VFSNode *top, int depth) {
 		node = node->next;
 	}
 
+	Arc_QUnlock(&top->branch_lock);
+
 	return count;
 }
 
@@ -316,6 +366,10 @@ uint64_t vfs_idx2idx(int type, uint64_t idx) {
 		return ARC_DRI_FIFO + 1;
 	}
 
+	case ARC_VFS_N_BLOCK: {
+		return ARC_DRI_BLOCK + 1;
+	}
+
 	case ARC_VFS_N_LINK: {
 		return 0xAB;
 	}
@@ -426,7 +480,19 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 
 		if (*component == '.' && component_length == 2 && *(component + 1) == '.') {
 			// .. dir, go up one
-			node = node->parent == NULL ? node : node->parent;
+			if (node->parent != NULL) {
+				if (Arc_QLock(&node->parent->branch_lock) != 0) {
+					ARC_DEBUG(ERR, "Lock error!\n");
+					goto cleanup;
+				}
+
+				Arc_QUnlock(&node->branch_lock);
+				node->ref_count--; // TODO: Atomize
+				node = node->parent;
+				node->ref_count++; // TODO: Atomize
+				info->node = node;
+			}
+
 			continue;
 		} else if (*component == '.' && component_length == 1) {
 			// . dir, skip
@@ -446,6 +512,8 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 			if ((info->create_level & VFS_NO_CREAT) == 1) {
 				// No creation desired by caller
 				ARC_DEBUG(ERR, "VFS_NO_CREAT specified\n");
+				Arc_QUnlock(&node->branch_lock);
+				node->ref_count--; // TODO: Atomize
 				return i;
 			}
 
@@ -455,6 +523,7 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 
 			if (new == NULL) {
 				ARC_DEBUG(ERR, "Cannot allocate next node\n");
+				goto cleanup;
 			}
 
 			memset(new, 0, sizeof(struct ARC_VFSNode));
@@ -490,13 +559,18 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 				struct ARC_Resource *res = info->mount->resource;
 				struct ARC_SuperDriverDef *def = (struct ARC_SuperDriverDef *)res->driver->driver;
 
-				if (def->stat(res, stat_path, &new->stat) != 0) {
+				Arc_SeqWriteLock(&new->stat_lock);
+				int stat_ret = def->stat(res, stat_path, &new->stat);
+				Arc_SeqWriteUnlock(&new->stat_lock);
+
+				if (stat_ret != 0) {
 					ARC_DEBUG(ERR, "Failed to stat %s\n", stat_path);
 					if ((info->create_level & VFS_FS_CREAT) != 1) {
 						ARC_DEBUG(ERR, "VFS_FS_CREAT not allowed\n");
 
 						Arc_SlabFree(stat_path);
 						Arc_QUnlock(&node->branch_lock);
+						node->ref_count--; // TODO: Atomize
 
 						return i;
 					}
@@ -507,7 +581,7 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 					// thing are mountpoints causes this case to break. As
 					// we can be sure that we will not try to create
 					// /to/thing/that/exists.txt (as /path/to/thing is present)
-					if (def->create(info->mountpath, info->mode, info->type) != 0) {
+					if (def->create(res, info->mountpath, info->mode, info->type) != 0) {
 						ARC_DEBUG(ERR, "VFS_FS_CREAT failed\n");
 					}
 				} else {
@@ -546,7 +620,7 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 				if (nres == NULL) {
 					ARC_DEBUG(ERR, "Failed to create resource\n");
 					Arc_SlabFree(stat_path);
-					return -1;
+					goto cleanup;
 				}
 			}
 
@@ -564,6 +638,9 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 			goto cleanup;
 		}
 
+		// Hand over hand, only the deepest node stays held
+		Arc_QUnlock(&node->branch_lock);
+
 		child->ref_count++; // TODO: Atomize
 		node->ref_count--; // TODO: Atomize
 		node = child;
@@ -579,6 +656,9 @@ int vfs_traverse(char *filepath, struct vfs_traverse_info *info, int link_depth)
 
 cleanup:;
 	ARC_DEBUG(WARN, "Definitely cleaning up\n");
+	Arc_QUnlock(&node->branch_lock);
+	node->ref_count--; // TODO: Atomize
+
 	return -1;
 }
 
@@ -655,12 +735,15 @@ int Arc_UnmountVFS(struct ARC_VFSNode *mount) {
 
 	if (Arc_QLock(&mount->branch_lock) != 0) {
 		ARC_DEBUG(ERR, "Lock error!\n");
+		Arc_MutexUnlock(&mount->property_lock);
 		return -1;
 	}
 	Arc_QYield(&mount->branch_lock);
 
 	if (Arc_QFreeze(&mount->branch_lock) != 0) {
 		ARC_DEBUG(ERR, "Could not freeze lock!\n");
+		Arc_QUnlock(&mount->branch_lock);
+		Arc_MutexUnlock(&mount->property_lock);
 		return -1;
 	}
 
@@ -668,6 +751,7 @@ int Arc_UnmountVFS(struct ARC_VFSNode *mount) {
 	// TODO: Destroy nodes
 
 	Arc_QUnlock(&mount->branch_lock);
+	Arc_MutexUnlock(&mount->property_lock);
 
 	ARC_DEBUG(INFO, "Successfully unmount %p\n", mount);
 
@@ -675,7 +759,6 @@ int Arc_UnmountVFS(struct ARC_VFSNode *mount) {
 }
 
 int Arc_OpenVFS(char *path, int flags, uint32_t mode, int link_depth, void **ret) {
-	(void)flags;
 
 	if (path == NULL) {
 		return EINVAL;
@@ -710,29 +793,35 @@ int Arc_OpenVFS(char *path, int flags, uint32_t mode, int link_depth, void **ret
 	*ret = desc;
 
 	desc->mode = mode;
+	desc->flags = flags;
 	desc->node = node;
 
 	ARC_DEBUG(INFO, "Created file descriptor %p\n", desc);
 
 	Arc_MutexLock(&node->property_lock);
-	if (node->is_open == 0 && node->type != ARC_VFS_N_DIR) {
+	// FIFOs see every handle, they count their writers
+	if ((node->is_open == 0 || node->type == ARC_VFS_N_FIFO) && node->type != ARC_VFS_N_DIR) {
 		if (node->type == ARC_VFS_N_LINK) {
+			// The link's own property_lock is already held
 			node = node->link;
+			Arc_MutexLock(&node->property_lock);
 		}
 
-		Arc_MutexLock(&node->property_lock);
 		// NOTE: node->resource->name will always correspond to the path
 		//       to the node within the filesystem. This name is changed
 		//       when renaming, the path is absolute relative to the
 		//       mount
 		struct ARC_Resource *res = node->resource;
-		if (res->driver->open(desc, res, node->resource->name, 0, mode) != 0) {
+		if (res->driver->open(desc, res, node->resource->name, flags, mode) != 0) {
 			ARC_DEBUG(ERR, "Failed to open file\n");
 		}
 
 		node->is_open = 1;
 		desc->node->is_open = 1;
-		Arc_MutexUnlock(&node->property_lock);
+
+		if (node != desc->node) {
+			Arc_MutexUnlock(&node->property_lock);
+		}
 
 		node = desc->node;
 
@@ -748,6 +837,269 @@ int Arc_OpenVFS(char *path, int flags, uint32_t mode, int link_depth, void **ret
 	return 0;
 }
 
+static int vfs_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res);
+
+/**
+ * Mark the data of a node as changed, after a write or truncate.
+ *
+ * Readahead buffers of every handle on the node go stale.
+ * */
+static void vfs_node_modified(struct ARC_VFSNode *node) {
+	atomic_fetch_add_explicit(&node->generation, 1, memory_order_release);
+}
+
+/**
+ * Get the node holding the data of a file, links resolved.
+ * */
+static struct ARC_VFSNode *vfs_data_node(struct ARC_File *file) {
+	return file->node->type == ARC_VFS_N_LINK ? file->node->link : file->node;
+}
+
+/**
+ * Wait for a background prefetch to finish.
+ * */
+static void vfs_prefetch_wait(struct ARC_FilePrefetch *prefetch) {
+	while (atomic_load_explicit(&prefetch->state, memory_order_acquire) == VFS_RA_PENDING) {
+		Arc_FutexWait((uint32_t *)&prefetch->state, VFS_RA_PENDING, 0, ARC_FUTEX_BITSET_ANY);
+	}
+}
+
+static void vfs_prefetch_work(struct ARC_AIOWork *work) {
+	struct ARC_FilePrefetch *prefetch = (struct ARC_FilePrefetch *)work;
+	int ret = vfs_pread(prefetch->buffer, 1, prefetch->size, prefetch->offset, prefetch->file, prefetch->res);
+
+	prefetch->filled = ret > 0 ? min((size_t)ret, prefetch->size) : 0;
+
+	atomic_store_explicit(&prefetch->state, VFS_RA_READY, memory_order_release);
+	Arc_FutexWake((uint32_t *)&prefetch->state, 1, ARC_FUTEX_BITSET_ANY);
+}
+
+/**
+ * Start reading the window after the buffer in the background.
+ *
+ * Only drivers with a pread callback are prefetched from, as the
+ * reader keeps moving file->offset meanwhile.
+ * */
+static void vfs_prefetch_start(struct ARC_File *file, struct ARC_VFSNode *node, struct ARC_Resource *res) {
+	struct ARC_FileReadahead *ra = &file->readahead;
+
+	if (res->driver->pread == NULL || ra->window == 0 || ra->buffer_size == 0) {
+		return;
+	}
+
+	if (ra->prefetch == NULL) {
+		struct ARC_FilePrefetch *prefetch = (struct ARC_FilePrefetch *)Arc_SlabAlloc(sizeof(struct ARC_FilePrefetch));
+
+		if (prefetch == NULL) {
+			return;
+		}
+
+		memset(prefetch, 0, sizeof(struct ARC_FilePrefetch));
+		prefetch->work.func = vfs_prefetch_work;
+		prefetch->buffer = (uint8_t *)Arc_ContiguousAllocPMM(VFS_RA_PAGES);
+
+		if (prefetch->buffer == NULL) {
+			Arc_SlabFree(prefetch);
+			return;
+		}
+
+		ra->prefetch = prefetch;
+	}
+
+	struct ARC_FilePrefetch *prefetch = ra->prefetch;
+
+	if (atomic_load_explicit(&prefetch->state, memory_order_acquire) != VFS_RA_IDLE) {
+		return;
+	}
+
+	long offset = ra->buffer_offset + ra->buffer_size;
+	long file_size = node->stat.st_size;
+	size_t size = ra->window;
+
+	if (file_size > 0) {
+		if (offset >= file_size) {
+			return;
+		}
+
+		size = min(size, (size_t)(file_size - offset));
+	}
+
+	prefetch->file = file;
+	prefetch->res = res;
+	prefetch->offset = offset;
+	prefetch->size = size;
+	prefetch->filled = 0;
+	// Taken before the read, a write landing meanwhile makes it stale
+	prefetch->generation = atomic_load_explicit(&node->generation, memory_order_acquire);
+
+	atomic_store_explicit(&prefetch->state, VFS_RA_PENDING, memory_order_relaxed);
+
+	if (Arc_AIOQueueWork(&prefetch->work) != 0) {
+		// No workers, reads stay synchronous
+		atomic_store_explicit(&prefetch->state, VFS_RA_IDLE, memory_order_relaxed);
+	}
+}
+
+/**
+ * Make the background prefetch the buffer, if it holds offset.
+ *
+ * @return Zero if the buffer now holds offset.
+ * */
+static int vfs_prefetch_take(struct ARC_FileReadahead *ra, long offset, uint64_t generation) {
+	struct ARC_FilePrefetch *prefetch = ra->prefetch;
+
+	if (prefetch == NULL || atomic_load_explicit(&prefetch->state, memory_order_acquire) == VFS_RA_IDLE) {
+		return 1;
+	}
+
+	vfs_prefetch_wait(prefetch);
+	atomic_store_explicit(&prefetch->state, VFS_RA_IDLE, memory_order_relaxed);
+
+	if (prefetch->generation != generation || prefetch->filled == 0
+	    || offset < prefetch->offset || offset >= prefetch->offset + (long)prefetch->filled) {
+		return 1;
+	}
+
+	uint8_t *buffer = ra->buffer;
+
+	ra->buffer = prefetch->buffer;
+	ra->buffer_offset = prefetch->offset;
+	ra->buffer_size = prefetch->filled;
+	prefetch->buffer = buffer;
+
+	return 0;
+}
+
+/**
+ * Release the readahead buffers of the given file.
+ * */
+static void vfs_readahead_free(struct ARC_File *file) {
+	struct ARC_FileReadahead *ra = &file->readahead;
+
+	if (ra->prefetch != NULL) {
+		// The worker still uses the file and the buffer
+		vfs_prefetch_wait(ra->prefetch);
+		Arc_ContiguousFreePMM(ra->prefetch->buffer, VFS_RA_PAGES);
+		Arc_SlabFree(ra->prefetch);
+		ra->prefetch = NULL;
+	}
+
+	if (ra->buffer != NULL) {
+		Arc_ContiguousFreePMM(ra->buffer, VFS_RA_PAGES);
+		ra->buffer = NULL;
+	}
+
+	ra->buffer_size = 0;
+	ra->window = 0;
+}
+
+/**
+ * Read from a file through its readahead buffer.
+ *
+ * Sequential access, detected by the read starting where the
+ * last one ended, doubles the readahead window up to
+ * VFS_RA_MAX_WINDOW. Requests which are satisfied by the
+ * buffer are copied out of it, otherwise the buffer is refilled
+ * with a window's worth of data, ideally already read in the
+ * background, and the window after it is prefetched.
+ *
+ * The buffer is dropped once the node's generation moves on, so
+ * writes and truncates through any handle are seen.
+ *
+ * @param void *buffer - The buffer into which to read.
+ * @param size_t wanted - The number of bytes to read.
+ * @param struct ARC_File *file - The file to read.
+ * @param struct ARC_VFSNode *node - The node holding the file's data.
+ * @param struct ARC_Resource *res - The resource backing the file.
+ * @return The number of bytes read, file->offset is advanced by this amount.
+ * */
+static int vfs_readahead_read(void *buffer, size_t wanted, struct ARC_File *file, struct ARC_VFSNode *node, struct ARC_Resource *res) {
+	struct ARC_FileReadahead *ra = &file->readahead;
+	uint64_t generation = atomic_load_explicit(&node->generation, memory_order_acquire);
+
+	if (ra->generation != generation) {
+		ra->buffer_size = 0;
+		ra->generation = generation;
+	}
+
+	if (file->offset != ra->last_offset) {
+		// Random access, shrink the window back down
+		ra->window = 0;
+	} else {
+		ra->window = ra->window == 0 ? VFS_RA_MIN_WINDOW : min(ra->window << 1, (size_t)VFS_RA_MAX_WINDOW);
+	}
+
+	if (ra->window != 0 && ra->buffer == NULL) {
+		ra->buffer = (uint8_t *)Arc_ContiguousAllocPMM(VFS_RA_PAGES);
+
+		if (ra->buffer == NULL) {
+			ra->window = 0;
+		}
+	}
+
+	if (ra->window == 0 || wanted >= ra->window) {
+		// Not worth buffering, go straight to the driver
+		int ret = res->driver->read(buffer, 1, wanted, file, res);
+
+		if (ret > 0) {
+			file->offset += ret;
+		}
+
+		ra->last_offset = file->offset;
+
+		return ret;
+	}
+
+	long file_size = node->stat.st_size;
+	size_t given = 0;
+
+	while (given < wanted) {
+		long buffer_end = ra->buffer_offset + ra->buffer_size;
+
+		if (file->offset >= ra->buffer_offset && file->offset < buffer_end) {
+			// Serve what we can from the buffer
+			size_t available = min((size_t)(buffer_end - file->offset), wanted - given);
+			memcpy(buffer + given, ra->buffer + (file->offset - ra->buffer_offset), available);
+
+			given += available;
+			file->offset += available;
+
+			continue;
+		}
+
+		if (file_size > 0 && file->offset >= file_size) {
+			break;
+		}
+
+		if (vfs_prefetch_take(ra, file->offset, generation) == 0) {
+			continue;
+		}
+
+		// Refill the buffer with the next window
+		size_t fill = ra->window;
+
+		if (file_size > 0) {
+			fill = min(fill, (size_t)(file_size - file->offset));
+		}
+
+		int ret = res->driver->read(ra->buffer, 1, fill, file, res);
+
+		if (ret <= 0) {
+			ra->buffer_size = 0;
+			break;
+		}
+
+		ra->buffer_offset = file->offset;
+		ra->buffer_size = min((size_t)ret, fill);
+	}
+
+	vfs_prefetch_start(file, node, res);
+
+	ra->last_offset = file->offset;
+
+	return given;
+}
+
 int Arc_ReadVFS(void *buffer, size_t size, size_t count, struct ARC_File *file) {
 	if (buffer == NULL || file == NULL) {
 		return -1;
@@ -761,16 +1113,25 @@ int Arc_ReadVFS(void *buffer, size_t size, size_t count, struct ARC_File *file)
 		return -1;
 	}
 
-	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+	struct ARC_VFSNode *node = file->node->type == ARC_VFS_N_LINK ? file->node->link : file->node;
+	struct ARC_Resource *res = node->resource;
 
 	if (res == NULL || res->driver->read == NULL) {
 		ARC_DEBUG(ERR, "One or more is NULL: %p %p\n", res, res->driver->read);
 		return -1;
 	}
 
+	if (node->type == ARC_VFS_N_FILE) {
+		// Only regular files have stable contents which
+		// are safe to prefetch
+		return vfs_readahead_read(buffer, size * count, file, node, res);
+	}
+
 	int ret = res->driver->read(buffer, size, count, file, res);
 
-	file->offset += ret;
+	if (ret > 0) {
+		file->offset += ret;
+	}
 
 	return ret;
 }
@@ -797,7 +1158,267 @@ int Arc_WriteVFS(void *buffer, size_t size, size_t count, struct ARC_File *file)
 
 	int ret = res->driver->write(buffer, size, count, file, res);
 
-	file->offset += ret;
+	vfs_node_modified(vfs_data_node(file));
+
+	if (ret > 0) {
+		file->offset += ret;
+	}
+
+	return ret;
+}
+
+/**
+ * Read from a resource at an explicit offset.
+ *
+ * Drivers without a pread callback are given the offset through
+ * file->offset, which is restored afterwards.
+ * */
+static int vfs_pread(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (res->driver->pread != NULL) {
+		return res->driver->pread(buffer, size, count, offset, file, res);
+	}
+
+	if (res->driver->read == NULL) {
+		return -1;
+	}
+
+	long org = file->offset;
+	file->offset = offset;
+	int ret = res->driver->read(buffer, size, count, file, res);
+	file->offset = org;
+
+	return ret;
+}
+
+/**
+ * Write to a resource at an explicit offset.
+ *
+ * Counterpart of vfs_pread.
+ * */
+static int vfs_pwrite(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (res->driver->pwrite != NULL) {
+		return res->driver->pwrite(buffer, size, count, offset, file, res);
+	}
+
+	if (res->driver->write == NULL) {
+		return -1;
+	}
+
+	long org = file->offset;
+	file->offset = offset;
+	int ret = res->driver->write(buffer, size, count, file, res);
+	file->offset = org;
+
+	return ret;
+}
+
+int Arc_PReadVFS(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file) {
+	if (buffer == NULL || file == NULL || offset < 0) {
+		return -1;
+	}
+
+	if (size == 0 || count == 0) {
+		return 0;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	return vfs_pread(buffer, size, count, offset, file, res);
+}
+
+int Arc_PWriteVFS(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file) {
+	if (buffer == NULL || file == NULL || offset < 0) {
+		return -1;
+	}
+
+	if (size == 0 || count == 0) {
+		return 0;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	int ret = vfs_pwrite(buffer, size, count, offset, file, res);
+
+	vfs_node_modified(vfs_data_node(file));
+
+	return ret;
+}
+
+/**
+ * Scatter from an explicit offset.
+ * */
+static int vfs_preadv(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (res->driver->readv != NULL) {
+		return res->driver->readv(iov, iovcnt, offset, file, res);
+	}
+
+	// Driver cannot scatter, split the request up
+	int total = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].length == 0) {
+			continue;
+		}
+
+		int ret = vfs_pread(iov[i].base, 1, iov[i].length, offset + total, file, res);
+
+		if (ret <= 0) {
+			return total == 0 ? ret : total;
+		}
+
+		total += ret;
+
+		if ((size_t)ret < iov[i].length) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+/**
+ * Gather to an explicit offset.
+ * */
+static int vfs_pwritev(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res) {
+	if (res->driver->writev != NULL) {
+		return res->driver->writev(iov, iovcnt, offset, file, res);
+	}
+
+	// Driver cannot gather, split the request up
+	int total = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].length == 0) {
+			continue;
+		}
+
+		int ret = vfs_pwrite(iov[i].base, 1, iov[i].length, offset + total, file, res);
+
+		if (ret <= 0) {
+			return total == 0 ? ret : total;
+		}
+
+		total += ret;
+
+		if ((size_t)ret < iov[i].length) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+int Arc_ReadVVFS(struct ARC_IOVec *iov, int iovcnt, struct ARC_File *file) {
+	if (iov == NULL || iovcnt < 0 || file == NULL) {
+		return -1;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	long start = file->offset;
+	int ret = vfs_preadv(iov, iovcnt, start, file, res);
+
+	if (ret > 0) {
+		file->offset += ret;
+	}
+
+	// Counts as a read for access pattern detection, the buffered
+	// data is still good as nothing was written
+	if (start != file->readahead.last_offset) {
+		file->readahead.window = 0;
+	}
+
+	file->readahead.last_offset = file->offset;
+
+	return ret;
+}
+
+int Arc_WriteVVFS(struct ARC_IOVec *iov, int iovcnt, struct ARC_File *file) {
+	if (iov == NULL || iovcnt < 0 || file == NULL) {
+		return -1;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	int ret = vfs_pwritev(iov, iovcnt, file->offset, file, res);
+
+	vfs_node_modified(vfs_data_node(file));
+
+	if (ret > 0) {
+		file->offset += ret;
+	}
+
+	return ret;
+}
+
+int Arc_PReadVVFS(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file) {
+	if (iov == NULL || iovcnt < 0 || file == NULL || offset < 0) {
+		return -1;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	return vfs_preadv(iov, iovcnt, offset, file, res);
+}
+
+int Arc_PWriteVVFS(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file) {
+	if (iov == NULL || iovcnt < 0 || file == NULL || offset < 0) {
+		return -1;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL) {
+		return -1;
+	}
+
+	int ret = vfs_pwritev(iov, iovcnt, offset, file, res);
+
+	vfs_node_modified(vfs_data_node(file));
 
 	return ret;
 }
@@ -820,6 +1441,108 @@ int Arc_SeekVFS(struct ARC_File *file, long offset, int whence) {
 	return res->driver->seek(file, res, offset, whence);
 }
 
+int Arc_TruncateVFS(struct ARC_File *file, size_t length) {
+	if (file == NULL) {
+		return -1;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return -1;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL || res->driver->truncate == NULL) {
+		return -1;
+	}
+
+	int ret = res->driver->truncate(file, res, length);
+
+	vfs_node_modified(vfs_data_node(file));
+
+	return ret;
+}
+
+int Arc_MMapVFS(void *address, size_t size, uint32_t flags, struct ARC_File *file, long offset, void **ret) {
+	if (file == NULL || ret == NULL || size == 0 || offset < 0 || ((uintptr_t)address & 0xFFF) != 0) {
+		return EINVAL;
+	}
+
+	if (file->node->type == ARC_VFS_N_LINK && file->node->link == NULL) {
+		return EINVAL;
+	}
+
+	struct ARC_Resource *res = file->node->type == ARC_VFS_N_LINK ? file->node->link->resource : file->node->resource;
+
+	if (res == NULL || res->driver->mmap == NULL) {
+		ARC_DEBUG(ERR, "Resource %p cannot be mapped\n", res);
+		return ENODEV;
+	}
+
+	int write = (flags & (1 << 1)) != 0;
+
+	if (write && (file->flags & O_ACCMODE) == O_RDONLY) {
+		return EACCES;
+	}
+
+	uint64_t base = 0;
+	int err = res->driver->mmap(file, res, offset, write, &base);
+
+	if (err != 0) {
+		return err;
+	}
+
+	uintptr_t vaddr = (uintptr_t)address + (base & 0xFFF);
+	long current = offset;
+
+	// Walk the file one physical page at a time, the byte at the
+	// start of each page must land on the start of a virtual page
+	while (current < offset + (long)size) {
+		uint64_t paddr = 0;
+
+		if (res->driver->mmap(file, res, current, write, &paddr) != 0) {
+			ARC_DEBUG(ERR, "Failed to get physical address of offset %ld\n", current);
+			err = EINVAL;
+			break;
+		}
+
+		if (address == NULL && paddr != base + (current - offset)) {
+			ARC_DEBUG(ERR, "Data at offset %ld is not physically contiguous\n", current);
+			err = EINVAL;
+			break;
+		}
+
+		if ((paddr & 0xFFF) != (vaddr & 0xFFF)) {
+			ARC_DEBUG(ERR, "Data at offset %ld cannot be mapped at %p\n", current, (void *)vaddr);
+			err = EINVAL;
+			break;
+		}
+
+		if (address != NULL && Arc_MapPageVMM(paddr & ~0xFFF, vaddr & ~0xFFF, flags | ARC_VMM_CREAT_FLAG) != 0) {
+			ARC_DEBUG(ERR, "Failed to map 0x%"PRIx64" to %p\n", paddr, (void *)vaddr);
+			err = ENOMEM;
+			break;
+		}
+
+		size_t step = 0x1000 - (paddr & 0xFFF);
+		current += step;
+		vaddr += step;
+	}
+
+	if (err != 0) {
+		// Take down the pages mapped before the failure
+		for (uintptr_t page = (uintptr_t)address; address != NULL && page < (vaddr & ~0xFFF); page += 0x1000) {
+			Arc_UnmapPageVMM(page);
+		}
+
+		return err;
+	}
+
+	*ret = address == NULL ? (void *)ARC_PHYS_TO_HHDM(base) : (void *)((uintptr_t)address + (base & 0xFFF));
+
+	return 0;
+}
+
 int Arc_CloseVFS(struct ARC_File *file) {
 	if (file == NULL) {
 		return -1;
@@ -842,11 +1565,17 @@ int Arc_CloseVFS(struct ARC_File *file) {
 	if (node->ref_count > 1 || (node->type != ARC_VFS_N_FILE && node->type != ARC_VFS_N_LINK)) {
 		ARC_DEBUG(INFO, "ref_count (%d) > 1, closing file descriptor\n", node->ref_count);
 
+		if (node->type == ARC_VFS_N_FIFO && node->resource != NULL) {
+			node->resource->driver->close(file, node->resource);
+		}
+
 		Arc_UnreferenceResource(file->reference);
+		vfs_readahead_free(file);
 		Arc_SlabFree(file);
 		node->ref_count--; // TODO: Atomize
 
 		Arc_MutexUnlock(&node->property_lock);
+		Arc_QUnlock(&node->branch_lock);
 
 		return 0;
 	}
@@ -863,8 +1592,14 @@ int Arc_CloseVFS(struct ARC_File *file) {
 
 	struct ARC_VFSNode *parent = node->parent;
 	struct ARC_VFSNode *top = node->mount->node;
+
+	// Locks are released before the node (and they with it) may be freed
+	Arc_MutexUnlock(&node->property_lock);
+	Arc_QUnlock(&node->branch_lock);
+
 	vfs_delete_node(node, 0);
 	vfs_bottom_up_prune(parent, top);
+	vfs_readahead_free(file);
 	Arc_SlabFree(file);
 
 	ARC_DEBUG(INFO, "Closed file successfully\n");
@@ -872,6 +1607,53 @@ int Arc_CloseVFS(struct ARC_File *file) {
 	return 0;
 }
 
+/**
+ * Copy the status of a node without locking it.
+ * */
+static void vfs_read_stat(struct ARC_VFSNode *node, struct stat *stat) {
+	uint32_t sequence = 0;
+
+	do {
+		sequence = Arc_SeqReadBegin(&node->stat_lock);
+		memcpy(stat, &node->stat, sizeof(struct stat));
+	} while (Arc_SeqReadRetry(&node->stat_lock, sequence));
+}
+
+int Arc_StatVFS(char *filepath, struct stat *stat) {
+	if (filepath == NULL || stat == NULL) {
+		ARC_DEBUG(ERR, "Invalid parameters given (%p, %p)\n", filepath, stat);
+		return EINVAL;
+	}
+
+	// Bring the node into the graph if needed, its stat is
+	// filled in from the physical file system when created
+	struct vfs_traverse_info info = { .create_level = VFS_GR_CREAT };
+	VFS_DETERMINE_START(info, filepath);
+
+	int ret = vfs_traverse(filepath, &info, 0);
+
+	if (ret == -2) {
+		// Empty path, stat the start node
+		vfs_read_stat(info.node, stat);
+		return 0;
+	}
+
+	if (ret != 0) {
+		ARC_DEBUG(ERR, "Failed to find %s\n", filepath);
+		return -1;
+	}
+
+	struct ARC_VFSNode *node = info.node;
+
+	// The reference keeps the node alive, the branch can be let go
+	// before copying so other walkers are not held up
+	Arc_QUnlock(&node->branch_lock);
+	vfs_read_stat(node, stat);
+	node->ref_count--; // TODO: Atomize
+
+	return 0;
+}
+
 int Arc_CreateVFS(char *path, uint32_t mode, int type, void *arg) {
 	if (path == NULL) {
 		ARC_DEBUG(ERR, "No path given\n");
@@ -915,6 +1697,8 @@ int Arc_RemoveVFS(char *filepath, bool physical, bool recurse) {
 
 	if (recurse == 0 && info.node->type == ARC_VFS_N_DIR) {
 		ARC_DEBUG(ERR, "Trying to non-recursively delete directory\n");
+		Arc_QUnlock(&info.node->branch_lock);
+		info.node->ref_count--; // TODO: Atomize
 		return -1;
 	}
 
@@ -922,15 +1706,13 @@ int Arc_RemoveVFS(char *filepath, bool physical, bool recurse) {
 	if (info.node->ref_count > 0 || info.node->is_open == 0) {
 		ARC_DEBUG(ERR, "Node %p is still in use\n", info.node);
 		Arc_MutexUnlock(&info.node->property_lock);
+		Arc_QUnlock(&info.node->branch_lock);
+		info.node->ref_count--; // TODO: Atomize
 		return -1;
 	}
 
-	if (Arc_QLock(&info.node->branch_lock) != 0) {
-		ARC_DEBUG(ERR, "Lock error\n");
-	}
-	Arc_QYield(&info.node->branch_lock);
-
-	// We now have the node completely under control
+	// We now have the node completely under control, its
+	// branch_lock is held from the traversal
 
 	if (physical == 1 && info.mount != NULL) {
 		ARC_DEBUG(INFO, "Removing %s physically on mount %p\n", info.mountpath, info.mount);
@@ -946,12 +1728,16 @@ int Arc_RemoveVFS(char *filepath, bool physical, bool recurse) {
 
 		struct ARC_SuperDriverDef *def = (struct ARC_SuperDriverDef *)res->driver->driver;
 
-		if (def->remove(info.mountpath) != 0) {
+		if (def->remove(res, info.mountpath) != 0) {
 			ARC_DEBUG(WARN, "Cannot physically remove path\n");
 		}
 	}
 
 	struct ARC_VFSNode *parent = info.node->parent;
+
+	Arc_MutexUnlock(&info.node->property_lock);
+	Arc_QUnlock(&info.node->branch_lock);
+
 	vfs_delete_node(info.node, recurse);
 	vfs_bottom_up_prune(parent, info.mount);
 
@@ -999,7 +1785,9 @@ int Arc_LinkVFS(char *a, char *b, uint32_t mode) {
 
 	Arc_MutexLock(&src->property_lock);
 	Arc_MutexLock(&lnk->property_lock);
+	Arc_SeqWriteLock(&src->stat_lock);
 	src->stat.st_nlink++;
+	Arc_SeqWriteUnlock(&src->stat_lock);
 	// src->ref_count is already incremented from the traverse
 	lnk->ref_count--;
 	lnk->link = src;
@@ -1042,10 +1830,11 @@ int Arc_RenameVFS(char *a, char *b) {
 	}
 
 	// Lock parent ASAP ensuring node_a is not modified
-	if (Arc_QLock(&info_a.node->parent->branch_lock) != 0) {
+	struct ARC_VFSNode *old_parent = info_a.node->parent;
+
+	if (Arc_QLock(&old_parent->branch_lock) != 0) {
 		ARC_DEBUG(ERR, "Lock error\n");
 	}
-	Arc_QYield(&info_a.node->parent->branch_lock);
 
 	struct vfs_traverse_info info_b = { .create_level = VFS_FS_CREAT | VFS_NOLCMP, .mode = info_a.mode };
 	VFS_DETERMINE_START(info_b, b);
@@ -1054,7 +1843,9 @@ int Arc_RenameVFS(char *a, char *b) {
 
 	if (ret != 0) {
 		ARC_DEBUG(ERR, "Failed to find or create %s in node graph / on disk\n", b);
-		Arc_QUnlock(&info_a.node->parent->branch_lock);
+		Arc_QUnlock(&old_parent->branch_lock);
+		Arc_QUnlock(&info_a.node->branch_lock);
+		info_a.node->ref_count--; // TODO: Atomize
 		return -1;
 	}
 
@@ -1100,6 +1891,7 @@ int Arc_RenameVFS(char *a, char *b) {
 	node_a->resource->name = strdup(b);
 	Arc_MutexUnlock(&node_a->resource->prop_mutex);
 
+	Arc_QUnlock(&old_parent->branch_lock);
 	Arc_QUnlock(&node_a->branch_lock);
 
 	node_a->ref_count--; // TODO: Atomize
@@ -1119,7 +1911,71 @@ int Arc_RenameVFS(char *a, char *b) {
 	} else {
 		// Physically rename file
 		struct ARC_SuperDriverDef *def = (struct ARC_SuperDriverDef *)info_a.mount->resource->driver->driver;
-		def->rename(info_a.mountpath, info_b.mountpath);
+		def->rename(info_a.mount->resource, info_a.mountpath, info_b.mountpath);
+	}
+
+	return 0;
+}
+
+/**
+ * List the entries a super driver knows of under path.
+ *
+ * Entries which have not yet been brought into the graph
+ * are only known by the driver, so ask it for them.
+ * */
+static int vfs_list_mount(struct ARC_VFSNode *mount, char *path, int recurse, int org) {
+	struct ARC_Resource *res = mount->resource;
+
+	if (res == NULL || res->driver->identifer != ARC_DRIVER_IDEN_SUPER) {
+		return -1;
+	}
+
+	struct ARC_SuperDriverDef *def = (struct ARC_SuperDriverDef *)res->driver->driver;
+
+	if (def->readdir == NULL) {
+		return -1;
+	}
+
+	char *name = NULL;
+	struct stat stat = { 0 };
+
+	for (uint64_t index = 0; def->readdir(res, path, index, &name, &stat) == 0; index++) {
+		size_t path_length = strlen(path);
+		size_t name_length = strlen(name);
+
+		// Skip entries which are already in the graph
+		struct ARC_VFSNode *child = path_length == 0 ? mount->children : NULL;
+		while (child != NULL && strcmp(child->name, name) != 0) {
+			child = child->next;
+		}
+
+		if (child != NULL) {
+			continue;
+		}
+
+		for (int i = 0; i < org - recurse; i++) {
+			printf("\t");
+		}
+
+		printf("%s\n", name);
+
+		if (recurse <= 0 || !S_ISDIR(stat.st_mode)) {
+			continue;
+		}
+
+		char *sub = (char *)Arc_SlabAlloc(path_length + name_length + 2);
+
+		if (sub == NULL) {
+			continue;
+		}
+
+		memcpy(sub, path, path_length);
+		sub[path_length] = '/';
+		memcpy(sub + path_length + 1, name, name_length + 1);
+
+		vfs_list_mount(mount, sub, recurse - 1, org);
+
+		Arc_SlabFree(sub);
 	}
 
 	return 0;
@@ -1145,6 +2001,10 @@ int vfs_list(struct ARC_VFSNode *node, int recurse, int org) {
 		child = child->next;
 	}
 
+	if (node->type == ARC_VFS_N_MOUNT) {
+		vfs_list_mount(node, "", recurse, org);
+	}
+
 	return 0;
 }
 
@@ -1164,7 +2024,7 @@ int Arc_ListVFS(char *path, int recurse) {
 	info.node->ref_count--; // TODO: Atomize
 
 	printf("Listing of %s\n", path);
-	vfs_list(&vfs_root, recurse, recurse);
+	vfs_list(info.node, recurse, recurse);
 
 	Arc_QUnlock(&info.node->branch_lock);
 
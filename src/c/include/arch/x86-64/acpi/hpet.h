@@ -0,0 +1,53 @@
+/**
+ * @file hpet.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * High Precision Event Timer, only its main counter is used. It is the
+ * reference the TSC and LAPIC timer are calibrated against.
+*/
+#ifndef ARC_ARCH_X86_64_ACPI_HPET_H
+#define ARC_ARCH_X86_64_ACPI_HPET_H
+
+#include <stdint.h>
+
+/**
+ * Get the period of the main counter.
+ *
+ * @return Femtoseconds per tick, 0 if there is no usable HPET.
+ * */
+uint64_t Arc_HPETPeriod();
+
+/**
+ * Read the main counter.
+ * */
+uint64_t Arc_HPETCounter();
+
+/**
+ * Check whether the main counter is 64 bits wide.
+ *
+ * @return 1 if it is, 0 if it is 32 bits wide and wraps within minutes.
+ * */
+int Arc_HPETIs64Bit();
+
+#endif
@@ -27,13 +27,77 @@
 #ifndef ARC_ARCH_X86_64_APIC_LAPIC_H
 #define ARC_ARCH_X86_64_APIC_LAPIC_H
 
+#include <stdint.h>
+
 /*
  * This header contains functions which manage the
  * LAPIC
  * */
 
+#define ARC_LAPIC_TIMER_VECTOR    48
+/// Sent to wake a halted CPU, it does nothing else.
+#define ARC_LAPIC_WAKE_VECTOR     49
+#define ARC_LAPIC_SPURIOUS_VECTOR 0xFF
+
+#define ARC_LAPIC_ICR_INIT         (0b101 << 8)
+#define ARC_LAPIC_ICR_STARTUP      (0b110 << 8)
+#define ARC_LAPIC_ICR_LEVEL_ASSERT (1 << 14)
+
+/**
+ * Enable the calling CPU's LAPIC.
+ * */
 int Arc_InitLAPIC();
 
+/**
+ * Get the ID of the calling CPU's LAPIC.
+ *
+ * @return The ID, 0 if the LAPIC is not up yet.
+ * */
+uint32_t Arc_LAPICID();
 
+/**
+ * Send an interprocessor interrupt.
+ *
+ * Returns once the LAPIC has sent it.
+ *
+ * @param uint32_t lapic_id - ID of the LAPIC to send to.
+ * @param uint32_t command - Low half of the ICR, the vector and delivery mode.
+ * */
+void Arc_LAPICSendIPI(uint32_t lapic_id, uint32_t command);
+
+/**
+ * Signal the end of an interrupt to the calling CPU's LAPIC.
+ * */
+void Arc_LAPICEOI();
+
+/**
+ * Set up the calling CPU's LAPIC timer for one-shot deadlines.
+ *
+ * The first call (cpu 0) measures the TSC and the LAPIC timer against
+ * the HPET, or PIT channel 2 if there is no HPET, and installs the
+ * interrupt gate. The timer is left stopped. TSC-deadline mode is
+ * used if the CPU has it.
+ *
+ * @return Zero on success.
+ * */
+int Arc_InitLAPICTimer(int cpu);
+
+/**
+ * Program the calling CPU's timer to interrupt at a TSC value.
+ *
+ * Only the last deadline programmed is kept. Without TSC-deadline mode
+ * far deadlines are cut short, the interrupt may come early and the
+ * caller is expected to program the deadline again.
+ *
+ * @param uint64_t deadline - TSC value to interrupt at, 0 to stop the timer.
+ * */
+void Arc_LAPICTimerDeadline(uint64_t deadline);
+
+/**
+ * Get the TSC frequency measured by Arc_InitLAPICTimer.
+ *
+ * @return Ticks per second, 0 if it has not been measured.
+ * */
+uint64_t Arc_GetTSCFrequency();
 
 #endif
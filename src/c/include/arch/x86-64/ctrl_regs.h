@@ -54,5 +54,7 @@ extern void _x86_setCR4();
 extern uint64_t _x86_RDMSR(uint32_t msr);
 // Value: EDX:EAX
 extern void _x86_WRMSR(uint32_t msr, uint64_t value);
+// Returns in EDX:EAX
+extern uint64_t _x86_RDTSC();
 
 #endif
@@ -0,0 +1,76 @@
+/**
+ * @file fpu.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Extended (x87, SSE, AVX) register state, saved with XSAVEOPT and
+ * restored with XRSTOR where the processor has them, FXSAVE and
+ * FXRSTOR otherwise.
+*/
+#ifndef ARC_ARCH_X86_64_FPU_H
+#define ARC_ARCH_X86_64_FPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARC_FPU_CR0_MP (1 << 1)
+#define ARC_FPU_CR0_EM (1 << 2)
+#define ARC_FPU_CR0_TS (1 << 3)
+
+/**
+ * Enable the FPU and extended state on the calling CPU.
+ *
+ * Every CPU must call this, the state size is the same on all of them.
+ * */
+int Arc_InitializeFPU();
+
+/**
+ * Bytes taken by a save area, which must be 64 byte aligned.
+ * */
+size_t Arc_FPUStateSize();
+
+/**
+ * Fill a save area with the state of a freshly reset FPU.
+ * */
+void Arc_FPUInitState(void *area);
+
+/**
+ * Save the registers into a save area.
+ *
+ * XSAVEOPT leaves out the components which are still in their initial
+ * state or unchanged since they were last restored from \a area.
+ * */
+void Arc_FPUSave(void *area);
+void Arc_FPURestore(void *area);
+
+/**
+ * Make the next FPU instruction raise #NM (set CR0.TS).
+ * */
+void Arc_FPUTrapNext();
+
+/**
+ * Let FPU instructions through again (clear CR0.TS).
+ * */
+void Arc_FPUAllow();
+
+#endif
@@ -24,11 +24,24 @@
  *
  * @DESCRIPTION
  * Change out the GDT to better suit 64-bit mode, remove no longer needed 32-bit
- * segments.
+ * segments. Each CPU has a GDT of its own, as each needs its own TSS.
 */
 #ifndef ARC_ARCH_X86_64_GDT_H
 #define ARC_ARCH_X86_64_GDT_H
 
-void Arc_InstallGDT();
+#include <stdint.h>
+
+/// Most CPUs which can have a GDT of their own.
+#define ARC_GDT_MAX_CPUS 64
+
+#define ARC_GDT_TSS_SEL 0x28
+
+/**
+ * Install the GDT and TSS of the calling CPU.
+ *
+ * @param int cpu - Index of the calling CPU.
+ * @param void *stack - Top of the stack the CPU switches to when entering ring 0 from userland.
+ * */
+int Arc_InstallGDT(int cpu, void *stack);
 
 #endif
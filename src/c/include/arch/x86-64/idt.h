@@ -30,4 +30,18 @@
 
 void Arc_InstallIDT();
 
+/**
+ * Load the IDT built by Arc_InstallIDT on the calling CPU.
+ *
+ * Unlike Arc_InstallIDT, interrupts are left off.
+ * */
+void Arc_LoadIDT();
+
+/**
+ * Point a vector at a handler stub of its own.
+ *
+ * The stub is entered as an interrupt gate and returns with iretq.
+ * */
+void Arc_InstallIDTGate(int vector, void (*stub)());
+
 #endif
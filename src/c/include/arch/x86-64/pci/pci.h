@@ -0,0 +1,109 @@
+/**
+ * @file pci.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * PCI configuration space access through the legacy 0xCF8 / 0xCFC
+ * ports, and probing of the devices found on the bus.
+*/
+#ifndef ARC_ARCH_X86_64_PCI_PCI_H
+#define ARC_ARCH_X86_64_PCI_PCI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARC_PCI_CFG_VENDOR     0x00
+#define ARC_PCI_CFG_DEVICE     0x02
+#define ARC_PCI_CFG_COMMAND    0x04
+#define ARC_PCI_CFG_STATUS     0x06
+#define ARC_PCI_CFG_PROG_IF    0x09
+#define ARC_PCI_CFG_SUBCLASS   0x0A
+#define ARC_PCI_CFG_CLASS      0x0B
+#define ARC_PCI_CFG_HEADER     0x0E
+#define ARC_PCI_CFG_BAR0       0x10
+#define ARC_PCI_CFG_CAPABILITY 0x34
+
+#define ARC_PCI_COMMAND_MEMORY     (1 << 1)
+#define ARC_PCI_COMMAND_BUS_MASTER (1 << 2)
+#define ARC_PCI_COMMAND_INTX_OFF   (1 << 10)
+
+#define ARC_PCI_STATUS_CAPABILITIES (1 << 4)
+
+#define ARC_PCI_CAP_MSIX   0x11
+#define ARC_PCI_CAP_VENDOR 0x09
+
+struct ARC_PCIDevice {
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t function;
+	uint16_t vendor;
+	uint16_t device;
+	uint8_t class;
+	uint8_t subclass;
+	uint8_t prog_if;
+};
+
+uint32_t Arc_PCIRead32(struct ARC_PCIDevice *dev, uint8_t offset);
+uint16_t Arc_PCIRead16(struct ARC_PCIDevice *dev, uint8_t offset);
+uint8_t Arc_PCIRead8(struct ARC_PCIDevice *dev, uint8_t offset);
+void Arc_PCIWrite32(struct ARC_PCIDevice *dev, uint8_t offset, uint32_t value);
+void Arc_PCIWrite16(struct ARC_PCIDevice *dev, uint8_t offset, uint16_t value);
+
+/**
+ * Get the physical address a memory BAR decodes.
+ *
+ * 64-bit BARs take up two slots, \a bar is the index of the lower one.
+ *
+ * @return The physical address, 0 if \a bar is not a memory BAR.
+ * */
+uint64_t Arc_PCIGetBAR(struct ARC_PCIDevice *dev, int bar);
+
+/**
+ * Find a capability.
+ *
+ * @param uint8_t id - The capability ID to look for.
+ * @param uint8_t after - Offset of the capability after which to start looking, 0 to start from the first.
+ * @return The offset of the capability in configuration space, 0 if there is none.
+ * */
+uint8_t Arc_PCIFindCapability(struct ARC_PCIDevice *dev, uint8_t id, uint8_t after);
+
+/**
+ * Turn on memory decoding and bus mastering.
+ *
+ * Legacy INTx is turned off, devices either use MSI-X or are polled.
+ * */
+void Arc_PCIEnableDevice(struct ARC_PCIDevice *dev);
+
+/**
+ * Map a range of a memory BAR into the HHDM as uncacheable.
+ *
+ * @return The HHDM address of the start of the range, NULL on failure.
+ * */
+void *Arc_PCIMapBAR(struct ARC_PCIDevice *dev, int bar, uint64_t offset, size_t length);
+
+/**
+ * Scan every bus, and initialize the devices which have drivers.
+ * */
+int Arc_InitializePCI();
+
+#endif
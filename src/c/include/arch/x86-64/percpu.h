@@ -0,0 +1,103 @@
+/**
+ * @file percpu.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Per-CPU data, addressed through the GS base.
+ *
+ * Each CPU's IA32_GS_BASE points at its own struct ARC_PerCPU, so a
+ * field of the calling CPU's area is read or written with a single
+ * gs: relative instruction, with no need to look up which CPU is
+ * running first. IA32_KERNEL_GS_BASE holds the other half of the
+ * swapgs done on syscall entry and exit.
+*/
+#ifndef ARC_ARCH_X86_64_PERCPU_H
+#define ARC_ARCH_X86_64_PERCPU_H
+
+#include <arch/x86-64/smp.h>
+#include <stdint.h>
+
+struct ARC_Thread;
+
+struct ARC_PerCPU {
+	/// Address of this area, must stay first.
+	struct ARC_PerCPU *self;
+	int cpu;
+	/// Thread picked by the scheduler, NULL while the boot thread runs.
+	struct ARC_Thread *current;
+	/// Statistics, only ever changed by the CPU itself.
+	uint64_t context_switches;
+	uint64_t timer_interrupts;
+}__attribute__((aligned(64)));
+
+#define ARC_PERCPU_OFFSET(field) __builtin_offsetof(struct ARC_PerCPU, field)
+#define ARC_PERCPU_TYPE(field) __typeof__(((struct ARC_PerCPU *)0)->field)
+
+/**
+ * Read a field of the calling CPU's area.
+ * */
+#define ARC_THIS_CPU_READ(field) ({ \
+	ARC_PERCPU_TYPE(field) __value; \
+	__asm__ volatile("mov %0, gs:[%c1]" : "=r"(__value) : "i"(ARC_PERCPU_OFFSET(field))); \
+	__value; \
+})
+
+/**
+ * Write a field of the calling CPU's area.
+ * */
+#define ARC_THIS_CPU_WRITE(field, value) do { \
+	ARC_PERCPU_TYPE(field) __value = (value); \
+	__asm__ volatile("mov gs:[%c0], %1" : : "i"(ARC_PERCPU_OFFSET(field)), "r"(__value) : "memory"); \
+} while (0)
+
+/**
+ * Add to a field of the calling CPU's area.
+ *
+ * A single instruction, so an interrupt cannot tear it, but it is not
+ * atomic with respect to other CPUs reading the field.
+ * */
+#define ARC_THIS_CPU_ADD(field, value) do { \
+	ARC_PERCPU_TYPE(field) __value = (value); \
+	__asm__ volatile("add gs:[%c0], %1" : : "i"(ARC_PERCPU_OFFSET(field)), "r"(__value) : "memory", "cc"); \
+} while (0)
+
+/**
+ * Get the address of the calling CPU's area.
+ * */
+#define ARC_THIS_CPU_PTR() ARC_THIS_CPU_READ(self)
+
+/**
+ * Point the calling CPU's GS base at the area of \a cpu.
+ *
+ * Must come after Arc_InstallGDT, loading GS clears its base.
+ * */
+int Arc_InitPerCPU(int cpu);
+
+/**
+ * Get the area of any CPU.
+ *
+ * @return The area, NULL if \a cpu is out of range.
+ * */
+struct ARC_PerCPU *Arc_GetPerCPU(int cpu);
+
+#endif
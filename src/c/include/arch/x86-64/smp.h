@@ -0,0 +1,71 @@
+/**
+ * @file smp.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Starting the application processors, which are given dense CPU
+ * indices in place of their LAPIC IDs.
+*/
+#ifndef ARC_ARCH_X86_64_SMP_H
+#define ARC_ARCH_X86_64_SMP_H
+
+#include <stdint.h>
+
+#define ARC_SMP_MAX_CPUS 64
+/// Physical address the real mode entry is copied to, it must be page aligned and below 1 MiB.
+#define ARC_SMP_TRAMPOLINE 0x8000
+
+/**
+ * Register a processor found in the MADT.
+ *
+ * The bootstrap processor is always CPU 0, the others are numbered
+ * from 1 in the order they are registered.
+ *
+ * @param uint32_t lapic_id - ID of the processor's LAPIC.
+ * @param uint32_t flags - Flags of the MADT entry, disabled processors are ignored.
+ * @return The CPU index given to the processor, -1 if it was not registered.
+ * */
+int Arc_SMPRegisterCPU(uint32_t lapic_id, uint32_t flags);
+
+/**
+ * Start every registered application processor.
+ *
+ * Processors are started one at a time with INIT-SIPI-SIPI. Each sets
+ * up its own GDT, LAPIC, scheduler and timers, then idles until given
+ * work.
+ *
+ * @return The number of processors started.
+ * */
+int Arc_StartAPs();
+
+/**
+ * Get the number of CPUs which are running, the bootstrap processor included.
+ * */
+int Arc_SMPCPUCount();
+
+/**
+ * Wake a CPU halted in Arc_IdleCPU.
+ * */
+void Arc_WakeCPU(int cpu);
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * @file aio.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Asynchronous I/O interface for the VFS. Requests are placed into a
+ * submission ring, executed by a pool of workers or handed to the block
+ * layer, and their results are posted to a completion ring.
+*/
+#ifndef ARC_FS_AIO_H
+#define ARC_FS_AIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <lib/atomics.h>
+#include <lib/resource.h>
+
+#define ARC_AIO_OP_NOP   0
+#define ARC_AIO_OP_READ  1
+#define ARC_AIO_OP_WRITE 2
+#define ARC_AIO_OP_OPEN  3
+#define ARC_AIO_OP_CLOSE 4
+#define ARC_AIO_OP_STAT  5
+
+/// Use (and advance) the file's own offset instead of an explicit one.
+#define ARC_AIO_OFFSET_CURRENT -1
+
+/// Worker threads started at boot.
+#define ARC_AIO_WORKERS 4
+
+/**
+ * A single request in the submission ring.
+ * */
+struct ARC_AIOSubmission {
+	/// The operation to perform (ARC_AIO_OP_*).
+	int opcode;
+	/// Flags to open the file with (ARC_AIO_OP_OPEN).
+	int flags;
+	/// Mode to open the file with (ARC_AIO_OP_OPEN).
+	uint32_t mode;
+	/// The file to operate on (ARC_AIO_OP_READ, ARC_AIO_OP_WRITE, ARC_AIO_OP_CLOSE).
+	struct ARC_File *file;
+	/// Data buffer, the struct ARC_File ** for ARC_AIO_OP_OPEN, or the struct stat * for ARC_AIO_OP_STAT.
+	void *buffer;
+	/// Size of the data buffer in bytes.
+	size_t size;
+	/// Offset in the file, or ARC_AIO_OFFSET_CURRENT.
+	long offset;
+	/// Path of the file (ARC_AIO_OP_OPEN, ARC_AIO_OP_STAT).
+	char *path;
+	/// Value passed back untouched in the completion.
+	uint64_t user_data;
+};
+
+/**
+ * A single result in the completion ring.
+ * */
+struct ARC_AIOCompletion {
+	/// user_data of the submission this completes.
+	uint64_t user_data;
+	/// Return value of the operation, for reads and writes done as bios the
+	/// byte count or a negated errno.
+	int64_t result;
+};
+
+/**
+ * A pair of submission and completion rings.
+ *
+ * The submitter produces into sq and consumes from cq, the
+ * workers do the opposite. Both rings have a power of two
+ * number of entries, and their indices only ever increase.
+ * */
+struct ARC_AIORing {
+	/// Next submission to be executed (advanced by workers).
+	_Atomic uint32_t sq_head __attribute__((aligned(64)));
+	/// Next free submission slot (advanced by the submitter).
+	_Atomic uint32_t sq_tail __attribute__((aligned(64)));
+	/// Next completion to be reaped (advanced by the submitter).
+	_Atomic uint32_t cq_head __attribute__((aligned(64)));
+	/// Next free completion slot (advanced by workers).
+	_Atomic uint32_t cq_tail __attribute__((aligned(64)));
+	/// Submissions prepared with Arc_AIOGetSubmission, but not yet published.
+	uint32_t sq_prepared;
+	/// Number of entries in each ring - 1.
+	uint32_t mask;
+	/// Completion slots reserved by workers and bios in flight which have yet to post.
+	_Atomic uint32_t cq_reserved;
+	/// Serializes posting completions, taken with interrupts off as bios post from their end_io.
+	ARC_GenericSpinlock cq_lock;
+	/// Submission ring (page aligned so it can be shared).
+	struct ARC_AIOSubmission *sq;
+	/// Completion ring (page aligned so it can be shared).
+	struct ARC_AIOCompletion *cq;
+	/// Non-zero while the ring sits in the list of rings with pending work.
+	_Atomic int queued;
+	/// Next ring in the list of rings with pending work.
+	struct ARC_AIORing *next;
+};
+
+/**
+ * Kernel work done by the worker pool, such as prefetching.
+ *
+ * Embedded into the caller's own state, which it owns again once func
+ * has been called.
+ * */
+struct ARC_AIOWork {
+	void (*func)(struct ARC_AIOWork *work);
+	struct ARC_AIOWork *next;
+};
+
+/**
+ * Create a new ring pair.
+ *
+ * @param uint32_t entries - Number of entries in each ring, rounded up to a power of two.
+ * @param struct ARC_AIORing **ring - Set to the newly created ring.
+ * @return zero on success.
+ * */
+int Arc_AIOCreateRing(uint32_t entries, struct ARC_AIORing **ring);
+
+/**
+ * Destroy the given ring pair.
+ *
+ * Outstanding submissions are dropped.
+ * */
+int Arc_AIODestroyRing(struct ARC_AIORing *ring);
+
+/**
+ * Get the next free submission slot.
+ *
+ * The slot is zeroed and only becomes visible to the workers
+ * once Arc_AIOSubmit is called, so many slots can be prepared
+ * and submitted as one batch.
+ *
+ * @return A pointer to the slot, NULL if the ring is full.
+ * */
+struct ARC_AIOSubmission *Arc_AIOGetSubmission(struct ARC_AIORing *ring);
+
+/**
+ * Submit all prepared submissions.
+ *
+ * @return The number of submissions published.
+ * */
+int Arc_AIOSubmit(struct ARC_AIORing *ring);
+
+/**
+ * Reap completions.
+ *
+ * Completions are not ordered with respect to their
+ * submissions, use user_data to match them up.
+ *
+ * @param struct ARC_AIORing *ring - The ring to reap from.
+ * @param struct ARC_AIOCompletion *completions - Array into which to copy the completions.
+ * @param int max - Maximum number of completions to reap.
+ * @return The number of completions reaped.
+ * */
+int Arc_AIOReap(struct ARC_AIORing *ring, struct ARC_AIOCompletion *completions, int max);
+
+/**
+ * Execute submissions of a ring.
+ *
+ * @param struct ARC_AIORing *ring - The ring to execute.
+ * @param int max - Maximum number of submissions to execute (<= 0: no limit).
+ * @return The number of submissions executed.
+ * */
+int Arc_AIOWork(struct ARC_AIORing *ring, int max);
+
+/**
+ * Have a worker call work->func.
+ *
+ * Work is called in the order it was queued, ahead of rings.
+ *
+ * @return Zero if the work was queued, 1 if there are no workers, in
+ * which case it is up to the caller to do it.
+ * */
+int Arc_AIOQueueWork(struct ARC_AIOWork *work);
+
+/**
+ * Body of an AIO worker.
+ *
+ * Runs queued work, then executes rings with pending work until none
+ * are left.
+ * Intended to be the entry point of each kernel thread in the
+ * worker pool.
+ *
+ * @return The number of submissions executed and work items run.
+ * */
+int Arc_AIOWorker();
+
+/**
+ * Start the worker pool.
+ *
+ * Each worker is a kernel thread running Arc_AIOWorker, and sleeping
+ * while there is no work queued and no ring with pending work.
+ *
+ * @param int count - Number of workers to start.
+ * @return Zero if at least one worker was started.
+ * */
+int Arc_AIOStartWorkers(int count);
+
+/**
+ * Register or unregister a running worker.
+ *
+ * While no workers are registered, Arc_AIOSubmit executes
+ * the submitted batch before returning.
+ *
+ * @param int delta - +1 when a worker starts, -1 when it stops.
+ * */
+void Arc_AIORegisterWorker(int delta);
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * @file block.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Generic block device layer.
+ *
+ * Users describe I/O as bios, which the layer merges into requests
+ * of physically adjacent sectors. Requests are held by an elevator,
+ * which decides the order in which they are handed to the device
+ * driver. Drivers complete requests whenever the hardware finishes
+ * them, completing every bio of the request.
+*/
+#ifndef ARC_FS_BLOCK_H
+#define ARC_FS_BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lib/atomics.h>
+#include <lib/resource.h>
+
+/// Driver group of block device drivers.
+#define ARC_DRI_GROUP_BLOCK 1
+/// Index of the RAM disk driver in ARC_DRI_GROUP_BLOCK.
+#define ARC_DRI_RAMDISK 0
+/// Index of the virtio-blk driver in ARC_DRI_GROUP_BLOCK.
+#define ARC_DRI_VIRTIO_BLK 1
+
+#define ARC_BIO_READ  0
+#define ARC_BIO_WRITE 1
+
+/// Number of requests a device can have queued or in flight.
+#define ARC_BLOCK_QUEUE_DEPTH 128
+/// Number of buckets in the back merge hash (power of two).
+#define ARC_BLOCK_HASH_SIZE 64
+
+struct ARC_BlockDevice;
+
+/**
+ * A single contiguous transfer.
+ * */
+struct ARC_Bio {
+	/// ARC_BIO_READ or ARC_BIO_WRITE.
+	int op;
+	/// First sector of the transfer.
+	uint64_t sector;
+	/// Number of sectors to transfer.
+	uint64_t count;
+	/// Memory to transfer to or from, count * sector_size bytes.
+	void *buffer;
+	/// Result of the transfer (0: success, otherwise an errno), valid in end_io.
+	int status;
+	/// Called once the transfer is finished, may be called before Arc_SubmitBio returns.
+	void (*end_io)(struct ARC_Bio *bio);
+	/// Owned by the submitter.
+	void *private;
+	/// Next bio in the request.
+	struct ARC_Bio *next;
+};
+
+/**
+ * A run of bios which access adjacent sectors in the same direction.
+ * */
+struct ARC_BlockRequest {
+	/// ARC_BIO_READ or ARC_BIO_WRITE.
+	int op;
+	/// First sector of the request.
+	uint64_t sector;
+	/// Number of sectors in the request.
+	uint64_t count;
+	/// Number of bios in the request.
+	int segments;
+	/// Bios in ascending sector order.
+	struct ARC_Bio *head;
+	struct ARC_Bio *tail;
+	/// Monotonic time after which the request should be dispatched before anything else.
+	uint64_t deadline;
+	/// Links of the elevator's sorted list.
+	struct ARC_BlockRequest *prev;
+	struct ARC_BlockRequest *next;
+	/// Links of the elevator's arrival list.
+	struct ARC_BlockRequest *fifo_prev;
+	struct ARC_BlockRequest *fifo_next;
+	/// Next request in the same back merge bucket.
+	struct ARC_BlockRequest *hash_next;
+	/// Owned by the driver while the request is in flight.
+	void *driver_data;
+};
+
+/**
+ * Operations provided by a device driver.
+ * */
+struct ARC_BlockDeviceOps {
+	/// Start executing the request, the driver calls Arc_BlockEndRequest once it is done (non-zero: failed to start).
+	int (*submit)(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req);
+	/// Complete finished requests, for drivers which are not interrupt driven (optional).
+	int (*poll)(struct ARC_BlockDevice *dev);
+};
+
+/**
+ * An I/O scheduler.
+ *
+ * All callbacks are made with the device's lock held.
+ * */
+struct ARC_Elevator {
+	char *name;
+	int (*init)(struct ARC_BlockDevice *dev);
+	int (*uninit)(struct ARC_BlockDevice *dev);
+	/// Take a new request.
+	void (*add)(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req);
+	/// Forget a request which was merged into another.
+	void (*remove)(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req);
+	/// Take the next request to hand to the driver (NULL: none queued).
+	struct ARC_BlockRequest *(*dispatch)(struct ARC_BlockDevice *dev);
+	/// Find a queued request beginning at the given sector, for front merges (optional).
+	struct ARC_BlockRequest *(*find)(struct ARC_BlockDevice *dev, int op, uint64_t sector);
+	/// Get the queued request following req in sector order (optional).
+	struct ARC_BlockRequest *(*next)(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req);
+};
+
+struct ARC_BlockStats {
+	/// Bios submitted.
+	uint64_t bios;
+	/// Bios merged into an existing request.
+	uint64_t merges;
+	/// Requests merged into a neighbouring request.
+	uint64_t request_merges;
+	/// Requests handed to the driver.
+	uint64_t dispatched;
+	/// Sectors read and written.
+	uint64_t read_sectors;
+	uint64_t write_sectors;
+};
+
+struct ARC_BlockDevice {
+	/// Set by the driver before registering.
+	char *name;
+	/// Size of a sector in bytes (power of two, at most 0x1000).
+	uint32_t sector_size;
+	/// Number of sectors on the device.
+	uint64_t sector_count;
+	/// Largest request the device accepts in sectors (0: no limit).
+	uint64_t max_sectors;
+	/// Largest number of bios in a request (0: no limit).
+	int max_segments;
+	/// Largest number of requests in flight at once (0: ARC_BLOCK_QUEUE_DEPTH).
+	int max_in_flight;
+	struct ARC_BlockDeviceOps *ops;
+	void *driver_state;
+
+	/// Managed by the block layer.
+	ARC_GenericMutex lock;
+	struct ARC_Elevator *elevator;
+	void *elevator_state;
+	/// Number of outstanding Arc_BlockPlug calls.
+	int plugged;
+	/// Non-zero while requests are being dispatched.
+	int running;
+	/// Number of requests held by the elevator.
+	int queued;
+	/// Number of requests handed to the driver.
+	int in_flight;
+	/// Request most recently merged into or added.
+	struct ARC_BlockRequest *last_merge;
+	/// Queued requests by their end sector.
+	struct ARC_BlockRequest *hash[ARC_BLOCK_HASH_SIZE];
+	/// Unused requests.
+	struct ARC_BlockRequest *free;
+	struct ARC_BlockRequest *pool;
+	struct ARC_BlockStats stats;
+	struct ARC_BlockDevice *next;
+};
+
+extern struct ARC_Elevator Arc_NoopElevator;
+extern struct ARC_Elevator Arc_DeadlineElevator;
+
+/**
+ * Register a block device.
+ *
+ * @param struct ARC_BlockDevice *dev - The device, with the driver supplied fields filled in.
+ * @param char *elevator - Name of the elevator to use (NULL: deadline).
+ * @return zero on success.
+ * */
+int Arc_BlockRegister(struct ARC_BlockDevice *dev, char *elevator);
+
+/**
+ * Unregister a block device.
+ *
+ * Queued requests are completed before returning.
+ * */
+int Arc_BlockUnregister(struct ARC_BlockDevice *dev);
+
+/**
+ * Find a registered block device by name.
+ * */
+struct ARC_BlockDevice *Arc_BlockFind(char *name);
+
+/**
+ * Switch the elevator of a device.
+ *
+ * Queued requests are completed before switching.
+ * */
+int Arc_BlockSetElevator(struct ARC_BlockDevice *dev, char *name);
+
+/**
+ * Submit a bio.
+ *
+ * The bio is merged into a queued request if possible. Unless the
+ * device is plugged, queued requests are dispatched before returning.
+ * Overlapping bios are not ordered against each other, wait for the
+ * first to complete before submitting the second.
+ *
+ * @return zero if the bio was queued, bio->end_io is not called otherwise.
+ * */
+int Arc_SubmitBio(struct ARC_BlockDevice *dev, struct ARC_Bio *bio);
+
+/**
+ * Hold back dispatching so that a batch of bios can be merged.
+ * */
+void Arc_BlockPlug(struct ARC_BlockDevice *dev);
+
+/**
+ * Undo Arc_BlockPlug, dispatching if this was the last plug.
+ * */
+void Arc_BlockUnplug(struct ARC_BlockDevice *dev);
+
+/**
+ * Hand queued requests to the driver until the device is full.
+ * */
+void Arc_BlockRun(struct ARC_BlockDevice *dev);
+
+/**
+ * Called by drivers once a request is finished.
+ *
+ * @param int status - 0 on success, otherwise an errno given to every bio.
+ * */
+void Arc_BlockEndRequest(struct ARC_BlockDevice *dev, struct ARC_BlockRequest *req, int status);
+
+/**
+ * Synchronously transfer sectors.
+ *
+ * Transfers larger than the device's limits are split.
+ *
+ * @return zero on success, otherwise an errno.
+ * */
+int Arc_BlockIO(struct ARC_BlockDevice *dev, int op, uint64_t sector, uint64_t count, void *buffer);
+
+/**
+ * Synchronously transfer consecutive sectors to or from several buffers.
+ *
+ * Each buffer becomes its own bio, all of which are submitted under a
+ * plug so that they can be merged into as few requests as possible.
+ *
+ * @param struct ARC_IOVec *iov - The buffers, each a multiple of the sector size long.
+ * @return zero on success, otherwise an errno.
+ * */
+int Arc_BlockIOV(struct ARC_BlockDevice *dev, int op, uint64_t sector, struct ARC_IOVec *iov, int iovcnt);
+
+#endif
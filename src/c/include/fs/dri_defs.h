@@ -5,5 +5,6 @@
 #define ARC_DRI_EXT2      2
 #define ARC_DRI_BUFFER    4
 #define ARC_DRI_FIFO      6
+#define ARC_DRI_BLOCK     8
 
 #endif
@@ -0,0 +1,292 @@
+/**
+ * @file ext2.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * On disk structures of the EXT2 filesystem and the state shared
+ * between the EXT2 super and file drivers.
+*/
+#ifndef ARC_FS_EXT2_H
+#define ARC_FS_EXT2_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <lib/resource.h>
+#include <lib/atomics.h>
+
+#define ARC_EXT2_MAGIC 0xEF53
+#define ARC_EXT2_SUPER_OFFSET 1024
+#define ARC_EXT2_ROOT_INO 2
+#define ARC_EXT2_GOOD_OLD_INODE_SIZE 128
+#define ARC_EXT2_GOOD_OLD_FIRST_INO 11
+
+#define ARC_EXT2_NDIR_BLOCKS 12
+#define ARC_EXT2_IND_BLOCK   12
+#define ARC_EXT2_DIND_BLOCK  13
+#define ARC_EXT2_TIND_BLOCK  14
+
+#define ARC_EXT2_INCOMPAT_FILETYPE 0x0002
+#define ARC_EXT2_RO_COMPAT_SPARSE_SUPER 0x0001
+#define ARC_EXT2_RO_COMPAT_LARGE_FILE   0x0002
+#define ARC_EXT2_RO_COMPAT_BTREE_DIR    0x0004
+
+#define ARC_EXT2_INDEX_FL 0x00001000
+
+#define ARC_EXT2_FT_UNKNOWN  0
+#define ARC_EXT2_FT_REG_FILE 1
+#define ARC_EXT2_FT_DIR      2
+#define ARC_EXT2_FT_CHRDEV   3
+#define ARC_EXT2_FT_BLKDEV   4
+#define ARC_EXT2_FT_FIFO     5
+#define ARC_EXT2_FT_SOCK     6
+#define ARC_EXT2_FT_SYMLINK  7
+
+struct ARC_Ext2Super {
+	uint32_t inodes_count;
+	uint32_t blocks_count;
+	uint32_t r_blocks_count;
+	uint32_t free_blocks_count;
+	uint32_t free_inodes_count;
+	uint32_t first_data_block;
+	uint32_t log_block_size;
+	uint32_t log_frag_size;
+	uint32_t blocks_per_group;
+	uint32_t frags_per_group;
+	uint32_t inodes_per_group;
+	uint32_t mtime;
+	uint32_t wtime;
+	uint16_t mnt_count;
+	uint16_t max_mnt_count;
+	uint16_t magic;
+	uint16_t state;
+	uint16_t errors;
+	uint16_t minor_rev_level;
+	uint32_t lastcheck;
+	uint32_t checkinterval;
+	uint32_t creator_os;
+	uint32_t rev_level;
+	uint16_t def_resuid;
+	uint16_t def_resgid;
+	// Revision 1 and later
+	uint32_t first_ino;
+	uint16_t inode_size;
+	uint16_t block_group_nr;
+	uint32_t feature_compat;
+	uint32_t feature_incompat;
+	uint32_t feature_ro_compat;
+	uint8_t uuid[16];
+	char volume_name[16];
+	char last_mounted[64];
+	uint32_t algo_bitmap;
+	uint8_t reserved[820];
+}__attribute__((packed));
+
+struct ARC_Ext2GroupDesc {
+	uint32_t block_bitmap;
+	uint32_t inode_bitmap;
+	uint32_t inode_table;
+	uint16_t free_blocks_count;
+	uint16_t free_inodes_count;
+	uint16_t used_dirs_count;
+	uint16_t pad;
+	uint8_t reserved[12];
+}__attribute__((packed));
+
+/// Naturally aligned, so not packed to allow taking pointers to block[].
+struct ARC_Ext2Inode {
+	uint16_t mode;
+	uint16_t uid;
+	uint32_t size;
+	uint32_t atime;
+	uint32_t ctime;
+	uint32_t mtime;
+	uint32_t dtime;
+	uint16_t gid;
+	uint16_t links_count;
+	/// Number of 512 byte sectors allocated.
+	uint32_t blocks;
+	uint32_t flags;
+	uint32_t osd1;
+	uint32_t block[15];
+	uint32_t generation;
+	uint32_t file_acl;
+	/// High 32 bits of the size of regular files.
+	uint32_t size_high;
+	uint32_t faddr;
+	uint8_t osd2[12];
+};
+
+struct ARC_Ext2DirEntry {
+	uint32_t inode;
+	uint16_t rec_len;
+	uint8_t name_len;
+	uint8_t file_type;
+	char name[];
+}__attribute__((packed));
+
+/**
+ * A cached block of the device.
+ * */
+struct ARC_Ext2Buffer {
+	/// Block number, (uint64_t)-1 if unused.
+	uint64_t block;
+	uint8_t *data;
+	/// Number of users, buffers in use are never evicted.
+	int refs;
+	int dirty;
+	struct ARC_Ext2Buffer *hash_next;
+	/// Least recently used is at the tail.
+	struct ARC_Ext2Buffer *lru_prev;
+	struct ARC_Ext2Buffer *lru_next;
+};
+
+#define ARC_EXT2_CACHE_BUFFERS 128
+#define ARC_EXT2_CACHE_BUCKETS 64
+
+/**
+ * State of a mounted EXT2 filesystem.
+ * */
+struct ARC_Ext2State {
+	struct ARC_Resource *resource;
+	/// The file or device on which the filesystem resides.
+	struct ARC_File *device;
+	/// Serializes all access to the filesystem.
+	ARC_GenericMutex lock;
+	int read_only;
+	uint32_t block_size;
+	uint32_t group_count;
+	uint32_t inode_size;
+	uint32_t first_ino;
+	/// Pinned buffer holding the superblock.
+	struct ARC_Ext2Buffer *super_buffer;
+	struct ARC_Ext2Super *super;
+	/// Pinned buffers holding the group descriptor table.
+	struct ARC_Ext2Buffer **gdt_buffers;
+	uint32_t gdt_blocks;
+	struct ARC_Ext2Buffer buffers[ARC_EXT2_CACHE_BUFFERS];
+	struct ARC_Ext2Buffer *hash[ARC_EXT2_CACHE_BUCKETS];
+	struct ARC_Ext2Buffer *lru_head;
+	struct ARC_Ext2Buffer *lru_tail;
+	/// Name handed out by readdir.
+	char readdir_name[256];
+	/// Scratch space of Arc_Ext2Sync.
+	struct ARC_Ext2Buffer *sync_order[ARC_EXT2_CACHE_BUFFERS];
+	struct ARC_IOVec sync_iov[ARC_EXT2_CACHE_BUFFERS];
+};
+
+/**
+ * Cache of the last indirect table used to map a file's blocks.
+ *
+ * Consecutive blocks share their last level table, so
+ * sequential access only walks the tree once per table.
+ * */
+struct ARC_Ext2MapCache {
+	/// Physical block of the table, 0 if the cache is empty.
+	uint32_t leaf;
+	/// Logical block mapped by the first pointer in leaf.
+	uint64_t first;
+	/// Last block allocated for the file, the goal for the next.
+	uint32_t last_alloc;
+};
+
+/**
+ * Get a block through the buffer cache.
+ *
+ * The caller must hold state->lock, and release the buffer
+ * with Arc_Ext2PutBuffer.
+ *
+ * @param struct ARC_Ext2State *state - The filesystem.
+ * @param uint64_t block - The block number.
+ * @param int read - Zero if the block will be wholly overwritten, skipping the read from the device.
+ * @return The buffer, NULL if it could not be read or every buffer is in use.
+ * */
+struct ARC_Ext2Buffer *Arc_Ext2GetBuffer(struct ARC_Ext2State *state, uint64_t block, int read);
+
+/**
+ * Release a buffer gotten by Arc_Ext2GetBuffer.
+ *
+ * @param struct ARC_Ext2State *state - The filesystem.
+ * @param struct ARC_Ext2Buffer *buffer - The buffer.
+ * @param int dirty - Non-zero if the buffer was modified.
+ * */
+void Arc_Ext2PutBuffer(struct ARC_Ext2State *state, struct ARC_Ext2Buffer *buffer, int dirty);
+
+/**
+ * Write all modified buffers back to the device.
+ * */
+int Arc_Ext2Sync(struct ARC_Ext2State *state);
+
+int Arc_Ext2ReadInode(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode);
+int Arc_Ext2WriteInode(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode);
+
+/**
+ * Find the inode at path.
+ *
+ * @param struct ARC_Ext2State *state - The filesystem.
+ * @param char *path - Path relative to the root of the filesystem.
+ * @return The inode number, 0 if it does not exist.
+ * */
+uint32_t Arc_Ext2Lookup(struct ARC_Ext2State *state, char *path);
+
+/**
+ * Map a logical block of an inode to a block of the device.
+ *
+ * The caller must hold state->lock. If a block is allocated,
+ * inode is modified and must be written back by the caller.
+ *
+ * @param struct ARC_Ext2State *state - The filesystem.
+ * @param uint32_t ino - The inode number.
+ * @param struct ARC_Ext2Inode *inode - The inode.
+ * @param uint64_t index - The logical block.
+ * @param int create - Non-zero to allocate the block if it is a hole.
+ * @param struct ARC_Ext2MapCache *cache - Per inode mapping cache, may be NULL.
+ * @return The block, 0 for a hole or if allocation failed.
+ * */
+uint32_t Arc_Ext2MapBlock(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode, uint64_t index, int create, struct ARC_Ext2MapCache *cache);
+
+/**
+ * Free all blocks of an inode from the logical block keep onwards.
+ *
+ * The caller must hold state->lock and write back inode.
+ * */
+void Arc_Ext2Trim(struct ARC_Ext2State *state, struct ARC_Ext2Inode *inode, uint64_t keep);
+
+/**
+ * Allocate a block, preferring goal and then the group of ino.
+ *
+ * The block is zeroed in the cache before it is returned.
+ *
+ * @return The block number, 0 if the filesystem is full or there was no
+ * buffer to zero the block in.
+ * */
+uint32_t Arc_Ext2AllocBlock(struct ARC_Ext2State *state, uint32_t ino, uint32_t goal);
+
+/**
+ * Free a block.
+ * */
+void Arc_Ext2FreeBlock(struct ARC_Ext2State *state, uint32_t block);
+
+void Arc_Ext2InodeStat(struct ARC_Ext2State *state, uint32_t ino, struct ARC_Ext2Inode *inode, struct stat *stat);
+
+#endif
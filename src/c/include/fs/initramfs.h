@@ -0,0 +1,170 @@
+/**
+ * @file initramfs.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Structures shared between the initramfs super and file drivers.
+*/
+#ifndef ARC_FS_INITRAMFS_H
+#define ARC_FS_INITRAMFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <lib/resource.h>
+
+#define ARC_CPIO_BIN_MAGIC  0070707
+#define ARC_CPIO_NEWC_MAGIC "070701"
+#define ARC_CPIO_CRC_MAGIC  "070702"
+
+#define ARC_NAME_OFFSET (sizeof(struct ARC_HeaderCPIO))
+#define ARC_NAME_SIZE(header) (header->namesize + (header->namesize & 1))
+#define ARC_DATA_OFFSET(header) (ARC_NAME_OFFSET + ARC_NAME_SIZE(header))
+#define ARC_FILE_SIZE(header) (((uint32_t)header->filesize[0] << 16) | header->filesize[1])
+#define ARC_DATA_SIZE(header) (ARC_FILE_SIZE(header) + (ARC_FILE_SIZE(header) & 1))
+
+struct ARC_HeaderCPIO {
+	uint16_t magic;
+	uint16_t device;
+	uint16_t inode;
+	uint16_t mode;
+	uint16_t uid;
+	uint16_t gid;
+	uint16_t nlink;
+	uint16_t rdev;
+	uint16_t mod_time[2];
+	uint16_t namesize;
+	uint16_t filesize[2];
+}__attribute__((packed));
+
+/**
+ * Header of the "new" portable (newc) and crc CPIO formats.
+ *
+ * All fields but magic are 8 ASCII hex digits. The name
+ * follows the header and is padded so that header and name
+ * together are a multiple of 4 bytes long, the data is
+ * likewise padded to a multiple of 4 bytes.
+ * */
+struct ARC_HeaderNewc {
+	char magic[6];
+	char inode[8];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char nlink[8];
+	char mod_time[8];
+	char filesize[8];
+	char dev_major[8];
+	char dev_minor[8];
+	char rdev_major[8];
+	char rdev_minor[8];
+	char namesize[8];
+	char check[8];
+}__attribute__((packed));
+
+/**
+ * Arguments given to the initramfs super driver on initialization.
+ * */
+struct ARC_InitramfsArgs {
+	/// Base of the image, either a CPIO archive or a gzip'd one.
+	void *base;
+	/// Size of the image in bytes.
+	size_t size;
+};
+
+/**
+ * A file or directory in the initramfs.
+ * */
+struct ARC_InitramfsEntry {
+	/// Path of the entry relative to the root of the archive (no leading or trailing '/').
+	char *name;
+	/// Length of name.
+	size_t name_length;
+	/// Pointer to the data of the entry.
+	void *data;
+	/// Status of the entry, st_size is the size of the data.
+	struct stat stat;
+	/// Next entry in the same hash bucket.
+	struct ARC_InitramfsEntry *hash_next;
+	/// The directory this entry is in.
+	struct ARC_InitramfsEntry *parent;
+	/// Head of the list of entries in this directory.
+	struct ARC_InitramfsEntry *children;
+	/// Next entry in the parent directory.
+	struct ARC_InitramfsEntry *next;
+};
+
+/**
+ * State of a mounted initramfs image.
+ *
+ * Built once when the super driver is initialized, shared
+ * with the file drivers of the files on the mount.
+ * */
+struct ARC_InitramfsState {
+	struct ARC_Resource *resource;
+	/// Base of the archive.
+	void *initramfs_base;
+	/// Size of the archive in bytes.
+	size_t initramfs_size;
+	/// Number of pages allocated for the archive if it was decompressed, otherwise 0.
+	size_t unpacked_pages;
+	/// Hash table of path -> entry.
+	struct ARC_InitramfsEntry **table;
+	/// Number of buckets in table (a power of two).
+	size_t table_size;
+	/// Entries for every file in the archive.
+	struct ARC_InitramfsEntry *entries;
+	/// Number of elements in entries.
+	size_t entry_count;
+	/// Number of elements entries has room for.
+	size_t entry_capacity;
+	/// Root of the directory tree.
+	struct ARC_InitramfsEntry root;
+};
+
+/**
+ * Find an entry in the initramfs.
+ *
+ * Leading "/" and "./", as well as trailing "/", are ignored.
+ *
+ * @param struct ARC_InitramfsState *state - The initramfs to search.
+ * @param char *path - The path of the entry relative to the root of the archive.
+ * @return The entry, NULL if it does not exist.
+ * */
+struct ARC_InitramfsEntry *Arc_InitramfsFind(struct ARC_InitramfsState *state, char *path);
+
+/**
+ * Borrow a pointer to the data of an open initramfs file.
+ *
+ * The archive is resident in memory for the lifetime of the
+ * kernel, so the data can be read in place without copying.
+ * The pointer remains valid while the file is open.
+ *
+ * @param struct ARC_File *file - The open file.
+ * @param long offset - The offset into the file.
+ * @param size_t *length - Set to the number of bytes readable from the returned pointer.
+ * @return A pointer to the data at offset, NULL if the file is not on an initramfs.
+ * */
+const void *Arc_InitramfsBorrow(struct ARC_File *file, long offset, size_t *length);
+
+#endif
@@ -38,6 +38,7 @@
 #define ARC_VFS_N_LINK  5
 #define ARC_VFS_N_BUFF  6
 #define ARC_VFS_N_FIFO  7
+#define ARC_VFS_N_BLOCK 8
 
 #define ARC_VFS_FS_EXT2      1
 #define ARC_VFS_FS_INITRAMFS 2
@@ -52,6 +53,7 @@
 #include <sys/stat.h>
 #include <lib/resource.h>
 #include <lib/atomics.h>
+#include <lib/rcu.h>
 #include <stdbool.h>
 
 /**
@@ -60,14 +62,18 @@
 struct ARC_VFSNode {
 	/// Lock on branching of this node (link, parent, children, next, prev, name, and the node itself)
 	struct ARC_QLock branch_lock;
-	/// Lock on the properties of this node (type, mount, stat, is_open)
+	/// Lock on the properties of this node (type, mount, is_open)
 	ARC_GenericMutex property_lock;
+	/// Sequence lock on stat, read with Arc_SeqReadBegin / Arc_SeqReadRetry.
+	ARC_SeqLock stat_lock;
 	/// Pointer to the device. References can be found through consulting resource.
 	struct ARC_Resource *resource;
 	/// The type of node.
 	int type;
 	/// Number of references to this node (> 0 means node and children cannot be destroyed).
 	uint64_t ref_count;
+	/// Bumped after every write or truncate through any handle, readahead buffers filled before are stale.
+	_Atomic uint64_t generation;
 	bool is_open;
 	/// The name of this node.
 	char *name;
@@ -85,6 +91,8 @@ struct ARC_VFSNode {
 	struct ARC_VFSNode *next;
 	/// Pointer to the previous element in the current linked list.
 	struct ARC_VFSNode *prev;
+	/// Frees the node once no reader can still reach it.
+	struct ARC_RCUHead rcu;
 };
 
 /**
@@ -139,7 +147,8 @@ int Arc_OpenVFS(char *path, int flags, uint32_t mode, int link_depth, void **ret
  * @param size_t size - The size of each word to read.
  * @param size_t count - The number of words to read.
  * @param struct ARC_VFSNode *file - The file to read.
- * @return The number of words read.
+ * @return The number of words read, negative on failure (-EAGAIN if
+ * non-blocking and nothing is there yet).
  * */
 int Arc_ReadVFS(void *buffer, size_t size, size_t count, struct ARC_File *file);
 /**
@@ -147,6 +156,47 @@ int Arc_ReadVFS(void *buffer, size_t size, size_t count, struct ARC_File *file);
  * */
 int Arc_HeadlessReadVFS(void *buffer, size_t size, size_t count, struct ARC_VFSNode *node);
 
+/**
+ * Read the given file at an offset.
+ *
+ * Reads /count words of /a size bytes from /a file, starting
+ * at /a offset, into /a buffer. The offset of /a file is neither
+ * used nor changed.
+ *
+ * @param void *buffer - The buffer into which to read the file data.
+ * @param size_t size - The size of each word to read.
+ * @param size_t count - The number of words to read.
+ * @param long offset - The offset in the file from which to start reading.
+ * @param struct ARC_File *file - The file to read.
+ * @return The number of bytes read.
+ * */
+int Arc_PReadVFS(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file);
+
+/**
+ * Scatter read the given file.
+ *
+ * Fills each of the /a iovcnt buffers described by /a iov in
+ * order, starting at the file's current offset, which is
+ * advanced by the amount read.
+ *
+ * @param struct ARC_IOVec *iov - The buffers into which to read.
+ * @param int iovcnt - The number of elements in /a iov.
+ * @param struct ARC_File *file - The file to read.
+ * @return The number of bytes read.
+ * */
+int Arc_ReadVVFS(struct ARC_IOVec *iov, int iovcnt, struct ARC_File *file);
+
+/**
+ * Scatter read the given file at an offset.
+ *
+ * Like Arc_ReadVVFS, starting at /a offset. The offset of /a file
+ * is neither used nor changed.
+ *
+ * @param long offset - The offset in the file from which to start reading.
+ * @return The number of bytes read.
+ * */
+int Arc_PReadVVFS(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file);
+
 /**
  * Write to the given file.
  *
@@ -157,7 +207,8 @@ int Arc_HeadlessReadVFS(void *buffer, size_t size, size_t count, struct ARC_VFSN
  * @param size_t size - The size of each word to write.
  * @param size_t count - The number of words to write.
  * @param struct ARC_VFSNode *file - The file to write.
- * @return The number of words written.
+ * @return The number of words written, negative on failure (-EAGAIN if
+ * non-blocking and there is no room).
  * */
 int Arc_WriteVFS(void *buffer, size_t size, size_t count, struct ARC_File *file);
 
@@ -166,6 +217,47 @@ int Arc_WriteVFS(void *buffer, size_t size, size_t count, struct ARC_File *file)
  * */
 int Arc_HeadlessWriteVFS(void *buffer, size_t size, size_t count, struct ARC_VFSNode *node);
 
+/**
+ * Write to the given file at an offset.
+ *
+ * Writes /count words of /a size bytes from /a buffer into
+ * /a file, starting at /a offset. The offset of /a file is
+ * neither used nor changed.
+ *
+ * @param void *buffer - The buffer from which to read the data.
+ * @param size_t size - The size of each word to write.
+ * @param size_t count - The number of words to write.
+ * @param long offset - The offset in the file at which to start writing.
+ * @param struct ARC_File *file - The file to write.
+ * @return The number of bytes written.
+ * */
+int Arc_PWriteVFS(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file);
+
+/**
+ * Gather write to the given file.
+ *
+ * Writes each of the /a iovcnt buffers described by /a iov in
+ * order, starting at the file's current offset, which is
+ * advanced by the amount written.
+ *
+ * @param struct ARC_IOVec *iov - The buffers from which to write.
+ * @param int iovcnt - The number of elements in /a iov.
+ * @param struct ARC_File *file - The file to write.
+ * @return The number of bytes written.
+ * */
+int Arc_WriteVVFS(struct ARC_IOVec *iov, int iovcnt, struct ARC_File *file);
+
+/**
+ * Gather write to the given file at an offset.
+ *
+ * Like Arc_WriteVVFS, starting at /a offset. The offset of /a file
+ * is neither used nor changed.
+ *
+ * @param long offset - The offset in the file at which to start writing.
+ * @return The number of bytes written.
+ * */
+int Arc_PWriteVVFS(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file);
+
 /**
  * Change the offset in the given file.
  *
@@ -176,6 +268,47 @@ int Arc_HeadlessWriteVFS(void *buffer, size_t size, size_t count, struct ARC_VFS
  * */
 int Arc_SeekVFS(struct ARC_File *file, long offset, int whence);
 
+/**
+ * Set the size of the given file.
+ *
+ * Data past /a length is discarded, growing the file
+ * reads back zeroes. The file offset is not changed.
+ *
+ * @param struct ARC_File *file - The file to truncate.
+ * @param size_t length - The new size of the file in bytes.
+ * @return zero on success.
+ * */
+int Arc_TruncateVFS(struct ARC_File *file, size_t length);
+
+/**
+ * Map the given file into memory without copying it.
+ *
+ * The driver of the file hands out the physical pages in which
+ * the file's data already resides, these are then mapped.
+ *
+ * If /a address is NULL, the data is used in place through the
+ * HHDM, which requires the requested range to be physically
+ * contiguous. Otherwise the pages are mapped at /a address, which
+ * must be page aligned, with /a flags (see Arc_MapPageVMM).
+ *
+ * As file data need not start on a page boundary, the returned
+ * pointer is that of the byte at /a offset, which may lie within
+ * the first mapped page.
+ *
+ * Writable mappings need the file to be open for writing, and are
+ * refused by drivers whose data is read only. Pages mapped before a
+ * failure are unmapped again.
+ *
+ * @param void *address - The page aligned virtual address at which to map, or NULL.
+ * @param size_t size - The number of bytes to map.
+ * @param uint32_t flags - The flags with which to map the pages.
+ * @param struct ARC_File *file - The file to map.
+ * @param long offset - The offset in the file from which to map.
+ * @param void **ret - Set to the address of the byte at /a offset.
+ * @return zero on success.
+ * */
+int Arc_MMapVFS(void *address, size_t size, uint32_t flags, struct ARC_File *file, long offset, void **ret);
+
 /**
  * Close the given file in the VFS.
  *
@@ -36,6 +36,11 @@
 
 #define ARC_HANG for (;;) __asm__("hlt");
 
+// For code which may run while another context's extended state is in
+// the registers (interrupt handlers, the switch path), the compiler must
+// not use SSE registers on its own
+#define ARC_NO_FPU __attribute__((target("general-regs-only")))
+
 #ifdef ARC_DEBUG_ENABLE
 
 #include <interface/printf.h>
@@ -29,30 +29,123 @@
 
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /// Generic spinlock
 typedef _Atomic int ARC_GenericSpinlock;
 
-/// Generic mutex
+/// Generic mutex, contended lockers sleep on it as a futex
 typedef _Atomic int ARC_GenericMutex;
 
+struct ARC_Thread;
+
+/// Most queue locks a thread can hold or wait on at once.
+#define ARC_QLOCK_NODES 16
+
+/**
+ * Queue entry of a thread on a queue lock.
+ *
+ * Kept in the thread's struct ARC_Thread, so locking allocates nothing.
+ * */
+struct ARC_QLockNode {
+	struct ARC_QLockNode *_Atomic next;
+	/// Cleared by the previous owner to hand the lock over.
+	_Atomic int locked;
+	/// Times the owner has taken the lock without releasing it.
+	uint32_t depth;
+	/// Lock the node is queued on, NULL if the node is free.
+	struct ARC_QLock *lock;
+	int64_t tid;
+	/// Thread the node belongs to, woken by the handover.
+	struct ARC_Thread *thread;
+};
+
 /**
  * Queue lock structure
+ *
+ * An MCS lock which a thread may take again while holding it.
  * */
 struct ARC_QLock {
-	/// Synchronization lock for the queue
-	ARC_GenericMutex lock;
 	bool is_frozen;
-	/// Pointer to the current owner of the lock
-	void *next;
-	/// Pointer to the last element in the queue
-	void *last;
+	/// Node of the current owner of the lock
+	struct ARC_QLockNode *_Atomic owner;
+	/// Last node in the queue, NULL if the lock is free
+	struct ARC_QLockNode *_Atomic tail;
+};
+
+/**
+ * Ticket lock.
+ *
+ * Waiters are let in in the order they arrived.
+ * */
+struct ARC_TicketLock {
+	/// Next ticket to be handed out.
+	_Atomic uint32_t next;
+	/// Ticket which holds the lock.
+	_Atomic uint32_t serving;
+};
+
+/**
+ * Queue entry of an MCS lock.
+ *
+ * Each locker brings its own, usually on its stack, and spins only
+ * on its own locked field. It must stay alive until the matching
+ * unlock.
+ * */
+struct ARC_MCSNode {
+	struct ARC_MCSNode *_Atomic next;
+	_Atomic int locked;
+};
+
+/**
+ * MCS queue lock.
+ * */
+struct ARC_MCSLock {
+	/// Last node in the queue, NULL if the lock is free.
+	struct ARC_MCSNode *_Atomic tail;
+};
+
+/**
+ * Reader-writer lock.
+ *
+ * Any number of readers, or one writer. Writers are preferred: once
+ * one is waiting, new readers hold back until it is done.
+ * */
+struct ARC_RWLock {
+	/// Readers in ARC_RWLOCK_READER units, plus ARC_RWLOCK_WRITER while written.
+	_Atomic uint32_t state;
+	/// Writers waiting for the lock.
+	_Atomic uint32_t waiting;
 };
 
+#define ARC_RWLOCK_WRITER 1
+#define ARC_RWLOCK_READER 2
+
+/**
+ * Sequence lock.
+ *
+ * For small plain data copied out by readers. Readers take no lock,
+ * they copy and retry if a writer was active meanwhile.
+ *
+ * uint32_t seq;
+ * do {
+ *	seq = Arc_SeqReadBegin(&lock);
+ *	copy = data;
+ * } while (Arc_SeqReadRetry(&lock, seq));
+ * */
+typedef struct ARC_SeqLock {
+	/// Odd while a write is in progress.
+	_Atomic uint32_t sequence;
+	/// Serializes writers.
+	ARC_GenericSpinlock lock;
+} ARC_SeqLock;
+
+// Test, then test-and-set, pausing while the lock is seen taken
 #define ARC_GENERIC_LOCK(__lock__) \
-	while (atomic_flag_test_and_set_explicit(__lock__, memory_order_acquire)) __builtin_ia32_pause();
+	while (atomic_exchange_explicit(__lock__, 1, memory_order_acquire)) \
+		while (atomic_load_explicit(__lock__, memory_order_relaxed)) __builtin_ia32_pause();
 #define ARC_GENERIC_UNLOCK(__lock__) \
-	atomic_flag_clear_explicit(__lock__, memory_order_release)
+	atomic_store_explicit(__lock__, 0, memory_order_release)
 
 /**
  * Initialize dynamic qlock
@@ -75,41 +168,111 @@ int Arc_QLockUninit(struct ARC_QLock *lock);
 int Arc_QLockStaticInit(struct ARC_QLock *head);
 
 /**
- * Enqueue calling thread.
+ * Take a queue lock.
  *
- * Enqueue the calling thread into the provided lock.
+ * Enqueue the calling thread into the provided lock, and wait
+ * until the lock is handed over. Taking a lock the thread already
+ * holds only counts the nesting.
  *
  * @struct ARC_QLock *lock - The lock into which the calling thread should be enqueued.
- * @return tid of the current thread upon success (>= 0), -1: thread owns lock, -2: failed
- * to enqueue thread.
+ * @return 0 once the lock is held, -2: no queue node left for the thread, -3: the
+ * lock is frozen.
  * */
 int Arc_QLock(struct ARC_QLock *lock);
 
 /**
- * Yield current thread to lock owner thread.
+ * Wait for the calling thread's turn.
  *
- * If the provided tid is not equivalent to
- * lock->next->tid, then the scheduler will be
- * asked to yield the calling thread to the thread
- * which owns the lock.
+ * Returns once the calling thread owns the lock, immediately if it
+ * already does or is not queued on it.
  * */
 void Arc_QYield(struct ARC_QLock *lock);
 
 /**
- * Dequeue current lock owner.
+ * Release a queue lock.
  *
- * Dequeues the current lock owner, which should
- * be the caller.
+ * Once the outermost Arc_QLock is matched, ownership is handed to the
+ * next thread in the queue.
  *
  * @param struct ARC_QLock *lock - Lock from which to dequeue current thread.
- * @return 0: upon succes, 1: upon current lock owner tid and calling thread tid
- * mismatch.
+ * @return 0: upon succes, -1: the calling thread does not own the lock.
  * */
 int Arc_QUnlock(struct ARC_QLock *lock);
 
 int Arc_QFreeze(struct ARC_QLock *head);
 int Arc_QThaw(struct ARC_QLock *head);
 
+/**
+ * Disable interrupts.
+ *
+ * @return The RFLAGS before, to be given to Arc_IRQRestore.
+ * */
+uint64_t Arc_IRQSave();
+
+/**
+ * Enable interrupts again if they were enabled in flags.
+ * */
+void Arc_IRQRestore(uint64_t flags);
+
+/**
+ * Take a test-and-test-and-set spinlock.
+ *
+ * While the lock is held the waiter only reads it, backing off with
+ * an exponentially growing number of pauses.
+ * */
+void Arc_SpinlockLock(ARC_GenericSpinlock *lock);
+
+/**
+ * Try to take a spinlock once.
+ *
+ * @return 1 if the lock was taken.
+ * */
+int Arc_SpinlockTryLock(ARC_GenericSpinlock *lock);
+void Arc_SpinlockUnlock(ARC_GenericSpinlock *lock);
+uint64_t Arc_SpinlockLockIRQSave(ARC_GenericSpinlock *lock);
+void Arc_SpinlockUnlockIRQRestore(ARC_GenericSpinlock *lock, uint64_t flags);
+
+int Arc_TicketLockStaticInit(struct ARC_TicketLock *lock);
+void Arc_TicketLock(struct ARC_TicketLock *lock);
+void Arc_TicketUnlock(struct ARC_TicketLock *lock);
+uint64_t Arc_TicketLockIRQSave(struct ARC_TicketLock *lock);
+void Arc_TicketUnlockIRQRestore(struct ARC_TicketLock *lock, uint64_t flags);
+
+int Arc_MCSLockStaticInit(struct ARC_MCSLock *lock);
+/**
+ * Queue on an MCS lock.
+ *
+ * @param struct ARC_MCSNode *node - The caller's queue entry, given again to Arc_MCSUnlock.
+ * */
+void Arc_MCSLock(struct ARC_MCSLock *lock, struct ARC_MCSNode *node);
+void Arc_MCSUnlock(struct ARC_MCSLock *lock, struct ARC_MCSNode *node);
+uint64_t Arc_MCSLockIRQSave(struct ARC_MCSLock *lock, struct ARC_MCSNode *node);
+void Arc_MCSUnlockIRQRestore(struct ARC_MCSLock *lock, struct ARC_MCSNode *node, uint64_t flags);
+
+int Arc_RWLockStaticInit(struct ARC_RWLock *lock);
+void Arc_RWReadLock(struct ARC_RWLock *lock);
+void Arc_RWReadUnlock(struct ARC_RWLock *lock);
+void Arc_RWWriteLock(struct ARC_RWLock *lock);
+void Arc_RWWriteUnlock(struct ARC_RWLock *lock);
+
+int Arc_SeqLockStaticInit(ARC_SeqLock *lock);
+
+/**
+ * Start a read.
+ *
+ * @return The sequence to give to Arc_SeqReadRetry.
+ * */
+uint32_t Arc_SeqReadBegin(ARC_SeqLock *lock);
+
+/**
+ * End a read.
+ *
+ * @return Non-zero if a write overlapped the read, which must be redone.
+ * */
+int Arc_SeqReadRetry(ARC_SeqLock *lock, uint32_t sequence);
+void Arc_SeqWriteLock(ARC_SeqLock *lock);
+void Arc_SeqWriteUnlock(ARC_SeqLock *lock);
+
 int Arc_MutexInit(ARC_GenericMutex **mutex);
 int Arc_MutexUninit(ARC_GenericMutex *mutex);
 int Arc_MutexStaticInit(ARC_GenericMutex *mutex);
@@ -0,0 +1,108 @@
+/**
+ * @file clock.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Timekeeping.
+ *
+ * The clocks are computed from a free running counter, the invariant
+ * TSC when the CPU has one. The parameters to do so live on a page of
+ * their own, which is also mapped read-only for userland at
+ * ARC_CLOCK_PAGE_USER, so that it can read the clocks without entering
+ * the kernel:
+ *
+ *	do {
+ *		wait while sequence is odd
+ *		read mode, cycle_base, ns_base, mult, real_offset
+ *		cycles = rdtsc
+ *	} while (sequence changed)
+ *
+ *	monotonic = ns_base + (((cycles - cycle_base) * mult) >> 32)
+ *	realtime = monotonic + real_offset
+ *
+ * with a 128-bit product. If mode is not ARC_CLOCK_MODE_TSC the counter
+ * cannot be read from userland, and CLOCK_GET has to be used.
+*/
+#ifndef ARC_LIB_CLOCK_H
+#define ARC_LIB_CLOCK_H
+
+#include <lib/atomics.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/// Same numbering as the C library.
+#define ARC_CLOCK_REALTIME  0
+#define ARC_CLOCK_MONOTONIC 1
+
+#define ARC_CLOCK_MODE_TSC  1
+#define ARC_CLOCK_MODE_HPET 2
+
+/// Where userland finds the clock page, the last page of the lower half.
+#define ARC_CLOCK_PAGE_USER 0x00007FFFFFFFF000
+
+/**
+ * Layout of the clock page, shared with userland.
+ * */
+struct ARC_ClockPage {
+	/// The sequence comes first, it is odd while the page is updated.
+	ARC_SeqLock lock;
+	uint32_t mode;
+	uint32_t resv0;
+	/// Counter value at which the monotonic clock read ns_base.
+	uint64_t cycle_base;
+	uint64_t ns_base;
+	/// Nanoseconds per counter tick, in 32.32 fixed point.
+	uint64_t mult;
+	/// Realtime minus monotonic, in nanoseconds.
+	uint64_t real_offset;
+};
+
+/**
+ * Pick the clocksource and start the clocks.
+ *
+ * The TSC is used if it is invariant, and is measured against the HPET.
+ * Until this is called the clocks count TSC cycles as nanoseconds. The
+ * realtime clock starts from the CMOS RTC.
+ * */
+int Arc_InitializeClock();
+
+/**
+ * Read a clock.
+ *
+ * @param int clock - ARC_CLOCK_REALTIME or ARC_CLOCK_MONOTONIC.
+ * @param uint64_t *ns - Where to put the time in nanoseconds.
+ * @return Zero on success, EINVAL if the clock is unknown.
+ * */
+int Arc_ClockGet(int clock, uint64_t *ns);
+
+/**
+ * Nanoseconds since the clocks started, never goes backwards.
+ * */
+uint64_t Arc_ClockMonotonic();
+
+/**
+ * Nanoseconds since the Unix epoch.
+ * */
+uint64_t Arc_ClockRealtime();
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file inflate.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * DEFLATE (RFC 1951) decompressor with a gzip (RFC 1952) wrapper.
+*/
+#ifndef ARC_LIB_INFLATE_H
+#define ARC_LIB_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARC_INFLATE_OK        0
+/// The input ended before the stream did.
+#define ARC_INFLATE_TRUNCATED 1
+/// The output buffer is too small.
+#define ARC_INFLATE_OVERFLOW  2
+/// The stream is malformed.
+#define ARC_INFLATE_CORRUPT   3
+/// The checksum of the output does not match.
+#define ARC_INFLATE_CHECKSUM  4
+
+/**
+ * Check if the given data begins with a gzip header.
+ *
+ * @param void *in - The data.
+ * @param size_t in_size - The size of the data in bytes.
+ * @return 1 if the data is gzip'd.
+ * */
+int Arc_IsGzip(void *in, size_t in_size);
+
+/**
+ * Get the uncompressed size of a gzip member.
+ *
+ * Read from the ISIZE field of the trailer, which is the
+ * size modulo 2^32.
+ *
+ * @param void *in - The gzip member.
+ * @param size_t in_size - The size of the member in bytes.
+ * @return The uncompressed size, 0 if in is not gzip'd.
+ * */
+size_t Arc_GzipSize(void *in, size_t in_size);
+
+/**
+ * Decompress a raw DEFLATE stream.
+ *
+ * @param void *out - The buffer to decompress into.
+ * @param size_t out_size - The size of out in bytes.
+ * @param void *in - The compressed stream.
+ * @param size_t in_size - The size of in in bytes.
+ * @param size_t *produced - Set to the number of bytes written to out.
+ * @param size_t *consumed - Set to the number of bytes of in used, may be NULL.
+ * @return ARC_INFLATE_OK upon success.
+ * */
+int Arc_Inflate(void *out, size_t out_size, void *in, size_t in_size, size_t *produced, size_t *consumed);
+
+/**
+ * Decompress a gzip member, verifying its CRC-32 and size.
+ *
+ * @param void *out - The buffer to decompress into.
+ * @param size_t out_size - The size of out in bytes.
+ * @param void *in - The gzip member.
+ * @param size_t in_size - The size of in in bytes.
+ * @param size_t *produced - Set to the number of bytes written to out.
+ * @return ARC_INFLATE_OK upon success.
+ * */
+int Arc_Gunzip(void *out, size_t out_size, void *in, size_t in_size, size_t *produced);
+
+#endif
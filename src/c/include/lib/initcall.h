@@ -0,0 +1,77 @@
+/**
+ * @file initcall.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Boot time initialization steps, registered into the .initcalls
+ * section with the names of the steps they depend on, and run in
+ * dependency order.
+*/
+#ifndef ARC_LIB_INITCALL_H
+#define ARC_LIB_INITCALL_H
+
+#include <stdint.h>
+
+/// Most init calls the kernel can order.
+#define ARC_INITCALL_MAX 64
+
+struct ARC_InitCall {
+	/// Name other init calls depend on this one by.
+	char *name;
+	/// Returns zero on success.
+	int (*init)();
+	/// Names of the init calls which must have succeeded first.
+	char **deps;
+	uint64_t dep_count;
+}__attribute__((packed));
+
+/**
+ * Register an init call.
+ *
+ * Followed by the body of the init function:
+ *
+ * ARC_REGISTER_INITCALL(apic, "acpi") {
+ *	return Arc_InitAPIC();
+ * }
+ * */
+#define ARC_REGISTER_INITCALL(name, ...) \
+	static int __initcall_fn_##name(); \
+	static char *__initcall_deps_##name[] = { __VA_ARGS__ }; \
+	static struct ARC_InitCall __initcall_##name __attribute__((used, section(".initcalls"), aligned(1))) = { \
+		#name, __initcall_fn_##name, __initcall_deps_##name, sizeof(__initcall_deps_##name) / sizeof(char *) \
+	}; \
+	static int __initcall_fn_##name()
+
+/**
+ * Run every registered init call.
+ *
+ * Calls run once all of their dependencies have succeeded, in waves:
+ * the calls of a wave only depend on earlier waves. Calls depending
+ * on a failed, missing or cyclic call are skipped. The time each call
+ * took is reported. All calls run on the calling CPU, one at a time.
+ *
+ * @return zero if every call ran and succeeded.
+ * */
+int Arc_RunInitCalls();
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * @file rcu.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Read-copy-update style deferred reclamation.
+ *
+ * Readers mark their critical sections, which only counts the nesting
+ * on their CPU. Writers unlink an object and hand it to Arc_CallRCU,
+ * which frees it once every CPU has passed a quiescent state (been
+ * outside of any read section) after the unlink, at which point no
+ * reader can still hold a pointer to it.
+*/
+#ifndef ARC_LIB_RCU_H
+#define ARC_LIB_RCU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Most CPUs which can take part in grace periods.
+#define ARC_RCU_MAX_CPUS 64
+
+/**
+ * Embedded into objects freed through Arc_CallRCU.
+ * */
+struct ARC_RCUHead {
+	struct ARC_RCUHead *next;
+	void (*func)(struct ARC_RCUHead *head);
+};
+
+/**
+ * Get the object a struct ARC_RCUHead is embedded in.
+ *
+ * @param __head__ - The struct ARC_RCUHead given to the callback.
+ * @param __type__ - Type of the object.
+ * @param __member__ - Name of the struct ARC_RCUHead in the object.
+ * */
+#define ARC_RCU_ENTRY(__head__, __type__, __member__) \
+	((__type__ *)((uintptr_t)(__head__) - offsetof(__type__, __member__)))
+
+/**
+ * Enter a read-side critical section.
+ *
+ * Sections nest, and must not sleep or yield. Rescheduling only happens
+ * when asked for, so a section must not call Arc_CondResched or
+ * Arc_Reschedule, nor block.
+ * */
+void Arc_RCUReadLock();
+void Arc_RCUReadUnlock();
+
+/**
+ * Call func once a grace period has passed.
+ *
+ * Objects unlinked before this call are no longer seen by any reader
+ * when func runs. Callable from within read sections and interrupts.
+ * */
+void Arc_CallRCU(struct ARC_RCUHead *head, void (*func)(struct ARC_RCUHead *head));
+
+/**
+ * Wait for a grace period to pass.
+ *
+ * Must not be called from within a read section.
+ * */
+void Arc_SynchronizeRCU();
+
+/**
+ * Report a quiescent state for the calling CPU.
+ *
+ * Called by the idle loop. Does nothing while the CPU is in a read
+ * section. Runs the callbacks of the CPU whose grace period has passed,
+ * so the caller must not hold any locks.
+ * */
+void Arc_RCUQuiescent();
+
+/**
+ * Report a quiescent state from the scheduler tick, unless it
+ * interrupted a read section.
+ *
+ * Runs no callbacks, and is called with interrupts off.
+ * */
+void Arc_RCUTick();
+
+/**
+ * Report a quiescent state from a context switch.
+ *
+ * Read sections must not be switched out of, doing so hangs the CPU.
+ * Runs no callbacks, and is called with interrupts off.
+ * */
+void Arc_RCUContextSwitch();
+
+/**
+ * Check whether the calling CPU has RCU work to do.
+ *
+ * @return 1 if it has callbacks waiting, or a grace period is waiting
+ * on its report, in which case it should not go to sleep.
+ * */
+int Arc_RCUNeedsCPU();
+
+/**
+ * Make a CPU take part in grace periods.
+ *
+ * The bootstrap processor is online from the start.
+ * */
+int Arc_RCUOnlineCPU(int cpu);
+
+/**
+ * Stop grace periods from waiting on the calling CPU while it halts.
+ *
+ * Reports a quiescent state if one is owed. Interrupts must be off,
+ * and the CPU must not enter a read section until Arc_RCUIdleExit.
+ * */
+void Arc_RCUIdleEnter();
+
+/**
+ * Take part in grace periods again after Arc_RCUIdleEnter.
+ * */
+void Arc_RCUIdleExit();
+
+#endif
@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <sys/stat.h>
 #include <lib/atomics.h>
+#include <lib/rcu.h>
 
 #define ARC_DRIVER_IDEN_SUPER 0x5245505553 // "SUPER" little endian
 
@@ -64,11 +65,37 @@ struct ARC_Reference {
 	ARC_GenericMutex branch_mutex;
 	struct ARC_Reference *prev;
 	struct ARC_Reference *next;
+	/// Frees the reference once no reader can still reach it.
+	struct ARC_RCUHead rcu;
+};
+
+/**
+ * Sequential readahead state of a file.
+ * */
+struct ARC_FilePrefetch;
+
+struct ARC_FileReadahead {
+	/// Offset at which the next read is expected if access is sequential.
+	long last_offset;
+	/// Current size of the readahead window in bytes (0: no sequential access detected).
+	size_t window;
+	/// Offset in the file at which the prefetched data begins.
+	long buffer_offset;
+	/// Number of valid bytes in the buffer.
+	size_t buffer_size;
+	/// Generation of the node the buffer was filled at, stale once the node's moves on.
+	uint64_t generation;
+	/// Pages holding the prefetched data, as many as the largest window (NULL until first needed).
+	uint8_t *buffer;
+	/// Window after the buffer being read in the background (NULL until first needed).
+	struct ARC_FilePrefetch *prefetch;
 };
 
 struct ARC_File {
 	/// Current offset into the file.
 	long offset;
+	/// Readahead state.
+	struct ARC_FileReadahead readahead;
 	/// Pointer to the VFS node.
 	struct ARC_VFSNode *node;
 	/// Reference
@@ -79,6 +106,16 @@ struct ARC_File {
 	int flags;
 };
 
+/**
+ * A single element of a scatter-gather list.
+ * */
+struct ARC_IOVec {
+	/// Base address of the buffer.
+	void *base;
+	/// Length of the buffer in bytes.
+	size_t length;
+};
+
 struct ARC_Mount {
 	/// Type of file system.
 	int fs_type;
@@ -99,19 +136,33 @@ struct ARC_DriverDef {
 	int (*open)(struct ARC_File *file, struct ARC_Resource *res, char *path, int flags, uint32_t mode);
 	int (*write)(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res);
 	int (*read)(void *buffer, size_t size, size_t count, struct ARC_File *file, struct ARC_Resource *res);
+	/// Write at the given offset, file->offset is left untouched.
+	int (*pwrite)(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res);
+	/// Read at the given offset, file->offset is left untouched.
+	int (*pread)(void *buffer, size_t size, size_t count, long offset, struct ARC_File *file, struct ARC_Resource *res);
+	/// Gather write of iovcnt buffers starting at the given offset.
+	int (*writev)(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res);
+	/// Scatter read into iovcnt buffers starting at the given offset.
+	int (*readv)(struct ARC_IOVec *iov, int iovcnt, long offset, struct ARC_File *file, struct ARC_Resource *res);
 	int (*close)(struct ARC_File *file, struct ARC_Resource *res);
 	int (*seek)(struct ARC_File *file, struct ARC_Resource *res, long offset, int whence);
+	/// Get the physical address of the byte at offset so the file can be mapped in place, write is set if it is to be mapped writable.
+	int (*mmap)(struct ARC_File *file, struct ARC_Resource *res, long offset, int write, uint64_t *paddr);
+	/// Set the size of the file to length, discarding or zero filling.
+	int (*truncate)(struct ARC_File *file, struct ARC_Resource *res, size_t length);
 	/// Rename the resource.
 	int (*rename)(char *newname, struct ARC_Resource *res);
 }__attribute__((packed));
 
 struct ARC_SuperDriverDef {
-	int (*create)(char *path, uint32_t mode, int type);
-	int (*remove)(char *path);
-	int (*link)(char *a, char *b);
+	int (*create)(struct ARC_Resource *res, char *path, uint32_t mode, int type);
+	int (*remove)(struct ARC_Resource *res, char *path);
+	int (*link)(struct ARC_Resource *res, char *a, char *b);
 	/// Rename the file.
-	int (*rename)(char *a, char *b);
+	int (*rename)(struct ARC_Resource *res, char *a, char *b);
 	int (*stat)(struct ARC_Resource *res, char *filename, struct stat *stat);
+	/// Get the name and status of the index-th entry in the directory at path (0: entry exists).
+	int (*readdir)(struct ARC_Resource *res, char *path, uint64_t index, char **name, struct stat *stat);
 }__attribute__((packed));
 
 #define ARC_REGISTER_DRIVER(group, name) \
@@ -121,6 +172,23 @@ struct ARC_Resource *Arc_InitializeResource(char *name, int dri_group, uint64_t
 int Arc_UninitializeResource(struct ARC_Resource *resource);
 struct ARC_Reference *Arc_ReferenceResource(struct ARC_Resource *resource);
 int Arc_UnreferenceResource(struct ARC_Reference *reference);
+
+/**
+ * Index the drivers of every group by their index.
+ *
+ * Must be called once the slab allocator is up. Until then, and for
+ * groups which could not be indexed, Arc_GetDriverDef scans the
+ * group's section.
+ *
+ * @return zero on success, 1 if two drivers in a group share an index.
+ * */
+int Arc_InitializeDriverTable();
+
+/**
+ * Get the definition of a driver.
+ *
+ * @return The definition, NULL if no driver in the group has the index.
+ * */
 struct ARC_DriverDef *Arc_GetDriverDef(int group, uint64_t index);
 
 #endif
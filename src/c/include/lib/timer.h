@@ -0,0 +1,121 @@
+/**
+ * @file timer.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * One-shot high resolution timers.
+ *
+ * Each CPU keeps the timers armed on it in a min-heap ordered by
+ * deadline, and its LAPIC timer is only ever programmed for the
+ * earliest one. A CPU with no timers armed takes no timer interrupts
+ * at all. Deadlines are TSC values, which is a constant rate clock on
+ * the machines this runs on.
+*/
+#ifndef ARC_LIB_TIMER_H
+#define ARC_LIB_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Most CPUs which can have timers.
+#define ARC_TIMER_MAX_CPUS 64
+/// Most timers which can be armed on a CPU at once.
+#define ARC_TIMER_HEAP_SIZE 256
+
+/**
+ * Owned by whoever arms it, and must stay around until it has fired
+ * or been cancelled.
+ * */
+struct ARC_Timer {
+	/// TSC value at which func is called.
+	uint64_t deadline;
+	/// Called with interrupts off, from the timer interrupt.
+	void (*func)(struct ARC_Timer *timer);
+	/// CPU the timer was last armed on, -1 if it never was.
+	_Atomic int cpu;
+	/// Position in the heap of its CPU, -1 if not armed.
+	int index;
+};
+
+/**
+ * Prepare a timer, it starts out not armed.
+ *
+ * The callback runs in interrupt context on top of whatever was
+ * interrupted, so it must not touch the FPU (see ARC_NO_FPU), block or
+ * take locks which are held with interrupts on.
+ * */
+int Arc_InitTimer(struct ARC_Timer *timer, void (*func)(struct ARC_Timer *timer));
+
+/**
+ * Arm a timer on the calling CPU to fire at a TSC value.
+ *
+ * A timer which is already armed is moved. A deadline which has already
+ * passed fires on the next timer interrupt, which is right away.
+ *
+ * @return Zero on success, 1 if the timers are not up or the heap of
+ * the CPU is full.
+ * */
+int Arc_TimerArmAt(struct ARC_Timer *timer, uint64_t deadline);
+
+/**
+ * Arm a timer on the calling CPU to fire in ns nanoseconds.
+ * */
+int Arc_TimerArm(struct ARC_Timer *timer, uint64_t ns);
+
+/**
+ * Disarm a timer, from any CPU.
+ *
+ * Does not wait for a callback which is already running. Cancelling the
+ * timer another CPU is programmed for leaves that CPU with an interrupt
+ * which finds nothing to do.
+ *
+ * @return Zero if the timer was armed, 1 if it was not.
+ * */
+int Arc_TimerCancel(struct ARC_Timer *timer);
+
+/**
+ * Get the time deadlines are measured in.
+ * */
+uint64_t Arc_TimerNow();
+
+/**
+ * Convert nanoseconds to ticks of Arc_TimerNow.
+ * */
+uint64_t Arc_TimerNSToTicks(uint64_t ns);
+
+/**
+ * Run the timers of the calling CPU whose deadline has passed, and
+ * program the hardware for the next one.
+ *
+ * Called from the timer interrupt.
+ * */
+void Arc_TimerInterrupt();
+
+/**
+ * Bring up the timers of a CPU.
+ *
+ * Called on the CPU itself, cpu 0 first as it calibrates the clocks.
+ * */
+int Arc_InitializeTimers(int cpu);
+
+#endif
@@ -84,6 +84,25 @@ uint64_t *Arc_GetPageTableVMM(uint64_t *parent, int level, uint64_t vaddr, uint3
  * */
 int Arc_MapPageVMM(uint64_t paddr, uint64_t vaddr, uint32_t flags);
 
+/**
+ * Remove the mapping of a 4 KiB page.
+ *
+ * The page tables leading to it are left in place, and only the
+ * calling CPU's TLB entry is flushed.
+ *
+ * @param uint64_t vaddr - The virtual page to unmap.
+ * @return Error code (0: success, 1: the page was not mapped).
+ * */
+int Arc_UnmapPageVMM(uint64_t vaddr);
+
+/**
+ * Translate a virtual address in the current address space.
+ *
+ * @param uint64_t vaddr - The virtual address.
+ * @return The physical address \a vaddr maps to, 0 if it is not mapped.
+ * */
+uint64_t Arc_TranslateVMM(uint64_t vaddr);
+
 /**
  * Change the current page table's address.
  *
@@ -0,0 +1,83 @@
+/**
+ * @file futex.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Fast userspace mutexes. Userland locks and condition variables only
+ * enter the kernel to sleep on a word while it has an expected value,
+ * or to wake those sleeping on it.
+ *
+ * All three calls return negated errno values on failure.
+*/
+#ifndef ARC_MP_FUTEX_H
+#define ARC_MP_FUTEX_H
+
+#include <stdint.h>
+
+/// Bitset which matches every waiter.
+#define ARC_FUTEX_BITSET_ANY 0xFFFFFFFF
+
+/**
+ * Sleep on a futex word.
+ *
+ * The value is compared and the caller queued atomically with respect
+ * to wakes, so a wake which follows a change of the word is never lost.
+ *
+ * @param uint32_t *address - The futex word, 4 byte aligned.
+ * @param uint32_t expected - Value the word must hold to go to sleep.
+ * @param uint64_t timeout - Nanoseconds to sleep at most, 0 to sleep until woken.
+ * @param uint32_t bitset - Wakes must match one of these bits, ARC_FUTEX_BITSET_ANY for any.
+ * @return 0 once woken, negated errno on failure: -EAGAIN the word did not hold
+ * expected, -ETIMEDOUT the timeout passed, -EINVAL bad arguments, -EFAULT the
+ * word is not mapped.
+ * */
+int Arc_FutexWait(uint32_t *address, uint32_t expected, uint64_t timeout, uint32_t bitset);
+
+/**
+ * Wake threads sleeping on a futex word.
+ *
+ * Waiters are woken in the order they went to sleep.
+ *
+ * @param int count - Most waiters to wake.
+ * @param uint32_t bitset - Only wake waiters sharing a bit with this.
+ * @return The number of waiters woken, negated errno on failure.
+ * */
+int Arc_FutexWake(uint32_t *address, int count, uint32_t bitset);
+
+/**
+ * Wake some waiters of a futex word and move others onto another word.
+ *
+ * Lets a condition variable broadcast wake one waiter and hand the rest
+ * to the mutex, instead of having them all race for it.
+ *
+ * @param int wake - Most waiters to wake.
+ * @param uint32_t *target - Word the remaining waiters are moved to, if it
+ * is \a address itself they are left in place and only counted.
+ * @param int requeue - Most waiters to move.
+ * @param uint32_t expected - Value \a address must still hold.
+ * @return The number of waiters woken and moved, negated errno on failure
+ * (-EAGAIN if \a address no longer held \a expected).
+ * */
+int Arc_FutexRequeue(uint32_t *address, int wake, uint32_t *target, int requeue, uint32_t expected);
+
+#endif
@@ -29,11 +29,25 @@
 
 #include <stdint.h>
 
+struct ARC_Thread;
+
 /**
  * Get the currently running thread ID.
  * */
 int64_t Arc_GetCurrentTID();
 
+/**
+ * Get the currently running thread.
+ *
+ * @return The thread, the CPU's boot thread if no other is running.
+ * */
+struct ARC_Thread *Arc_GetCurrentThread();
+
+/**
+ * Get the index of the CPU the caller runs on.
+ * */
+int Arc_GetCurrentCPU();
+
 /**
  * Yield CPU to desired thread.
  * */
@@ -0,0 +1,87 @@
+/**
+ * @file mlfq.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Multi-level feedback queue scheduler with a run queue per CPU.
+ *
+ * Threads start at the highest level and drop a level each time they
+ * use up their time slice, which grows with the level. Every so often
+ * all threads of a CPU are boosted back to the top so none starve. A
+ * CPU which runs out of threads steals one from the busiest other CPU.
+*/
+#ifndef ARC_MP_SCHED_MLFQ_H
+#define ARC_MP_SCHED_MLFQ_H
+
+#include <mp/thread.h>
+#include <stdint.h>
+
+#define ARC_MLFQ_LEVELS 8
+/// Ticks at the top level, each level down gets this many more.
+#define ARC_MLFQ_SLICE 2
+/// Ticks between priority boosts of a CPU.
+#define ARC_MLFQ_BOOST_TICKS 128
+#define ARC_SCHED_MAX_CPUS 64
+
+/**
+ * Bring up the run queue of a CPU.
+ *
+ * The CPU is open to being stolen from, and steals, from then on.
+ * */
+int Arc_MLFQInitCPU(int cpu);
+
+/**
+ * Make a thread runnable.
+ *
+ * The thread goes on the run queue of its CPU, or of the calling CPU
+ * if it has none (cpu < 0), behind the threads of its level.
+ * */
+int Arc_MLFQEnqueue(struct ARC_Thread *thread);
+
+/**
+ * Choose the next thread to run on the calling CPU.
+ *
+ * The current thread goes back on the run queue if it is still
+ * running, and the first thread of the highest non-empty level is
+ * taken. The caller switches to it.
+ *
+ * @return The thread to run, NULL to idle.
+ * */
+struct ARC_Thread *Arc_MLFQSchedule();
+
+/**
+ * Account a timer tick to the calling CPU.
+ *
+ * @return 1 if the current thread used up its slice, or a boost
+ * happened, and the CPU should reschedule.
+ * */
+int Arc_MLFQTick();
+
+/**
+ * Get the thread running on the calling CPU.
+ *
+ * @return The thread, NULL if the CPU is still in its boot context or idle.
+ * */
+struct ARC_Thread *Arc_MLFQCurrent();
+
+#endif
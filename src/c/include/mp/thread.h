@@ -0,0 +1,174 @@
+/**
+ * @file thread.h
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Kernel threads.
+ *
+ * Each CPU also has a boot thread, standing for the context it booted
+ * in. It is never queued, and runs whenever there is nothing else.
+ *
+ * Kernel code is not preempted. The scheduler tick only runs while a
+ * thread other than the boot thread is on the CPU, and marks it to
+ * reschedule once its slice is used up, which it does the next time
+ * it calls Arc_CondResched.
+*/
+#ifndef ARC_MP_THREAD_H
+#define ARC_MP_THREAD_H
+
+#include <lib/atomics.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Pages of kernel stack per thread.
+#define ARC_THREAD_STACK_PAGES 4
+/// Period of the scheduler tick.
+#define ARC_THREAD_TICK_NS 4000000
+
+#define ARC_THREAD_READY   0
+#define ARC_THREAD_RUNNING 1
+#define ARC_THREAD_BLOCKED 2
+#define ARC_THREAD_DEAD    3
+
+struct ARC_Thread {
+	int64_t tid;
+	/// Changed by wakers from other CPUs, see Arc_WakeThread.
+	_Atomic int state;
+	/// Feedback queue level, 0 is the highest priority.
+	int level;
+	/// Ticks left at the current level before being demoted.
+	uint32_t slice;
+	/// CPU whose run queue the thread belongs to.
+	int cpu;
+	/// Set while the thread's context is live on a CPU, it cannot be stolen meanwhile.
+	_Atomic int on_cpu;
+	/// Next thread in the run queue.
+	struct ARC_Thread *next;
+	/// Stack pointer while switched out.
+	uint64_t rsp;
+	void *stack;
+	/// Extended state save area.
+	void *fpu_state;
+	/// CPU whose registers last held the extended state, -1 if none.
+	int fpu_cpu;
+	void (*entry)(void *arg);
+	void *arg;
+	/// Queue lock nodes of the thread.
+	struct ARC_QLockNode qlock_nodes[ARC_QLOCK_NODES];
+};
+
+/**
+ * Set up threading on the calling CPU.
+ *
+ * Enables the FPU and turns the context the CPU is running in into
+ * its boot thread.
+ * */
+int Arc_InitializeThreads(int cpu);
+
+/**
+ * Create a kernel thread and make it runnable.
+ *
+ * @param void (*entry)(void *arg) - Function the thread runs, it exits once the function returns.
+ * @return The thread, NULL on failure.
+ * */
+struct ARC_Thread *Arc_CreateKernelThread(void (*entry)(void *arg), void *arg);
+
+/**
+ * End the calling thread.
+ * */
+void Arc_ExitThread();
+
+/**
+ * Switch to the thread the scheduler picks next, if any.
+ * */
+void Arc_Reschedule();
+
+/**
+ * Reschedule if the tick found the calling thread's slice used up.
+ *
+ * Long running kernel threads call this between units of work.
+ * */
+void Arc_CondResched();
+
+/**
+ * Run the threads which are ready, then sleep until an interrupt.
+ *
+ * Only called by the boot thread, from its idle loop. The CPU takes no
+ * ticks while it sleeps, only the interrupts of the timers armed on it,
+ * and a wake IPI when another CPU creates a thread.
+ * */
+void Arc_IdleCPU();
+
+/**
+ * Mark the calling thread as about to block.
+ *
+ * Called before publishing the thread to whoever will wake it, then
+ * the wake condition is checked again and Arc_Block called if it still
+ * does not hold. A wake in between leaves the thread runnable, so it is
+ * never lost. The boot thread cannot block, and is left running.
+ *
+ * @return The calling thread, to hand to the waker.
+ * */
+struct ARC_Thread *Arc_PrepareBlock();
+
+/**
+ * Leave the CPU until woken by Arc_WakeThread.
+ *
+ * May return without the wake the caller waits for, as wakes are not
+ * tied to what the thread sleeps on, so callers check their condition
+ * in a loop, calling Arc_PrepareBlock again each time around. The boot
+ * thread runs the threads which are ready instead and returns.
+ * */
+void Arc_Block();
+
+/**
+ * Undo Arc_PrepareBlock when the condition turned out to hold.
+ * */
+void Arc_CancelBlock();
+
+/**
+ * Make a blocked thread runnable again.
+ *
+ * Callable from interrupt context, such as a timer callback.
+ *
+ * @return Zero if the thread was woken, 1 if it was not blocked.
+ * */
+int Arc_WakeThread(struct ARC_Thread *thread);
+
+/**
+ * Get the boot thread of a CPU.
+ * */
+struct ARC_Thread *Arc_GetBootThread(int cpu);
+
+/**
+ * Measure a context switch.
+ *
+ * Two threads hand the CPU back and forth  round_trips times.
+ *
+ * @param bool fpu - Have both threads touch the FPU each turn.
+ * @return Average TSC cycles per round trip (two switches).
+ * */
+uint64_t Arc_BenchmarkContextSwitch(uint64_t round_trips, bool fpu);
+
+#endif
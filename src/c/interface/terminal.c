@@ -25,6 +25,7 @@
  * @DESCRIPTION
 */
 #include <fs/vfs.h>
+#include <fs/initramfs.h>
 #include <mm/slab.h>
 #include <global.h>
 #include <interface/terminal.h>
@@ -72,6 +73,10 @@ void Arc_TermDraw(struct ARC_TermMeta *term) {
 
 	uint8_t *data = Arc_SlabAlloc(size_in_bytes);
 
+	// Read glyphs in place when the font is in the initramfs
+	size_t font_size = 0;
+	const uint8_t *font = Arc_InitramfsBorrow(Arc_FontFile, 0, &font_size);
+
 	for (int y = 0; y < term->term_height; y++) {
 		for (int x = 0; x < term->term_width; x++) {
 			int sx = x * term->font_width;
@@ -79,14 +84,20 @@ void Arc_TermDraw(struct ARC_TermMeta *term) {
 
 			char c = term->term_mem[y * term->term_width + x];
 
-			memset(data, 0, size_in_bytes);
-			Arc_SeekVFS(Arc_FontFile, (c * size_in_bytes), ARC_VFS_SEEK_SET);
-			Arc_ReadVFS(data, 1, size_in_bytes, Arc_FontFile);
+			long offset = c * size_in_bytes;
+			const uint8_t *glyph = data;
+
+			if (font != NULL && offset >= 0 && offset + size_in_bytes <= font_size) {
+				glyph = font + offset;
+			} else {
+				memset(data, 0, size_in_bytes);
+				Arc_PReadVFS(data, 1, size_in_bytes, offset, Arc_FontFile);
+			}
 
 			for (int i = 0; i < term->font_height; i++) {
 				int rx = 0;
 				for (int j = term->font_width - 1; j >= 0; j--) {
-					if (((data[i] >> j) & 1) == 1 && c != 0) {
+					if (((glyph[i] >> j) & 1) == 1 && c != 0) {
 						*((uint32_t *)term->framebuffer + (i + sy) * term->fb_width + (sx + rx)) = 0x00FFFFFF;
 					}
 
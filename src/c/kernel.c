@@ -25,6 +25,7 @@
  * @DESCRIPTION
 */
 #include <lib/resource.h>
+#include <lib/initcall.h>
 #include <mm/slab.h>
 #include <mm/freelist.h>
 #include <mm/pmm.h>
@@ -37,27 +38,137 @@
 #include <arch/x86-64/ctrl_regs.h>
 #include <arch/x86-64/acpi/acpi.h>
 #include <arch/x86-64/apic/apic.h>
+#include <arch/x86-64/pci/pci.h>
 #include <boot/parse.h>
 
 #include <arch/x86-64/idt.h>
 #include <arch/x86-64/gdt.h>
+#include <arch/x86-64/smp.h>
+#include <arch/x86-64/percpu.h>
 
 #include <interface/terminal.h>
 #include <mm/pmm.h>
 #include <fs/vfs.h>
+#include <fs/initramfs.h>
+#include <fs/block.h>
+#include <fs/aio.h>
 
 #include <arch/x86-64/syscall.h>
+#include <mp/sched/mlfq.h>
+#include <mp/thread.h>
+#include <lib/timer.h>
+#include <lib/clock.h>
 
 struct ARC_BootMeta *Arc_BootMeta = NULL;
 struct ARC_TermMeta Arc_MainTerm = { 0 };
 struct ARC_Resource *Arc_InitramfsRes = NULL;
 struct ARC_File *Arc_FontFile = NULL;
 static char Arc_MainTerm_mem[180 * 120] = { 0 };
+// What the BSP enters ring 0 on from userland, the PMM is not up
+// yet when its GDT is installed
+static uint8_t Arc_BSPKernelStack[ARC_THREAD_STACK_PAGES * 0x1000] __attribute__((aligned(0x1000)));
 
 int empty() {
 	return 0;
 }
 
+ARC_REGISTER_INITCALL(vfs) {
+	Arc_InitializeVFS();
+	Arc_CreateVFS("/initramfs/", 0, ARC_VFS_N_DIR, NULL);
+	Arc_CreateVFS("/dev/", 0, ARC_VFS_N_DIR, NULL);
+
+	return 0;
+}
+
+ARC_REGISTER_INITCALL(acpi, "vfs") {
+	return Arc_InitializeACPI(Arc_BootMeta->rsdp);
+}
+
+// TODO: Implement properly
+ARC_REGISTER_INITCALL(apic, "acpi") {
+	return Arc_InitAPIC();
+}
+
+ARC_REGISTER_INITCALL(syscall) {
+	return Arc_InitializeSyscall();
+}
+
+ARC_REGISTER_INITCALL(initramfs, "vfs") {
+	struct ARC_InitramfsArgs initramfs_args = { .base = (void *)ARC_PHYS_TO_HHDM(Arc_BootMeta->initramfs), .size = Arc_BootMeta->initramfs_size };
+	Arc_InitramfsRes = Arc_InitializeResource("initramfs", 0, 0, &initramfs_args);
+
+	if (Arc_InitramfsRes == NULL) {
+		return 1;
+	}
+
+	Arc_MountVFS("/initramfs/", Arc_InitramfsRes, ARC_VFS_FS_INITRAMFS);
+	Arc_LinkVFS("/initramfs/boot/ANTIQUE.F14", "/font.fnt", 0);
+	Arc_RenameVFS("/font.fnt", "/fonts/font.fnt");
+	Arc_OpenVFS("/fonts/font.fnt", 0, 0, 0, (void *)&Arc_FontFile);
+
+	return 0;
+}
+
+ARC_REGISTER_INITCALL(ram0, "vfs") {
+	size_t ram0_size = 0x400000;
+	struct ARC_Resource *ram0 = Arc_InitializeResource("ram0", ARC_DRI_GROUP_BLOCK, ARC_DRI_RAMDISK, &ram0_size);
+
+	if (ram0 == NULL || ram0->driver_state == NULL) {
+		return 1;
+	}
+
+	return Arc_CreateVFS("/dev/ram0", 0, ARC_VFS_N_BLOCK, ram0->driver_state);
+}
+
+ARC_REGISTER_INITCALL(framebuffer) {
+        // Quickly map framebuffer in
+	uint64_t fb_size = Arc_MainTerm.fb_width * Arc_MainTerm.fb_height * (Arc_MainTerm.fb_bpp / 8);
+	for (uint64_t i = 0; i < fb_size; i += 0x1000) {
+		Arc_MapPageVMM(ARC_HHDM_TO_PHYS(Arc_MainTerm.framebuffer + i), (uintptr_t)(Arc_MainTerm.framebuffer + i), ARC_VMM_OVERW_FLAG | 3 | ARC_VMM_PAT_WC(0));
+	}
+
+	return 0;
+}
+
+ARC_REGISTER_INITCALL(sched) {
+	return Arc_MLFQInitCPU(0);
+}
+
+ARC_REGISTER_INITCALL(threads, "sched") {
+	return Arc_InitializeThreads(0);
+}
+
+ARC_REGISTER_INITCALL(timer, "apic", "threads") {
+	return Arc_InitializeTimers(0);
+}
+
+ARC_REGISTER_INITCALL(clock, "timer") {
+	return Arc_InitializeClock();
+}
+
+ARC_REGISTER_INITCALL(switch_bench, "threads") {
+	uint64_t plain = Arc_BenchmarkContextSwitch(10000, 0);
+	uint64_t fpu = Arc_BenchmarkContextSwitch(10000, 1);
+
+	ARC_DEBUG(INFO, "Context switch round trip: %lu cycles, %lu cycles touching the FPU\n", plain, fpu);
+
+	return 0;
+}
+
+ARC_REGISTER_INITCALL(aio, "vfs", "threads") {
+	return Arc_AIOStartWorkers(ARC_AIO_WORKERS);
+}
+
+ARC_REGISTER_INITCALL(smp, "apic", "syscall", "sched", "threads", "timer", "clock") {
+	Arc_StartAPs();
+
+	return 0;
+}
+
+ARC_REGISTER_INITCALL(pci, "vfs") {
+	return Arc_InitializePCI();
+}
+
 int kernel_main(struct ARC_BootMeta *boot_meta) {
         *((uint8_t *)0xB8002) = 'A';
 
@@ -76,7 +187,8 @@ int kernel_main(struct ARC_BootMeta *boot_meta) {
 	ARC_DEBUG(INFO, "Sucessfully entered long mode\n");
 
         // Initialize really basic things
-	Arc_InstallGDT();
+	Arc_InstallGDT(0, Arc_BSPKernelStack + sizeof(Arc_BSPKernelStack));
+	Arc_InitPerCPU(0);
 	Arc_InstallIDT();
 	Arc_ParseBootInfo();
 
@@ -89,22 +201,10 @@ int kernel_main(struct ARC_BootMeta *boot_meta) {
 	Arc_InitVMM();
         // Arc_InitBuddy(big_block_size, max_subdivisions);
 	Arc_InitSlabAllocator(100);
+	Arc_InitializeDriverTable();
 
         // Initialize more complicated things
-	Arc_InitializeVFS();
-	Arc_CreateVFS("/initramfs/", 0, ARC_VFS_N_DIR, NULL);
-        Arc_CreateVFS("/dev/", 0, ARC_VFS_N_DIR, NULL);
-
-        Arc_InitializeACPI(boot_meta->rsdp);
-        // TODO: Implement properly
-        Arc_InitAPIC();
-	Arc_InitializeSyscall();
-
-	Arc_InitramfsRes = Arc_InitializeResource("initramfs", 0, 0, (void *)ARC_PHYS_TO_HHDM(boot_meta->initramfs));
-	Arc_MountVFS("/initramfs/", Arc_InitramfsRes, ARC_VFS_FS_INITRAMFS);
-	Arc_LinkVFS("/initramfs/boot/ANTIQUE.F14", "/font.fnt", 0);
-	Arc_RenameVFS("/font.fnt", "/fonts/font.fnt");
-	Arc_OpenVFS("/fonts/font.fnt", 0, 0, 0, (void *)&Arc_FontFile);
+	Arc_RunInitCalls();
 
 	size_t size = 64;
 	struct ARC_File *buffer0 = NULL;
@@ -122,12 +222,6 @@ int kernel_main(struct ARC_BootMeta *boot_meta) {
 
 	Arc_ListVFS("/", 8);
 
-        // Quickly map framebuffer in
-	uint64_t fb_size = Arc_MainTerm.fb_width * Arc_MainTerm.fb_height * (Arc_MainTerm.fb_bpp / 8);
-	for (uint64_t i = 0; i < fb_size; i += 0x1000) {
-		Arc_MapPageVMM(ARC_HHDM_TO_PHYS(Arc_MainTerm.framebuffer + i), (uintptr_t)(Arc_MainTerm.framebuffer + i), ARC_VMM_OVERW_FLAG | 3 | ARC_VMM_PAT_WC(0));
-	}
-
 	for (int i = 0; i < 60; i++) {
 		for (int y = 0; y < Arc_MainTerm.fb_height; y++) {
 			for (int x = 0; x < Arc_MainTerm.fb_width; x++) {
@@ -138,6 +232,8 @@ int kernel_main(struct ARC_BootMeta *boot_meta) {
 
 	for (;;) {
 		Arc_TermDraw(&Arc_MainTerm);
+		Arc_RCUQuiescent();
+		Arc_IdleCPU();
 	}
 
 	return 0;
@@ -28,11 +28,43 @@
 #include <lib/atomics.h>
 #include <util.h>
 #include <mp/sched/abstract.h>
+#include <mp/thread.h>
+#include <mp/futex.h>
+#include <abi-bits/errno.h>
 #include <global.h>
-struct internal_qlock_node {
-	int64_t tid;
-	struct internal_qlock_node *next;
-};
+
+#define ATOMICS_RFLAGS_IF (1 << 9)
+// Most pauses between two looks at a taken spinlock
+#define ATOMICS_MAX_BACKOFF 1024
+// Pauses per locker ahead in a ticket lock
+#define ATOMICS_TICKET_BACKOFF 32
+
+// Mutex states, contended means someone may be asleep on it
+#define ATOMICS_MUTEX_FREE      0
+#define ATOMICS_MUTEX_LOCKED    1
+#define ATOMICS_MUTEX_CONTENDED 2
+
+/**
+ * Get the calling thread's queue lock nodes.
+ * */
+static struct ARC_QLockNode *qlock_get_nodes() {
+	return Arc_GetCurrentThread()->qlock_nodes;
+}
+
+/**
+ * Find the calling thread's node on the given lock.
+ *
+ * @return The node, NULL if the thread is neither queued on nor holding the lock.
+ * */
+static struct ARC_QLockNode *qlock_find_node(struct ARC_QLockNode *nodes, struct ARC_QLock *head) {
+	for (int i = 0; i < ARC_QLOCK_NODES; i++) {
+		if (nodes[i].lock == head) {
+			return &nodes[i];
+		}
+	}
+
+	return NULL;
+}
 
 int Arc_QLockInit(struct ARC_QLock **lock) {
 	*lock = Arc_SlabAlloc(sizeof(struct ARC_QLock));
@@ -49,6 +81,16 @@ int Arc_QLockInit(struct ARC_QLock **lock) {
 	return 0;
 }
 
+int Arc_QLockUninit(struct ARC_QLock *lock) {
+	if (lock == NULL || atomic_load_explicit(&lock->tail, memory_order_acquire) != NULL) {
+		return 1;
+	}
+
+	Arc_SlabFree(lock);
+
+	return 0;
+}
+
 int Arc_QLockStaticInit(struct ARC_QLock *head) {
 	memset(head, 0, sizeof(struct ARC_QLock));
 
@@ -56,74 +98,113 @@ int Arc_QLockStaticInit(struct ARC_QLock *head) {
 }
 
 int Arc_QLock(struct ARC_QLock *head) {
-	if (head->is_frozen) {
-		ARC_DEBUG(ERR, "Head %p is frozen!\n", head);
-		return -3;
-	}
-
 	int64_t tid = Arc_GetCurrentTID();
+	struct ARC_QLockNode *nodes = qlock_get_nodes();
+	struct ARC_QLockNode *node = qlock_find_node(nodes, head);
+
+	if (node != NULL) {
+		// Already held (or queued on) by this thread
+		node->depth++;
+		Arc_QYield(head);
 
-	if (head->next != NULL && ((struct internal_qlock_node *)head->next)->tid == tid) {
 		return 0;
 	}
 
-	register struct internal_qlock_node *next = (struct internal_qlock_node *)Arc_SlabAlloc(sizeof(struct internal_qlock_node));
+	if (head->is_frozen) {
+		ARC_DEBUG(ERR, "Head %p is frozen!\n", head);
+		return -3;
+	}
 
-	if (next == NULL) {
-		ARC_DEBUG(ERR, "Failed to allocate next link\n");
+	node = qlock_find_node(nodes, NULL);
+
+	if (node == NULL) {
+		ARC_DEBUG(ERR, "Thread %ld holds too many queue locks\n", tid);
 		return -2;
 	}
 
-	memset(next, 0, sizeof(struct internal_qlock_node));
+	node->lock = head;
+	node->tid = tid;
+	node->thread = Arc_GetCurrentThread();
+	node->depth = 1;
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
 
-	next->tid = tid;
+	struct ARC_QLockNode *prev = atomic_exchange_explicit(&head->tail, node, memory_order_acq_rel);
 
-	Arc_MutexUnlock(&head->lock);
+	if (prev == NULL) {
+		atomic_store_explicit(&node->locked, 0, memory_order_relaxed);
+		atomic_store_explicit(&head->owner, node, memory_order_relaxed);
 
-	if (head->last == NULL) {
-		head->next = next;
-	} else {
-		((struct internal_qlock_node *)head->last)->next = next;
+		return 0;
 	}
 
-	head->last = next;
-
-	Arc_MutexUnlock(&head->lock);
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+	Arc_QYield(head);
 
 	return 0;
 }
 
 void Arc_QYield(struct ARC_QLock *head) {
-	int64_t current_tid = ((struct internal_qlock_node *)head->next)->tid;
+	struct ARC_QLockNode *node = qlock_find_node(qlock_get_nodes(), head);
 
-	if (current_tid == Arc_GetCurrentTID()) {
+	if (node == NULL) {
 		return;
 	}
 
-	while (current_tid != Arc_GetCurrentTID()) {
-		Arc_YieldCPU(current_tid);
+	// The previous owner hands the lock over by clearing our flag and
+	// waking us, only this node's line is read while waiting
+	while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+		Arc_PrepareBlock();
+
+		// Look again now that a handover would find us blocked
+		if (!atomic_load_explicit(&node->locked, memory_order_seq_cst)) {
+			Arc_CancelBlock();
+			break;
+		}
+
+		Arc_Block();
 	}
+
+	atomic_store_explicit(&head->owner, node, memory_order_relaxed);
 }
 
 int Arc_QUnlock(struct ARC_QLock *head) {
-	struct internal_qlock_node *next = ((struct internal_qlock_node *)head->next)->next;
+	struct ARC_QLockNode *node = qlock_find_node(qlock_get_nodes(), head);
 
-	if (head->next == NULL || ((struct internal_qlock_node *)head->next)->tid != Arc_GetCurrentTID()) {
-		ARC_DEBUG(ERR, "Lock is not owned by %d or is owned by no-one\n", Arc_GetCurrentTID());
+	if (node == NULL || atomic_load_explicit(&node->locked, memory_order_relaxed)) {
+		ARC_DEBUG(ERR, "Lock is not owned by %ld\n", Arc_GetCurrentTID());
 		return -1;
 	}
 
-	Arc_MutexLock(&head->lock);
-
-	Arc_SlabFree(head->next);
+	if (--node->depth > 0) {
+		return 0;
+	}
 
-	head->next = next;
+	struct ARC_QLockNode *next = atomic_load_explicit(&node->next, memory_order_acquire);
 
 	if (next == NULL) {
-		head->last = NULL;
+		struct ARC_QLockNode *expected = node;
+		atomic_store_explicit(&head->owner, NULL, memory_order_relaxed);
+
+		if (atomic_compare_exchange_strong_explicit(&head->tail, &expected, NULL, memory_order_release, memory_order_relaxed)) {
+			node->lock = NULL;
+			return 0;
+		}
+
+		// A waiter swapped itself in and is about to link up
+		while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+			__builtin_ia32_pause();
+		}
 	}
 
-	Arc_MutexUnlock(&head->lock);
+	// Hand over directly to the next waiter, and wake it if it went
+	// to sleep
+	struct ARC_Thread *thread = next->thread;
+
+	atomic_store_explicit(&head->owner, next, memory_order_relaxed);
+	atomic_store_explicit(&next->locked, 0, memory_order_seq_cst);
+	Arc_WakeThread(thread);
+	node->lock = NULL;
 
 	return 0;
 }
@@ -154,13 +235,16 @@ int Arc_QFreeze(struct ARC_QLock *head) {
 
 	return 0;
 }
+
 int Arc_QThaw(struct ARC_QLock *head) {
 	// Thaw a frozen lock
 	if (head->is_frozen == 0) {
 		return 0;
 	}
 
-	if (((struct internal_qlock_node *)head->next)->tid != Arc_GetCurrentTID()) {
+	struct ARC_QLockNode *owner = atomic_load_explicit(&head->owner, memory_order_relaxed);
+
+	if (owner == NULL || owner->tid != Arc_GetCurrentTID()) {
 		return -1;
 	}
 
@@ -169,6 +253,99 @@ int Arc_QThaw(struct ARC_QLock *head) {
 	return 0;
 }
 
+int Arc_RWLockStaticInit(struct ARC_RWLock *lock) {
+	if (lock == NULL) {
+		return 1;
+	}
+
+	atomic_init(&lock->state, 0);
+	atomic_init(&lock->waiting, 0);
+
+	return 0;
+}
+
+void Arc_RWReadLock(struct ARC_RWLock *lock) {
+	for (;;) {
+		uint32_t state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+		if ((state & ARC_RWLOCK_WRITER) == 0 && atomic_load_explicit(&lock->waiting, memory_order_relaxed) == 0
+		    && atomic_compare_exchange_weak_explicit(&lock->state, &state, state + ARC_RWLOCK_READER, memory_order_acquire, memory_order_relaxed)) {
+			return;
+		}
+
+		__builtin_ia32_pause();
+	}
+}
+
+void Arc_RWReadUnlock(struct ARC_RWLock *lock) {
+	atomic_fetch_sub_explicit(&lock->state, ARC_RWLOCK_READER, memory_order_release);
+}
+
+void Arc_RWWriteLock(struct ARC_RWLock *lock) {
+	atomic_fetch_add_explicit(&lock->waiting, 1, memory_order_relaxed);
+
+	for (;;) {
+		uint32_t state = 0;
+
+		if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0
+		    && atomic_compare_exchange_weak_explicit(&lock->state, &state, ARC_RWLOCK_WRITER, memory_order_acquire, memory_order_relaxed)) {
+			break;
+		}
+
+		__builtin_ia32_pause();
+	}
+
+	atomic_fetch_sub_explicit(&lock->waiting, 1, memory_order_relaxed);
+}
+
+void Arc_RWWriteUnlock(struct ARC_RWLock *lock) {
+	atomic_store_explicit(&lock->state, 0, memory_order_release);
+}
+
+int Arc_SeqLockStaticInit(ARC_SeqLock *lock) {
+	if (lock == NULL) {
+		return 1;
+	}
+
+	atomic_init(&lock->sequence, 0);
+	atomic_init(&lock->lock, 0);
+
+	return 0;
+}
+
+uint32_t Arc_SeqReadBegin(ARC_SeqLock *lock) {
+	uint32_t sequence = 0;
+
+	while ((sequence = atomic_load_explicit(&lock->sequence, memory_order_acquire)) & 1) {
+		__builtin_ia32_pause();
+	}
+
+	return sequence;
+}
+
+int Arc_SeqReadRetry(ARC_SeqLock *lock, uint32_t sequence) {
+	// The copy must be complete before the sequence is looked at again
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&lock->sequence, memory_order_relaxed) != sequence;
+}
+
+void Arc_SeqWriteLock(ARC_SeqLock *lock) {
+	Arc_SpinlockLock(&lock->lock);
+
+	uint32_t sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+	atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);
+	// Readers must see the odd sequence before any of the data changes
+	atomic_thread_fence(memory_order_release);
+}
+
+void Arc_SeqWriteUnlock(ARC_SeqLock *lock) {
+	uint32_t sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+	atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_release);
+
+	Arc_SpinlockUnlock(&lock->lock);
+}
+
 int Arc_MutexInit(ARC_GenericMutex **mutex) {
 	if (mutex == NULL) {
 		return 1;
@@ -202,13 +379,194 @@ int Arc_MutexStaticInit(ARC_GenericMutex *mutex) {
 }
 
 int Arc_MutexLock(ARC_GenericMutex *mutex) {
-	// Atomically lock and yield if it is locked
-	(void)mutex;
+	if (mutex == NULL) {
+		return 1;
+	}
+
+	int state = ATOMICS_MUTEX_FREE;
+
+	if (atomic_compare_exchange_strong_explicit(mutex, &state, ATOMICS_MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+		return 0;
+	}
+
+	// Mark it contended so the owner knows to wake someone, and
+	// sleep on it until it is let go
+	if (state != ATOMICS_MUTEX_CONTENDED) {
+		state = atomic_exchange_explicit(mutex, ATOMICS_MUTEX_CONTENDED, memory_order_acquire);
+	}
+
+	while (state != ATOMICS_MUTEX_FREE) {
+		if (Arc_FutexWait((uint32_t *)mutex, ATOMICS_MUTEX_CONTENDED, 0, ARC_FUTEX_BITSET_ANY) == -EFAULT) {
+			// Paging is not up yet, there is nothing to key a sleep on
+			__builtin_ia32_pause();
+		}
+
+		state = atomic_exchange_explicit(mutex, ATOMICS_MUTEX_CONTENDED, memory_order_acquire);
+	}
+
 	return 0;
 }
 
 int Arc_MutexUnlock(ARC_GenericMutex *mutex) {
-	// Atomically unlock
-	(void)mutex;
+	if (mutex == NULL) {
+		return 1;
+	}
+
+	if (atomic_exchange_explicit(mutex, ATOMICS_MUTEX_FREE, memory_order_release) == ATOMICS_MUTEX_CONTENDED) {
+		Arc_FutexWake((uint32_t *)mutex, 1, ARC_FUTEX_BITSET_ANY);
+	}
+
 	return 0;
 }
+
+uint64_t Arc_IRQSave() {
+	uint64_t flags = 0;
+
+	__asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+
+	return flags;
+}
+
+void Arc_IRQRestore(uint64_t flags) {
+	if (flags & ATOMICS_RFLAGS_IF) {
+		__asm__ volatile("sti" : : : "memory");
+	}
+}
+
+void Arc_SpinlockLock(ARC_GenericSpinlock *lock) {
+	int backoff = 1;
+
+	while (atomic_exchange_explicit(lock, 1, memory_order_acquire)) {
+		// Wait on the cached line rather than bouncing it with writes
+		while (atomic_load_explicit(lock, memory_order_relaxed)) {
+			for (int i = 0; i < backoff; i++) {
+				__builtin_ia32_pause();
+			}
+
+			backoff = min(backoff * 2, ATOMICS_MAX_BACKOFF);
+		}
+	}
+}
+
+int Arc_SpinlockTryLock(ARC_GenericSpinlock *lock) {
+	if (atomic_load_explicit(lock, memory_order_relaxed)) {
+		return 0;
+	}
+
+	return !atomic_exchange_explicit(lock, 1, memory_order_acquire);
+}
+
+void Arc_SpinlockUnlock(ARC_GenericSpinlock *lock) {
+	atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+uint64_t Arc_SpinlockLockIRQSave(ARC_GenericSpinlock *lock) {
+	uint64_t flags = Arc_IRQSave();
+	Arc_SpinlockLock(lock);
+
+	return flags;
+}
+
+void Arc_SpinlockUnlockIRQRestore(ARC_GenericSpinlock *lock, uint64_t flags) {
+	Arc_SpinlockUnlock(lock);
+	Arc_IRQRestore(flags);
+}
+
+int Arc_TicketLockStaticInit(struct ARC_TicketLock *lock) {
+	if (lock == NULL) {
+		return 1;
+	}
+
+	atomic_init(&lock->next, 0);
+	atomic_init(&lock->serving, 0);
+
+	return 0;
+}
+
+void Arc_TicketLock(struct ARC_TicketLock *lock) {
+	uint32_t ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+	uint32_t serving = 0;
+
+	while ((serving = atomic_load_explicit(&lock->serving, memory_order_acquire)) != ticket) {
+		// Back off in proportion to the number of lockers ahead
+		for (uint32_t i = 0; i < (ticket - serving) * ATOMICS_TICKET_BACKOFF; i++) {
+			__builtin_ia32_pause();
+		}
+	}
+}
+
+void Arc_TicketUnlock(struct ARC_TicketLock *lock) {
+	// Only the holder writes serving
+	uint32_t serving = atomic_load_explicit(&lock->serving, memory_order_relaxed);
+	atomic_store_explicit(&lock->serving, serving + 1, memory_order_release);
+}
+
+uint64_t Arc_TicketLockIRQSave(struct ARC_TicketLock *lock) {
+	uint64_t flags = Arc_IRQSave();
+	Arc_TicketLock(lock);
+
+	return flags;
+}
+
+void Arc_TicketUnlockIRQRestore(struct ARC_TicketLock *lock, uint64_t flags) {
+	Arc_TicketUnlock(lock);
+	Arc_IRQRestore(flags);
+}
+
+int Arc_MCSLockStaticInit(struct ARC_MCSLock *lock) {
+	if (lock == NULL) {
+		return 1;
+	}
+
+	atomic_init(&lock->tail, NULL);
+
+	return 0;
+}
+
+void Arc_MCSLock(struct ARC_MCSLock *lock, struct ARC_MCSNode *node) {
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+
+	struct ARC_MCSNode *prev = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+
+	if (prev == NULL) {
+		return;
+	}
+
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+
+	while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+		__builtin_ia32_pause();
+	}
+}
+
+void Arc_MCSUnlock(struct ARC_MCSLock *lock, struct ARC_MCSNode *node) {
+	struct ARC_MCSNode *next = atomic_load_explicit(&node->next, memory_order_acquire);
+
+	if (next == NULL) {
+		struct ARC_MCSNode *expected = node;
+
+		if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL, memory_order_release, memory_order_relaxed)) {
+			return;
+		}
+
+		// Someone swapped in behind us and is about to link up
+		while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+			__builtin_ia32_pause();
+		}
+	}
+
+	atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+uint64_t Arc_MCSLockIRQSave(struct ARC_MCSLock *lock, struct ARC_MCSNode *node) {
+	uint64_t flags = Arc_IRQSave();
+	Arc_MCSLock(lock, node);
+
+	return flags;
+}
+
+void Arc_MCSUnlockIRQRestore(struct ARC_MCSLock *lock, struct ARC_MCSNode *node, uint64_t flags) {
+	Arc_MCSUnlock(lock, node);
+	Arc_IRQRestore(flags);
+}
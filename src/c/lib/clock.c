@@ -0,0 +1,312 @@
+/**
+ * @file clock.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * The clock page is only written when the clocksource changes, which
+ * is once at boot. The 32.32 conversion with a 128-bit product does not
+ * overflow for centuries, so no periodic update is needed, and an idle
+ * CPU is not woken up to keep time.
+*/
+#include <lib/clock.h>
+#include <arch/x86-64/acpi/hpet.h>
+#include <arch/x86-64/apic/lapic.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <arch/x86-64/io/port.h>
+#include <mm/vmm.h>
+#include <global.h>
+#include <util.h>
+#include <cpuid.h>
+#include <abi-bits/errno.h>
+
+/// How long the TSC is measured against the HPET, in milliseconds.
+#define CLOCK_CALIBRATE_MS 100
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA    0x71
+
+static union {
+	struct ARC_ClockPage data;
+	uint8_t bytes[0x1000];
+} clock_page __attribute__((aligned(0x1000))) = {
+	// Count TSC cycles as nanoseconds until calibrated
+	.data = { .mode = ARC_CLOCK_MODE_TSC, .mult = 1ULL << 32 },
+};
+
+static uint64_t clock_read_counter(uint32_t mode) {
+	if (mode == ARC_CLOCK_MODE_HPET) {
+		return Arc_HPETCounter();
+	}
+
+	return _x86_RDTSC();
+}
+
+/**
+ * Read the monotonic clock and the realtime offset together.
+ * */
+static uint64_t clock_read(uint64_t *real_offset) {
+	struct ARC_ClockPage *page = &clock_page.data;
+	uint64_t ns = 0;
+	uint64_t offset = 0;
+	uint32_t sequence = 0;
+
+	do {
+		sequence = Arc_SeqReadBegin(&page->lock);
+
+		uint64_t delta = clock_read_counter(page->mode) - page->cycle_base;
+
+		ns = page->ns_base + (uint64_t)(((unsigned __int128)delta * page->mult) >> 32);
+		offset = page->real_offset;
+	} while (Arc_SeqReadRetry(&page->lock, sequence));
+
+	if (real_offset != NULL) {
+		*real_offset = offset;
+	}
+
+	return ns;
+}
+
+static int clock_tsc_invariant() {
+	register uint32_t eax;
+	register uint32_t ebx;
+	register uint32_t ecx;
+	register uint32_t edx;
+
+	__cpuid(0x80000000, eax, ebx, ecx, edx);
+
+	if (eax < 0x80000007) {
+		return 0;
+	}
+
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+
+	return (edx >> 8) & 1;
+}
+
+/**
+ * Measure the TSC against the HPET, over a longer stretch than the
+ * LAPIC timer calibration for a better estimate.
+ *
+ * @return Ticks per second.
+ * */
+static uint64_t clock_calibrate_tsc() {
+	uint64_t period = Arc_HPETPeriod();
+
+	if (period == 0) {
+		return Arc_GetTSCFrequency();
+	}
+
+	uint64_t ticks = (CLOCK_CALIBRATE_MS * 1000000000000ULL) / period;
+	uint64_t flags = Arc_IRQSave();
+
+	uint64_t hpet_start = Arc_HPETCounter();
+	uint64_t tsc_start = _x86_RDTSC();
+	uint32_t elapsed = 0;
+
+	// The counter may only be 32 bits wide, the wait fits either way
+	while ((elapsed = (uint32_t)(Arc_HPETCounter() - hpet_start)) < ticks) {
+		__builtin_ia32_pause();
+	}
+
+	uint64_t tsc = _x86_RDTSC() - tsc_start;
+
+	Arc_IRQRestore(flags);
+
+	uint64_t ns = ((uint64_t)elapsed * period) / 1000000;
+
+	return (tsc * 1000000000) / ns;
+}
+
+static uint8_t clock_cmos(uint8_t reg) {
+	outb(CMOS_ADDRESS, reg);
+
+	return inb(CMOS_DATA);
+}
+
+static void clock_cmos_time(uint8_t time[6]) {
+	// Not in the middle of an update
+	while (clock_cmos(0x0A) & 0x80) {
+		__builtin_ia32_pause();
+	}
+
+	time[0] = clock_cmos(0x00); // Seconds
+	time[1] = clock_cmos(0x02); // Minutes
+	time[2] = clock_cmos(0x04); // Hours
+	time[3] = clock_cmos(0x07); // Day
+	time[4] = clock_cmos(0x08); // Month
+	time[5] = clock_cmos(0x09); // Year
+}
+
+static int clock_bcd(int value) {
+	return (value & 0x0F) + (value >> 4) * 10;
+}
+
+/**
+ * Read the CMOS RTC.
+ *
+ * @return Seconds since the Unix epoch.
+ * */
+static uint64_t clock_read_rtc() {
+	uint8_t time[6];
+	uint8_t again[6];
+
+	// An update can still land in between, read until two reads agree
+	clock_cmos_time(time);
+
+	for (;;) {
+		clock_cmos_time(again);
+
+		int same = 1;
+
+		for (int i = 0; i < 6; i++) {
+			same &= time[i] == again[i];
+		}
+
+		if (same) {
+			break;
+		}
+
+		memcpy(time, again, sizeof(time));
+	}
+
+	uint8_t status = clock_cmos(0x0B);
+	int pm = (time[2] & 0x80) != 0;
+	int values[6];
+
+	time[2] &= 0x7F;
+
+	for (int i = 0; i < 6; i++) {
+		values[i] = (status & 0x04) ? time[i] : clock_bcd(time[i]);
+	}
+
+	if ((status & 0x02) == 0) {
+		// 12 hour clock, 12AM is 0
+		values[2] = (values[2] % 12) + (pm ? 12 : 0);
+	}
+
+	// There is no century register to go by
+	int64_t year = 2000 + values[5];
+	int64_t month = values[4];
+	int64_t day = values[3];
+
+	// Days since the epoch of a proleptic Gregorian date
+	year -= month <= 2;
+
+	int64_t era = year / 400;
+	int64_t year_of_era = year - era * 400;
+	int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	int64_t days = era * 146097 + day_of_era - 719468;
+
+	return days * 86400 + values[2] * 3600 + values[1] * 60 + values[0];
+}
+
+int Arc_InitializeClock() {
+	struct ARC_ClockPage *page = &clock_page.data;
+	uint32_t mode = ARC_CLOCK_MODE_TSC;
+	uint64_t mult = 0;
+
+	if (clock_tsc_invariant()) {
+		uint64_t hz = clock_calibrate_tsc();
+
+		if (hz == 0) {
+			ARC_DEBUG(ERR, "Failed to measure the TSC\n");
+			return 1;
+		}
+
+		mult = (1000000000ULL << 32) / hz;
+		ARC_DEBUG(INFO, "Clocksource: invariant TSC, %"PRIu64"Hz\n", hz);
+	} else if (Arc_HPETPeriod() != 0 && Arc_HPETIs64Bit()) {
+		mode = ARC_CLOCK_MODE_HPET;
+		mult = (Arc_HPETPeriod() << 32) / 1000000;
+		ARC_DEBUG(INFO, "Clocksource: HPET, TSC is not invariant\n");
+	} else if (Arc_GetTSCFrequency() != 0) {
+		mult = (1000000000ULL << 32) / Arc_GetTSCFrequency();
+		ARC_DEBUG(WARN, "Clocksource: TSC, which is not invariant, time may drift\n");
+	} else {
+		ARC_DEBUG(ERR, "No clocksource\n");
+		return 1;
+	}
+
+	uint64_t real = clock_read_rtc() * 1000000000ULL;
+
+	Arc_SeqWriteLock(&page->lock);
+
+	// Carry on from where the uncalibrated clock got to
+	uint64_t now = page->ns_base + (uint64_t)(((unsigned __int128)(clock_read_counter(page->mode) - page->cycle_base) * page->mult) >> 32);
+
+	page->mode = mode;
+	page->cycle_base = clock_read_counter(mode);
+	page->ns_base = now;
+	page->mult = mult;
+	page->real_offset = real - now;
+
+	Arc_SeqWriteUnlock(&page->lock);
+
+	// Present and user accessible, not writable
+	uint64_t physical = Arc_TranslateVMM((uintptr_t)&clock_page);
+
+	if (physical == 0 || Arc_MapPageVMM(physical, ARC_CLOCK_PAGE_USER, ARC_VMM_CREAT_FLAG | (1 << 2) | 1) != 0) {
+		ARC_DEBUG(WARN, "Failed to map clock page for userland\n");
+	}
+
+	return 0;
+}
+
+int Arc_ClockGet(int clock, uint64_t *ns) {
+	if (ns == NULL) {
+		return EINVAL;
+	}
+
+	uint64_t offset = 0;
+	uint64_t monotonic = clock_read(&offset);
+
+	switch (clock) {
+	case ARC_CLOCK_REALTIME: {
+		*ns = monotonic + offset;
+		break;
+	}
+
+	case ARC_CLOCK_MONOTONIC: {
+		*ns = monotonic;
+		break;
+	}
+
+	default: {
+		return EINVAL;
+	}
+	}
+
+	return 0;
+}
+
+uint64_t Arc_ClockMonotonic() {
+	return clock_read(NULL);
+}
+
+uint64_t Arc_ClockRealtime() {
+	uint64_t offset = 0;
+	uint64_t monotonic = clock_read(&offset);
+
+	return monotonic + offset;
+}
@@ -0,0 +1,613 @@
+/**
+ * @file inflate.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * DEFLATE (RFC 1951) decompressor with a gzip (RFC 1952) wrapper.
+ *
+ * Codes of up to INFLATE_FAST_BITS bits are resolved with a single
+ * table lookup, longer codes fall back to walking the canonical code
+ * counts one bit at a time.
+*/
+#include <lib/inflate.h>
+#include <mm/slab.h>
+#include <global.h>
+#include <util.h>
+
+#define INFLATE_MAX_BITS   15
+#define INFLATE_FAST_BITS  9
+#define INFLATE_MAX_LCODES 286
+#define INFLATE_MAX_DCODES 30
+#define INFLATE_FIX_LCODES 288
+
+#define GZIP_FTEXT    0x01
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+struct inflate_huffman {
+	/// Number of codes of each length.
+	uint16_t count[INFLATE_MAX_BITS + 1];
+	/// Symbols ordered by their codes.
+	uint16_t symbol[INFLATE_FIX_LCODES];
+	/// (symbol << 4) | length indexed by the next INFLATE_FAST_BITS of input, 0 if the code is longer.
+	uint16_t fast[1 << INFLATE_FAST_BITS];
+};
+
+struct inflate_state {
+	uint8_t *out;
+	size_t out_size;
+	size_t out_pos;
+	uint8_t *in;
+	size_t in_size;
+	size_t in_pos;
+	/// Bits not yet consumed, LSB first.
+	uint64_t bit_buffer;
+	int bit_count;
+	/// Bits of zeroes fed in past the end of the input.
+	size_t padding;
+	struct inflate_huffman lencode;
+	struct inflate_huffman distcode;
+};
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t code_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static struct inflate_huffman fixed_lencode;
+static struct inflate_huffman fixed_distcode;
+static int fixed_built = 0;
+
+static uint32_t crc_table[256];
+static int crc_built = 0;
+
+static void inflate_refill(struct inflate_state *state) {
+	while (state->bit_count <= 56) {
+		uint64_t byte = 0;
+
+		if (state->in_pos < state->in_size) {
+			byte = state->in[state->in_pos++];
+		} else {
+			state->padding += 8;
+		}
+
+		state->bit_buffer |= byte << state->bit_count;
+		state->bit_count += 8;
+	}
+}
+
+static uint32_t inflate_bits(struct inflate_state *state, int need) {
+	if (state->bit_count < need) {
+		inflate_refill(state);
+	}
+
+	uint32_t value = state->bit_buffer & ((1ULL << need) - 1);
+	state->bit_buffer >>= need;
+	state->bit_count -= need;
+
+	return value;
+}
+
+static int inflate_truncated(struct inflate_state *state) {
+	// Consumed bits which only exist as padding
+	return state->padding > (size_t)state->bit_count;
+}
+
+/**
+ * Build a decoding table from a list of code lengths.
+ *
+ * @return 0 for a complete code, > 0 for an incomplete code, < 0 for an over-subscribed code.
+ * */
+static int inflate_construct(struct inflate_huffman *h, uint8_t *length, int n) {
+	memset(h->count, 0, sizeof(h->count));
+
+	for (int symbol = 0; symbol < n; symbol++) {
+		h->count[length[symbol]]++;
+	}
+
+	if (h->count[0] == n) {
+		// No codes, complete but decoding will fail
+		memset(h->fast, 0, sizeof(h->fast));
+		return 0;
+	}
+
+	int left = 1;
+	for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+
+		if (left < 0) {
+			return left;
+		}
+	}
+
+	uint16_t offs[INFLATE_MAX_BITS + 1];
+	offs[1] = 0;
+	for (int len = 1; len < INFLATE_MAX_BITS; len++) {
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+
+	for (int symbol = 0; symbol < n; symbol++) {
+		if (length[symbol] != 0) {
+			h->symbol[offs[length[symbol]]++] = symbol;
+		}
+	}
+
+	// Codes are stored MSB first while input is read LSB
+	// first, index the fast table by the reversed code
+	memset(h->fast, 0, sizeof(h->fast));
+
+	int code = 0;
+	int index = 0;
+	for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+		for (int i = 0; i < h->count[len]; i++) {
+			uint16_t symbol = h->symbol[index++];
+			int reversed = 0;
+
+			for (int bit = 0; bit < len; bit++) {
+				reversed |= ((code >> bit) & 1) << (len - bit - 1);
+			}
+
+			for (int fill = reversed; fill < (1 << INFLATE_FAST_BITS); fill += 1 << len) {
+				h->fast[fill] = (symbol << 4) | len;
+			}
+
+			code++;
+		}
+
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int inflate_decode(struct inflate_state *state, struct inflate_huffman *h) {
+	if (state->bit_count < INFLATE_MAX_BITS) {
+		inflate_refill(state);
+	}
+
+	uint16_t entry = h->fast[state->bit_buffer & ((1 << INFLATE_FAST_BITS) - 1)];
+
+	if (entry != 0) {
+		state->bit_buffer >>= entry & 0xF;
+		state->bit_count -= entry & 0xF;
+		return entry >> 4;
+	}
+
+	int code = 0;
+	int first = 0;
+	int index = 0;
+
+	for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+		code |= inflate_bits(state, 1);
+		int count = h->count[len];
+
+		if (code - count < first) {
+			return h->symbol[index + (code - first)];
+		}
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static int inflate_stored(struct inflate_state *state) {
+	// Discard up to the byte boundary
+	inflate_bits(state, state->bit_count & 7);
+
+	uint32_t len = inflate_bits(state, 16);
+	uint32_t nlen = inflate_bits(state, 16);
+
+	if (inflate_truncated(state)) {
+		return ARC_INFLATE_TRUNCATED;
+	}
+
+	if (len != (~nlen & 0xFFFF)) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	if (state->out_pos + len > state->out_size) {
+		return ARC_INFLATE_OVERFLOW;
+	}
+
+	while (len > 0 && state->bit_count >= 8) {
+		state->out[state->out_pos++] = inflate_bits(state, 8);
+		len--;
+	}
+
+	if (inflate_truncated(state) || state->in_pos + len > state->in_size) {
+		return ARC_INFLATE_TRUNCATED;
+	}
+
+	memcpy(state->out + state->out_pos, state->in + state->in_pos, len);
+	state->out_pos += len;
+	state->in_pos += len;
+
+	return ARC_INFLATE_OK;
+}
+
+static int inflate_codes(struct inflate_state *state, struct inflate_huffman *lencode, struct inflate_huffman *distcode) {
+	for (;;) {
+		int symbol = inflate_decode(state, lencode);
+
+		if (symbol < 0) {
+			return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_CORRUPT;
+		}
+
+		if (symbol < 256) {
+			if (state->out_pos >= state->out_size) {
+				return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_OVERFLOW;
+			}
+
+			state->out[state->out_pos++] = symbol;
+			continue;
+		}
+
+		if (symbol == 256) {
+			return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_OK;
+		}
+
+		symbol -= 257;
+
+		if (symbol >= 29) {
+			return ARC_INFLATE_CORRUPT;
+		}
+
+		size_t len = length_base[symbol] + inflate_bits(state, length_extra[symbol]);
+		symbol = inflate_decode(state, distcode);
+
+		if (symbol < 0 || symbol >= 30) {
+			return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_CORRUPT;
+		}
+
+		size_t dist = dist_base[symbol] + inflate_bits(state, dist_extra[symbol]);
+
+		if (dist > state->out_pos) {
+			return ARC_INFLATE_CORRUPT;
+		}
+
+		if (state->out_pos + len > state->out_size) {
+			return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_OVERFLOW;
+		}
+
+		uint8_t *to = state->out + state->out_pos;
+		uint8_t *from = to - dist;
+
+		if (dist >= len) {
+			memcpy(to, from, len);
+		} else {
+			// Overlapping copy repeats the last dist bytes
+			for (size_t i = 0; i < len; i++) {
+				to[i] = from[i];
+			}
+		}
+
+		state->out_pos += len;
+	}
+}
+
+static int inflate_fixed(struct inflate_state *state) {
+	if (!fixed_built) {
+		uint8_t lengths[INFLATE_FIX_LCODES];
+		int symbol = 0;
+
+		for (; symbol < 144; symbol++) {
+			lengths[symbol] = 8;
+		}
+
+		for (; symbol < 256; symbol++) {
+			lengths[symbol] = 9;
+		}
+
+		for (; symbol < 280; symbol++) {
+			lengths[symbol] = 7;
+		}
+
+		for (; symbol < INFLATE_FIX_LCODES; symbol++) {
+			lengths[symbol] = 8;
+		}
+
+		inflate_construct(&fixed_lencode, lengths, INFLATE_FIX_LCODES);
+
+		for (symbol = 0; symbol < INFLATE_MAX_DCODES; symbol++) {
+			lengths[symbol] = 5;
+		}
+
+		inflate_construct(&fixed_distcode, lengths, INFLATE_MAX_DCODES);
+
+		fixed_built = 1;
+	}
+
+	return inflate_codes(state, &fixed_lencode, &fixed_distcode);
+}
+
+static int inflate_dynamic(struct inflate_state *state) {
+	uint8_t lengths[INFLATE_MAX_LCODES + INFLATE_MAX_DCODES];
+
+	int nlen = inflate_bits(state, 5) + 257;
+	int ndist = inflate_bits(state, 5) + 1;
+	int ncode = inflate_bits(state, 4) + 4;
+
+	if (nlen > INFLATE_MAX_LCODES || ndist > INFLATE_MAX_DCODES) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	int index = 0;
+	for (; index < ncode; index++) {
+		lengths[code_order[index]] = inflate_bits(state, 3);
+	}
+
+	for (; index < 19; index++) {
+		lengths[code_order[index]] = 0;
+	}
+
+	if (inflate_construct(&state->lencode, lengths, 19) != 0) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	index = 0;
+	while (index < nlen + ndist) {
+		int symbol = inflate_decode(state, &state->lencode);
+
+		if (symbol < 0) {
+			return inflate_truncated(state) ? ARC_INFLATE_TRUNCATED : ARC_INFLATE_CORRUPT;
+		}
+
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		uint8_t len = 0;
+
+		if (symbol == 16) {
+			if (index == 0) {
+				return ARC_INFLATE_CORRUPT;
+			}
+
+			len = lengths[index - 1];
+			symbol = 3 + inflate_bits(state, 2);
+		} else if (symbol == 17) {
+			symbol = 3 + inflate_bits(state, 3);
+		} else {
+			symbol = 11 + inflate_bits(state, 7);
+		}
+
+		if (index + symbol > nlen + ndist) {
+			return ARC_INFLATE_CORRUPT;
+		}
+
+		while (symbol-- > 0) {
+			lengths[index++] = len;
+		}
+	}
+
+	if (lengths[256] == 0) {
+		// No end of block code
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	int err = inflate_construct(&state->lencode, lengths, nlen);
+
+	if (err < 0 || (err > 0 && nlen - state->lencode.count[0] != 1)) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	err = inflate_construct(&state->distcode, lengths + nlen, ndist);
+
+	if (err < 0 || (err > 0 && ndist - state->distcode.count[0] != 1)) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	return inflate_codes(state, &state->lencode, &state->distcode);
+}
+
+int Arc_Inflate(void *out, size_t out_size, void *in, size_t in_size, size_t *produced, size_t *consumed) {
+	if (out == NULL || in == NULL || produced == NULL) {
+		ARC_DEBUG(ERR, "Invalid arguments (%p, %p, %p)\n", out, in, produced);
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	struct inflate_state *state = (struct inflate_state *)Arc_SlabAlloc(sizeof(struct inflate_state));
+
+	if (state == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate state\n");
+		return ARC_INFLATE_OVERFLOW;
+	}
+
+	memset(state, 0, sizeof(struct inflate_state));
+
+	state->out = (uint8_t *)out;
+	state->out_size = out_size;
+	state->in = (uint8_t *)in;
+	state->in_size = in_size;
+
+	int last = 0;
+	int ret = ARC_INFLATE_OK;
+
+	while (!last && ret == ARC_INFLATE_OK) {
+		last = inflate_bits(state, 1);
+		int type = inflate_bits(state, 2);
+
+		switch (type) {
+		case 0: {
+			ret = inflate_stored(state);
+			break;
+		}
+
+		case 1: {
+			ret = inflate_fixed(state);
+			break;
+		}
+
+		case 2: {
+			ret = inflate_dynamic(state);
+			break;
+		}
+
+		default: {
+			ret = ARC_INFLATE_CORRUPT;
+			break;
+		}
+		}
+	}
+
+	*produced = state->out_pos;
+
+	if (consumed != NULL) {
+		// Give back whole bytes still in the bit buffer
+		size_t bits = (size_t)state->bit_count;
+		size_t unused = bits > state->padding ? (bits - state->padding) / 8 : 0;
+		*consumed = state->in_pos - unused;
+	}
+
+	Arc_SlabFree(state);
+
+	return ret;
+}
+
+static uint32_t gzip_crc32(uint8_t *data, size_t size) {
+	if (!crc_built) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+
+			for (int j = 0; j < 8; j++) {
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+			}
+
+			crc_table[i] = crc;
+		}
+
+		crc_built = 1;
+	}
+
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t i = 0; i < size; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+static uint32_t gzip_le32(uint8_t *data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+int Arc_IsGzip(void *in, size_t in_size) {
+	uint8_t *data = (uint8_t *)in;
+
+	// ID1, ID2, CM = deflate
+	return in != NULL && in_size >= 18 && data[0] == 0x1F && data[1] == 0x8B && data[2] == 8;
+}
+
+size_t Arc_GzipSize(void *in, size_t in_size) {
+	if (!Arc_IsGzip(in, in_size)) {
+		return 0;
+	}
+
+	return gzip_le32((uint8_t *)in + in_size - 4);
+}
+
+int Arc_Gunzip(void *out, size_t out_size, void *in, size_t in_size, size_t *produced) {
+	if (!Arc_IsGzip(in, in_size) || produced == NULL) {
+		return ARC_INFLATE_CORRUPT;
+	}
+
+	uint8_t *data = (uint8_t *)in;
+	uint8_t flags = data[3];
+	size_t offset = 10;
+
+	if (flags & GZIP_FEXTRA) {
+		if (offset + 2 > in_size) {
+			return ARC_INFLATE_TRUNCATED;
+		}
+
+		offset += 2 + (data[offset] | (data[offset + 1] << 8));
+	}
+
+	if (flags & GZIP_FNAME) {
+		while (offset < in_size && data[offset] != 0) {
+			offset++;
+		}
+
+		offset++;
+	}
+
+	if (flags & GZIP_FCOMMENT) {
+		while (offset < in_size && data[offset] != 0) {
+			offset++;
+		}
+
+		offset++;
+	}
+
+	if (flags & GZIP_FHCRC) {
+		offset += 2;
+	}
+
+	if (offset + 8 > in_size) {
+		return ARC_INFLATE_TRUNCATED;
+	}
+
+	size_t consumed = 0;
+	int ret = Arc_Inflate(out, out_size, data + offset, in_size - offset - 8, produced, &consumed);
+
+	if (ret != ARC_INFLATE_OK) {
+		return ret;
+	}
+
+	uint8_t *trailer = data + offset + consumed;
+
+	if (gzip_le32(trailer + 4) != (uint32_t)*produced || gzip_le32(trailer) != gzip_crc32((uint8_t *)out, *produced)) {
+		ARC_DEBUG(ERR, "Checksum mismatch\n");
+		return ARC_INFLATE_CHECKSUM;
+	}
+
+	return ARC_INFLATE_OK;
+}
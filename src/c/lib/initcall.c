@@ -0,0 +1,182 @@
+/**
+ * @file initcall.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Orders the init calls by their dependencies (Kahn's algorithm, a
+ * wave at a time) and runs them. Nothing here allocates, as it runs
+ * before most of the kernel is up.
+ *
+ * The calls of a wave are independent, but they still run one after
+ * another on the bootstrap processor. The APs only come up in the smp
+ * call, after the waves which hold nearly all of the work, and the
+ * calls share state (the VFS tree, resources, the PMM) that has never
+ * been set up concurrently. Handing waves to the APs would need smp to
+ * run first and each call audited for it, so it is not done.
+*/
+#include <lib/initcall.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <global.h>
+#include <util.h>
+
+#define INITCALL_PENDING 0
+#define INITCALL_DONE    1
+#define INITCALL_FAILED  2
+#define INITCALL_SKIPPED 3
+
+extern struct ARC_InitCall __INITCALLS_START[];
+extern struct ARC_InitCall __INITCALLS_END[];
+
+/// Index of each dependency of each call, -1 if no call has that name.
+static int initcall_deps[ARC_INITCALL_MAX][ARC_INITCALL_MAX];
+static int initcall_state[ARC_INITCALL_MAX];
+
+static int initcall_find(int count, char *name) {
+	for (int i = 0; i < count; i++) {
+		if (strcmp(__INITCALLS_START[i].name, name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * See whether a pending call can run.
+ *
+ * @return INITCALL_DONE if it can run now, INITCALL_PENDING if it has
+ * to wait, INITCALL_SKIPPED if it never can.
+ * */
+static int initcall_ready(int call) {
+	struct ARC_InitCall *def = &__INITCALLS_START[call];
+
+	for (uint64_t i = 0; i < def->dep_count; i++) {
+		int dep = initcall_deps[call][i];
+
+		if (dep == -1) {
+			ARC_DEBUG(ERR, "Init call %s depends on unknown %s\n", def->name, def->deps[i]);
+			return INITCALL_SKIPPED;
+		}
+
+		switch (initcall_state[dep]) {
+		case INITCALL_PENDING: {
+			return INITCALL_PENDING;
+		}
+
+		case INITCALL_FAILED:
+		case INITCALL_SKIPPED: {
+			ARC_DEBUG(ERR, "Skipping init call %s, %s did not succeed\n", def->name, def->deps[i]);
+			return INITCALL_SKIPPED;
+		}
+		}
+	}
+
+	return INITCALL_DONE;
+}
+
+int Arc_RunInitCalls() {
+	int count = __INITCALLS_END - __INITCALLS_START;
+
+	if (count > ARC_INITCALL_MAX) {
+		ARC_DEBUG(ERR, "%d init calls, only %d can be ordered\n", count, ARC_INITCALL_MAX);
+		return 1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct ARC_InitCall *def = &__INITCALLS_START[i];
+
+		if (def->dep_count > ARC_INITCALL_MAX) {
+			return 1;
+		}
+
+		for (uint64_t j = 0; j < def->dep_count; j++) {
+			initcall_deps[i][j] = initcall_find(count, def->deps[j]);
+		}
+
+		initcall_state[i] = INITCALL_PENDING;
+	}
+
+	int left = count;
+	int err = 0;
+	uint64_t total = 0;
+
+	for (int wave = 0; left > 0; wave++) {
+		int ready[ARC_INITCALL_MAX];
+		int ready_count = 0;
+
+		// Decide the whole wave before running any of it, the calls of a
+		// wave do not depend on each other
+		for (int i = 0; i < count; i++) {
+			if (initcall_state[i] != INITCALL_PENDING) {
+				continue;
+			}
+
+			int state = initcall_ready(i);
+
+			if (state == INITCALL_DONE) {
+				ready[ready_count++] = i;
+			} else if (state == INITCALL_SKIPPED) {
+				initcall_state[i] = INITCALL_SKIPPED;
+				left--;
+				err = 1;
+			}
+		}
+
+		if (ready_count == 0 && left > 0) {
+			// Everything left waits on something else that is left
+			for (int i = 0; i < count; i++) {
+				if (initcall_state[i] == INITCALL_PENDING) {
+					ARC_DEBUG(ERR, "Init call %s is part of a dependency cycle\n", __INITCALLS_START[i].name);
+					initcall_state[i] = INITCALL_SKIPPED;
+				}
+			}
+
+			return 1;
+		}
+
+		// Serially, see the top of the file for why waves are not
+		// spread over the APs
+		for (int i = 0; i < ready_count; i++) {
+			struct ARC_InitCall *def = &__INITCALLS_START[ready[i]];
+
+			uint64_t start = _x86_RDTSC();
+			int ret = def->init();
+			uint64_t cycles = _x86_RDTSC() - start;
+
+			total += cycles;
+			initcall_state[ready[i]] = ret == 0 ? INITCALL_DONE : INITCALL_FAILED;
+			left--;
+
+			if (ret != 0) {
+				ARC_DEBUG(ERR, "Init call %s failed (%d)\n", def->name, ret);
+				err = 1;
+			}
+
+			ARC_DEBUG(INFO, "Init call %s (wave %d): %lu cycles\n", def->name, wave, cycles);
+		}
+	}
+
+	ARC_DEBUG(INFO, "Ran %d init calls in %lu cycles\n", count, total);
+
+	return err;
+}
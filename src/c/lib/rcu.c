@@ -0,0 +1,316 @@
+/**
+ * @file rcu.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Grace periods are numbered. One is started when a CPU has callbacks
+ * waiting and none is running, and it completes once every online CPU
+ * has reported a quiescent state since it started. Each CPU keeps two
+ * callback lists: those not yet waiting on a grace period, and those
+ * waiting on the one numbered wait_gp.
+ *
+ * The tick and context switches only report quiescent states, as they
+ * may come with locks held. Callbacks are run by Arc_RCUQuiescent, from
+ * the idle loop.
+*/
+#include <lib/rcu.h>
+#include <lib/atomics.h>
+#include <mp/sched/abstract.h>
+#include <global.h>
+
+struct rcu_cpu {
+	/// Read section nesting, only ever touched by the CPU itself.
+	_Atomic uint32_t nesting;
+	/// Callbacks which have not been given a grace period.
+	struct ARC_RCUHead *next;
+	struct ARC_RCUHead **next_tail;
+	/// Callbacks run once grace period wait_gp completes.
+	struct ARC_RCUHead *wait;
+	uint64_t wait_gp;
+}__attribute__((aligned(64)));
+
+static struct rcu_cpu rcu_cpus[ARC_RCU_MAX_CPUS] = { 0 };
+
+static struct {
+	ARC_GenericSpinlock lock;
+	/// Last grace period started.
+	uint64_t current;
+	/// Last grace period completed, equal to current if none is running.
+	uint64_t completed;
+	/// Highest grace period a CPU is waiting on.
+	uint64_t needed;
+	/// CPUs yet to report a quiescent state for current.
+	uint64_t pending;
+	uint64_t online;
+} rcu_state = { .online = 1 };
+
+void Arc_RCUReadLock() {
+	// The kernel only reschedules when asked to, so no preemption count
+	// is kept. A section which calls Arc_CondResched or blocks gets
+	// caught by Arc_RCUContextSwitch.
+	struct rcu_cpu *cpu = &rcu_cpus[Arc_GetCurrentCPU()];
+
+	atomic_store_explicit(&cpu->nesting, atomic_load_explicit(&cpu->nesting, memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_signal_fence(memory_order_seq_cst);
+}
+
+void Arc_RCUReadUnlock() {
+	struct rcu_cpu *cpu = &rcu_cpus[Arc_GetCurrentCPU()];
+
+	atomic_signal_fence(memory_order_seq_cst);
+	atomic_store_explicit(&cpu->nesting, atomic_load_explicit(&cpu->nesting, memory_order_relaxed) - 1, memory_order_relaxed);
+}
+
+/**
+ * Start the next grace period.
+ *
+ * Called with rcu_state.lock held.
+ * */
+static void rcu_start_gp() {
+	rcu_state.current++;
+	rcu_state.pending = rcu_state.online;
+
+	if (rcu_state.pending == 0) {
+		// Every CPU is halted, none can be in a read section
+		rcu_state.completed = rcu_state.current;
+	}
+}
+
+/**
+ * Get a grace period which starts after now.
+ *
+ * Called with rcu_state.lock held.
+ * */
+static uint64_t rcu_request_gp() {
+	if (rcu_state.current == rcu_state.completed) {
+		// None running, start one
+		rcu_state.needed = rcu_state.current + 1;
+		rcu_start_gp();
+
+		return rcu_state.current;
+	}
+
+	// The running one may already have this CPU's report, take the next
+	rcu_state.needed = rcu_state.current + 1;
+
+	return rcu_state.needed;
+}
+
+/**
+ * Report a quiescent state for the running grace period, if one is owed.
+ *
+ * Called with rcu_state.lock held.
+ * */
+static void rcu_report(int id) {
+	if ((rcu_state.pending & (1ULL << id)) == 0) {
+		return;
+	}
+
+	rcu_state.pending &= ~(1ULL << id);
+
+	if (rcu_state.pending != 0) {
+		return;
+	}
+
+	rcu_state.completed = rcu_state.current;
+
+	if (rcu_state.needed > rcu_state.completed) {
+		rcu_start_gp();
+	}
+}
+
+/**
+ * Give the callbacks of a CPU a grace period and report its quiescent
+ * state, without running any of them.
+ *
+ * Called with interrupts off, outside of any read section.
+ * */
+static ARC_NO_FPU void rcu_note(int id, struct rcu_cpu *cpu) {
+	Arc_SpinlockLock(&rcu_state.lock);
+
+	if (cpu->wait == NULL && cpu->next != NULL) {
+		cpu->wait = cpu->next;
+		cpu->wait_gp = rcu_request_gp();
+		cpu->next = NULL;
+		cpu->next_tail = NULL;
+	}
+
+	rcu_report(id);
+
+	Arc_SpinlockUnlock(&rcu_state.lock);
+}
+
+void Arc_RCUQuiescent() {
+	int id = Arc_GetCurrentCPU();
+	struct rcu_cpu *cpu = &rcu_cpus[id];
+
+	if (atomic_load_explicit(&cpu->nesting, memory_order_relaxed) != 0) {
+		return;
+	}
+
+	uint64_t flags = Arc_IRQSave();
+	struct ARC_RCUHead *ready = NULL;
+
+	rcu_note(id, cpu);
+
+	Arc_SpinlockLock(&rcu_state.lock);
+
+	if (cpu->wait != NULL && rcu_state.completed >= cpu->wait_gp) {
+		ready = cpu->wait;
+		cpu->wait = NULL;
+	}
+
+	Arc_SpinlockUnlock(&rcu_state.lock);
+	Arc_IRQRestore(flags);
+
+	while (ready != NULL) {
+		struct ARC_RCUHead *next = ready->next;
+		ready->func(ready);
+		ready = next;
+	}
+}
+
+void Arc_CallRCU(struct ARC_RCUHead *head, void (*func)(struct ARC_RCUHead *head)) {
+	if (head == NULL || func == NULL) {
+		return;
+	}
+
+	head->next = NULL;
+	head->func = func;
+
+	uint64_t flags = Arc_IRQSave();
+	struct rcu_cpu *cpu = &rcu_cpus[Arc_GetCurrentCPU()];
+
+	if (cpu->next == NULL) {
+		cpu->next = head;
+	} else {
+		*cpu->next_tail = head;
+	}
+
+	cpu->next_tail = &head->next;
+
+	Arc_IRQRestore(flags);
+}
+
+ARC_NO_FPU void Arc_RCUTick() {
+	int id = Arc_GetCurrentCPU();
+	struct rcu_cpu *cpu = &rcu_cpus[id];
+
+	// The tick may have interrupted a reader
+	if (atomic_load_explicit(&cpu->nesting, memory_order_relaxed) != 0) {
+		return;
+	}
+
+	rcu_note(id, cpu);
+}
+
+ARC_NO_FPU void Arc_RCUContextSwitch() {
+	int id = Arc_GetCurrentCPU();
+	struct rcu_cpu *cpu = &rcu_cpus[id];
+
+	if (atomic_load_explicit(&cpu->nesting, memory_order_relaxed) != 0) {
+		// The nesting count is the CPU's, the next thread would
+		// inherit the section and the grace period never end
+		ARC_DEBUG(ERR, "Context switch in an RCU read section on CPU %d\n", id);
+		ARC_HANG;
+	}
+
+	rcu_note(id, cpu);
+}
+
+struct rcu_sync {
+	struct ARC_RCUHead head;
+	_Atomic int done;
+};
+
+static void rcu_sync_done(struct ARC_RCUHead *head) {
+	atomic_store_explicit(&ARC_RCU_ENTRY(head, struct rcu_sync, head)->done, 1, memory_order_release);
+}
+
+void Arc_SynchronizeRCU() {
+	struct rcu_sync sync = { .done = 0 };
+
+	Arc_CallRCU(&sync.head, rcu_sync_done);
+
+	while (atomic_load_explicit(&sync.done, memory_order_acquire) == 0) {
+		Arc_RCUQuiescent();
+		__builtin_ia32_pause();
+	}
+}
+
+int Arc_RCUNeedsCPU() {
+	int id = Arc_GetCurrentCPU();
+	struct rcu_cpu *cpu = &rcu_cpus[id];
+
+	if (cpu->next != NULL || cpu->wait != NULL) {
+		return 1;
+	}
+
+	uint64_t flags = Arc_IRQSave();
+
+	Arc_SpinlockLock(&rcu_state.lock);
+	int pending = (rcu_state.pending & (1ULL << id)) != 0;
+	Arc_SpinlockUnlock(&rcu_state.lock);
+
+	Arc_IRQRestore(flags);
+
+	return pending;
+}
+
+int Arc_RCUOnlineCPU(int cpu) {
+	if (cpu < 0 || cpu >= ARC_RCU_MAX_CPUS) {
+		return 1;
+	}
+
+	// Taken by the tick too
+	uint64_t flags = Arc_SpinlockLockIRQSave(&rcu_state.lock);
+	// Joins from the next grace period on, it has no readers in older ones
+	rcu_state.online |= 1ULL << cpu;
+	Arc_SpinlockUnlockIRQRestore(&rcu_state.lock, flags);
+
+	return 0;
+}
+
+void Arc_RCUIdleEnter() {
+	int id = Arc_GetCurrentCPU();
+	uint64_t flags = Arc_IRQSave();
+
+	Arc_SpinlockLock(&rcu_state.lock);
+	// Halted, so in no read section, grace periods need not wait on it
+	rcu_state.online &= ~(1ULL << id);
+	rcu_report(id);
+	Arc_SpinlockUnlock(&rcu_state.lock);
+
+	Arc_IRQRestore(flags);
+}
+
+void Arc_RCUIdleExit() {
+	int id = Arc_GetCurrentCPU();
+	uint64_t flags = Arc_IRQSave();
+
+	Arc_SpinlockLock(&rcu_state.lock);
+	rcu_state.online |= 1ULL << id;
+	Arc_SpinlockUnlock(&rcu_state.lock);
+
+	Arc_IRQRestore(flags);
+}
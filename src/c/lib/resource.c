@@ -40,6 +40,27 @@ extern struct ARC_DriverDef __DRIVERS1_END[];
 extern struct ARC_DriverDef __DRIVERS2_END[];
 extern struct ARC_DriverDef __DRIVERS3_END[];
 
+#define ARC_DRIVER_GROUPS 4
+// Indices at or above this keep their group on a linear scan, so a
+// table never takes more than a page
+#define ARC_DRIVER_MAX_INDEX (0x1000 / sizeof(struct ARC_DriverDef *))
+
+struct driver_group {
+	struct ARC_DriverDef *start;
+	struct ARC_DriverDef *end;
+	/// Definition of each index, NULL where there is none.
+	struct ARC_DriverDef **table;
+	/// Number of entries in the table.
+	uint64_t count;
+};
+
+static struct driver_group driver_groups[ARC_DRIVER_GROUPS] = {
+	{ __DRIVERS0_START, __DRIVERS0_END, NULL, 0 },
+	{ __DRIVERS1_START, __DRIVERS1_END, NULL, 0 },
+	{ __DRIVERS2_START, __DRIVERS2_END, NULL, 0 },
+	{ __DRIVERS3_START, __DRIVERS3_END, NULL, 0 },
+};
+
 struct ARC_Resource *Arc_InitializeResource(char *name, int dri_group, uint64_t dri_index, void *args) {
 	struct ARC_Resource *resource = (struct ARC_Resource *)Arc_SlabAlloc(sizeof(struct ARC_Resource));
 
@@ -78,6 +99,10 @@ struct ARC_Resource *Arc_InitializeResource(char *name, int dri_group, uint64_t
 	return resource;
 }
 
+static void resource_free_reference(struct ARC_RCUHead *head) {
+	Arc_SlabFree(ARC_RCU_ENTRY(head, struct ARC_Reference, rcu));
+}
+
 int Arc_UninitializeResource(struct ARC_Resource *resource) {
 	if (resource == NULL) {
 		ARC_DEBUG(ERR, "Resource is NULL, cannot uninitialize\n");
@@ -100,7 +125,7 @@ int Arc_UninitializeResource(struct ARC_Resource *resource) {
 		// TODO: What if we fail to close?
 		if (current_ref->signal != NULL && current_ref->signal(0, NULL) == 0) {
 			resource->ref_count -= 1;
-			Arc_SlabFree(current_ref);
+			Arc_CallRCU(&current_ref->rcu, resource_free_reference);
 		}
 
 		current_ref = tmp;
@@ -136,12 +161,16 @@ struct ARC_Reference *Arc_ReferenceResource(struct ARC_Resource *resource) {
 
 	ref->resource = resource;
 
-	resource->ref_count++; // TODO: Atomize
-	Arc_MutexLock(&resource->references->branch_mutex);
+	Arc_MutexLock(&resource->ref_count_mutex);
+	resource->ref_count++;
 	ref->next = resource->references;
-	resource->references->prev = ref;
+
+	if (ref->next != NULL) {
+		ref->next->prev = ref;
+	}
+
 	resource->references = ref;
-	Arc_MutexUnlock(&ref->next->branch_mutex);
+	Arc_MutexUnlock(&resource->ref_count_mutex);
 
 reference_fall:
 	return ref;
@@ -155,11 +184,10 @@ int Arc_UnreferenceResource(struct ARC_Reference *reference) {
 
 	struct ARC_Resource *res = reference->resource;
 
-        Arc_MutexLock(&reference->prev->branch_mutex);
-        Arc_MutexLock(&reference->branch_mutex);
-        Arc_MutexLock(&reference->next->branch_mutex);
+	// The list and the count are both covered by ref_count_mutex
+	Arc_MutexLock(&res->ref_count_mutex);
 
-	res->ref_count--; // TODO: Atomize
+	res->ref_count--;
 
 	struct ARC_Reference *next = reference->next;
 	struct ARC_Reference *prev = reference->prev;
@@ -174,51 +202,75 @@ int Arc_UnreferenceResource(struct ARC_Reference *reference) {
 		next->prev = prev;
 	}
 
-        Arc_MutexUnlock(&reference->prev->branch_mutex);
-        Arc_MutexUnlock(&reference->branch_mutex);
-        Arc_MutexUnlock(&reference->next->branch_mutex);
+	Arc_MutexUnlock(&res->ref_count_mutex);
 
-        Arc_SlabFree(reference);
+	Arc_CallRCU(&reference->rcu, resource_free_reference);
 
 	return 0;
 }
 
-// TODO: This can most definitely be optimzied
-struct ARC_DriverDef *Arc_GetDriverDef(int group, uint64_t index) {
-	struct ARC_DriverDef *start = NULL;
-	struct ARC_DriverDef *end = NULL;
+int Arc_InitializeDriverTable() {
+	int err = 0;
 
-	switch (group) {
-	case 0: {
-		start = __DRIVERS0_START;
-		end = __DRIVERS0_END;
-		break;
-	}
+	for (int group = 0; group < ARC_DRIVER_GROUPS; group++) {
+		struct driver_group *dri_group = &driver_groups[group];
 
-	case 1: {
-		start = __DRIVERS1_START;
-		end = __DRIVERS1_END;
-		break;
-	}
+		if (dri_group->start == dri_group->end) {
+			continue;
+		}
 
-	case 2: {
-		start = __DRIVERS2_START;
-		end = __DRIVERS2_END;
-		break;
-	}
+		uint64_t highest = 0;
 
-	case 3: {
-		start = __DRIVERS3_START;
-		end = __DRIVERS3_END;
-		break;
-	}
+		for (struct ARC_DriverDef *def = dri_group->start; def < dri_group->end; def++) {
+			highest = max(highest, def->index);
+		}
+
+		if (highest >= ARC_DRIVER_MAX_INDEX) {
+			ARC_DEBUG(WARN, "Driver group %d has index %lu, leaving it unindexed\n", group, highest);
+			continue;
+		}
+
+		struct ARC_DriverDef **table = (struct ARC_DriverDef **)Arc_SlabAlloc((highest + 1) * sizeof(struct ARC_DriverDef *));
+
+		if (table == NULL) {
+			ARC_DEBUG(ERR, "Failed to allocate table for driver group %d\n", group);
+			err = 1;
+			continue;
+		}
+
+		memset(table, 0, (highest + 1) * sizeof(struct ARC_DriverDef *));
+
+		for (struct ARC_DriverDef *def = dri_group->start; def < dri_group->end; def++) {
+			if (table[def->index] != NULL) {
+				// Keep the first, as the linear scan would have
+				ARC_DEBUG(ERR, "Driver index %lu of group %d is registered twice\n", def->index, group);
+				err = 1;
+				continue;
+			}
+
+			table[def->index] = def;
+		}
+
+		dri_group->count = highest + 1;
+		dri_group->table = table;
 	}
 
-	if (start == NULL || end == NULL) {
+	return err;
+}
+
+struct ARC_DriverDef *Arc_GetDriverDef(int group, uint64_t index) {
+	if (group < 0 || group >= ARC_DRIVER_GROUPS) {
 		return NULL;
 	}
 
-	for (struct ARC_DriverDef *def = start; def < end; def++) {
+	struct driver_group *dri_group = &driver_groups[group];
+
+	if (dri_group->table != NULL) {
+		return index < dri_group->count ? dri_group->table[index] : NULL;
+	}
+
+	// Before the table is built, or if the group could not be indexed
+	for (struct ARC_DriverDef *def = dri_group->start; def < dri_group->end; def++) {
 		if (def->index == index) {
 			return def;
 		}
@@ -0,0 +1,271 @@
+/**
+ * @file timer.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Everything which can run from the timer interrupt is built without
+ * SSE, the interrupted thread's extended state may be in the registers.
+*/
+#include <lib/timer.h>
+#include <lib/atomics.h>
+#include <arch/x86-64/apic/lapic.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <mp/sched/abstract.h>
+#include <global.h>
+
+struct timer_cpu {
+	ARC_GenericSpinlock lock;
+	int count;
+	/// Deadline the hardware is programmed for, 0 if it is stopped.
+	uint64_t programmed;
+	struct ARC_Timer *heap[ARC_TIMER_HEAP_SIZE];
+}__attribute__((aligned(64)));
+
+static struct timer_cpu timer_cpus[ARC_TIMER_MAX_CPUS] = { 0 };
+/// TSC frequency, 0 until the timers are up.
+static uint64_t timer_hz = 0;
+
+static ARC_NO_FPU void timer_place(struct timer_cpu *cpu, struct ARC_Timer *timer, int index) {
+	cpu->heap[index] = timer;
+	timer->index = index;
+}
+
+static ARC_NO_FPU void timer_sift_up(struct timer_cpu *cpu, int index) {
+	struct ARC_Timer *timer = cpu->heap[index];
+
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (cpu->heap[parent]->deadline <= timer->deadline) {
+			break;
+		}
+
+		timer_place(cpu, cpu->heap[parent], index);
+		index = parent;
+	}
+
+	timer_place(cpu, timer, index);
+}
+
+static ARC_NO_FPU void timer_sift_down(struct timer_cpu *cpu, int index) {
+	struct ARC_Timer *timer = cpu->heap[index];
+
+	for (;;) {
+		int child = index * 2 + 1;
+
+		if (child >= cpu->count) {
+			break;
+		}
+
+		if (child + 1 < cpu->count && cpu->heap[child + 1]->deadline < cpu->heap[child]->deadline) {
+			child++;
+		}
+
+		if (cpu->heap[child]->deadline >= timer->deadline) {
+			break;
+		}
+
+		timer_place(cpu, cpu->heap[child], index);
+		index = child;
+	}
+
+	timer_place(cpu, timer, index);
+}
+
+/**
+ * Take a timer out of the heap, called with the lock held.
+ * */
+static ARC_NO_FPU void timer_remove(struct timer_cpu *cpu, struct ARC_Timer *timer) {
+	int index = timer->index;
+	struct ARC_Timer *last = cpu->heap[--cpu->count];
+
+	timer->index = -1;
+
+	if (index == cpu->count) {
+		return;
+	}
+
+	timer_place(cpu, last, index);
+	timer_sift_down(cpu, index);
+	timer_sift_up(cpu, last->index);
+}
+
+/**
+ * Program the hardware for the earliest deadline.
+ *
+ * Called on the CPU itself with the lock held.
+ * */
+static ARC_NO_FPU void timer_program(struct timer_cpu *cpu) {
+	uint64_t next = cpu->count == 0 ? 0 : cpu->heap[0]->deadline;
+
+	if (next == cpu->programmed) {
+		return;
+	}
+
+	cpu->programmed = next;
+	Arc_LAPICTimerDeadline(next);
+}
+
+int Arc_InitTimer(struct ARC_Timer *timer, void (*func)(struct ARC_Timer *timer)) {
+	if (timer == NULL || func == NULL) {
+		return 1;
+	}
+
+	timer->deadline = 0;
+	timer->func = func;
+	timer->cpu = -1;
+	timer->index = -1;
+
+	return 0;
+}
+
+ARC_NO_FPU int Arc_TimerArmAt(struct ARC_Timer *timer, uint64_t deadline) {
+	if (timer == NULL || timer->func == NULL || timer_hz == 0) {
+		return 1;
+	}
+
+	Arc_TimerCancel(timer);
+
+	int id = Arc_GetCurrentCPU();
+	struct timer_cpu *cpu = &timer_cpus[id];
+
+	uint64_t flags = Arc_SpinlockLockIRQSave(&cpu->lock);
+
+	if (cpu->count >= ARC_TIMER_HEAP_SIZE) {
+		Arc_SpinlockUnlockIRQRestore(&cpu->lock, flags);
+		ARC_DEBUG(ERR, "Timer heap of CPU %d is full\n", id);
+
+		return 1;
+	}
+
+	// 0 stops the hardware, so it is never a deadline
+	timer->deadline = max(deadline, (uint64_t)1);
+	atomic_store_explicit(&timer->cpu, id, memory_order_relaxed);
+
+	cpu->heap[cpu->count] = timer;
+	timer_sift_up(cpu, cpu->count++);
+	timer_program(cpu);
+
+	Arc_SpinlockUnlockIRQRestore(&cpu->lock, flags);
+
+	return 0;
+}
+
+ARC_NO_FPU int Arc_TimerArm(struct ARC_Timer *timer, uint64_t ns) {
+	return Arc_TimerArmAt(timer, Arc_TimerNow() + Arc_TimerNSToTicks(ns));
+}
+
+ARC_NO_FPU int Arc_TimerCancel(struct ARC_Timer *timer) {
+	if (timer == NULL) {
+		return 1;
+	}
+
+	for (;;) {
+		int id = atomic_load_explicit(&timer->cpu, memory_order_relaxed);
+
+		if (id < 0) {
+			return 1;
+		}
+
+		struct timer_cpu *cpu = &timer_cpus[id];
+		uint64_t flags = Arc_SpinlockLockIRQSave(&cpu->lock);
+
+		if (atomic_load_explicit(&timer->cpu, memory_order_relaxed) != id) {
+			// Moved to another CPU in the meantime
+			Arc_SpinlockUnlockIRQRestore(&cpu->lock, flags);
+			continue;
+		}
+
+		int armed = timer->index >= 0;
+
+		if (armed) {
+			timer_remove(cpu, timer);
+
+			if (id == Arc_GetCurrentCPU()) {
+				timer_program(cpu);
+			}
+		}
+
+		Arc_SpinlockUnlockIRQRestore(&cpu->lock, flags);
+
+		return !armed;
+	}
+}
+
+ARC_NO_FPU uint64_t Arc_TimerNow() {
+	return _x86_RDTSC();
+}
+
+ARC_NO_FPU uint64_t Arc_TimerNSToTicks(uint64_t ns) {
+	// Split so neither product can overflow
+	return (ns / 1000000000) * timer_hz + ((ns % 1000000000) * timer_hz) / 1000000000;
+}
+
+ARC_NO_FPU void Arc_TimerInterrupt() {
+	struct timer_cpu *cpu = &timer_cpus[Arc_GetCurrentCPU()];
+
+	// Interrupts are already off
+	Arc_SpinlockLock(&cpu->lock);
+
+	// One-shot, the hardware is stopped now
+	cpu->programmed = 0;
+
+	uint64_t now = Arc_TimerNow();
+
+	while (cpu->count > 0 && cpu->heap[0]->deadline <= now) {
+		struct ARC_Timer *timer = cpu->heap[0];
+
+		timer_remove(cpu, timer);
+
+		// The callback may arm it again, or free it
+		Arc_SpinlockUnlock(&cpu->lock);
+		timer->func(timer);
+		Arc_SpinlockLock(&cpu->lock);
+	}
+
+	timer_program(cpu);
+
+	Arc_SpinlockUnlock(&cpu->lock);
+}
+
+int Arc_InitializeTimers(int cpu) {
+	if (cpu < 0 || cpu >= ARC_TIMER_MAX_CPUS) {
+		return 1;
+	}
+
+	if (Arc_InitLAPICTimer(cpu) != 0) {
+		ARC_DEBUG(ERR, "No timer on CPU %d\n", cpu);
+		return 1;
+	}
+
+	struct timer_cpu *state = &timer_cpus[cpu];
+
+	state->count = 0;
+	state->programmed = 0;
+
+	if (cpu == 0) {
+		timer_hz = Arc_GetTSCFrequency();
+	}
+
+	return 0;
+}
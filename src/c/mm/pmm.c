@@ -28,18 +28,25 @@
 #include <global.h>
 #include <mm/freelist.h>
 #include <mm/pmm.h>
+#include <lib/atomics.h>
 #include <stdint.h>
 
 static struct ARC_FreelistMeta *arc_physical_mem = NULL;
 static struct ARC_FreelistMeta new_list = { 0 };
 static struct ARC_FreelistMeta combined = { 0 };
+/// Taken around every list operation, the CPUs share one list.
+static ARC_GenericSpinlock pmm_lock = 0;
 
 void *Arc_AllocPMM() {
 	if (arc_physical_mem == NULL) {
 		return NULL;
 	}
 
-	return Arc_ListAlloc(arc_physical_mem);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&pmm_lock);
+	void *ret = Arc_ListAlloc(arc_physical_mem);
+	Arc_SpinlockUnlockIRQRestore(&pmm_lock, flags);
+
+	return ret;
 }
 
 void *Arc_ContiguousAllocPMM(size_t objects) {
@@ -47,7 +54,11 @@ void *Arc_ContiguousAllocPMM(size_t objects) {
 		return NULL;
 	}
 
-	return Arc_ListContiguousAlloc(arc_physical_mem, objects);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&pmm_lock);
+	void *ret = Arc_ListContiguousAlloc(arc_physical_mem, objects);
+	Arc_SpinlockUnlockIRQRestore(&pmm_lock, flags);
+
+	return ret;
 }
 
 void *Arc_FreePMM(void *address) {
@@ -55,7 +66,11 @@ void *Arc_FreePMM(void *address) {
 		return NULL;
 	}
 
-	return Arc_ListFree(arc_physical_mem, address);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&pmm_lock);
+	void *ret = Arc_ListFree(arc_physical_mem, address);
+	Arc_SpinlockUnlockIRQRestore(&pmm_lock, flags);
+
+	return ret;
 }
 
 void *Arc_ContiguousFreePMM(void *address, size_t objects) {
@@ -63,7 +78,11 @@ void *Arc_ContiguousFreePMM(void *address, size_t objects) {
 		return NULL;
 	}
 
-	return Arc_ListContiguousFree(arc_physical_mem, address, objects);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&pmm_lock);
+	void *ret = Arc_ListContiguousFree(arc_physical_mem, address, objects);
+	Arc_SpinlockUnlockIRQRestore(&pmm_lock, flags);
+
+	return ret;
 }
 
 void Arc_InitPMM(struct ARC_MMap *mmap, int entries) {
@@ -26,6 +26,7 @@
 #include <mm/freelist.h>
 #include <mm/pmm.h>
 #include <mm/slab.h>
+#include <lib/atomics.h>
 #include <global.h>
 #include <util.h>
 
@@ -33,6 +34,7 @@ struct ARC_AllocMeta {
 	struct ARC_FreelistMeta *physical_mem;
 	struct ARC_FreelistMeta lists[8];
 	size_t list_sizes[8];
+	ARC_GenericSpinlock locks[8];
 };
 
 static struct ARC_AllocMeta heap = { 0 };
@@ -51,7 +53,9 @@ void *Arc_SlabAlloc(size_t size) {
 		}
 	}
 
+	uint64_t flags = Arc_SpinlockLockIRQSave(&heap.locks[i]);
 	void *a = Arc_ListAlloc(&heap.lists[i]);
+	Arc_SpinlockUnlockIRQRestore(&heap.locks[i], flags);
 
 	return a;
 }
@@ -76,7 +80,11 @@ void *Arc_SlabFree(void *address) {
 
 	memset(address, 0, heap.list_sizes[list]);
 
-	return Arc_ListFree(&heap.lists[list], address);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&heap.locks[list]);
+	void *ret = Arc_ListFree(&heap.lists[list], address);
+	Arc_SpinlockUnlockIRQRestore(&heap.locks[list], flags);
+
+	return ret;
 }
 
 // TODO: Realloc, Calloc
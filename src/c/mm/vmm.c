@@ -80,8 +80,66 @@ int Arc_MapPageVMM(uint64_t paddr, uint64_t vaddr, uint32_t flags) {
 	return 0;
 }
 
+uint64_t Arc_TranslateVMM(uint64_t vaddr) {
+	if (pml4 == NULL) {
+		return 0;
+	}
+
+	uint64_t *table = pml4;
+
+	for (int level = 4; level > 0; level--) {
+		int shift = ((level - 1) * 9) + 12;
+		uint64_t entry = table[(vaddr >> shift) & 0x1FF];
+
+		if ((entry & 1) == 0) {
+			return 0;
+		}
+
+		uint64_t address = entry & 0x000FFFFFFFFFF000;
+
+		// PTE, or a 2MiB / 1GiB page (PS)
+		if (level == 1 || (level < 4 && ((entry >> 7) & 1) == 1)) {
+			uint64_t mask = (1ULL << shift) - 1;
+
+			return (address & ~mask) | (vaddr & mask);
+		}
+
+		table = (uint64_t *)ARC_PHYS_TO_HHDM(address);
+	}
+
+	return 0;
+}
+
 int Arc_UnmapPageVMM(uint64_t vaddr) {
-        return 0;
+	if (pml4 == NULL) {
+		return 2;
+	}
+
+	uint64_t *table = pml4;
+
+	for (int level = 4; level > 1; level--) {
+		int shift = ((level - 1) * 9) + 12;
+		uint64_t entry = table[(vaddr >> shift) & 0x1FF];
+
+		if ((entry & 1) == 0 || (level < 4 && ((entry >> 7) & 1) == 1)) {
+			// Not mapped, or part of a large page
+			return 1;
+		}
+
+		table = (uint64_t *)ARC_PHYS_TO_HHDM(entry & 0x000FFFFFFFFFF000);
+	}
+
+	int entry_idx = (vaddr >> 12) & 0x1FF;
+
+	if ((table[entry_idx] & 1) == 0) {
+		return 1;
+	}
+
+	table[entry_idx] = 0;
+
+	__asm__("invlpg [%0]" : : "r"(vaddr) : "memory");
+
+	return 0;
 }
 
 void Arc_SetPML4(uint64_t *new_pml4) {
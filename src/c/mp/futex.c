@@ -0,0 +1,350 @@
+/**
+ * @file futex.c
+ *
+ * @author awewsomegamer <awewsomegamer@gmail.com>
+ *
+ * @LICENSE
+ * Arctan - Operating System Kernel
+ * Copyright (C) 2023-2024 awewsomegamer
+ *
+ * This file is part of Arctan.
+ *
+ * Arctan is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * @DESCRIPTION
+ * Waiters are queued on their own stacks in a hash table of buckets,
+ * and block until a wake takes them off it or their timer fires.
+ * Futexes are keyed by the physical address of the word, so processes
+ * sharing the page share the futex, whatever address they map it at.
+*/
+#include <abi-bits/errno.h>
+#include <lib/clock.h>
+#include <lib/atomics.h>
+#include <lib/timer.h>
+#include <mp/futex.h>
+#include <mp/thread.h>
+#include <mm/vmm.h>
+#include <global.h>
+#include <stddef.h>
+
+#define FUTEX_BUCKET_SHIFT 8
+#define FUTEX_BUCKETS (1 << FUTEX_BUCKET_SHIFT)
+
+struct futex_bucket {
+	ARC_GenericSpinlock lock;
+	struct futex_waiter *head;
+	struct futex_waiter *tail;
+}__attribute__((aligned(64)));
+
+struct futex_waiter {
+	/// Physical address of the word waited on.
+	uint64_t key;
+	uint32_t bitset;
+	/// Set by the waker once the waiter is off its bucket.
+	_Atomic int woken;
+	/// Set by the timer once the timeout passed.
+	_Atomic int expired;
+	/// Set once the timer callback is done with the waiter.
+	_Atomic int timer_done;
+	/// Thread sleeping on the futex.
+	struct ARC_Thread *thread;
+	/// Fires the timeout, armed on the waiter's CPU.
+	struct ARC_Timer timer;
+	/// Bucket the waiter is on, changed by requeues.
+	struct futex_bucket *_Atomic bucket;
+	struct futex_waiter *next;
+	struct futex_waiter *prev;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_BUCKETS] = { 0 };
+
+static struct futex_bucket *futex_hash(uint64_t key) {
+	// Fibonacci hashing, the low two bits are always clear
+	return &futex_buckets[((key >> 2) * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_BUCKET_SHIFT)];
+}
+
+/**
+ * Get the key of a futex word.
+ *
+ * @return The key, 0 if the word is misaligned or not mapped.
+ * */
+static uint64_t futex_key(uint32_t *address) {
+	if (address == NULL || ((uintptr_t)address & 3) != 0) {
+		return 0;
+	}
+
+	return Arc_TranslateVMM((uintptr_t)address);
+}
+
+/**
+ * Error for a word futex_key gave no key for.
+ * */
+static int futex_key_error(uint32_t *address) {
+	return address == NULL || ((uintptr_t)address & 3) != 0 ? -EINVAL : -EFAULT;
+}
+
+static void futex_enqueue(struct futex_bucket *bucket, struct futex_waiter *waiter) {
+	waiter->next = NULL;
+	waiter->prev = bucket->tail;
+
+	if (bucket->tail == NULL) {
+		bucket->head = waiter;
+	} else {
+		bucket->tail->next = waiter;
+	}
+
+	bucket->tail = waiter;
+	atomic_store_explicit(&waiter->bucket, bucket, memory_order_relaxed);
+}
+
+static void futex_dequeue(struct futex_bucket *bucket, struct futex_waiter *waiter) {
+	if (waiter->prev == NULL) {
+		bucket->head = waiter->next;
+	} else {
+		waiter->prev->next = waiter->next;
+	}
+
+	if (waiter->next == NULL) {
+		bucket->tail = waiter->prev;
+	} else {
+		waiter->next->prev = waiter->prev;
+	}
+}
+
+/**
+ * Lock the bucket a waiter is on.
+ *
+ * A requeue may move the waiter until its bucket is held.
+ * */
+static struct futex_bucket *futex_lock_waiter(struct futex_waiter *waiter, uint64_t *flags) {
+	for (;;) {
+		struct futex_bucket *bucket = atomic_load_explicit(&waiter->bucket, memory_order_relaxed);
+		*flags = Arc_SpinlockLockIRQSave(&bucket->lock);
+
+		if (bucket == atomic_load_explicit(&waiter->bucket, memory_order_relaxed)) {
+			return bucket;
+		}
+
+		Arc_SpinlockUnlockIRQRestore(&bucket->lock, *flags);
+	}
+}
+
+/**
+ * Timeout of a waiter, wakes its thread to give up.
+ * */
+static ARC_NO_FPU void futex_timeout(struct ARC_Timer *timer) {
+	struct futex_waiter *waiter = (struct futex_waiter *)((uintptr_t)timer - offsetof(struct futex_waiter, timer));
+	struct ARC_Thread *thread = waiter->thread;
+
+	atomic_store_explicit(&waiter->expired, 1, memory_order_seq_cst);
+	Arc_WakeThread(thread);
+
+	// Last access, the waiter may return once it sees this
+	atomic_store_explicit(&waiter->timer_done, 1, memory_order_release);
+}
+
+int Arc_FutexWait(uint32_t *address, uint32_t expected, uint64_t timeout, uint32_t bitset) {
+	if (bitset == 0) {
+		return -EINVAL;
+	}
+
+	uint64_t key = futex_key(address);
+
+	if (key == 0) {
+		return futex_key_error(address);
+	}
+
+	struct futex_waiter waiter = { .key = key, .bitset = bitset, .woken = 0, .expired = 0, .timer_done = 0 };
+	struct futex_bucket *bucket = futex_hash(key);
+
+	Arc_InitTimer(&waiter.timer, futex_timeout);
+
+	uint64_t flags = Arc_SpinlockLockIRQSave(&bucket->lock);
+
+	// Wakers take the bucket lock, so none can slip in between the
+	// check and the enqueue
+	if (atomic_load_explicit((_Atomic uint32_t *)address, memory_order_relaxed) != expected) {
+		Arc_SpinlockUnlockIRQRestore(&bucket->lock, flags);
+		return -EAGAIN;
+	}
+
+	// Blocked before it can be found, so a wake right after the unlock
+	// makes it runnable again instead of being lost
+	waiter.thread = Arc_PrepareBlock();
+	futex_enqueue(bucket, &waiter);
+	Arc_SpinlockUnlockIRQRestore(&bucket->lock, flags);
+
+	int armed = timeout != 0 && Arc_TimerArm(&waiter.timer, timeout) == 0;
+	// Without a timer the clock is polled instead, the thread is kept runnable
+	uint64_t deadline = timeout != 0 && !armed ? Arc_ClockMonotonic() + timeout : 0;
+
+	while (atomic_load_explicit(&waiter.woken, memory_order_seq_cst) == 0
+	       && atomic_load_explicit(&waiter.expired, memory_order_seq_cst) == 0) {
+		if (deadline != 0) {
+			if (Arc_ClockMonotonic() >= deadline) {
+				break;
+			}
+
+			Arc_CancelBlock();
+			Arc_Reschedule();
+			__builtin_ia32_pause();
+		} else {
+			Arc_Block();
+		}
+
+		Arc_PrepareBlock();
+	}
+
+	Arc_CancelBlock();
+
+	if (armed && Arc_TimerCancel(&waiter.timer) != 0) {
+		// Fired, its callback may still be using the waiter
+		while (atomic_load_explicit(&waiter.timer_done, memory_order_acquire) == 0) {
+			__builtin_ia32_pause();
+		}
+	}
+
+	if (atomic_load_explicit(&waiter.woken, memory_order_acquire) != 0) {
+		return 0;
+	}
+
+	bucket = futex_lock_waiter(&waiter, &flags);
+
+	if (atomic_load_explicit(&waiter.woken, memory_order_relaxed) != 0) {
+		// Woken while taking the lock, the waker owns the wake
+		Arc_SpinlockUnlockIRQRestore(&bucket->lock, flags);
+		return 0;
+	}
+
+	futex_dequeue(bucket, &waiter);
+	Arc_SpinlockUnlockIRQRestore(&bucket->lock, flags);
+
+	return -ETIMEDOUT;
+}
+
+/**
+ * Take waiters off a bucket and wake them.
+ *
+ * Called with the bucket held.
+ *
+ * @return The number woken.
+ * */
+static int futex_wake_bucket(struct futex_bucket *bucket, uint64_t key, int count, uint32_t bitset) {
+	int woken = 0;
+	struct futex_waiter *waiter = bucket->head;
+
+	while (waiter != NULL && woken < count) {
+		struct futex_waiter *next = waiter->next;
+
+		if (waiter->key == key && (waiter->bitset & bitset) != 0) {
+			struct ARC_Thread *thread = waiter->thread;
+
+			futex_dequeue(bucket, waiter);
+			// Last access, the waiter may return and its stack go away
+			atomic_store_explicit(&waiter->woken, 1, memory_order_seq_cst);
+			// At worst a spurious wake of whatever the thread sleeps on next
+			Arc_WakeThread(thread);
+			woken++;
+		}
+
+		waiter = next;
+	}
+
+	return woken;
+}
+
+int Arc_FutexWake(uint32_t *address, int count, uint32_t bitset) {
+	if (bitset == 0 || count < 0) {
+		return -EINVAL;
+	}
+
+	uint64_t key = futex_key(address);
+
+	if (key == 0) {
+		return futex_key_error(address);
+	}
+
+	struct futex_bucket *bucket = futex_hash(key);
+	uint64_t flags = Arc_SpinlockLockIRQSave(&bucket->lock);
+	int woken = futex_wake_bucket(bucket, key, count, bitset);
+	Arc_SpinlockUnlockIRQRestore(&bucket->lock, flags);
+
+	return woken;
+}
+
+int Arc_FutexRequeue(uint32_t *address, int wake, uint32_t *target, int requeue, uint32_t expected) {
+	if (wake < 0 || requeue < 0) {
+		return -EINVAL;
+	}
+
+	uint64_t key = futex_key(address);
+	uint64_t target_key = futex_key(target);
+
+	if (key == 0) {
+		return futex_key_error(address);
+	}
+
+	if (target_key == 0) {
+		return futex_key_error(target);
+	}
+
+	struct futex_bucket *from = futex_hash(key);
+	struct futex_bucket *to = futex_hash(target_key);
+
+	// Always lock the lower bucket first
+	uint64_t flags = Arc_SpinlockLockIRQSave(from < to ? &from->lock : &to->lock);
+
+	if (from != to) {
+		Arc_SpinlockLock(from < to ? &to->lock : &from->lock);
+	}
+
+	int done = -EAGAIN;
+
+	if (atomic_load_explicit((_Atomic uint32_t *)address, memory_order_relaxed) != expected) {
+		goto unlock;
+	}
+
+	done = futex_wake_bucket(from, key, wake, ARC_FUTEX_BITSET_ANY);
+
+	struct futex_waiter *waiter = from->head;
+	int moved = 0;
+
+	while (waiter != NULL && moved < requeue) {
+		struct futex_waiter *next = waiter->next;
+
+		if (waiter->key == key && key == target_key) {
+			// Already where they would be moved to, moving them would put
+			// them back at the tail of this very list
+			moved++;
+		} else if (waiter->key == key) {
+			futex_dequeue(from, waiter);
+			waiter->key = target_key;
+			futex_enqueue(to, waiter);
+			moved++;
+		}
+
+		waiter = next;
+	}
+
+	done += moved;
+
+	unlock:
+	if (from != to) {
+		Arc_SpinlockUnlock(from < to ? &to->lock : &from->lock);
+	}
+
+	Arc_SpinlockUnlockIRQRestore(from < to ? &from->lock : &to->lock, flags);
+
+	return done;
+}
@@ -25,10 +25,26 @@
  * @DESCRIPTION
 */
 #include <mp/sched/abstract.h>
+#include <mp/sched/mlfq.h>
+#include <mp/thread.h>
+#include <arch/x86-64/percpu.h>
 #include <global.h>
 
 int64_t Arc_GetCurrentTID() {
-	return 1;
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	// The boot context counts as thread 1
+	return current == NULL ? 1 : current->tid;
+}
+
+struct ARC_Thread *Arc_GetCurrentThread() {
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	return current == NULL ? Arc_GetBootThread(Arc_GetCurrentCPU()) : current;
+}
+
+ARC_NO_FPU int Arc_GetCurrentCPU() {
+	return ARC_THIS_CPU_READ(cpu);
 }
 
 int Arc_YieldCPU(int64_t tid) {
@@ -36,7 +52,8 @@ int Arc_YieldCPU(int64_t tid) {
 		return 0;
 	}
 
-	ARC_DEBUG(INFO, "Yielding CPU\n");
+	// TODO: Directed yield, for now whoever the scheduler picks runs
+	Arc_Reschedule();
 
 	return 0;
 }
@@ -23,4 +23,309 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  *
  * @DESCRIPTION
+ * Each level is a FIFO list, and a bitmap of the non-empty levels
+ * finds the highest one in a single instruction. Run queues each have
+ * their own lock, and a CPU only ever holds one of them at once, so
+ * nothing is shared between CPUs but the occasional steal.
+ *
+ * Ticks and scheduling happen from the timer interrupt too, so that
+ * path is built without SSE.
 */
+#include <mp/sched/mlfq.h>
+#include <mp/sched/abstract.h>
+#include <arch/x86-64/percpu.h>
+#include <lib/atomics.h>
+#include <stdbool.h>
+#include <global.h>
+#include <util.h>
+
+struct mlfq_level {
+	struct ARC_Thread *head;
+	struct ARC_Thread *tail;
+};
+
+struct mlfq_runqueue {
+	ARC_GenericSpinlock lock;
+	/// Bit n is set if level n has threads.
+	uint32_t bitmap;
+	/// Threads queued, read without the lock to find who to steal from.
+	_Atomic uint32_t count;
+	struct mlfq_level levels[ARC_MLFQ_LEVELS];
+	uint64_t ticks;
+	uint64_t next_boost;
+}__attribute__((aligned(64)));
+
+static struct mlfq_runqueue mlfq_runqueues[ARC_SCHED_MAX_CPUS] = { 0 };
+/// CPUs with an initialized run queue.
+static _Atomic uint64_t mlfq_online = 0;
+
+static ARC_NO_FPU uint32_t mlfq_slice(int level) {
+	return ARC_MLFQ_SLICE * (level + 1);
+}
+
+/**
+ * Append a thread to its level.
+ *
+ * Called with the run queue held.
+ * */
+static ARC_NO_FPU void mlfq_push(struct mlfq_runqueue *rq, struct ARC_Thread *thread) {
+	struct mlfq_level *level = &rq->levels[thread->level];
+
+	thread->next = NULL;
+
+	if (level->tail == NULL) {
+		level->head = thread;
+	} else {
+		level->tail->next = thread;
+	}
+
+	level->tail = thread;
+	rq->bitmap |= 1 << thread->level;
+	atomic_fetch_add_explicit(&rq->count, 1, memory_order_relaxed);
+}
+
+/**
+ * Take the first thread of the highest level which may run here.
+ *
+ * Called with the run queue held.
+ *
+ * @param bool steal - Skip threads whose context is still live on another CPU.
+ * */
+static ARC_NO_FPU struct ARC_Thread *mlfq_pop(struct mlfq_runqueue *rq, bool steal) {
+	uint32_t bitmap = rq->bitmap;
+
+	while (bitmap != 0) {
+		int index = __builtin_ctz(bitmap);
+		struct mlfq_level *level = &rq->levels[index];
+		struct ARC_Thread *prev = NULL;
+		struct ARC_Thread *thread = level->head;
+
+		while (thread != NULL && steal && atomic_load_explicit(&thread->on_cpu, memory_order_acquire) != 0) {
+			prev = thread;
+			thread = thread->next;
+		}
+
+		if (thread != NULL) {
+			if (prev == NULL) {
+				level->head = thread->next;
+			} else {
+				prev->next = thread->next;
+			}
+
+			if (level->tail == thread) {
+				level->tail = prev;
+			}
+
+			if (level->head == NULL) {
+				rq->bitmap &= ~(1 << index);
+			}
+
+			atomic_fetch_sub_explicit(&rq->count, 1, memory_order_relaxed);
+			thread->next = NULL;
+
+			return thread;
+		}
+
+		bitmap &= ~(1 << index);
+	}
+
+	return NULL;
+}
+
+/**
+ * Move every thread of a CPU to the top level.
+ *
+ * Called with the run queue held.
+ * */
+static ARC_NO_FPU void mlfq_boost(struct mlfq_runqueue *rq) {
+	struct mlfq_level *top = &rq->levels[0];
+
+	for (int i = 1; i < ARC_MLFQ_LEVELS; i++) {
+		struct mlfq_level *level = &rq->levels[i];
+
+		if (level->head == NULL) {
+			continue;
+		}
+
+		for (struct ARC_Thread *thread = level->head; thread != NULL; thread = thread->next) {
+			thread->level = 0;
+			thread->slice = mlfq_slice(0);
+		}
+
+		// Splice the whole level behind the top one
+		if (top->tail == NULL) {
+			top->head = level->head;
+		} else {
+			top->tail->next = level->head;
+		}
+
+		top->tail = level->tail;
+		level->head = NULL;
+		level->tail = NULL;
+	}
+
+	struct ARC_Thread *current = ARC_THIS_CPU_READ(current);
+
+	if (current != NULL) {
+		current->level = 0;
+		current->slice = mlfq_slice(0);
+	}
+
+	rq->bitmap = top->head != NULL ? 1 : 0;
+	rq->next_boost = rq->ticks + ARC_MLFQ_BOOST_TICKS;
+}
+
+/**
+ * Take a thread from the CPU with the most queued threads.
+ *
+ * Queue lengths are read without locks, only the victim's lock is
+ * taken, and only for the steal itself. Called with interrupts off.
+ * */
+static ARC_NO_FPU struct ARC_Thread *mlfq_steal(int self) {
+	uint64_t online = atomic_load_explicit(&mlfq_online, memory_order_acquire);
+	int busiest = -1;
+	uint32_t most = 0;
+
+	for (int cpu = 0; cpu < ARC_SCHED_MAX_CPUS; cpu++) {
+		if (cpu == self || (online & (1ULL << cpu)) == 0) {
+			continue;
+		}
+
+		uint32_t count = atomic_load_explicit(&mlfq_runqueues[cpu].count, memory_order_relaxed);
+
+		if (count > most) {
+			most = count;
+			busiest = cpu;
+		}
+	}
+
+	if (busiest < 0) {
+		return NULL;
+	}
+
+	struct mlfq_runqueue *victim = &mlfq_runqueues[busiest];
+
+	Arc_SpinlockLock(&victim->lock);
+	struct ARC_Thread *thread = mlfq_pop(victim, 1);
+	Arc_SpinlockUnlock(&victim->lock);
+
+	if (thread != NULL) {
+		thread->cpu = self;
+	}
+
+	return thread;
+}
+
+int Arc_MLFQInitCPU(int cpu) {
+	if (cpu < 0 || cpu >= ARC_SCHED_MAX_CPUS) {
+		return 1;
+	}
+
+	struct mlfq_runqueue *rq = &mlfq_runqueues[cpu];
+
+	memset(rq, 0, sizeof(struct mlfq_runqueue));
+	rq->next_boost = ARC_MLFQ_BOOST_TICKS;
+
+	atomic_fetch_or_explicit(&mlfq_online, 1ULL << cpu, memory_order_release);
+
+	return 0;
+}
+
+ARC_NO_FPU int Arc_MLFQEnqueue(struct ARC_Thread *thread) {
+	if (thread == NULL || thread->level < 0 || thread->level >= ARC_MLFQ_LEVELS) {
+		return 1;
+	}
+
+	if (thread->cpu < 0) {
+		thread->cpu = Arc_GetCurrentCPU();
+	}
+
+	if (thread->slice == 0) {
+		thread->slice = mlfq_slice(thread->level);
+	}
+
+	struct mlfq_runqueue *rq = &mlfq_runqueues[thread->cpu];
+
+	uint64_t flags = Arc_SpinlockLockIRQSave(&rq->lock);
+	thread->state = ARC_THREAD_READY;
+	mlfq_push(rq, thread);
+	Arc_SpinlockUnlockIRQRestore(&rq->lock, flags);
+
+	return 0;
+}
+
+ARC_NO_FPU struct ARC_Thread *Arc_MLFQSchedule() {
+	int self = Arc_GetCurrentCPU();
+	struct mlfq_runqueue *rq = &mlfq_runqueues[self];
+
+	// current is only touched by its own CPU, with interrupts off
+	uint64_t flags = Arc_IRQSave();
+
+	Arc_SpinlockLock(&rq->lock);
+
+	struct ARC_Thread *prev = ARC_THIS_CPU_READ(current);
+
+	if (prev != NULL && prev->state == ARC_THREAD_RUNNING) {
+		// Preempted or yielded, it goes behind its level
+		prev->state = ARC_THREAD_READY;
+		mlfq_push(rq, prev);
+	}
+
+	struct ARC_Thread *next = mlfq_pop(rq, 0);
+
+	Arc_SpinlockUnlock(&rq->lock);
+
+	if (next == NULL) {
+		next = mlfq_steal(self);
+	}
+
+	if (next != NULL) {
+		next->state = ARC_THREAD_RUNNING;
+		atomic_store_explicit(&next->on_cpu, 1, memory_order_relaxed);
+	}
+
+	ARC_THIS_CPU_WRITE(current, next);
+
+	Arc_IRQRestore(flags);
+
+	return next;
+}
+
+ARC_NO_FPU int Arc_MLFQTick() {
+	struct mlfq_runqueue *rq = &mlfq_runqueues[Arc_GetCurrentCPU()];
+	int reschedule = 0;
+
+	uint64_t flags = Arc_SpinlockLockIRQSave(&rq->lock);
+
+	rq->ticks++;
+
+	struct ARC_Thread *current = ARC_THIS_CPU_READ(current);
+
+	if (current != NULL && current->slice > 0 && --current->slice == 0) {
+		// Used the whole slice, drop a level
+		if (current->level < ARC_MLFQ_LEVELS - 1) {
+			current->level++;
+		}
+
+		current->slice = mlfq_slice(current->level);
+		reschedule = 1;
+	}
+
+	if (rq->ticks >= rq->next_boost) {
+		mlfq_boost(rq);
+		reschedule = 1;
+	}
+
+	// Nothing else to run, keep going
+	if (rq->bitmap == 0) {
+		reschedule = 0;
+	}
+
+	Arc_SpinlockUnlockIRQRestore(&rq->lock, flags);
+
+	return reschedule;
+}
+
+ARC_NO_FPU struct ARC_Thread *Arc_MLFQCurrent() {
+	return ARC_THIS_CPU_READ(current);
+}
@@ -23,4 +23,497 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  *
  * @DESCRIPTION
+ * Kernel threads and switching between them.
+ *
+ * Extended state is switched lazily. A thread switched in whose state
+ * is not in the registers runs with CR0.TS set, and only has its state
+ * restored if it touches the FPU and traps (#NM). A thread is only
+ * saved on the way out if TS was clear, that is if it could have
+ * touched the FPU since it came in. XSAVEOPT further skips the
+ * components left in their initial state or not modified since they
+ * were restored.
 */
+#include <mp/thread.h>
+#include <mp/sched/mlfq.h>
+#include <mp/sched/abstract.h>
+#include <arch/x86-64/fpu.h>
+#include <arch/x86-64/idt.h>
+#include <arch/x86-64/ctrl_regs.h>
+#include <arch/x86-64/smp.h>
+#include <arch/x86-64/percpu.h>
+#include <lib/timer.h>
+#include <lib/rcu.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <global.h>
+#include <util.h>
+
+#define THREAD_PAGE_SIZE 0x1000
+
+extern void _x86_switch_context(uint64_t *save_rsp, uint64_t load_rsp);
+extern void _x86_thread_start();
+extern void _x86_fpu_trap_stub();
+
+struct thread_cpu {
+	struct ARC_Thread boot;
+	/// Thread whose extended state is in the registers, NULL if none.
+	struct ARC_Thread *fpu_owner;
+	/// Mirror of CR0.TS, writes to CR0 serialize.
+	int fpu_trapping;
+	/// Thread switched away from, cleaned up by the one switched to.
+	struct ARC_Thread *switch_prev;
+	/// Scheduler tick, only armed while a thread other than boot runs.
+	struct ARC_Timer tick;
+	int ticking;
+	/// Set by the tick once the current thread should make way.
+	int need_resched;
+};
+
+static struct thread_cpu thread_cpus[ARC_SCHED_MAX_CPUS] = { 0 };
+// 1 is the boot thread
+static _Atomic int64_t thread_next_tid = 2;
+/// CPUs halted in Arc_IdleCPU.
+static _Atomic uint64_t thread_idle_cpus = 0;
+
+static size_t thread_fpu_pages() {
+	return ALIGN(Arc_FPUStateSize(), THREAD_PAGE_SIZE) / THREAD_PAGE_SIZE;
+}
+
+/**
+ * Allocate a save area in its initial state.
+ *
+ * Whole pages, so the area is aligned as XSAVE needs.
+ * */
+static void *thread_alloc_fpu() {
+	void *area = Arc_ContiguousAllocPMM(thread_fpu_pages());
+
+	if (area != NULL) {
+		Arc_FPUInitState(area);
+	}
+
+	return area;
+}
+
+static ARC_NO_FPU void thread_free(struct ARC_Thread *thread) {
+	Arc_ContiguousFreePMM(thread->fpu_state, thread_fpu_pages());
+	Arc_ContiguousFreePMM(thread->stack, ARC_THREAD_STACK_PAGES);
+	Arc_SlabFree(thread);
+}
+
+static ARC_NO_FPU struct ARC_Thread *thread_current(struct thread_cpu *cpu) {
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	return current == NULL ? &cpu->boot : current;
+}
+
+/**
+ * Save the outgoing thread's extended state if it may have changed,
+ * and arm the trap unless the incoming one's is already loaded.
+ * */
+static ARC_NO_FPU void thread_switch_fpu(struct thread_cpu *cpu, int id, struct ARC_Thread *prev, struct ARC_Thread *next) {
+	if (cpu->fpu_owner == prev && !cpu->fpu_trapping) {
+		if (prev->state == ARC_THREAD_DEAD) {
+			cpu->fpu_owner = NULL;
+		} else {
+			Arc_FPUSave(prev->fpu_state);
+		}
+	}
+
+	if (cpu->fpu_owner == next && next->fpu_cpu == id) {
+		// Nothing ran on the FPU here since next was saved
+		if (cpu->fpu_trapping) {
+			Arc_FPUAllow();
+			cpu->fpu_trapping = 0;
+		}
+
+		return;
+	}
+
+	if (!cpu->fpu_trapping) {
+		Arc_FPUTrapNext();
+		cpu->fpu_trapping = 1;
+	}
+}
+
+/**
+ * Clean up after the thread switched away from.
+ *
+ * Runs on the stack of the thread switched to.
+ * */
+static ARC_NO_FPU void thread_finish_switch() {
+	struct thread_cpu *cpu = &thread_cpus[Arc_GetCurrentCPU()];
+	struct ARC_Thread *prev = cpu->switch_prev;
+
+	cpu->switch_prev = NULL;
+
+	if (prev == NULL) {
+		return;
+	}
+
+	if (prev->state == ARC_THREAD_DEAD) {
+		thread_free(prev);
+		return;
+	}
+
+	// Its context is saved, other CPUs may take it now
+	atomic_store_explicit(&prev->on_cpu, 0, memory_order_release);
+}
+
+/**
+ * #NM handler, CR0.TS has been cleared already.
+ * */
+ARC_NO_FPU void thread_fpu_trap() {
+	int id = Arc_GetCurrentCPU();
+	struct thread_cpu *cpu = &thread_cpus[id];
+	struct ARC_Thread *current = thread_current(cpu);
+
+	cpu->fpu_trapping = 0;
+
+	if (cpu->fpu_owner == current && current->fpu_cpu == id) {
+		return;
+	}
+
+	// The owner, if any, was saved when it switched out
+	Arc_FPURestore(current->fpu_state);
+	current->fpu_cpu = id;
+	cpu->fpu_owner = current;
+}
+
+static ARC_NO_FPU void thread_tick(struct ARC_Timer *timer) {
+	struct thread_cpu *cpu = &thread_cpus[Arc_GetCurrentCPU()];
+
+	if (Arc_MLFQTick()) {
+		cpu->need_resched = 1;
+	}
+
+	Arc_RCUTick();
+
+	cpu->ticking = Arc_TimerArm(timer, ARC_THREAD_TICK_NS) == 0;
+}
+
+/**
+ * Tick only while a thread other than the boot thread runs, an idle
+ * CPU is left alone.
+ * */
+static ARC_NO_FPU void thread_update_tick(struct thread_cpu *cpu, struct ARC_Thread *next) {
+	if (next == &cpu->boot) {
+		if (cpu->ticking) {
+			Arc_TimerCancel(&cpu->tick);
+			cpu->ticking = 0;
+		}
+
+		return;
+	}
+
+	if (!cpu->ticking) {
+		cpu->ticking = Arc_TimerArm(&cpu->tick, ARC_THREAD_TICK_NS) == 0;
+	}
+}
+
+/**
+ * Where a new thread first runs, called by _x86_thread_start.
+ * */
+void thread_start(struct ARC_Thread *thread) {
+	thread_finish_switch();
+	__asm__ volatile("sti" : : : "memory");
+
+	thread->entry(thread->arg);
+
+	Arc_ExitThread();
+}
+
+ARC_NO_FPU void Arc_Reschedule() {
+	uint64_t flags = Arc_IRQSave();
+	int id = Arc_GetCurrentCPU();
+	struct thread_cpu *cpu = &thread_cpus[id];
+
+	Arc_RCUContextSwitch();
+
+	struct ARC_Thread *prev = thread_current(cpu);
+	struct ARC_Thread *next = Arc_MLFQSchedule();
+
+	if (next == NULL) {
+		next = &cpu->boot;
+	}
+
+	cpu->need_resched = 0;
+	thread_update_tick(cpu, next);
+
+	if (prev == next) {
+		Arc_IRQRestore(flags);
+		return;
+	}
+
+	thread_switch_fpu(cpu, id, prev, next);
+	cpu->switch_prev = prev;
+	ARC_THIS_CPU_ADD(context_switches, 1);
+
+	_x86_switch_context(&prev->rsp, next->rsp);
+
+	// Switched back to, maybe on another CPU
+	thread_finish_switch();
+	Arc_IRQRestore(flags);
+}
+
+void Arc_CondResched() {
+	if (thread_cpus[Arc_GetCurrentCPU()].need_resched) {
+		Arc_Reschedule();
+	}
+}
+
+void Arc_IdleCPU() {
+	int id = Arc_GetCurrentCPU();
+
+	__asm__ volatile("cli" : : : "memory");
+
+	Arc_Reschedule();
+
+	// Advertise first and look again, a thread queued in between
+	// either is seen here or gets this CPU woken
+	atomic_fetch_or_explicit(&thread_idle_cpus, 1ULL << id, memory_order_seq_cst);
+	Arc_Reschedule();
+
+	if (Arc_RCUNeedsCPU()) {
+		// Stay awake for the grace period
+		atomic_fetch_and_explicit(&thread_idle_cpus, ~(1ULL << id), memory_order_relaxed);
+		__asm__ volatile("sti" : : : "memory");
+		return;
+	}
+
+	Arc_RCUIdleEnter();
+
+	// sti takes effect after the next instruction, an interrupt
+	// cannot slip in before the hlt
+	__asm__ volatile("sti; hlt" : : : "memory");
+
+	Arc_RCUIdleExit();
+	atomic_fetch_and_explicit(&thread_idle_cpus, ~(1ULL << id), memory_order_relaxed);
+}
+
+/**
+ * Wake a halted CPU, other than the caller, to pick up new work.
+ * */
+static ARC_NO_FPU void thread_wake_idle() {
+	atomic_thread_fence(memory_order_seq_cst);
+
+	uint64_t idle = atomic_load_explicit(&thread_idle_cpus, memory_order_relaxed);
+
+	idle &= ~(1ULL << Arc_GetCurrentCPU());
+
+	if (idle != 0) {
+		Arc_WakeCPU(__builtin_ctzll(idle));
+	}
+}
+
+struct ARC_Thread *Arc_PrepareBlock() {
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	if (current == NULL) {
+		return Arc_GetBootThread(Arc_GetCurrentCPU());
+	}
+
+	// Ordered before the caller's second look at its condition, which
+	// pairs with the waker changing it before Arc_WakeThread
+	atomic_store_explicit(&current->state, ARC_THREAD_BLOCKED, memory_order_seq_cst);
+
+	return current;
+}
+
+void Arc_Block() {
+	if (Arc_MLFQCurrent() == NULL) {
+		// The boot thread has to stay, make use of the wait
+		Arc_Reschedule();
+		__builtin_ia32_pause();
+		return;
+	}
+
+	// Not queued again while blocked, unless a wake already came
+	Arc_Reschedule();
+}
+
+void Arc_CancelBlock() {
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	if (current == NULL) {
+		return;
+	}
+
+	int expected = ARC_THREAD_BLOCKED;
+
+	if (!atomic_compare_exchange_strong_explicit(&current->state, &expected, ARC_THREAD_RUNNING, memory_order_seq_cst, memory_order_seq_cst)) {
+		// A waker got to it first and is queueing it, the scheduler
+		// picks it back up from there
+		Arc_Reschedule();
+	}
+}
+
+ARC_NO_FPU int Arc_WakeThread(struct ARC_Thread *thread) {
+	if (thread == NULL) {
+		return 1;
+	}
+
+	int expected = ARC_THREAD_BLOCKED;
+
+	// Only one waker wins, and the thread cannot run meanwhile
+	if (!atomic_compare_exchange_strong_explicit(&thread->state, &expected, ARC_THREAD_READY, memory_order_seq_cst, memory_order_seq_cst)) {
+		return 1;
+	}
+
+	Arc_MLFQEnqueue(thread);
+	thread_wake_idle();
+
+	return 0;
+}
+
+struct ARC_Thread *Arc_CreateKernelThread(void (*entry)(void *arg), void *arg) {
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	struct ARC_Thread *thread = (struct ARC_Thread *)Arc_SlabAlloc(sizeof(struct ARC_Thread));
+
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	memset(thread, 0, sizeof(struct ARC_Thread));
+
+	thread->stack = Arc_ContiguousAllocPMM(ARC_THREAD_STACK_PAGES);
+	thread->fpu_state = thread_alloc_fpu();
+
+	if (thread->stack == NULL || thread->fpu_state == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate thread\n");
+
+		if (thread->stack != NULL) {
+			Arc_ContiguousFreePMM(thread->stack, ARC_THREAD_STACK_PAGES);
+		}
+
+		if (thread->fpu_state != NULL) {
+			Arc_ContiguousFreePMM(thread->fpu_state, thread_fpu_pages());
+		}
+
+		Arc_SlabFree(thread);
+
+		return NULL;
+	}
+
+	thread->tid = atomic_fetch_add_explicit(&thread_next_tid, 1, memory_order_relaxed);
+	thread->cpu = -1;
+	thread->fpu_cpu = -1;
+	thread->entry = entry;
+	thread->arg = arg;
+
+	// Frame popped by _x86_switch_context, returning into _x86_thread_start
+	// with r12 holding the thread and the stack aligned for the call
+	uint64_t *sp = (uint64_t *)((uintptr_t)thread->stack + ARC_THREAD_STACK_PAGES * THREAD_PAGE_SIZE);
+
+	*--sp = (uintptr_t)_x86_thread_start;
+	*--sp = 0; // rbp
+	*--sp = 0; // rbx
+	*--sp = (uintptr_t)thread; // r12
+	*--sp = 0; // r13
+	*--sp = 0; // r14
+	*--sp = 0; // r15
+
+	thread->rsp = (uintptr_t)sp;
+
+	Arc_MLFQEnqueue(thread);
+	thread_wake_idle();
+
+	return thread;
+}
+
+void Arc_ExitThread() {
+	Arc_IRQSave();
+
+	struct ARC_Thread *current = Arc_MLFQCurrent();
+
+	if (current == NULL) {
+		ARC_DEBUG(ERR, "The boot thread cannot exit\n");
+		ARC_HANG;
+	}
+
+	current->state = ARC_THREAD_DEAD;
+	Arc_Reschedule();
+
+	// A dead thread is never switched back to
+	ARC_HANG;
+}
+
+struct ARC_Thread *Arc_GetBootThread(int cpu) {
+	return &thread_cpus[cpu].boot;
+}
+
+int Arc_InitializeThreads(int cpu) {
+	if (cpu < 0 || cpu >= ARC_SCHED_MAX_CPUS) {
+		return 1;
+	}
+
+	Arc_InitializeFPU();
+
+	struct thread_cpu *state = &thread_cpus[cpu];
+	struct ARC_Thread *boot = &state->boot;
+
+	// Not zeroed, the boot context may already hold queue locks
+	boot->tid = 1;
+	boot->state = ARC_THREAD_RUNNING;
+	boot->cpu = cpu;
+	boot->fpu_state = thread_alloc_fpu();
+	boot->fpu_cpu = cpu;
+
+	if (boot->fpu_state == NULL) {
+		ARC_DEBUG(ERR, "Failed to allocate boot thread FPU state\n");
+		return 1;
+	}
+
+	// The registers hold the boot context's state
+	state->fpu_owner = boot;
+	state->fpu_trapping = 0;
+
+	// Armed once the timers are up
+	Arc_InitTimer(&state->tick, thread_tick);
+	state->ticking = 0;
+	state->need_resched = 0;
+
+	if (cpu == 0) {
+		Arc_InstallIDTGate(7, _x86_fpu_trap_stub);
+	}
+
+	return 0;
+}
+
+struct thread_bench {
+	uint64_t round_trips;
+	bool fpu;
+};
+
+static void thread_bench_main(void *arg) {
+	struct thread_bench *bench = (struct thread_bench *)arg;
+
+	for (uint64_t i = 0; i < bench->round_trips; i++) {
+		if (bench->fpu) {
+			__asm__ volatile("movq xmm0, %0" : : "r"(i) : "xmm0");
+		}
+
+		Arc_Reschedule();
+	}
+}
+
+uint64_t Arc_BenchmarkContextSwitch(uint64_t round_trips, bool fpu) {
+	if (round_trips == 0) {
+		return 0;
+	}
+
+	struct thread_bench bench = { .round_trips = round_trips, .fpu = fpu };
+
+	if (Arc_CreateKernelThread(thread_bench_main, &bench) == NULL || Arc_CreateKernelThread(thread_bench_main, &bench) == NULL) {
+		return 0;
+	}
+
+	uint64_t start = _x86_RDTSC();
+
+	// The boot thread only runs again once both have exited
+	Arc_Reschedule();
+
+	return (_x86_RDTSC() - start) / round_trips;
+}
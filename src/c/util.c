@@ -38,15 +38,13 @@ int strncmp(char *a, char *b, size_t len) {
 }
 
 void memset(void *a, uint8_t value, size_t size) {
-	for (size_t i = 0; i < size; i++) {
-		*((uint8_t *)a + i) = value;
-	}
+	__asm__ volatile("rep stosb" : "+D"(a), "+c"(size) : "a"(value) : "memory");
 }
 
 void memcpy(void *a, void *b, size_t size) {
-	for (size_t i = 0; i < size; i++) {
-		*(uint8_t *)(a + i) = *(uint8_t *)(b + i);
-	}
+	// Copies forwards, callers rely on this for overlapping
+	// regions where a < b
+	__asm__ volatile("rep movsb" : "+D"(a), "+S"(b), "+c"(size) : : "memory");
 }
 
 size_t strlen(char *a) {